@@ -0,0 +1,55 @@
+#!/bin/bash
+#
+# Regression test for the link under errors: 2000 frames of
+# PAYLOAD_MAX bytes go through the daemon to the emulator and
+# back, with a bit flipped in 1 in 40 of the emulator's replies.
+# Damaged exchanges lose frames, but credit must keep flowing:
+# a credit handshake that stalls shows as most of them lost, and
+# the emulator holding frames it cannot send. Each frame's payload
+# is a pattern from its number, so one reassembled from pieces of
+# two shows as damaged: a lost fragment must not splice frames.
+# A few still can, when the end of one frame and the start of the
+# next are both lost, so a handful are allowed.
+#
+# Run from ip400emu after make CC=gcc, with the daemon built for
+# this machine: ./errtest.sh [path to ip400spi]
+#
+daemon=${1:-../ip400spi/Ip400Spi}
+errors=40
+frames=2000
+length=1053
+needback=80
+maxdamaged=10
+
+if [ ! -x ./ip400emu ] || [ ! -x ./spibench ] || [ ! -x "$daemon" ]; then
+	echo "Usage: errtest [path to ip400spi], with ip400emu and spibench built"
+	exit 100
+fi
+
+dir=$(mktemp -d)
+mkfifo $dir/drdy.fifo
+
+./ip400emu -e -c 0 -y $errors -s $dir/emu.sock -g $dir/drdy.fifo 2>$dir/emu.log &
+emu=$!
+sleep 0.5
+$daemon -s emu:$dir/emu.sock -n 127.0.0.1 -p 5101 -m 5100 -g $dir/drdy.fifo 2>$dir/daemon.log &
+spi=$!
+sleep 1
+
+./spibench -c $frames -l $length -w 64 -a $needback -d $maxdamaged
+result=$?
+
+kill $spi
+sleep 0.2
+kill $emu
+wait 2>/dev/null
+
+if [ $result -ne 0 ]; then
+	cat $dir/emu.log
+	tail -20 $dir/daemon.log
+	echo "FAIL: fewer than $needback% of the frames back, or more than $maxdamaged damaged"
+else
+	echo "PASS"
+fi
+rm -rf $dir
+exit $result
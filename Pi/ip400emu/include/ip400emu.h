@@ -0,0 +1,97 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        ip400emu.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for the node emulator and the benchmark
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_IP400EMU_H_
+#define INCLUDE_IP400EMU_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "spidefs.h"
+
+/*
+ * The emulator plays the node's side of the exchange, as the
+ * firmware does it: the eye, full length then header first
+ * exchanges, packed frames, fragments, the busy bit, credit
+ * both ways and the data ready line. The daemon connects with
+ * -s emu:path, and each transfer is one seqpacket message each
+ * way. Frames come from a generator standing in for the radio,
+ * and in echo mode the frames the daemon sends are sent back.
+ * Transfers can be slowed to a modelled SPI clock plus a fixed
+ * latency, and replies damaged to test the daemon's recovery.
+ * Each message from the daemon starts with the clock it runs
+ * at: the modelled clock follows it unless one is fixed, and
+ * above a given rate bits are lost both ways, more the faster
+ * it goes, so that clock tuning has an edge to find.
+ */
+#define	EMU_QUEUE_FRAMES	64						// frames waiting for the host
+#define	EMU_FRAME_MAX		SPI_REASM_MAX			// largest frame payload
+#define	EMU_CREDIT_WINDOW	4096					// bytes the host may send
+#define	EMU_STATS_TIME		10						// seconds between stats
+#define	EMU_CODING			0						// coding of generated frames
+#define	EMU_CLOCK_HOST		-1						// modelled clock: the host's
+
+// exchange phases, as the firmware's
+enum	{
+	EMU_PHASE_FULL=0,						// full length
+	EMU_PHASE_HDR,							// header first: the header
+	EMU_PHASE_PAYLOAD						// header first: the payload
+};
+
+// emulator stats
+typedef struct emu_stats_t	{
+	uint32_t		nTransfers;				// messages from the host
+	uint32_t		nExchanges;				// complete exchanges
+	uint32_t		nHdrOnly;				// header first, nothing to clock
+	uint32_t		nRxFrames;				// frames from the host
+	uint32_t		nRxFrags;				// fragments from the host
+	uint32_t		nRxPacked;				// frames unpacked
+	uint32_t		nRxBad;					// bad eye or record
+	uint32_t		nTxFrames;				// frames to the host
+	uint32_t		nTxFrags;				// fragments to the host
+	uint32_t		nTxPacked;				// frames packed
+	uint32_t		nGenerated;				// frames from the generator
+	uint32_t		nQueueFull;				// frames lost, queue full
+	uint32_t		nCreditStalls;			// held back for credit
+	uint32_t		nResyncs;				// transfer length not as expected
+	uint32_t		nEyeErrors;				// replies with the eye damaged
+	uint32_t		nBitErrors;				// replies with a bit flipped
+	uint32_t		nClockErrors;			// bits lost to the clock, both ways
+	uint32_t		nCheckErrors;			// host exchanges that failed the CRC
+	uint32_t		nSeqErrors;				// host exchanges missing
+	uint32_t		nTestEchoes;			// test frames sent back
+} EMU_STATS;
+
+/*
+ * Benchmark frames carry a sequence number and the
+ * time they were sent at the start of the payload
+ */
+typedef struct bench_stamp_t	{
+	uint32_t		magic;					// BENCH_MAGIC
+	uint32_t		seq;					// sequence number
+	int64_t			sent;					// CLOCK_MONOTONIC ns
+} BENCH_STAMP;
+
+#define	BENCH_MAGIC			0x49503442		// 'IP4B'
+#define	BENCH_HOST_PORT		5101			// where the benchmark listens
+#define	BENCH_DAEMON_PORT	5100			// where the daemon listens
+
+#endif /* INCLUDE_IP400EMU_H_ */
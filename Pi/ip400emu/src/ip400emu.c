@@ -0,0 +1,935 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        ip400emu.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Node emulator. Plays the firmware's side of the SPI
+                          exchange over a unix socket, so the daemon can be
+                          run and tuned without a HAT.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "types.h"
+#include "spidefs.h"
+#include "ip400emu.h"
+
+// a frame waiting for the host
+typedef struct emu_frame_t	{
+	struct spi_hdr_t	hdr;				// as it will be sent
+	uint16_t			length;				// payload length
+	uint8_t				data[EMU_FRAME_MAX];
+} EMU_FRAME;
+
+// frames for the host, oldest first
+static EMU_FRAME queue[EMU_QUEUE_FRAMES];
+static int qHead, qCount;
+static uint32_t qBytes;						// payload bytes waiting
+static uint16_t txOffset;					// sent of the oldest, when fragmenting
+
+// the exchange
+static SPI_BUFFER txActive;					// what the host clocks in next
+static SPI_BUFFER rxBuf;					// what it clocked out
+static int phase;							// full, header or payload
+static uint16_t payloadLen;					// length of the payload phase
+static uint16_t checkAt;					// where the trailers are, when checked
+static uint32_t hostClock;					// the clock the host runs at
+
+// checked exchanges
+static BOOL linkChecked;
+static uint8_t txSeq, rxSeq;
+static BOOL rxSeqValid;
+
+// a test frame to send back
+static BOOL echoPending;
+static struct spi_hdr_t echoHdr;
+static uint8_t echoData[SPI_BUFFER_LEN];
+static uint16_t echoLen;
+
+// what the host said it can do
+static BOOL peerCanPack;
+static uint16_t peerPackMax;
+static BOOL peerHasCredit;
+static uint16_t peerCredit;
+static BOOL peerWantsCredit;
+static uint32_t grantAnswered;				// grant the last request was answered with
+static BOOL creditAsked;					// asked the host for credit
+static uint16_t creditAskedAt;				// with this much credit
+
+// fragments from the host
+static EMU_FRAME reasm;
+static BOOL reasmActive;
+
+// options
+static char sockPath[100];					// where we listen
+static long spiClock;						// modelled clock, Hz, 0 for none
+static long flakyClock;						// bits lost above this, Hz, 0 never
+static int latency;							// us added to each transfer
+static int eyeErrRate;						// 1 in n replies with a bad eye
+static int bitErrRate;						// 1 in n replies with a bit flipped
+static BOOL echo;							// host frames come back
+static int genRate;							// generated frames/s
+static int genLength;						// their length
+static int creditWindow;					// bytes the host may send
+static char drdyPath[100];					// data ready FIFO, if any
+static BOOL verbose;						// stats as we go
+
+// data ready
+static int drdyFD = -1;
+static BOOL drdyState;
+
+static EMU_STATS stats;
+static uint32_t genSeq;
+static int64_t nextGen;
+
+static void compose(void);
+void show_help(char *name);
+
+// monotonic time in ns
+static int64_t monoNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static void setEye(struct spi_hdr_t *hdr)
+{
+	hdr->eye[0] = 'I';
+	hdr->eye[1] = 'P';
+	hdr->eye[2] = '4';
+	hdr->eye[3] = 'C';
+}
+
+BOOL isIP400Frame(uint8_t *eye)
+{
+	return ((eye[0] == 'I') && (eye[1] == 'P') && (eye[2] == '4') && (eye[3] == 'C')) ? TRUE : FALSE;
+}
+
+/*
+ * Raise or lower the data ready line. The FIFO is
+ * opened when the daemon has it open for reading
+ */
+static void setDataReady(BOOL ready)
+{
+	if((drdyPath[0] == '\0') || (ready == drdyState))
+		return;
+
+	if(drdyFD == -1)
+		drdyFD = open(drdyPath, O_WRONLY | O_NONBLOCK);
+	if(drdyFD == -1)
+		return;
+
+	if(write(drdyFD, ready ? "1" : "0", 1) != 1)	{
+		close(drdyFD);
+		drdyFD = -1;
+		return;
+	}
+	drdyState = ready;
+}
+
+/*
+ * The frame queue
+ */
+static BOOL enqueue(struct spi_hdr_t *hdr, uint8_t *data, uint16_t length)
+{
+	if((qCount == EMU_QUEUE_FRAMES) || (length > EMU_FRAME_MAX))	{
+		stats.nQueueFull++;
+		return FALSE;
+	}
+
+	EMU_FRAME *f = &queue[(qHead + qCount) % EMU_QUEUE_FRAMES];
+	memcpy(&f->hdr, hdr, sizeof(struct spi_hdr_t));
+	memcpy(f->data, data, length);
+	f->length = length;
+	qCount++;
+	qBytes += length;
+	return TRUE;
+}
+
+static void dequeue(void)
+{
+	qBytes -= queue[qHead].length;
+	qHead = (qHead + 1) % EMU_QUEUE_FRAMES;
+	qCount--;
+	txOffset = 0;
+}
+
+// the host's credit: the window, less what is waiting
+static uint16_t creditGrant(void)
+{
+	return (qBytes >= creditWindow) ? 0 : creditWindow - qBytes;
+}
+
+/*
+ * Idle header: what we can do, and a grant for
+ * the host, less what is already waiting. Returns the grant
+ */
+static uint16_t setIdleHeader(BOOL creditReq)
+{
+	struct spi_hdr_t *hdr = &txActive.spiData.hdr;
+	uint16_t grant = creditGrant();
+
+	setEye(hdr);
+	hdr->status = NO_FRAME | SPI_CAP_PACKED | SPI_CAP_VARLEN | SPI_CAP_CREDIT;
+	if(creditReq)
+		hdr->status |= SPI_CREDIT_REQ | SPI_BUSY;
+	hdr->offset_hi = (SPI_BUFFER_LEN >> 8);
+	hdr->offset_lo = (SPI_BUFFER_LEN & 0xFF);
+	hdr->length_hi = (grant >> 8);
+	hdr->length_lo = (grant & 0xFF);
+	hdr->coding = SPI_XCAPS_MARK | SPI_XCAP_CHECK | SPI_XCAP_ECHO;
+	return grant;
+}
+
+/*
+ * An idle header in the exchanges: it answers a request from
+ * the host once for each grant, the same one again is no news
+ */
+static void idleHeader(BOOL creditReq)
+{
+	uint16_t grant = setIdleHeader(creditReq);
+	if(!peerWantsCredit)
+		return;
+
+	peerWantsCredit = FALSE;
+	if(grant != grantAnswered)	{
+		grantAnswered = grant;
+		txActive.spiData.hdr.status |= SPI_BUSY;
+	}
+}
+
+/*
+ * Pack whole frames that fit. Returns the number packed
+ */
+static int packFrames(void)
+{
+	uint16_t packLen = 0;
+	int nPacked = 0;
+
+	uint16_t packMax = (peerPackMax < SPI_BUFFER_LEN) ? peerPackMax : SPI_BUFFER_LEN;
+	if(peerHasCredit && (peerCredit < packMax))
+		packMax = peerCredit;
+
+	while((qCount != 0) && (txOffset == 0))	{
+		EMU_FRAME *f = &queue[qHead];
+		if(packLen + SPI_PACK_REC_HDR + f->length > packMax)
+			break;
+
+		uint8_t *rec = txActive.spiData.buffer + packLen;
+		uint16_t recLen = sizeof(struct spi_hdr_t) + f->length;
+		struct spi_hdr_t *recHdr = (struct spi_hdr_t *)(rec + SPI_PACK_LEN_SIZE);
+
+		rec[0] = (recLen >> 8);
+		rec[1] = (recLen & 0xFF);
+		memcpy(recHdr, &f->hdr, sizeof(struct spi_hdr_t));
+		setEye(recHdr);
+		recHdr->status = SINGLE_FRAME;
+		recHdr->offset_hi = recHdr->offset_lo = 0;
+		recHdr->length_hi = (f->length >> 8);
+		recHdr->length_lo = (f->length & 0xFF);
+		memcpy(rec + SPI_PACK_REC_HDR, f->data, f->length);
+
+		packLen += SPI_PACK_LEN_SIZE + recLen;
+		nPacked++;
+		dequeue();
+	}
+
+	if(nPacked == 0)
+		return 0;
+
+	struct spi_hdr_t *hdr = &txActive.spiData.hdr;
+	setEye(hdr);
+	hdr->status = PACKED_FRAME;
+	if(qCount != 0)
+		hdr->status |= SPI_BUSY;
+	hdr->offset_hi = hdr->offset_lo = 0;
+	hdr->length_hi = (packLen >> 8);
+	hdr->length_lo = (packLen & 0xFF);
+
+	if(peerHasCredit)
+		peerCredit -= packLen;
+	stats.nTxPacked += nPacked;
+	stats.nTxFrames += nPacked;
+	return nPacked;
+}
+
+/*
+ * The next buffer for the host: a grant it asked for, packed
+ * frames, the next fragment or frame, else an idle header.
+ * As the firmware does, a grant only goes ahead of frames the
+ * host has room for when it is not the one last answered
+ */
+static void compose(void)
+{
+	// a test frame goes back first, as it came
+	if(echoPending)	{
+		struct spi_hdr_t *hdr = &txActive.spiData.hdr;
+		memcpy(hdr, &echoHdr, sizeof(struct spi_hdr_t));
+		memcpy(txActive.spiData.buffer, echoData, echoLen);
+		if(qCount != 0)
+			hdr->status |= SPI_BUSY;
+		echoPending = FALSE;
+		stats.nTestEchoes++;
+		return;
+	}
+
+	if(peerWantsCredit && (creditGrant() != grantAnswered))	{
+		idleHeader(FALSE);
+		return;
+	}
+
+	if(peerCanPack && (packFrames() != 0))	{
+		creditAsked = FALSE;
+		return;
+	}
+
+	if(qCount == 0)	{
+		idleHeader(FALSE);
+		return;
+	}
+
+	// a frame is only started when the host has room for it all
+	EMU_FRAME *f = &queue[qHead];
+	if(txOffset == 0)	{
+		if(peerHasCredit && (f->length > peerCredit))	{
+			stats.nCreditStalls++;
+
+			// ask once, and again only if the host's grant changes
+			idleHeader(!creditAsked || (peerCredit != creditAskedAt));
+			creditAsked = TRUE;
+			creditAskedAt = peerCredit;
+			return;
+		}
+		creditAsked = FALSE;
+		if(peerHasCredit)
+			peerCredit -= f->length;
+	}
+
+	uint16_t segLen = f->length - txOffset;
+	if(segLen > SPI_BUFFER_LEN)
+		segLen = SPI_BUFFER_LEN;
+
+	uint8_t status;
+	if(txOffset == 0)
+		status = (segLen == f->length) ? SINGLE_FRAME : FIRST_FRAGMENT;
+	else
+		status = ((txOffset + segLen) == f->length) ? LAST_FRAGMENT : MIDDLE_FRAGMENT;
+
+	struct spi_hdr_t *hdr = &txActive.spiData.hdr;
+	memcpy(hdr, &f->hdr, sizeof(struct spi_hdr_t));
+	setEye(hdr);
+	hdr->status = status;
+	hdr->offset_hi = (txOffset >> 8);
+	hdr->offset_lo = (txOffset & 0xFF);
+	hdr->length_hi = (segLen >> 8);
+	hdr->length_lo = (segLen & 0xFF);
+	memcpy(txActive.spiData.buffer, f->data + txOffset, segLen);
+
+	if(status != SINGLE_FRAME)
+		stats.nTxFrags++;
+
+	txOffset += segLen;
+	if(txOffset == f->length)	{
+		stats.nTxFrames++;
+		dequeue();
+	}
+
+	if((qCount != 0) || (txOffset != 0))
+		hdr->status |= SPI_BUSY;
+}
+
+// the active buffer says nothing: a new frame can replace it
+static BOOL txIdle(void)
+{
+	struct spi_hdr_t *hdr = &txActive.spiData.hdr;
+	return (((hdr->status & SPI_STATUS_MASK) == NO_FRAME) && !(hdr->status & SPI_CREDIT_REQ)) ? TRUE : FALSE;
+}
+
+static BOOL txHasNews(void)
+{
+	struct spi_hdr_t *hdr = &txActive.spiData.hdr;
+	return (((hdr->status & SPI_STATUS_MASK) != NO_FRAME) || (hdr->status & SPI_BUSY)) ? TRUE : FALSE;
+}
+
+/*
+ * A frame from the host. In echo mode it goes back
+ */
+static void deliver(struct spi_hdr_t *hdr, uint8_t *data, uint16_t length)
+{
+	stats.nRxFrames++;
+	if(echo)
+		enqueue(hdr, data, length);
+}
+
+// fragments arrive in order, one frame at a time
+static void reassemble(struct spi_hdr_t *hdr, uint8_t *data, uint16_t length)
+{
+	uint8_t status = hdr->status & SPI_STATUS_MASK;
+	uint16_t offset = (hdr->offset_hi << 8) + hdr->offset_lo;
+
+	stats.nRxFrags++;
+	if(status == FIRST_FRAGMENT)	{
+		memcpy(&reasm.hdr, hdr, sizeof(struct spi_hdr_t));
+		reasm.length = 0;
+		reasmActive = TRUE;
+	}
+
+	if(!reasmActive || (offset != reasm.length) || ((offset + length) > EMU_FRAME_MAX))	{
+		stats.nRxBad++;
+		reasmActive = FALSE;
+		return;
+	}
+
+	memcpy(reasm.data + offset, data, length);
+	reasm.length += length;
+
+	if(status == LAST_FRAGMENT)	{
+		reasmActive = FALSE;
+		deliver(&reasm.hdr, reasm.data, reasm.length);
+	}
+}
+
+static void unpack(uint16_t packLen)
+{
+	uint8_t *rec = rxBuf.spiData.buffer;
+	uint8_t *end = rec + packLen;
+
+	while(rec + SPI_PACK_REC_HDR <= end)	{
+		uint16_t recLen = (rec[0] << 8) + rec[1];
+		struct spi_hdr_t *recHdr = (struct spi_hdr_t *)(rec + SPI_PACK_LEN_SIZE);
+
+		if((recLen < sizeof(struct spi_hdr_t)) || (rec + SPI_PACK_LEN_SIZE + recLen > end) || !isIP400Frame(recHdr->eye))	{
+			stats.nRxBad++;
+			return;
+		}
+
+		stats.nRxPacked++;
+		deliver(recHdr, rec + SPI_PACK_REC_HDR, recLen - sizeof(struct spi_hdr_t));
+		rec += SPI_PACK_LEN_SIZE + recLen;
+	}
+}
+
+// the payload length a header announces
+static uint16_t hdrPayloadLength(struct spi_hdr_t *hdr)
+{
+	if(((hdr->status & SPI_STATUS_MASK) == NO_FRAME) || !isIP400Frame(hdr->eye))
+		return 0;
+
+	uint16_t length = (hdr->length_hi << 8) + hdr->length_lo;
+	return (length > SPI_BUFFER_LEN) ? SPI_BUFFER_LEN : length;
+}
+
+// CRC-16 CCITT, msb first
+static uint16_t checkCRC(uint16_t crc, uint8_t *data, int length)
+{
+	for(int i=0;i<length;i++)	{
+		crc ^= (uint16_t)data[i] << 8;
+		for(int bit=0;bit<8;bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ SPI_CHECK_POLY : (crc << 1);
+	}
+	return crc;
+}
+
+static uint16_t trailerCRC(SPI_BUFFER *buf, uint8_t *trailer)
+{
+	uint16_t crc = checkCRC(SPI_CHECK_INIT, buf->rawData, SPI_HDR_LEN);
+	crc = checkCRC(crc, buf->spiData.buffer, hdrPayloadLength(&buf->spiData.hdr));
+	return checkCRC(crc, trailer, 2);
+}
+
+// our trailer, after the payload
+static void sealTrailer(void)
+{
+	uint8_t *trailer = txActive.spiData.buffer + checkAt;
+
+	trailer[0] = ++txSeq;
+	trailer[1] = 0;
+	uint16_t crc = trailerCRC(&txActive, trailer);
+	trailer[2] = (crc >> 8);
+	trailer[3] = (crc & 0xFF);
+}
+
+// the host's: a failed one is dropped whole
+static BOOL checkTrailer(void)
+{
+	uint8_t *trailer = rxBuf.spiData.buffer + checkAt;
+
+	if(trailerCRC(&rxBuf, trailer) != (((uint16_t)trailer[2] << 8) + trailer[3]))	{
+		stats.nCheckErrors++;
+		rxSeq++;
+		return FALSE;
+	}
+
+	if(rxSeqValid && (trailer[0] != (uint8_t)(rxSeq + 1)))
+		stats.nSeqErrors++;
+	rxSeq = trailer[0];
+	rxSeqValid = TRUE;
+	return TRUE;
+}
+
+/*
+ * Above the flaky clock, a transfer loses a bit with
+ * a chance that grows with how far above it is
+ */
+static void clockErrors(uint8_t *data, int len, uint32_t clock)
+{
+	if((flakyClock == 0) || (clock <= flakyClock) || (len == 0))
+		return;
+
+	double chance = (double)(clock - flakyClock) / flakyClock;
+	if(((double)rand() / RAND_MAX) >= chance)
+		return;
+
+	int bit = rand() % (len * 8);
+	data[bit/8] ^= (1 << (bit%8));
+	stats.nClockErrors++;
+}
+
+/*
+ * An exchange is done: what the host sent, then
+ * the next buffer, as the firmware's completion does
+ */
+static void exchangeDone(void)
+{
+	struct spi_hdr_t *hdr = &rxBuf.spiData.hdr;
+	uint8_t status = hdr->status & SPI_STATUS_MASK;
+	uint16_t length = (hdr->length_hi << 8) + hdr->length_lo;
+	BOOL eyeOK = isIP400Frame(hdr->eye);
+
+	stats.nExchanges++;
+
+	// nothing from an exchange that failed its check
+	if(linkChecked && !checkTrailer())	{
+		compose();
+		setDataReady(txHasNews());
+		return;
+	}
+
+	if((status == NO_FRAME) && eyeOK)	{
+		peerCanPack = (hdr->status & SPI_CAP_PACKED) ? TRUE : FALSE;
+		peerPackMax = (hdr->offset_hi << 8) + hdr->offset_lo;
+		peerHasCredit = (hdr->status & SPI_CAP_CREDIT) ? TRUE : FALSE;
+		if(peerHasCredit)
+			peerCredit = length;
+		if(hdr->status & SPI_CREDIT_REQ)
+			peerWantsCredit = TRUE;
+
+		// both idle headers offered header first: switch after this one
+		struct spi_hdr_t *txHdr = &txActive.spiData.hdr;
+		if((phase == EMU_PHASE_FULL) && (hdr->status & SPI_CAP_VARLEN) &&
+				((txHdr->status & SPI_STATUS_MASK) == NO_FRAME) && (txHdr->status & SPI_CAP_VARLEN))	{
+			phase = EMU_PHASE_HDR;
+
+			// and checked, if the host offered it
+			linkChecked = (((hdr->coding & SPI_XCAPS_MASK) == SPI_XCAPS_MARK) && (hdr->coding & SPI_XCAP_CHECK)) ? TRUE : FALSE;
+			txSeq = 0;
+			rxSeqValid = FALSE;
+		}
+	} else if(!eyeOK)	{
+		stats.nRxBad++;
+	} else if(length > SPI_BUFFER_LEN)	{
+		stats.nRxBad++;
+	} else if(status == SINGLE_FRAME)	{
+		deliver(hdr, rxBuf.spiData.buffer, length);
+	} else if(status < N_FRAGS)	{
+		reassemble(hdr, rxBuf.spiData.buffer, length);
+	} else if(status == PACKED_FRAME)	{
+		unpack(length);
+	} else if(status == TEST_FRAME)	{
+		memcpy(&echoHdr, hdr, sizeof(struct spi_hdr_t));
+		memcpy(echoData, rxBuf.spiData.buffer, length);
+		echoLen = length;
+		echoPending = TRUE;
+	} else {
+		stats.nRxBad++;
+	}
+
+	compose();
+	setDataReady(txHasNews());
+}
+
+/*
+ * One transfer from the host: answer with what the node
+ * had ready, after as long as the clock would take
+ */
+static void transfer(int conn, uint8_t *host, int len)
+{
+	static uint8_t reply[SPI_RAW_LEN + SPI_CHECK_LEN];
+	uint8_t *source;
+	int avail;
+	BOOL stray = FALSE;
+
+	stats.nTransfers++;
+
+	/*
+	 * The host knows how long the transfer is: follow it. A full
+	 * length one means it has gone back to full exchanges; any
+	 * other length in header first is a payload it sized from a
+	 * damaged header, which is dropped, still header first
+	 */
+	int expect = (phase == EMU_PHASE_FULL) ? SPI_RAW_LEN : (phase == EMU_PHASE_HDR) ? SPI_HDR_LEN : payloadLen;
+	if(len != expect)	{
+		stats.nResyncs++;
+		if(len == SPI_RAW_LEN)	{
+			phase = EMU_PHASE_FULL;
+			linkChecked = FALSE;
+		} else if(len == SPI_HDR_LEN)	{
+			phase = EMU_PHASE_HDR;
+		} else if(phase != EMU_PHASE_FULL)	{
+			stray = TRUE;
+		}
+	}
+	if(len > SPI_RAW_LEN + SPI_CHECK_LEN)
+		len = SPI_RAW_LEN + SPI_CHECK_LEN;
+
+	if((phase == EMU_PHASE_PAYLOAD) || stray)	{
+		source = txActive.spiData.buffer;
+		avail = SPI_BUFFER_LEN + SPI_CHECK_LEN;
+	} else {
+		source = txActive.rawData;
+		avail = SPI_RAW_LEN;
+	}
+	memset(reply, 0, len);
+	memcpy(reply, source, (len < avail) ? len : avail);
+
+	// damage it if asked
+	if((eyeErrRate != 0) && (phase != EMU_PHASE_PAYLOAD) && !stray && ((rand() % eyeErrRate) == 0))	{
+		reply[0] ^= 0xFF;
+		stats.nEyeErrors++;
+	}
+	if((bitErrRate != 0) && ((rand() % bitErrRate) == 0))	{
+		int bit = rand() % (len * 8);
+		reply[bit/8] ^= (1 << (bit%8));
+		stats.nBitErrors++;
+	}
+	clockErrors(reply, len, hostClock);
+	clockErrors(host, len, hostClock);
+
+	// as long as the wire would take
+	long clock = (spiClock == EMU_CLOCK_HOST) ? (long)hostClock : spiClock;
+	long delay = latency;
+	if(clock != 0)
+		delay += ((long long)len * 8 * 1000000) / clock;
+	if(delay != 0)
+		usleep(delay);
+
+	if(send(conn, reply, len, MSG_NOSIGNAL) != len)
+		return;
+
+	// a stray payload is dropped, and a payload of ours with it
+	if(stray)	{
+		stats.nRxBad++;
+		if(phase == EMU_PHASE_PAYLOAD)	{
+			phase = EMU_PHASE_HDR;
+			compose();
+			setDataReady(txHasNews());
+		}
+		return;
+	}
+
+	// then take in what the host sent
+	if(phase == EMU_PHASE_PAYLOAD)	{
+		memcpy(rxBuf.spiData.buffer, host, (len < SPI_BUFFER_LEN + SPI_CHECK_LEN) ? len : SPI_BUFFER_LEN + SPI_CHECK_LEN);
+		phase = EMU_PHASE_HDR;
+	} else {
+		memcpy(rxBuf.rawData, host, (len < SPI_RAW_LEN) ? len : SPI_RAW_LEN);
+		if(phase == EMU_PHASE_HDR)	{
+			uint16_t txLen = hdrPayloadLength(&txActive.spiData.hdr);
+			uint16_t rxLen = hdrPayloadLength(&rxBuf.spiData.hdr);
+			payloadLen = (txLen > rxLen) ? txLen : rxLen;
+
+			// checked: trailers straight after, even with no payload
+			if(linkChecked)	{
+				checkAt = payloadLen;
+				payloadLen += SPI_CHECK_LEN;
+				sealTrailer();
+			}
+			if(payloadLen != 0)	{
+				phase = EMU_PHASE_PAYLOAD;
+				return;
+			}
+			stats.nHdrOnly++;
+		}
+	}
+
+	exchangeDone();
+}
+
+/*
+ * Frames from the radio, at the rate asked for. Each
+ * carries a stamp, so the benchmark can time it
+ */
+static void generate(void)
+{
+	static struct spi_hdr_t hdr;
+	static uint8_t data[EMU_FRAME_MAX];
+	BOOL added = FALSE;
+
+	if(genRate == 0)
+		return;
+
+	int64_t now = monoNow();
+	if(nextGen == 0)
+		nextGen = now;
+
+	while(now >= nextGen)	{
+		BENCH_STAMP *stamp = (BENCH_STAMP *)data;
+
+		memset(&hdr, 0, sizeof(hdr));
+		setEye(&hdr);
+		memcpy(hdr.fromCall, "EMU0", N_CALL);
+		hdr.coding = EMU_CODING;
+
+		stamp->magic = BENCH_MAGIC;
+		stamp->seq = genSeq++;
+		stamp->sent = now;
+		stats.nGenerated++;
+		if(enqueue(&hdr, data, genLength))
+			added = TRUE;
+		nextGen += 1000000000LL / genRate;
+	}
+
+	// an idle buffer waiting to go can carry it instead
+	if(added && (phase != EMU_PHASE_PAYLOAD) && txIdle())	{
+		compose();
+		setDataReady(txHasNews());
+	}
+}
+
+static void logStats(void)
+{
+	fprintf(stderr, "Transfers %u, exchanges %u (%u header only), resyncs %u, phase %s\n",
+			stats.nTransfers, stats.nExchanges, stats.nHdrOnly, stats.nResyncs,
+			(phase == EMU_PHASE_FULL) ? "full" : "header first");
+	fprintf(stderr, "From host: %u frames, %u fragments, %u packed, %u bad\n",
+			stats.nRxFrames, stats.nRxFrags, stats.nRxPacked, stats.nRxBad);
+	fprintf(stderr, "To host: %u frames, %u fragments, %u packed, %u generated, %u lost queue full, %u credit stalls\n",
+			stats.nTxFrames, stats.nTxFrags, stats.nTxPacked, stats.nGenerated, stats.nQueueFull, stats.nCreditStalls);
+	fprintf(stderr, "Injected: %u bad eyes, %u bit errors, %u lost to the clock\n",
+			stats.nEyeErrors, stats.nBitErrors, stats.nClockErrors);
+	fprintf(stderr, "Checked: %s at %u Hz, %u CRC errors, %u missing, %u test frames echoed\n",
+			linkChecked ? "yes" : "no", hostClock, stats.nCheckErrors, stats.nSeqErrors, stats.nTestEchoes);
+}
+
+// a new host starts from scratch, as after the firmware's timeout
+static void resetLink(void)
+{
+	qHead = qCount = 0;
+	qBytes = 0;
+	txOffset = 0;
+	phase = EMU_PHASE_FULL;
+	peerCanPack = peerHasCredit = peerWantsCredit = FALSE;
+	peerPackMax = peerCredit = 0;
+	grantAnswered = SPI_GRANT_NONE;
+	creditAsked = FALSE;
+	reasmActive = FALSE;
+	linkChecked = FALSE;
+	echoPending = FALSE;
+	memset(&txActive, 0, sizeof(txActive));
+	setIdleHeader(FALSE);
+	setDataReady(FALSE);
+}
+
+/*
+ * Serve one host until it goes
+ */
+static void serve(int conn)
+{
+	static uint8_t host[sizeof(uint32_t) + SPI_RAW_LEN + SPI_CHECK_LEN + 1];
+	int64_t lastStats = monoNow();
+	struct pollfd pfd;
+
+	resetLink();
+	fprintf(stderr, "Host connected\n");
+
+	for(;;)	{
+		pfd.fd = conn;
+		pfd.events = POLLIN;
+		int nReady = poll(&pfd, 1, 10);
+
+		generate();
+
+		if(verbose && ((monoNow() - lastStats) >= (EMU_STATS_TIME * 1000000000LL)))	{
+			logStats();
+			lastStats = monoNow();
+		}
+
+		if(nReady <= 0)
+			continue;
+
+		// the clock, then the data
+		int len = recv(conn, host, sizeof(host), 0);
+		if(len < (int)sizeof(uint32_t))
+			break;
+		memcpy(&hostClock, host, sizeof(uint32_t));
+		transfer(conn, host + sizeof(uint32_t), len - sizeof(uint32_t));
+	}
+
+	fprintf(stderr, "Host gone\n");
+	logStats();
+	resetLink();
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_un addr;
+	int c;
+
+	strcpy(sockPath, SPI_EMU_SOCKET);
+	spiClock = EMU_CLOCK_HOST;
+	creditWindow = EMU_CREDIT_WINDOW;
+	genLength = 100;
+
+	while ((c = getopt(argc, argv, "s:c:f:d:x:y:er:l:w:g:vh")) != -1) {
+
+		switch((char )c) {
+
+			// socket
+			case 's':
+				strncpy(sockPath, optarg, sizeof(sockPath)-1);
+				break;
+
+			// modelled clock
+			case 'c':
+				spiClock = atol(optarg);
+				break;
+
+			// bits lost above this clock
+			case 'f':
+				flakyClock = atol(optarg);
+				break;
+
+			// latency per transfer
+			case 'd':
+				latency = atoi(optarg);
+				break;
+
+			// bad eyes
+			case 'x':
+				eyeErrRate = atoi(optarg);
+				break;
+
+			// bit errors
+			case 'y':
+				bitErrRate = atoi(optarg);
+				break;
+
+			// echo
+			case 'e':
+				echo = TRUE;
+				break;
+
+			// generator rate
+			case 'r':
+				genRate = atoi(optarg);
+				break;
+
+			// and length
+			case 'l':
+				genLength = atoi(optarg);
+				break;
+
+			// credit window
+			case 'w':
+				creditWindow = atoi(optarg);
+				break;
+
+			// data ready FIFO
+			case 'g':
+				strncpy(drdyPath, optarg, sizeof(drdyPath)-1);
+				break;
+
+			case 'v':
+				verbose = TRUE;
+				break;
+
+			case 'h':
+			default:
+				show_help(argv[0]);
+				exit(1);
+		}
+	}
+
+	if((genLength < (int)sizeof(BENCH_STAMP)) || (genLength > EMU_FRAME_MAX))	{
+		fprintf(stderr, "Frame length must be %d to %d\n", (int)sizeof(BENCH_STAMP), EMU_FRAME_MAX);
+		exit(1);
+	}
+	if(creditWindow > SPI_CREDIT_MAX)
+		creditWindow = SPI_CREDIT_MAX;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int listenFD = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if(listenFD == -1)	{
+		perror("socket");
+		exit(100);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, sockPath, sizeof(addr.sun_path)-1);
+	unlink(addr.sun_path);
+	if((bind(listenFD, (struct sockaddr *)&addr, sizeof(addr)) == -1) || (listen(listenFD, 1) == -1))	{
+		fprintf(stderr, "Cannot listen on %s: %s\n", addr.sun_path, strerror(errno));
+		exit(100);
+	}
+	fprintf(stderr, "Node emulator on %s\n", addr.sun_path);
+
+	// one host at a time
+	for(;;)	{
+		int conn = accept(listenFD, NULL, NULL);
+		if(conn == -1)	{
+			if(errno == EINTR)
+				continue;
+			perror("accept");
+			exit(101);
+		}
+		serve(conn);
+		close(conn);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void show_help(char *name) {
+	fprintf(stderr,
+			"Usage: %s -[scfdxyerlwgvh]\n"
+			"-s socket, default " SPI_EMU_SOCKET "\n"
+			"-c modelled SPI clock in Hz, 0 for none, default the host's\n"
+			"-f lose bits above this SPI clock, more the faster, Hz\n"
+			"-d latency added to each transfer, us\n"
+			"-x damage the eye of 1 in n replies\n"
+			"-y flip a bit in 1 in n replies\n"
+			"-e echo frames from the host back to it\n"
+			"-r frames/s from the radio\n"
+			"-l length of those frames, default 100\n"
+			"-w credit window for the host, default %d\n"
+			"-g data ready FIFO, as given to ip400spi -g\n"
+			"-v log stats every %d seconds\n"
+			"-h print this help message\n",
+			name, EMU_CREDIT_WINDOW, EMU_STATS_TIME);
+}
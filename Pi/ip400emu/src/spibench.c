@@ -0,0 +1,332 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        spibench.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Throughput and latency through the daemon. Frames
+                          go to ip400spi over UDP, across the SPI link to the
+                          emulator in echo mode and back; frames the emulator
+                          generates are timed on the way in as well.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "types.h"
+#include "spidefs.h"
+#include "ip400emu.h"
+
+#define	BENCH_IDLE_TIME		2000			// ms without a frame before giving up
+#define	BENCH_RADIO_MAX		1000000			// radio frames timed
+#define	BENCH_LOST_TIME		200				// ms with the window shut before frames count as lost
+
+// latencies for one direction
+typedef struct bench_dir_t	{
+	char			*name;
+	int64_t			*lat;					// ns
+	uint32_t		nLat;
+	uint32_t		maxLat;
+	uint32_t		nDups;					// seen before, or damaged
+	uint32_t		lastSeq;				// for gaps in the radio frames
+	uint32_t		nGaps;
+	uint64_t		nBytes;
+} BENCH_DIR;
+
+static char daemonHost[50] = "127.0.0.1";
+static int daemonPort = BENCH_DAEMON_PORT;
+static int myPort = BENCH_HOST_PORT;
+static int nFrames = 10000;
+static int frameLen = 100;
+static int rate;							// frames/s, 0 as fast as the window allows
+static int window = 16;						// frames in flight
+static int duration;						// s just timing radio frames
+static int needBack = 100;					// % of frames back for success
+static int maxDamaged;						// frames that may come back damaged
+
+void show_help(char *name);
+
+// monotonic time in ns
+static int64_t monoNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+// the rest of the payload: a pattern from the frame's number,
+// so a frame put together from pieces of two shows
+static void fillPattern(uint8_t *payload, uint32_t seq)
+{
+	for(int i=sizeof(BENCH_STAMP);i<frameLen;i++)
+		payload[i] = (uint8_t)(seq + i);
+}
+
+static BOOL checkPattern(uint8_t *payload, int len, uint32_t seq)
+{
+	if(len != frameLen)
+		return FALSE;
+
+	for(int i=sizeof(BENCH_STAMP);i<frameLen;i++)	{
+		if(payload[i] != (uint8_t)(seq + i))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static int cmpLat(const void *a, const void *b)
+{
+	int64_t x = *(int64_t *)a, y = *(int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void report(BENCH_DIR *d, double secs)
+{
+	if(d->nLat == 0)	{
+		printf("%-6s no frames\n", d->name);
+		return;
+	}
+
+	qsort(d->lat, d->nLat, sizeof(int64_t), cmpLat);
+	int64_t total = 0;
+	for(uint32_t i=0;i<d->nLat;i++)
+		total += d->lat[i];
+
+	printf("%-6s %7u frames %8.0f frames/s %8.1f kbit/s  us: min %7.1f avg %7.1f p50 %7.1f p99 %7.1f max %8.1f\n",
+			d->name, d->nLat, d->nLat/secs, (d->nBytes*8)/(secs*1000),
+			d->lat[0]/1000.0, (total/d->nLat)/1000.0,
+			d->lat[d->nLat/2]/1000.0, d->lat[(d->nLat*99)/100]/1000.0, d->lat[d->nLat-1]/1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+	static uint8_t txBuf[sizeof(struct spi_hdr_t) + PAYLOAD_MAX];
+	static uint8_t rxBuf[sizeof(struct spi_hdr_t) + SPI_REASM_MAX];
+	struct sockaddr_in local, remote;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:p:m:c:l:r:w:t:a:d:h")) != -1) {
+
+		switch((char )c) {
+
+			case 'n':
+				strncpy(daemonHost, optarg, sizeof(daemonHost)-1);
+				break;
+
+			case 'p':
+				daemonPort = atoi(optarg);
+				break;
+
+			case 'm':
+				myPort = atoi(optarg);
+				break;
+
+			case 'c':
+				nFrames = atoi(optarg);
+				break;
+
+			case 'l':
+				frameLen = atoi(optarg);
+				break;
+
+			case 'r':
+				rate = atoi(optarg);
+				break;
+
+			case 'w':
+				window = atoi(optarg);
+				break;
+
+			case 't':
+				duration = atoi(optarg);
+				break;
+
+			case 'a':
+				needBack = atoi(optarg);
+				break;
+
+			case 'd':
+				maxDamaged = atoi(optarg);
+				break;
+
+			case 'h':
+			default:
+				show_help(argv[0]);
+				exit(1);
+		}
+	}
+
+	if((frameLen < (int)sizeof(BENCH_STAMP)) || (frameLen > PAYLOAD_MAX))	{
+		fprintf(stderr, "Frame length must be %d to %d\n", (int)sizeof(BENCH_STAMP), PAYLOAD_MAX);
+		exit(1);
+	}
+	if(duration != 0)
+		nFrames = 0;
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(myPort);
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	if(bind(sock, (struct sockaddr *)&local, sizeof(local)) == -1)	{
+		perror("bind");
+		exit(100);
+	}
+	memset(&remote, 0, sizeof(remote));
+	remote.sin_family = AF_INET;
+	remote.sin_port = htons(daemonPort);
+	if(inet_aton(daemonHost, &remote.sin_addr) == 0)	{
+		fprintf(stderr, "Bad address %s\n", daemonHost);
+		exit(100);
+	}
+
+	BENCH_DIR echoDir = { "echo" }, radioDir = { "radio" };
+	uint8_t *seen = calloc(nFrames + 1, 1);
+	echoDir.lat = malloc((nFrames + 1) * sizeof(int64_t));
+	echoDir.maxLat = nFrames;
+	radioDir.lat = malloc(BENCH_RADIO_MAX * sizeof(int64_t));
+	radioDir.maxLat = BENCH_RADIO_MAX;
+
+	// the frame: a single, then the stamp
+	struct spi_hdr_t *hdr = (struct spi_hdr_t *)txBuf;
+	BENCH_STAMP *stamp = (BENCH_STAMP *)(txBuf + sizeof(struct spi_hdr_t));
+	memcpy(hdr->eye, "IP4C", 4);
+	hdr->status = SINGLE_FRAME;
+	hdr->length_hi = (frameLen >> 8);
+	hdr->length_lo = (frameLen & 0xFF);
+	memcpy(hdr->fromCall, "BNCH", N_CALL);
+	hdr->coding = EMU_CODING;
+	stamp->magic = BENCH_MAGIC;
+
+	int64_t start = monoNow(), lastRx = start, nextTx = start;
+	int64_t stop = start + (int64_t)duration * 1000000000LL;
+	int nSent = 0, nWrittenOff = 0;
+
+	for(;;)	{
+		int64_t now = monoNow();
+		int inFlight = nSent - echoDir.nLat - nWrittenOff;
+
+		// frames lost on the link would keep the window shut
+		if((inFlight >= window) && ((now - lastRx) > (BENCH_LOST_TIME * 1000000LL)))	{
+			nWrittenOff = nSent - echoDir.nLat;
+			inFlight = 0;
+			lastRx = now;
+		}
+
+		// send when due and the window is open
+		while((nSent < nFrames) && (inFlight < window) && (now >= nextTx))	{
+			stamp->seq = nSent;
+			stamp->sent = now;
+			fillPattern((uint8_t *)stamp, nSent);
+			if(sendto(sock, txBuf, sizeof(struct spi_hdr_t) + frameLen, 0, (struct sockaddr *)&remote, sizeof(remote)) == -1)
+				break;
+			nSent++;
+			inFlight++;
+			if(rate != 0)
+				nextTx += 1000000000LL / rate;
+		}
+
+		// done?
+		if(duration != 0)	{
+			if(now >= stop)
+				break;
+		} else if((echoDir.nLat == nFrames) || ((now - lastRx) > (BENCH_IDLE_TIME * 1000000LL)))	{
+			break;
+		}
+
+		struct pollfd pfd = { sock, POLLIN, 0 };
+		int timeout = ((rate != 0) && (nSent < nFrames) && (inFlight < window)) ? 0 : 10;
+		if(timeout == 0)	{
+			int64_t wait = nextTx - monoNow();
+			timeout = (wait > 0) ? (int)(wait / 1000000) : 0;
+		}
+		if(poll(&pfd, 1, timeout) <= 0)
+			continue;
+
+		// everything waiting
+		int len;
+		while((len = recv(sock, rxBuf, sizeof(rxBuf), MSG_DONTWAIT)) > 0)	{
+			now = monoNow();
+			if(len < (int)(sizeof(struct spi_hdr_t) + sizeof(BENCH_STAMP)))
+				continue;
+			struct spi_hdr_t *rxHdr = (struct spi_hdr_t *)rxBuf;
+			BENCH_STAMP *rxStamp = (BENCH_STAMP *)(rxBuf + sizeof(struct spi_hdr_t));
+			if(rxStamp->magic != BENCH_MAGIC)
+				continue;
+			lastRx = now;
+
+			// a stamp from the future, or long ago, was damaged
+			int64_t lat = now - rxStamp->sent;
+			BOOL damaged = ((lat < 0) || (lat > (int64_t)BENCH_IDLE_TIME * 1000000LL)) ? TRUE : FALSE;
+
+			BENCH_DIR *d;
+			if(!memcmp(rxHdr->fromCall, "EMU0", N_CALL))	{
+				d = &radioDir;
+				if((d->nLat != 0) && (rxStamp->seq != d->lastSeq + 1))
+					d->nGaps++;
+				d->lastSeq = rxStamp->seq;
+			} else {
+				d = &echoDir;
+				if(damaged || (rxStamp->seq >= (uint32_t)nFrames) || seen[rxStamp->seq] ||
+						!checkPattern((uint8_t *)rxStamp, len - sizeof(struct spi_hdr_t), rxStamp->seq))	{
+					d->nDups++;
+					continue;
+				}
+				seen[rxStamp->seq] = 1;
+			}
+			if(damaged)
+				continue;
+			if(d->nLat < d->maxLat)
+				d->lat[d->nLat++] = lat;
+			d->nBytes += len - sizeof(struct spi_hdr_t);
+		}
+	}
+
+	double secs = (monoNow() - start) / 1e9;
+	printf("%d frames of %d bytes sent in %.2f s, %u back, %u lost, %u duplicate or damaged; radio %u gaps\n",
+			nSent, frameLen, secs, echoDir.nLat, nSent - echoDir.nLat, echoDir.nDups, radioDir.nGaps);
+	report(&echoDir, secs);
+	report(&radioDir, secs);
+
+	// a lossy link passes with enough back, and few damaged
+	if(echoDir.nDups > (uint32_t)maxDamaged)
+		return 2;
+	return ((uint64_t)echoDir.nLat * 100 >= (uint64_t)nSent * needBack) ? EXIT_SUCCESS : 2;
+}
+
+void show_help(char *name) {
+	fprintf(stderr,
+			"Usage: %s -[npmclrwtadh]\n"
+			"-n daemon address, default 127.0.0.1\n"
+			"-p daemon port, default %d\n"
+			"-m my port: the daemon's -p, default %d\n"
+			"-c frames to send, default 10000\n"
+			"-l payload length, default 100\n"
+			"-r frames/s, default as fast as the window allows\n"
+			"-w frames in flight, default 16\n"
+			"-t seconds to time radio frames only, sending nothing\n"
+			"-a %% of frames that must come back, default 100\n"
+			"-d frames that may come back duplicate or damaged, default 0\n"
+			"-h print this help message\n",
+			name, BENCH_DAEMON_PORT, BENCH_HOST_PORT);
+}
@@ -0,0 +1,278 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        spisoak.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Soak test for the daemon's memory. Millions of frames
+                          of every length go to ip400spi over UDP, across the SPI
+                          link to the emulator in echo mode and back, while the
+                          daemon's resident set is sampled: once it has warmed
+                          up it must stay flat.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "types.h"
+#include "spidefs.h"
+#include "ip400emu.h"
+
+#define	SOAK_FRAMES			2000000			// frames to send
+#define	SOAK_SAMPLE			100000			// frames between RSS samples
+#define	SOAK_GROWTH			64				// kB the RSS may grow after the first sample
+#define	SOAK_LOST_TIME		50				// ms with the window shut before frames count as lost
+
+static char daemonHost[50] = "127.0.0.1";
+static int daemonPort = BENCH_DAEMON_PORT;
+static int myPort = BENCH_HOST_PORT;
+static int daemonPid;
+static int nFrames = SOAK_FRAMES;
+static int maxLen = PAYLOAD_MAX;				// past SPI_BUFFER_LEN: fragments to the node
+static int window = 64;						// frames in flight
+static int sampleEvery = SOAK_SAMPLE;
+static int growth = SOAK_GROWTH;
+
+void show_help(char *name);
+
+// monotonic time in ms
+static int64_t monoNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+// the daemon's resident set, kB, or -1 if it has gone
+static long daemonRSS(void)
+{
+	char path[50], line[100];
+	long rss = -1;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", daemonPid);
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL)
+		return -1;
+	while(fgets(line, sizeof(line), fp) != NULL)	{
+		if(sscanf(line, "VmRSS: %ld", &rss) == 1)
+			break;
+	}
+	fclose(fp);
+	return rss;
+}
+
+int main(int argc, char *argv[])
+{
+	static uint8_t txBuf[sizeof(struct spi_hdr_t) + SPI_REASM_MAX];
+	static uint8_t rxBuf[sizeof(struct spi_hdr_t) + SPI_REASM_MAX];
+	struct sockaddr_in local, remote;
+	int c;
+
+	while ((c = getopt(argc, argv, "P:n:p:m:c:l:w:s:g:h")) != -1) {
+
+		switch((char )c) {
+
+			case 'P':
+				daemonPid = atoi(optarg);
+				break;
+
+			case 'n':
+				strncpy(daemonHost, optarg, sizeof(daemonHost)-1);
+				break;
+
+			case 'p':
+				daemonPort = atoi(optarg);
+				break;
+
+			case 'm':
+				myPort = atoi(optarg);
+				break;
+
+			case 'c':
+				nFrames = atoi(optarg);
+				break;
+
+			case 'l':
+				maxLen = atoi(optarg);
+				break;
+
+			case 'w':
+				window = atoi(optarg);
+				break;
+
+			case 's':
+				sampleEvery = atoi(optarg);
+				break;
+
+			case 'g':
+				growth = atoi(optarg);
+				break;
+
+			case 'h':
+			default:
+				show_help(argv[0]);
+				exit(1);
+		}
+	}
+
+	if(daemonPid <= 0)	{
+		fprintf(stderr, "Need the daemon's pid\n");
+		show_help(argv[0]);
+		exit(1);
+	}
+	if((maxLen < (int)sizeof(BENCH_STAMP)) || (maxLen > SPI_REASM_MAX))	{
+		fprintf(stderr, "Longest payload must be %d to %d\n", (int)sizeof(BENCH_STAMP), SPI_REASM_MAX);
+		exit(1);
+	}
+	if(sampleEvery <= 0)
+		sampleEvery = SOAK_SAMPLE;
+	if(window <= 0)
+		window = 1;
+
+	long firstRSS = daemonRSS();
+	if(firstRSS < 0)	{
+		fprintf(stderr, "Cannot read the memory of process %d\n", daemonPid);
+		exit(100);
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(myPort);
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	if(bind(sock, (struct sockaddr *)&local, sizeof(local)) == -1)	{
+		perror("bind");
+		exit(100);
+	}
+	memset(&remote, 0, sizeof(remote));
+	remote.sin_family = AF_INET;
+	remote.sin_port = htons(daemonPort);
+	if(inet_aton(daemonHost, &remote.sin_addr) == 0)	{
+		fprintf(stderr, "Bad address %s\n", daemonHost);
+		exit(100);
+	}
+
+	// the frame: a single, then the stamp; the length steps
+	// through every size, so some go to the node in fragments
+	struct spi_hdr_t *hdr = (struct spi_hdr_t *)txBuf;
+	BENCH_STAMP *stamp = (BENCH_STAMP *)(txBuf + sizeof(struct spi_hdr_t));
+	memcpy(hdr->eye, "IP4C", 4);
+	hdr->status = SINGLE_FRAME;
+	memcpy(hdr->fromCall, "SOAK", N_CALL);
+	hdr->coding = EMU_CODING;
+	stamp->magic = BENCH_MAGIC;
+
+	printf("%d frames of up to %d bytes to process %d, RSS %ld kB at the start\n",
+			nFrames, maxLen, daemonPid, firstRSS);
+	fflush(stdout);
+
+	int64_t start = monoNow(), lastRx = start;
+	uint32_t nSent = 0, nBack = 0, nWrittenOff = 0;
+	long baseRSS = -1, rss = firstRSS, peakRSS = 0;
+	int frameLen = sizeof(BENCH_STAMP);
+
+	while(nSent < nFrames)	{
+		int64_t now = monoNow();
+		int inFlight = nSent - nBack - nWrittenOff;
+
+		// frames dropped on the way would keep the window shut
+		if((inFlight >= window) && ((now - lastRx) > SOAK_LOST_TIME))	{
+			nWrittenOff = nSent - nBack;
+			inFlight = 0;
+			lastRx = now;
+		}
+
+		while((nSent < nFrames) && (inFlight < window))	{
+			hdr->length_hi = (frameLen >> 8);
+			hdr->length_lo = (frameLen & 0xFF);
+			stamp->seq = nSent;
+			if(sendto(sock, txBuf, sizeof(struct spi_hdr_t) + frameLen, 0, (struct sockaddr *)&remote, sizeof(remote)) == -1)
+				break;
+			if(++frameLen > maxLen)
+				frameLen = sizeof(BENCH_STAMP);
+			nSent++;
+			inFlight++;
+
+			// sample once it has warmed up
+			if((nSent % sampleEvery) == 0)	{
+				if((rss = daemonRSS()) < 0)	{
+					fprintf(stderr, "Process %d has gone after %u frames\n", daemonPid, nSent);
+					exit(2);
+				}
+				if(baseRSS < 0)
+					baseRSS = rss;
+				if(rss > peakRSS)
+					peakRSS = rss;
+				printf("%9u frames sent, %9u back, RSS %ld kB (%+ld)\n", nSent, nBack, rss, rss - baseRSS);
+				fflush(stdout);
+			}
+		}
+
+		struct pollfd pfd = { sock, POLLIN, 0 };
+		if(poll(&pfd, 1, 1) <= 0)
+			continue;
+
+		int len;
+		while((len = recv(sock, rxBuf, sizeof(rxBuf), MSG_DONTWAIT)) > 0)	{
+			struct spi_hdr_t *rxHdr = (struct spi_hdr_t *)rxBuf;
+			BENCH_STAMP *rxStamp = (BENCH_STAMP *)(rxBuf + sizeof(struct spi_hdr_t));
+			if((len < (int)(sizeof(struct spi_hdr_t) + sizeof(BENCH_STAMP))) || (rxStamp->magic != BENCH_MAGIC))
+				continue;
+			if(memcmp(rxHdr->fromCall, "SOAK", N_CALL))
+				continue;
+			nBack++;
+			lastRx = monoNow();
+		}
+	}
+
+	if((rss = daemonRSS()) < 0)	{
+		fprintf(stderr, "Process %d has gone at the end\n", daemonPid);
+		exit(2);
+	}
+	if(baseRSS < 0)
+		baseRSS = rss;
+	if(rss > peakRSS)
+		peakRSS = rss;
+
+	double secs = (monoNow() - start) / 1000.0;
+	BOOL flat = ((peakRSS - baseRSS) <= growth) ? TRUE : FALSE;
+	printf("%u frames sent in %.1f s, %u back; RSS %ld kB after warm up, %ld kB peak, %ld kB at the end: %s\n",
+			nSent, secs, nBack, baseRSS, peakRSS, rss, flat ? "flat" : "GROWING");
+
+	return flat ? EXIT_SUCCESS : 2;
+}
+
+void show_help(char *name) {
+	fprintf(stderr,
+			"Usage: %s -P pid -[npmclwsgh]\n"
+			"-P the daemon's process id, to watch its memory\n"
+			"-n daemon address, default 127.0.0.1\n"
+			"-p daemon port, default %d\n"
+			"-m my port: the daemon's -p, default %d\n"
+			"-c frames to send, default %d\n"
+			"-l longest payload, at most %d, default %d\n"
+			"-w frames in flight, default 64\n"
+			"-s frames between memory samples, default %d\n"
+			"-g kB the memory may grow after the first sample, default %d\n"
+			"-h print this help message\n",
+			name, BENCH_DAEMON_PORT, BENCH_HOST_PORT, SOAK_FRAMES, SPI_REASM_MAX, PAYLOAD_MAX, SOAK_SAMPLE, SOAK_GROWTH);
+}
@@ -0,0 +1,59 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        ip400shm.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Client library for the SPI daemon's shared memory rings
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_IP400SHM_H_
+#define INCLUDE_IP400SHM_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "shmring.h"
+
+/*
+ * Connect with ip400shmOpen, giving the codings wanted, one bit
+ * each. Frames from the node are read in place: ip400shmPeek
+ * returns the oldest, header then payload, ip400shmRelease hands
+ * its slot back. When there are none, ip400shmWait blocks until
+ * the daemon says there are more; its descriptor can go in a
+ * poll or epoll set instead. Frames for the node are written in
+ * place too: fill ip400shmTxBuffer and pass the length to
+ * ip400shmSend.
+ */
+typedef struct ip400shm_t	{
+	int				connFD;					// unix socket to the daemon
+	int				memFD;					// the region
+	int				rxBell;					// signalled: frames for us
+	int				txBell;					// we signal: frames for it
+	SHM_REGION		*region;				// mapped
+} IP400SHM;
+
+// functions
+IP400SHM *ip400shmOpen(char *path, uint16_t codings);
+void ip400shmClose(IP400SHM *shm);
+int ip400shmFd(IP400SHM *shm);
+BOOL ip400shmWait(IP400SHM *shm, int timeout);
+uint8_t *ip400shmPeek(IP400SHM *shm, uint16_t *length);
+void ip400shmRelease(IP400SHM *shm);
+uint8_t *ip400shmTxBuffer(IP400SHM *shm);
+BOOL ip400shmSend(IP400SHM *shm, uint16_t length);
+uint32_t ip400shmDrops(IP400SHM *shm);
+
+#endif /* INCLUDE_IP400SHM_H_ */
@@ -0,0 +1,199 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        ip400shm.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Client library for the SPI daemon's shared memory
+                          rings: connects, maps the region, and reads and
+                          writes frames in place.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "types.h"
+#include "shmring.h"
+#include "ip400shm.h"
+
+/*
+ * Connect to the daemon and map the rings
+ */
+IP400SHM *ip400shmOpen(char *path, uint16_t codings)
+{
+	struct sockaddr_un addr;
+	SHM_HELLO hello;
+	struct msghdr msg;
+	struct iovec iov;
+	uint8_t ok;
+	union {
+		char			buf[CMSG_SPACE(SHM_N_FDS * sizeof(int))];
+		struct cmsghdr	align;
+	} ctl;
+
+	IP400SHM *shm = calloc(1, sizeof(IP400SHM));
+	if(shm == NULL)
+		return NULL;
+	shm->memFD = shm->rxBell = shm->txBell = -1;
+
+	if((shm->connFD = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1)	{
+		free(shm);
+		return NULL;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	if(connect(shm->connFD, (struct sockaddr *)&addr, sizeof(addr)) == -1)	{
+		ip400shmClose(shm);
+		return NULL;
+	}
+
+	hello.magic = SHM_MAGIC;
+	hello.version = SHM_VERSION;
+	hello.codings = codings;
+	if(send(shm->connFD, &hello, sizeof(hello), 0) != sizeof(hello))	{
+		ip400shmClose(shm);
+		return NULL;
+	}
+
+	// the answer carries the descriptors
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &ok;
+	iov.iov_len = sizeof(ok);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	if(recvmsg(shm->connFD, &msg, MSG_CMSG_CLOEXEC) <= 0)	{
+		ip400shmClose(shm);
+		return NULL;
+	}
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if((cmsg == NULL) || (cmsg->cmsg_type != SCM_RIGHTS) ||
+			(cmsg->cmsg_len != CMSG_LEN(SHM_N_FDS * sizeof(int))))	{
+		ip400shmClose(shm);
+		return NULL;
+	}
+	int fds[SHM_N_FDS];
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	shm->memFD = fds[0];
+	shm->rxBell = fds[1];
+	shm->txBell = fds[2];
+
+	shm->region = mmap(NULL, sizeof(SHM_REGION), PROT_READ | PROT_WRITE, MAP_SHARED, shm->memFD, 0);
+	if((shm->region == MAP_FAILED) || (shm->region->magic != SHM_MAGIC) || (shm->region->version != SHM_VERSION))	{
+		if(shm->region == MAP_FAILED)
+			shm->region = NULL;
+		ip400shmClose(shm);
+		return NULL;
+	}
+
+	return shm;
+}
+
+void ip400shmClose(IP400SHM *shm)
+{
+	if(shm->region != NULL)
+		munmap(shm->region, sizeof(SHM_REGION));
+	if(shm->memFD != -1)
+		close(shm->memFD);
+	if(shm->rxBell != -1)
+		close(shm->rxBell);
+	if(shm->txBell != -1)
+		close(shm->txBell);
+	close(shm->connFD);
+	free(shm);
+}
+
+// readable when there are frames
+int ip400shmFd(IP400SHM *shm)
+{
+	return shm->rxBell;
+}
+
+/*
+ * Wait up to timeout ms, -1 for ever, for more frames.
+ * Returns FALSE on a timeout. Peek first: frames that
+ * came before the last wait do not signal again
+ */
+BOOL ip400shmWait(IP400SHM *shm, int timeout)
+{
+	struct pollfd pfd;
+	uint64_t count;
+
+	pfd.fd = shm->rxBell;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, timeout) <= 0)
+		return FALSE;
+
+	return (read(shm->rxBell, &count, sizeof(count)) == sizeof(count)) ? TRUE : FALSE;
+}
+
+/*
+ * The oldest frame and its length, or NULL
+ */
+uint8_t *ip400shmPeek(IP400SHM *shm, uint16_t *length)
+{
+	SHM_SLOT *slot = shmRingPeek(&shm->region->rx);
+
+	if(slot == NULL)
+		return NULL;
+	*length = slot->length;
+	return slot->data;
+}
+
+void ip400shmRelease(IP400SHM *shm)
+{
+	shmRingRelease(&shm->region->rx);
+}
+
+/*
+ * Where to build the next frame for the node,
+ * or NULL if the ring is full
+ */
+uint8_t *ip400shmTxBuffer(IP400SHM *shm)
+{
+	SHM_SLOT *slot = shmRingSlot(&shm->region->tx);
+
+	return (slot == NULL) ? NULL : slot->data;
+}
+
+// send the frame built in the tx buffer
+BOOL ip400shmSend(IP400SHM *shm, uint16_t length)
+{
+	uint64_t one = 1;
+	SHM_SLOT *slot = shmRingSlot(&shm->region->tx);
+
+	if((slot == NULL) || (length > SHM_SLOT_LEN))
+		return FALSE;
+
+	slot->length = length;
+	shmRingCommit(&shm->region->tx);
+	return (write(shm->txBell, &one, sizeof(one)) == sizeof(one)) ? TRUE : FALSE;
+}
+
+// frames the daemon could not give us: the rx ring was full
+uint32_t ip400shmDrops(IP400SHM *shm)
+{
+	return shm->region->rx.nDrops;
+}
@@ -0,0 +1,339 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        shmbench.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Latency benchmark for the shared memory rings. It
+                          attaches to a running ip400spi -u with libip400shm,
+                          sends frames through the tx ring to a node echoing
+                          them (ip400emu -e), and times each one back in the
+                          rx ring. A UDP subscriber on the daemon's host port
+                          gets the same frames, and is timed alongside.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "types.h"
+#include "shmring.h"
+#include "ip400shm.h"
+
+// defaults
+#define	BENCH_FRAMES		10000				// frames to send
+#define	BENCH_SIZE			100					// payload bytes
+#define	BENCH_GAP			1000				// us between frames
+#define	BENCH_UDP_PORT		5101				// the daemon's -p
+#define	BENCH_CODING		0					// the emulator's coding
+#define	BENCH_IDLE			2000				// ms with nothing back: done
+#define	BENCH_MAGIC			0x49503453			// 'IP4S'
+
+// the start of each payload
+typedef struct shm_stamp_t	{
+	uint32_t		magic;					// BENCH_MAGIC
+	uint32_t		seq;					// frame number
+	int64_t			sent;					// ns, monotonic
+} SHM_STAMP;
+
+static char sockPath[100] = SHM_SOCKET;
+static int udpPort = BENCH_UDP_PORT;
+static int nFrames = BENCH_FRAMES;
+static int payloadLen = BENCH_SIZE;
+static int frameGap = BENCH_GAP;
+
+// what one subscriber saw
+typedef struct bench_rx_t	{
+	char			*name;
+	int64_t			*lat;					// ns, each frame back
+	int64_t			*arrived;				// ns, by frame number
+	int				nBack;
+	int				nDups;
+} BENCH_RX;
+
+// when each frame reached the UDP subscriber: shared with it
+static int64_t *udpArrived;
+
+static int64_t nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static int cmpLatency(const void *a, const void *b)
+{
+	int64_t x = *(int64_t *)a, y = *(int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void rxInit(BENCH_RX *rx, char *name, int64_t *arrived)
+{
+	rx->name = name;
+	rx->lat = malloc(nFrames * sizeof(int64_t));
+	rx->arrived = arrived;
+	rx->nBack = rx->nDups = 0;
+	if((rx->lat == NULL) || (rx->arrived == NULL))	{
+		fprintf(stderr, "%s: out of memory\n", name);
+		exit(1);
+	}
+}
+
+// one of ours: time it, once
+static void rxFrame(BENCH_RX *rx, uint8_t *frame, int length)
+{
+	SHM_STAMP stamp;
+	int64_t now = nowNs();
+
+	if(length < (int)(sizeof(struct spi_hdr_t) + sizeof(SHM_STAMP)))
+		return;
+	memcpy(&stamp, frame + sizeof(struct spi_hdr_t), sizeof(stamp));
+	if((stamp.magic != BENCH_MAGIC) || (stamp.seq >= (uint32_t)nFrames))
+		return;
+	if(rx->arrived[stamp.seq] != 0)	{
+		rx->nDups++;
+		return;
+	}
+	rx->arrived[stamp.seq] = now;
+	rx->lat[rx->nBack++] = now - stamp.sent;
+}
+
+static void report(BENCH_RX *rx)
+{
+	int n = rx->nBack;
+	int64_t total = 0;
+
+	if(n == 0)	{
+		printf("%-4s %6d frames back of %d\n", rx->name, 0, nFrames);
+		return;
+	}
+
+	qsort(rx->lat, n, sizeof(int64_t), cmpLatency);
+	for(int i=0;i<n;i++)
+		total += rx->lat[i];
+
+	printf("%-4s %6d frames back, %d dup  us: min %7.1f avg %7.1f p50 %7.1f p99 %7.1f max %7.1f\n",
+			rx->name, n, rx->nDups, rx->lat[0]/1000.0, (total/n)/1000.0, rx->lat[n/2]/1000.0,
+			rx->lat[(n*99)/100]/1000.0, rx->lat[n-1]/1000.0);
+	fflush(stdout);
+}
+
+/*
+ * UDP subscriber: a process of its own, as an application
+ * would be, on the port the daemon sends frames from the node to.
+ * Says it is ready on the pipe, and reports when the frames stop
+ */
+static void udpSubscriber(int ready)
+{
+	struct sockaddr_in addr;
+	static uint8_t frame[SHM_SLOT_LEN];
+	BENCH_RX rx;
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(udpPort);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if((sock == -1) || (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1))	{
+		perror("udp subscriber");
+		exit(1);
+	}
+	rxInit(&rx, "udp", udpArrived);
+	if(write(ready, "", 1) != 1)
+		exit(1);
+	close(ready);
+
+	struct pollfd pfd = { sock, POLLIN, 0 };
+	while((rx.nBack < nFrames) && (poll(&pfd, 1, BENCH_IDLE) > 0))	{
+		int len = recv(sock, frame, sizeof(frame), 0);
+		if(len > 0)
+			rxFrame(&rx, frame, len);
+	}
+	report(&rx);
+	close(sock);
+	exit(0);
+}
+
+// take what is in the rx ring
+static void shmTake(IP400SHM *shm, BENCH_RX *rx)
+{
+	uint8_t *frame;
+	uint16_t length;
+
+	while((frame = ip400shmPeek(shm, &length)) != NULL)	{
+		rxFrame(rx, frame, length);
+		ip400shmRelease(shm);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int c, ready[2];
+	char ok;
+
+	while((c = getopt(argc, argv, "u:m:n:s:g:h")) != -1)	{
+		switch((char)c)	{
+
+		case 'u':
+			strncpy(sockPath, optarg, sizeof(sockPath)-1);
+			break;
+
+		case 'm':
+			udpPort = atoi(optarg);
+			break;
+
+		case 'n':
+			nFrames = atoi(optarg);
+			break;
+
+		case 's':
+			payloadLen = atoi(optarg);
+			break;
+
+		case 'g':
+			frameGap = atoi(optarg);
+			break;
+
+		default:
+			fprintf(stderr, "Usage: %s [-u daemon socket] [-m daemon's UDP host port] [-n frames] "
+					"[-s payload size] [-g us between frames]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(payloadLen < (int)sizeof(SHM_STAMP))
+		payloadLen = sizeof(SHM_STAMP);
+	if(payloadLen > SPI_REASM_MAX)
+		payloadLen = SPI_REASM_MAX;
+	if(nFrames <= 0)
+		nFrames = 1;
+
+	// the UDP subscriber first, so it misses nothing
+	udpArrived = mmap(NULL, nFrames * sizeof(int64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(udpArrived == MAP_FAILED)	{
+		perror("mmap");
+		return 1;
+	}
+	if(pipe(ready) == -1)	{
+		perror("pipe");
+		return 1;
+	}
+	pid_t udpPid = fork();
+	if(udpPid == 0)	{
+		close(ready[0]);
+		udpSubscriber(ready[1]);
+	}
+	close(ready[1]);
+	if((udpPid == -1) || (read(ready[0], &ok, 1) != 1))	{
+		fprintf(stderr, "UDP subscriber did not start\n");
+		return 1;
+	}
+	close(ready[0]);
+
+	IP400SHM *shm = ip400shmOpen(sockPath, 1 << BENCH_CODING);
+	if(shm == NULL)	{
+		fprintf(stderr, "Cannot attach to ip400spi on %s\n", sockPath);
+		kill(udpPid, SIGTERM);
+		return 1;
+	}
+
+	printf("%d frames of %d bytes, %d us apart, through %s; UDP on port %d\n",
+			nFrames, payloadLen, frameGap, sockPath, udpPort);
+	fflush(stdout);
+
+	BENCH_RX rx;
+	rxInit(&rx, "shm", calloc(nFrames, sizeof(int64_t)));
+
+	// the frame: a single, then the stamp
+	struct spi_hdr_t hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.eye, "IP4C", 4);
+	hdr.status = SINGLE_FRAME;
+	hdr.length_hi = (payloadLen >> 8);
+	hdr.length_lo = (payloadLen & 0xFF);
+	memcpy(hdr.fromCall, "SHMB", N_CALL);
+	hdr.coding = BENCH_CODING;
+
+	int nSent = 0, nFull = 0;
+	int64_t nextTx = nowNs(), lastRx = nextTx;
+
+	for(;;)	{
+		int64_t now = nowNs();
+
+		if((nSent < nFrames) && (now >= nextTx))	{
+			uint8_t *buf = ip400shmTxBuffer(shm);
+			if(buf == NULL)	{
+				nFull++;
+			} else {
+				SHM_STAMP stamp = { BENCH_MAGIC, nSent, now };
+				memcpy(buf, &hdr, sizeof(hdr));
+				memset(buf + sizeof(hdr), 0, payloadLen);
+				memcpy(buf + sizeof(hdr), &stamp, sizeof(stamp));
+				if(!ip400shmSend(shm, sizeof(hdr) + payloadLen))
+					break;
+				nSent++;
+			}
+			nextTx += (int64_t)frameGap * 1000;
+			continue;
+		}
+
+		// done when all are back, or nothing has come for a while
+		if(rx.nBack >= nFrames)
+			break;
+		if((nSent == nFrames) && ((now - lastRx) > (BENCH_IDLE * 1000000LL)))
+			break;
+
+		// wait for frames until the next one is due
+		int timeout = (nSent < nFrames) ? (int)((nextTx - now) / 1000000) : BENCH_IDLE;
+		int nBefore = rx.nBack;
+		shmTake(shm, &rx);
+		if(ip400shmWait(shm, timeout))
+			shmTake(shm, &rx);
+		if(rx.nBack != nBefore)
+			lastRx = nowNs();
+	}
+
+	report(&rx);
+	if(nFull || ip400shmDrops(shm))
+		printf("shm  tx ring full %d times, %u frames dropped on a full rx ring\n", nFull, ip400shmDrops(shm));
+	fflush(stdout);
+	ip400shmClose(shm);
+
+	int status;
+	waitpid(udpPid, &status, 0);
+
+	// the same frames, both ways: how much later the ring had them
+	int nBoth = 0;
+	for(int i=0;i<nFrames;i++)	{
+		if((rx.arrived[i] != 0) && (udpArrived[i] != 0))
+			rx.lat[nBoth++] = rx.arrived[i] - udpArrived[i];
+	}
+	if(nBoth != 0)	{
+		qsort(rx.lat, nBoth, sizeof(int64_t), cmpLatency);
+		printf("shm after udp on %d frames   us: min %7.1f p50 %7.1f p99 %7.1f max %7.1f\n",
+				nBoth, rx.lat[0]/1000.0, rx.lat[nBoth/2]/1000.0, rx.lat[(nBoth*99)/100]/1000.0, rx.lat[nBoth-1]/1000.0);
+	}
+	munmap(udpArrived, nFrames * sizeof(int64_t));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        callsign.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for callsign compression
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_CALLSIGN_H_
+#define INCLUDE_CALLSIGN_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "frame.h"
+
+#define	RADIX_40		40					// callsign alphabet radix
+#define	BROADCAST_CALL	0xFF				// all bytes of a broadcast call
+
+// functions
+BOOL encodeCall(char *call, uint8_t *enc);
+BOOL decodeCall(uint8_t *enc, char *call);
+BOOL isBroadcastCall(uint8_t *call);
+
+#endif /* INCLUDE_CALLSIGN_H_ */
@@ -0,0 +1,45 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        drdy.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for the node data ready line
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_DRDY_H_
+#define INCLUDE_DRDY_H_
+
+#include "types.h"
+#include "timer.h"
+
+/*
+ * The node raises its data ready line while it has something
+ * for us. The line is a GPIO on a gpiochip, given as chip:line,
+ * e.g. /dev/gpiochip0:25. Anything else is taken as the path of
+ * a FIFO standing in for the line: writing '1' raises it and
+ * '0' lowers it.
+ */
+#define	DRDY_IDLE_POLL		TIMER_VALUE		// ms between ticks with the line low
+#define	DRDY_GAP			200				// us between back to back exchanges
+#define	DRDY_CONSUMER		"ip400spi"		// line consumer label
+
+// functions
+BOOL drdyOpen(char *lineSpec);
+BOOL drdyStart(void (*exec_function)(void), BOOL (*pending)(void));
+void drdyClose(void);
+void drdyWake(void);
+
+#endif /* INCLUDE_DRDY_H_ */
@@ -0,0 +1,77 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        framering.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for the frame ring
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_FRAMERING_H_
+#define INCLUDE_FRAMERING_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "types.h"
+#include "spidefs.h"
+
+/*
+ * A bounded ring of preallocated frame slots. Any number of
+ * producers may put frames, one consumer takes them. Each slot
+ * has a sequence number that says whose turn it is: producers
+ * claim a slot by advancing the put position, fill it, then
+ * publish it by bumping its sequence; the consumer frees it by
+ * bumping the sequence again. No locks.
+ * The slots are allocated and touched once when the ring is
+ * set up, and recycled from then on, so the memory used never
+ * changes. A full ring refuses the frame and counts the drop.
+ */
+#define	FRAME_RING_SLOTS	64									// default slots
+#define	FRAME_RING_MAX		4096								// most slots
+#define	FRAME_SLOT_LEN		(sizeof(struct spi_hdr_t) + PAYLOAD_MAX)	// largest frame
+
+// one slot
+typedef struct frame_slot_t	{
+	atomic_uint			seq;				// sequence: whose turn
+	SPI_DATA_FRAME		frame;				// the frame, pointing at data
+	uint8_t				data[FRAME_SLOT_LEN];
+} FRAME_SLOT;
+
+// the ring
+typedef struct frame_ring_t	{
+	FRAME_SLOT			*slots;				// allocated once
+	unsigned			nSlots;				// power of 2
+	unsigned			mask;				// nSlots-1
+	atomic_uint			putPos;				// next slot to claim
+	atomic_uint			takePos;			// next slot to take
+	// stats
+	atomic_uint			nPut;				// frames put
+	atomic_uint			nDrops;				// ring full
+	atomic_uint			nTooLong;			// frame longer than a slot
+	atomic_uint			highWater;			// deepest the ring has been
+	atomic_uint			nExhausted;			// times the last slot was taken
+} FRAME_RING;
+
+// functions
+BOOL ringInit(FRAME_RING *ring, unsigned nSlots);
+void ringFree(FRAME_RING *ring);
+BOOL ringPut(FRAME_RING *ring, void *data, uint16_t length);
+SPI_DATA_FRAME *ringPeek(FRAME_RING *ring);
+void ringRelease(FRAME_RING *ring);
+uint32_t ringDepth(FRAME_RING *ring);
+BOOL ringFull(FRAME_RING *ring);
+
+#endif /* INCLUDE_FRAMERING_H_ */
@@ -0,0 +1,87 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        kiss.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for the KISS TCP server
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_KISS_H_
+#define INCLUDE_KISS_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "spidefs.h"
+
+/*
+ * KISS over TCP: AX.25 applications connect, as they would to
+ * a TNC, and their data frames go to the mesh as AX.25 frames,
+ * as the node's own KISS port sends them. AX.25 frames from the
+ * mesh go to every client. Given as [address:]port; the address
+ * defaults to the loopback.
+ */
+#define	KISS_MAX_CLIENTS	4					// applications at once
+#define	KISS_READ_LEN		4096				// read from a client at once
+#define	KISS_RX_BURST		8					// reads per wakeup
+#define	KISS_OUT_LEN		32768				// waiting to go to a client
+#define	KISS_DEFAULT_ADDR	"127.0.0.1"
+
+// KISS framing
+#define	KISS_FEND			0xC0				// frame end
+#define	KISS_FESC			0xDB				// frame escape
+#define	KISS_TFEND			0xDC				// transposed frame end
+#define	KISS_TFESC			0xDD				// transposed frame escape
+#define	KISS_TYPE_DATA		0x00				// data frame, port 0
+#define	KISS_CMD_MASK		0x0F				// command in the type byte
+
+// AX.25 addresses
+#define	AX25_ADDR_LEN		7					// shifted call and SSID
+#define	AX25_MIN_ADDRS		2					// destination and source
+#define	AX25_MAX_ADDRS		10					// and up to 8 repeaters
+#define	AX25_SSID_FINAL		0x01				// last address
+#define	AX25_SSID_RES		0x60				// reserved bits, set
+#define	AX25_SSID_CH		0x80				// command/has been repeated
+#define	AX25_BROADCAST		"QST"				// for the broadcast call
+
+// the VPN field of an AX.25 call: 0xFFA0 | C/H << 4 | SSID
+#define	AX25_VPN_LO			0xA0
+#define	AX25_VPN_HI			0xFF
+#define	AX25_VPN_MASK		0xE0
+
+// largest frame: type byte, addresses and the payload
+#define	KISS_FRAME_MAX		(1 + AX25_MAX_ADDRS*AX25_ADDR_LEN + PAYLOAD_MAX)
+
+// KISS stats
+typedef struct kiss_stats_t	{
+	uint32_t		nClients;				// connected now
+	uint32_t		nConnects;				// since we started
+	uint32_t		nTxFrames;				// frames to the mesh
+	uint32_t		nRxFrames;				// frames to clients
+	uint32_t		nTxDrops;				// bad, too long or no room
+	uint32_t		nRxDrops;				// bad, or a client too slow for one
+	uint32_t		nCommands;				// TNC commands, ignored
+} KISS_STATS;
+
+// functions
+BOOL kissOpen(char *kissSpec);
+void kissClose(void);
+void kissDeliver(uint8_t *frame, uint16_t length);
+void kissFlush(void);
+void kiss_rx_resume(void);
+void kissGetStats(KISS_STATS *stats);
+
+#endif /* INCLUDE_KISS_H_ */
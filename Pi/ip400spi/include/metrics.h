@@ -0,0 +1,78 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        metrics.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for the metrics registry
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_METRICS_H_
+#define INCLUDE_METRICS_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+/*
+ * Counters and histograms for sizing the SPI speed and the
+ * polling interval. Updates are relaxed atomic adds, so any
+ * thread can make them without a lock. Histogram bucket n
+ * counts values up to 2^n, the last one everything larger.
+ * When the registry is read, the stats the other modules keep
+ * are added, and the lot is written in the Prometheus text
+ * format: to whoever connects to the metrics socket, and to a
+ * file rewritten every METRICS_FILE_TIME seconds.
+ */
+#define	METRICS_HIST_BUCKETS	20			// up to 2^18, then the rest
+#define	METRICS_FILE_TIME		10			// seconds between file updates
+#define	METRICS_TEXT_MAX		16384		// largest report
+#define	METRICS_PREFIX			"ip400spi_"	// on every name
+
+// counters
+typedef enum	{
+	MET_SPI_EXCHANGES=0,					// exchanges with the node
+	MET_SPI_ERRORS,							// exchanges that failed
+	MET_SPI_BYTES,							// bytes clocked
+	MET_SPI_CALLS,							// calls to the driver
+	MET_SPI_EYE_FAILS,						// frames or headers without the eye
+	MET_SPI_RX_FRAMES,						// single frames from the node
+	MET_SPI_RX_PACKED,						// frames unpacked from packed ones
+	MET_SPI_RX_TOO_LONG,					// single frames too long
+	MET_SPI_TX_FRAMES,						// frames to the node
+	MET_SPI_TX_FRAGS,						// fragments to the node
+	MET_SPI_TX_PACKED,						// frames packed for the node
+	N_MET_COUNTERS
+} METRIC_COUNTER;
+
+// histograms
+typedef enum	{
+	MET_HIST_EXCHANGE=0,					// us per exchange
+	MET_HIST_TICK_LATE,						// us a tick ran late
+	MET_HIST_TX_DEPTH,						// tx ring depth at each exchange
+	MET_HIST_BATCH,							// exchanges per SPI task run
+	N_MET_HISTS
+} METRIC_HIST;
+
+// functions
+BOOL metricsOpen(char *sockPath, char *filePath);
+void metricsClose(void);
+void metricInc(METRIC_COUNTER id);
+void metricAdd(METRIC_COUNTER id, uint32_t n);
+void metricObserve(METRIC_HIST id, uint32_t value);
+uint32_t metricPercentile(METRIC_HIST id, int permille);
+int metricsFormat(char *buffer, int size);
+
+#endif /* INCLUDE_METRICS_H_ */
@@ -0,0 +1,65 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        reactor.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for the event loop
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_REACTOR_H_
+#define INCLUDE_REACTOR_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+/*
+ * One thread does everything: the tick that runs the SPI
+ * exchange, the UDP socket and any other descriptors, each
+ * handler doing a bounded amount of work per wakeup. Ticks
+ * are absolute CLOCK_MONOTONIC deadlines on a timerfd, so
+ * they do not drift, and how late each one runs is measured.
+ */
+#define	REACTOR_MAX_SOURCES		24			// descriptors besides the timer
+#define	REACTOR_MAX_EVENTS		8			// events per wait
+#define	REACTOR_STATS_TIME		60			// seconds between jitter logs
+
+// handler for a descriptor that is ready
+typedef void (*REACTOR_HANDLER)(int fd, uint32_t events, void *arg);
+
+// tick timing
+typedef struct reactor_stats_t	{
+	uint32_t		nTicks;					// ticks run
+	uint32_t		nMissed;				// deadlines passed before the tick ran
+	uint32_t		nEarly;					// ticks pulled in
+	uint32_t		minLate;				// lateness, us
+	uint32_t		maxLate;
+	uint64_t		totLate;				// for the average
+} REACTOR_STATS;
+
+// functions
+BOOL reactorInit(void);
+BOOL reactorAdd(int fd, REACTOR_HANDLER handler, void *arg);
+BOOL reactorRemove(int fd);
+BOOL reactorEnable(int fd, BOOL enable);
+BOOL reactorEnableOutput(int fd, BOOL enable);
+BOOL reactorStartTick(int interval, void (*tick_function)(void));
+void reactorNextTick(int delay);
+BOOL reactorRun(void);
+void reactorStop(void);
+void reactorGetStats(REACTOR_STATS *stats);
+
+#endif /* INCLUDE_REACTOR_H_ */
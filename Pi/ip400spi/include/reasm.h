@@ -0,0 +1,75 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        reasm.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for fragment reassembly
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_REASM_H_
+#define INCLUDE_REASM_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "spidefs.h"
+
+/*
+ * Fragments from the node are reassembled in a small table of
+ * streams, keyed by source and destination call and IP. Each
+ * fragment says where its data goes, and streams may be
+ * interleaved. The node sends a frame's fragments in order, so
+ * a fragment that does not follow the data held means one was
+ * lost, and the stream is dropped; a first fragment on a stream
+ * that holds data means the end of the last frame was lost, and
+ * the stream starts over. The header has no frame number, so
+ * losing the end of one frame and the start of the next leaves
+ * pieces that still line up: that splice is not caught here. A complete frame goes to UDP as one
+ * datagram. Memory is fixed: a full table evicts its oldest
+ * stream, and a stream that is not complete in time is dropped.
+ */
+#define	REASM_STREAMS		4						// streams at once
+#define	REASM_SEGMENTS		16						// fragments per stream
+#define	REASM_TIMEOUT		2000					// ms to complete a stream
+
+// the stream key
+struct reasm_key_t	{
+	uint8_t			fromCall[N_CALL];
+	uint8_t			fromIP[IP_400_PORT_SIZE];
+	uint8_t			toCall[N_CALL];
+	uint8_t			toIP[IP_400_PORT_SIZE];
+};
+
+// reassembly stats
+typedef struct reasm_stats_t	{
+	uint32_t		nFrags;					// fragments received
+	uint32_t		nFrames;				// frames completed
+	uint32_t		nOutOfOrder;			// fragments after a gap: stream dropped
+	uint32_t		nDuplicates;			// fragments already held
+	uint32_t		nBadFrags;				// past the end or too many
+	uint32_t		nTimeouts;				// streams not completed in time
+	uint32_t		nEvicted;				// streams pushed out by a new one
+	uint32_t		nRestarts;				// streams dropped for a new first fragment
+	uint32_t		maxStreams;				// most streams at once
+} REASM_STATS;
+
+// functions
+void reasmInit(void);
+void reasmFragment(struct spi_hdr_t *hdr, uint8_t *data);
+void reasmExpire(void);
+void reasmGetStats(REASM_STATS *stats);
+
+#endif /* INCLUDE_REASM_H_ */
@@ -0,0 +1,45 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        rt.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for real-time mode
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_RT_H_
+#define INCLUDE_RT_H_
+
+#include "types.h"
+
+/*
+ * Real-time mode puts the thread running the event loop, and
+ * so the SPI exchange, in SCHED_FIFO at the given priority,
+ * optionally pinned to one CPU, with its memory locked and
+ * touched so the exchange does not take page faults. It is
+ * done last, once every buffer is allocated. Anything the
+ * system will not allow is logged and the daemon carries on
+ * without it.
+ */
+#define	RT_PRIORITY_NONE	0				// not real-time
+#define	RT_CPU_ANY			-1				// not pinned
+#define	RT_STACK_PREFAULT	(256*1024)		// stack touched up front
+#define	RT_TIMER_SLACK		1				// ns of timer slack
+
+// functions
+BOOL rtSetup(int priority, int cpu);
+void rtClose(void);
+
+#endif /* INCLUDE_RT_H_ */
@@ -0,0 +1,39 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        shm.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for shared memory clients
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_SHM_H_
+#define INCLUDE_SHM_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "shmring.h"
+
+#define	SHM_MAX_CLIENTS		4					// applications at once
+
+// functions
+BOOL shmOpen(char *path);
+void shmClose(void);
+void shmDeliver(uint8_t *frame, uint16_t length);
+void shmFlush(void);
+void shm_rx_resume(void);
+
+#endif /* INCLUDE_SHM_H_ */
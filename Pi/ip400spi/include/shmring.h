@@ -0,0 +1,120 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        shmring.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Layout of the shared memory rings between the SPI
+                          daemon and local applications. Used by both.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_SHMRING_H_
+#define INCLUDE_SHMRING_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "types.h"
+#include "spidefs.h"
+
+/*
+ * A local application connects to the daemon's unix socket and
+ * sends a hello with the codings it wants. The daemon answers
+ * with three descriptors: a memfd holding an SHM_REGION, an
+ * eventfd it signals when it has put frames in the rx ring, and
+ * an eventfd the application signals when it has put frames in
+ * the tx ring. Each ring has one producer and one consumer, so
+ * a head and a tail are all it needs. Frames are whole SPI
+ * frames, header then payload, read and written in place.
+ */
+#define	SHM_SOCKET			"/run/ip400spi.sock"		// default socket
+#define	SHM_MAGIC			0x53345049					// 'IP4S'
+#define	SHM_VERSION			1
+#define	SHM_RING_SLOTS		64							// slots each way, power of 2
+#define	SHM_RING_MASK		(SHM_RING_SLOTS-1)
+#define	SHM_SLOT_LEN		(sizeof(struct spi_hdr_t) + SPI_REASM_MAX)
+#define	SHM_CACHE_LINE		64
+#define	SHM_N_FDS			3							// region, rx and tx doorbells
+
+// the hello
+typedef struct shm_hello_t	{
+	uint32_t		magic;
+	uint16_t		version;
+	uint16_t		codings;					// bit per coding wanted
+} SHM_HELLO;
+
+// one frame
+typedef struct shm_slot_t	{
+	uint32_t		length;						// bytes in data
+	uint8_t			data[SHM_SLOT_LEN];			// SPI header and payload
+} SHM_SLOT;
+
+// one direction: head and tail on their own cache lines
+typedef struct shm_ring_t	{
+	_Alignas(SHM_CACHE_LINE) atomic_uint	head;	// producer: next to fill
+	_Alignas(SHM_CACHE_LINE) atomic_uint	tail;	// consumer: next to take
+	_Alignas(SHM_CACHE_LINE) uint32_t		nDrops;	// producer: ring was full
+	SHM_SLOT		slots[SHM_RING_SLOTS];
+} SHM_RING;
+
+// the shared region
+typedef struct shm_region_t	{
+	uint32_t		magic;
+	uint32_t		version;
+	SHM_RING		rx;							// daemon to application
+	SHM_RING		tx;							// application to daemon
+} SHM_REGION;
+
+/*
+ * Producer: the next free slot, or NULL if the ring is full
+ */
+static inline SHM_SLOT *shmRingSlot(SHM_RING *ring)
+{
+	unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if((head - tail) >= SHM_RING_SLOTS)
+		return NULL;
+	return &ring->slots[head & SHM_RING_MASK];
+}
+
+// producer: the slot is filled
+static inline void shmRingCommit(SHM_RING *ring)
+{
+	unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	atomic_store_explicit(&ring->head, head+1, memory_order_release);
+}
+
+/*
+ * Consumer: the oldest frame, or NULL if there is none
+ */
+static inline SHM_SLOT *shmRingPeek(SHM_RING *ring)
+{
+	unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if(head == tail)
+		return NULL;
+	return &ring->slots[tail & SHM_RING_MASK];
+}
+
+// consumer: done with the oldest frame
+static inline void shmRingRelease(SHM_RING *ring)
+{
+	unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	atomic_store_explicit(&ring->tail, tail+1, memory_order_release);
+}
+
+#endif /* INCLUDE_SHMRING_H_ */
@@ -0,0 +1,89 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        spiclock.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for SPI clock tuning
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_SPICLOCK_H_
+#define INCLUDE_SPICLOCK_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+/*
+ * Clock tuning. Once exchanges are checked and the node echoes
+ * test frames, the clock is stepped up from SPI_SPEED, with
+ * SPI_TUNE_TESTS full length test frames at each step. Tuning
+ * stops at the first step where an exchange fails its check,
+ * or an echo is lost or comes back different, or at the
+ * highest rate asked for. Either way the clock is then set
+ * SPI_TUNE_MARGIN steps below the highest rate that passed,
+ * but not below SPI_SPEED if that passed. After that,
+ * SPI_BACKOFF_ERRORS bad exchanges within SPI_BACKOFF_WINDOW
+ * take it down a step, as far as SPI_SLOW_SPEED, and
+ * SPI_STEPUP_WINDOWS clean windows in a row take it back up
+ * a step, no higher than it was tuned to. A step up that is
+ * backed off again doubles the clean windows needed for the
+ * next, up to SPI_STEPUP_MAX. Without tuning the clock stays
+ * at SPI_SPEED until errors take it down.
+ */
+#define	SPI_TUNE_TESTS		16				// test frames per step
+#define	SPI_TUNE_WAIT		32				// exchanges to wait for an echo
+#define	SPI_TUNE_MARGIN		1				// steps below the highest that passed
+#define	SPI_BACKOFF_ERRORS	3				// bad exchanges to back off
+#define	SPI_BACKOFF_WINDOW	1000			// in this many exchanges
+#define	SPI_STEPUP_WINDOWS	30				// clean windows to step back up
+#define	SPI_STEPUP_MAX		960				// most, after failed step ups
+
+// how a checked exchange went
+typedef enum	{
+	SPI_LINK_OK=0,							// passed
+	SPI_LINK_EYE,							// header without the eye
+	SPI_LINK_CRC,							// failed the CRC
+	SPI_LINK_SEQ							// an exchange went missing
+} SPI_LINK_RESULT;
+
+// clock stats
+typedef struct spi_clock_stats_t	{
+	uint32_t		clockHz;				// now
+	uint32_t		maxHz;					// highest to tune to, 0 if not
+	BOOL			tuning;					// stepping up now
+	BOOL			tuned;					// done
+	uint32_t		nChecked;				// checked exchanges
+	uint32_t		nEyeErrors;				// without the eye
+	uint32_t		nCheckErrors;			// failed the CRC
+	uint32_t		nSeqErrors;				// exchanges missing
+	uint32_t		nBackoffs;				// steps down for errors
+	uint32_t		nStepUps;				// steps back up after clean windows
+	uint32_t		nTests;					// test frames sent
+	uint32_t		nTestFails;				// lost or damaged
+} SPI_CLOCK_STATS;
+
+// functions
+void spiClockInit(int device, uint32_t maxHz);
+void spiClockLinkUp(BOOL canEcho);
+void spiClockLinkDown(void);
+BOOL spiClockTuning(void);
+BOOL spiClockTestDue(void);
+uint16_t spiClockTest(uint8_t *data);
+void spiClockEcho(uint8_t *data, uint16_t length);
+void spiClockExchange(SPI_LINK_RESULT result);
+void spiClockGetStats(SPI_CLOCK_STATS *stats);
+
+#endif /* INCLUDE_SPICLOCK_H_ */
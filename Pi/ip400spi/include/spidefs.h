@@ -45,6 +45,7 @@ enum {
 	SPI_1_0,			// SPI device 1 CS 0
 	SPI_1_1,			// SPI device 1 CS 1
 	SPI_1_2,			// SPI device 1 CS 2
+	SPI_EMU,			// node emulator
 	N_SPI				// number of SPI devices
 };
 
@@ -53,8 +54,11 @@ enum {
 #define   SPI_1_DEV_0       "/dev/spidev1.0"
 #define   SPI_1_DEV_1       "/dev/spidev1.1"
 #define   SPI_1_DEV_2       "/dev/spidev1.2"
-#define   SPI_SPEED         500000
-#define   SPI_SLOW_SPEED    100000
+#define   SPI_EMU_PREFIX    "emu:"			// emu:path is the node emulator's socket
+#define   SPI_EMU_SOCKET    "/tmp/ip400emu.sock"
+#define   SPI_EMU_TIMEOUT   1000			// ms to wait for the emulator
+#define   SPI_SPEED         500000			// until tuned
+#define   SPI_SLOW_SPEED    100000			// slowest the clock is backed off to
 #define	  SPI_NBITS	    	8				// All Spi's are 8 bits
 #define   SPI_RESET_COUNT   10				// number of times to hold spi reset
 
@@ -63,19 +67,117 @@ enum {
 #define   SPI_REG_INVALID   -1              // invalid register called
 
 // new def's imported from node code
-#define	SPI_BUFFER_LEN		400		// 400 bytes/transfer
+#define	SPI_BUFFER_LEN		500		// 500 bytes/transfer: same as the node
 #define	SPI_RAW_LEN			SPI_BUFFER_LEN + sizeof(struct spi_hdr_t)
 
 // status values
 enum {
 	NO_FRAME=0,				// no frame data to process
 	SINGLE_FRAME,			// single frame
-	FRAME_FRAGMENT,			// fragment
+	FIRST_FRAGMENT,			// first fragment
+	MIDDLE_FRAGMENT,		// middle fragment
 	LAST_FRAGMENT,			// last fragment
 	N_FRAGS					// number of frags
 };
 
+// status byte fields
+#define	SPI_STATUS_MASK		0x07	// frame status
+#define	SPI_CAP_PACKED		0x08	// NO_FRAME only: sender accepts packed frames
+#define	SPI_CAP_VARLEN		0x10	// NO_FRAME only: sender can do header first
+#define	SPI_CAP_CREDIT		0x20	// NO_FRAME only: length field is a credit grant
+#define	SPI_CREDIT_REQ		0x40	// NO_FRAME only: sender is out of credit
+#define	SPI_BUSY			0x80	// sender has more to send
+
+/*
+ * Packed frames: several complete frames in one exchange.
+ * The payload is a series of sub-records, each a 2 byte
+ * length (msb first) followed by an SPI header and its data.
+ * Only sent once the node has set SPI_CAP_PACKED in a NO_FRAME
+ * header, which also carries its max packed payload in the
+ * offset field.
+ */
+#define	PACKED_FRAME		7		// status: packed sub-records
+#define	SPI_PACK_LEN_SIZE	sizeof(uint16_t)
+#define	SPI_PACK_REC_HDR	(SPI_PACK_LEN_SIZE + sizeof(struct spi_hdr_t))
+
+/*
+ * Header first exchanges: each exchange starts with just the
+ * headers, whose length fields give the payload each end will
+ * send (zero for NO_FRAME). Then exactly the larger of the two
+ * is clocked, or nothing at all when both are idle.
+ * Both ends start with full length exchanges, and switch
+ * after the first one where both idle headers had SPI_CAP_VARLEN.
+ */
+#define	SPI_HDR_LEN			sizeof(struct spi_hdr_t)
+#define	SPI_PHASE_DELAY		100		// us between header and payload: node re-arms its DMA
+#define	SPI_VARLEN_ERRORS	10		// bad headers in a row before going back to full length
+
+/*
+ * Batched exchanges: while either end has a backlog, several
+ * transfers go to the driver in one SPI_IOC_MESSAGE(n), chip
+ * select toggled and a gap between each for the node to re-arm
+ * its DMA. Full length exchanges are composed ahead and run up
+ * to SPI_BATCH_MAX at a time; header first ones chain each
+ * payload with the next header. spidev limits the bytes in one
+ * message to its bufsiz parameter.
+ * The gap covers the node's ISR between transfers, estimated for
+ * its 64 MHz Cortex-M0+ as no hardware was to hand to measure it:
+ *	SwapTxBuffers/SealTrailer CRC-16, table driven,
+ *	about 12 cycles a byte over 524 bytes		6300 cycles
+ *	pool alloc, enqueFrame, the rx trailer		 700 cycles
+ *	IRQ entry, HAL callback, StartSPIExchange	2500 cycles
+ * about 9500 cycles, 150 us, rounded up. Never less than the
+ * SPI_PHASE_DELAY the node gets between header and payload.
+ */
+#define	SPI_BATCH_MAX		8		// exchanges per SPI task run
+#define	SPI_BATCH_GAP		200		// us between chained transfers: the node re-arms in its ISR
+#define	SPI_BATCH_START		2		// first guess at the node's backlog, exchanges
+#define	SPIDEV_BUFSIZ		"/sys/module/spidev/parameters/bufsiz"
+#define	SPIDEV_BUFSIZ_DEF	4096	// bytes per message if it cannot be read
+
+#if	SPI_BATCH_GAP < SPI_PHASE_DELAY
+#error "SPI_BATCH_GAP must give the node at least SPI_PHASE_DELAY"
+#endif
+
+/*
+ * Checked exchanges: once both idle headers that switch to
+ * header first also carry SPI_XCAP_CHECK, every exchange has a
+ * payload phase SPI_CHECK_LEN longer than the larger payload.
+ * Each end puts a trailer straight after the payload: its own
+ * exchange count, a spare byte, and a CRC-16 (CCITT, msb first)
+ * of its header, its own payload and those two bytes. An
+ * exchange that fails the check is dropped whole. The extra
+ * caps are in the coding field of idle headers, which a frame
+ * coding never reaches. A node with SPI_XCAP_ECHO sends each
+ * TEST_FRAME back as it came, for tuning the clock.
+ */
+#define	SPI_CHECK_LEN		4		// trailer: count, spare, CRC
+#define	SPI_CHECK_INIT		0xFFFF	// CRC preset
+#define	SPI_CHECK_POLY		0x1021	// CCITT polynomial
+#define	SPI_XCAPS_MARK		0xA0	// NO_FRAME coding: the rest are extra caps
+#define	SPI_XCAPS_MASK		0xF0
+#define	SPI_XCAP_CHECK		0x01	// sender can do checked exchanges
+#define	SPI_XCAP_ECHO		0x02	// sender echoes test frames
+#define	TEST_FRAME			6		// status: test pattern, to be echoed
+
+/*
+ * Credit flow control: the length field of an idle header with
+ * SPI_CAP_CREDIT is the number of payload bytes the sender will
+ * take. Frames are only sent while they fit; a sender out of
+ * credit sets SPI_CREDIT_REQ and the peer answers with a grant.
+ * A request is answered once for each change in the grant:
+ * the answer goes ahead of frames, but the same grant again
+ * does not, so frames the peer has room for are not held up
+ * behind it. A sender asks once, then again only when the grant
+ * it sees changes, so two peers out of credit do not trade idle
+ * headers for ever.
+ * Our grant is the free space in the UDP socket send buffer.
+ */
+#define	SPI_CREDIT_MAX		0xFFFF	// largest grant
+#define	SPI_GRANT_NONE		(SPI_CREDIT_MAX+1)	// no request answered yet
+
 #define		PAYLOAD_MAX		1053	// max frame payload
+#define		SPI_REASM_MAX	(4*PAYLOAD_MAX)	// largest reassembled frame: four fragments over the air
 
 // SPI frame header
 struct spi_hdr_t	{
@@ -98,11 +200,35 @@ struct spi_hdr_t	{
 typedef union	{
 	struct {
 		struct spi_hdr_t	hdr;		// header
-		uint8_t	buffer[SPI_BUFFER_LEN];
+		uint8_t	buffer[SPI_BUFFER_LEN + SPI_CHECK_LEN];	// and room for a trailer
 	} spiData;
-	uint8_t	rawData[SPI_RAW_LEN];
+	uint8_t	rawData[SPI_RAW_LEN + SPI_CHECK_LEN];
 } SPI_BUFFER;
 
+// one transfer of several done together
+typedef struct spi_xfer_t	{
+	SPI_WORD		*txdata;
+	SPI_WORD		*rxdata;
+	int				length;
+	uint16_t		gap;				// us after it, before the next
+} SPI_XFER;
+
+/*
+ * SPI transports: spidev for the HAT, or a unix socket to the
+ * node emulator, which answers each transfer with as many
+ * bytes as it was sent, so the daemon can run without a node
+ */
+typedef struct spi_transport_t	{
+	char			*name;
+	int				(*open)(int device);
+	int				(*transfer)(int device, SPI_WORD *txdata, SPI_WORD *rxdata, int length);
+	int				(*transferv)(int device, SPI_XFER *xfers, int nXfers);
+	int				(*close)(int device);
+} SPI_TRANSPORT;
+
+extern SPI_TRANSPORT spidevTransport;
+extern SPI_TRANSPORT emuTransport;
+
 // SPI struct
 typedef struct spi_config_t	{
 	uint8_t		 	mode;				// mode
@@ -110,24 +236,51 @@ typedef struct spi_config_t	{
 	uint32_t	 	speed;				// speed
 	int				fd;					// file descriptor
 	uint8_t			debug;				// debug
+	SPI_TRANSPORT	*transport;			// how to reach it
+	uint32_t		maxMessage;			// bytes in one batch, 0 if no limit
 } SPI_CONFIG;
 
+extern char *devnames[N_SPI];
+extern SPI_CONFIG spi_config[N_SPI];
+
 // SPI data frame
 typedef struct spi_data_frame_t	{
 	void			*buffer;			// data buffer
 	uint16_t		length;				// length
 } SPI_DATA_FRAME;
 
+// SPI task: the tx ring and credit
+typedef struct spi_stats_t	{
+	uint32_t		txSlots;			// frames the ring holds
+	uint32_t		txDepth;			// frames waiting for the node
+	uint32_t		txHighWater;		// most there have been
+	uint32_t		txPut;				// frames queued
+	uint32_t		txDrops;			// ring full
+	uint32_t		txTooLong;			// longer than a slot
+	uint32_t		txExhausted;		// times every slot was in use
+	uint32_t		peerCredit;			// bytes the node will take
+	uint32_t		creditStalls;		// frames held back for credit
+	uint32_t		creditRequests;		// grants asked for by the node
+	BOOL			headerFirst;		// header first exchanges
+	BOOL			linkChecked;		// exchanges carry a CRC
+} SPI_STATS;
+
 //  SPI task
 int spi_lookup(char *devName);
-BOOL spiTaskInit(int spiDev);
+BOOL spiTaskInit(int spiDev, unsigned txSlots);
 void spiTask(void);
+BOOL spiPending(void);
+uint32_t spiTxRoom(void);
+void spiDeliver(void *data, uint16_t length);
+void spiGetStats(SPI_STATS *stats);
 
 // SPI functions
 void spi_setup(int device, uint8_t spiMode, uint8_t spibitsPerWord, int spiSpeed, uint8_t debug);
 int spi_open(int device);
 int spi_close(int device);
 int spi_fdtransfer(int device, SPI_WORD *txdata, SPI_WORD *rxdata, int length);
+int spi_fdtransferv(int device, SPI_XFER *xfers, int nXfers);
+void spi_setspeed(int device, uint32_t speed);
 int spi_hdread(int fd, uint8_t *data, uint16_t length);
 int spi_hdwrite(int fd, uint8_t *data, uint16_t length);
 
@@ -135,9 +288,25 @@ int spi_hdwrite(int fd, uint8_t *data, uint16_t length);
 BOOL EnqueSPIFrame(void *spiFrame);
 BOOL isIP400Frame(uint8_t *eye);
 
+// UDP batching: calls made against frames moved
+typedef struct udp_stats_t	{
+	uint32_t		nRxCalls;			// recvmmsg calls
+	uint32_t		nRxFrames;			// datagrams received
+	uint32_t		nTxCalls;			// sendmmsg calls
+	uint32_t		nTxFrames;			// datagrams sent
+	uint32_t		nTxDrops;			// failed or too long
+	uint32_t		nUnsubscribed;		// frames no one wanted
+} UDP_STATS;
+
 // UDP stuff
 BOOL setup_udp_socket(char *hostname, int hostport, int localport, int debug);
+BOOL udp_multicast_if(char *ifAddr);
 BOOL send_udp_packet(void *data, uint16_t length);
+void close_udp_socket(void);
+void udp_flush(void);
+void udp_get_stats(UDP_STATS *stats);
+uint32_t udp_tx_room(void);
+void udp_rx_resume(void);
 
 #endif
 
@@ -0,0 +1,82 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        subs.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for UDP subscribers
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_SUBS_H_
+#define INCLUDE_SUBS_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "types.h"
+#include "spidefs.h"
+
+/*
+ * Frames from the node go to every subscriber whose filter
+ * matches the SPI header: a set of codings, and optionally a
+ * callsign that must be the source or destination. Subscribers
+ * come from the -n/-p host, a file of lines
+ *		host port codings [callsign]
+ * where codings is * or a list such as 0,2,4, or from a text
+ * datagram sent to our port:
+ *		SUB codings [callsign]	- subscribe the sender
+ *		UNSUB					- and unsubscribe
+ * which must be repeated within SUBS_EXPIRE seconds to stay
+ * subscribed. A multicast group can be a subscriber: frames to
+ * it go out with a TTL of SUBS_MCAST_TTL, so they stay on the
+ * local network, from the interface given with -i, else the one
+ * the kernel routes the group to. Control
+ * datagrams are only taken from the loopback, or a network
+ * given as address/bits, and cannot change a subscriber from
+ * the command line or the file.
+ */
+#define	SUBS_MAX			16					// subscribers
+#define	SUBS_EXPIRE			300					// seconds a datagram subscription lasts
+#define	SUBS_MCAST_TTL		1					// hops for frames to a multicast group
+#define	SUBS_ALL_CODINGS	0xFFFF				// one bit per coding
+#define	SUBS_CODING_MASK	0x0F				// codings are 4 bits
+#define	SUBS_CMD_SUB		"SUB"
+#define	SUBS_CMD_UNSUB		"UNSUB"
+#define	SUBS_LOOPBACK_NET	0x7F000000			// 127.0.0.0/8
+#define	SUBS_LOOPBACK_MASK	0xFF000000
+
+// a subscriber
+typedef struct subscriber_t	{
+	BOOL				inUse;					// slot in use
+	struct sockaddr_in	addr;					// where to send
+	uint16_t			codings;				// bit per coding wanted
+	BOOL				hasCall;				// filter on a callsign
+	uint8_t				call[N_CALL];			// compressed
+	BOOL				permanent;				// from the command line or file
+	time_t				expires;				// else when it lapses
+	uint32_t			nFrames;				// frames sent to it
+} SUBSCRIBER;
+
+// functions
+void subsInit(void);
+BOOL subsAdd(struct sockaddr_in *addr, uint16_t codings, char *call, BOOL permanent);
+BOOL subsLoad(char *fileName);
+BOOL subsControlNet(char *netSpec);
+BOOL subsControl(char *msg, int length, struct sockaddr_in *from);
+int subsMatch(struct spi_hdr_t *hdr, struct sockaddr_in *dests, int maxDests);
+void subsLog(void);
+
+#endif /* INCLUDE_SUBS_H_ */
@@ -7,7 +7,7 @@
 
         Creation Date:    Mar. 6, 2025
 
-        Description:      Definitions for the timer and associated tasks
+        Description:      Timing definitions
 
                           This program is free software: you can redistribute it and/or modify
                           it under the terms of the GNU General Public License as published by
@@ -30,9 +30,5 @@
 #define	MSTOUS(x)	((int)x*(int)1000)
 #define	MSTONS(x)	((long long)x*(long long)1000000)
 
-// functions
-BOOL startTimer(int interval, void (*exec_function)(void));
-void stopTimer(void);
-
 
 #endif /* INCLUDE_TIMER_H_ */
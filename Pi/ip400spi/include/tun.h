@@ -0,0 +1,73 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        tun.h
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Definitions for the TUN interface
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+
+#ifndef INCLUDE_TUN_H_
+#define INCLUDE_TUN_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "spidefs.h"
+
+/*
+ * TUN mode: IPv4 packets on a tun interface go to the mesh as
+ * IP encapsulated frames, and IP frames from the mesh are written
+ * back to it. Addresses are the node's VPN addresses, 172.16/12:
+ * the second octet comes from the callsign, the last two from the
+ * VPN field. The table of callsign and VPN for each address is
+ * learned from beacons and from IP frames as they arrive.
+ * Given as name,callsign,address, e.g. ip400,VE6XYZ,172.20.1.2
+ */
+#define	TUN_MTU				PAYLOAD_MAX			// largest packet
+#define	TUN_PEERS			64					// addresses learned
+#define	TUN_PEER_AGE		1800				// seconds before one is forgotten
+#define	TUN_RX_BURST		16					// packets read per wakeup
+#define	TUN_NETMASK			0xFFF00000			// 172.16/12
+#define	TUN_NETWORK			0xAC100000
+
+// codings, as the node sends them
+#define	TUN_CODING_BEACON	2					// beacon
+#define	TUN_CODING_IP		4					// IP encapsulated
+
+// flags in the header flags byte: what comes before the payload
+#define	TUN_FLAG_HOPTABLE	0x10				// hop table
+#define	TUN_FLAG_SRCEXT		0x20				// source call extension
+#define	TUN_FLAG_DESTEXT	0x40				// dest call extension
+#define	TUN_HOPTABLE_SIZE	16					// two calls and their flags
+
+// TUN stats
+typedef struct tun_stats_t	{
+	uint32_t		nTxPackets;				// packets to the mesh
+	uint32_t		nRxPackets;				// packets from the mesh
+	uint32_t		nNoRoute;				// no callsign for the address
+	uint32_t		nTxDrops;				// too long or no room
+	uint32_t		nRxDrops;				// not IPv4 or could not write
+	uint32_t		nLearned;				// addresses learned
+} TUN_STATS;
+
+// functions
+BOOL tunOpen(char *tunSpec);
+void tunClose(void);
+BOOL tunDeliver(uint8_t *frame, uint16_t length);
+void tun_rx_resume(void);
+void tunGetStats(TUN_STATS *stats);
+
+#endif /* INCLUDE_TUN_H_ */
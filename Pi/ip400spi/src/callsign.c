@@ -0,0 +1,88 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        callsign.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Callsign compression, as the node does it
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "types.h"
+#include "callsign.h"
+
+// callsign alphabet, as the node has it
+static const char alphabet[RADIX_40+1] = "0123456789 ABCDEFGHIJKLMNOPQRSTUVWXYZ()-";
+
+/*
+ * Compress a callsign of up to 6 characters,
+ * space padded, radix 40
+ */
+BOOL encodeCall(char *call, uint8_t *enc)
+{
+	uint32_t chunk = 0;
+	int len = strlen(call);
+
+	if((len == 0) || (len > MAX_CALL))
+		return FALSE;
+
+	for(int i=0;i<MAX_CALL;i++)	{
+		char c = (i < len) ? call[i] : ' ';
+		if(islower(c))
+			c = toupper(c);
+		char *pos = strchr(alphabet, c);
+		chunk = (chunk * RADIX_40) + ((pos == NULL) ? 0 : (uint32_t)(pos - alphabet));
+	}
+
+	// little endian, as the node stores it
+	for(int i=0;i<N_CALL;i++)
+		enc[i] = (uint8_t)(chunk >> (8*i));
+	return TRUE;
+}
+
+/*
+ * And back: up to 6 characters, trailing spaces
+ * removed. FALSE if it is not a radix 40 callsign
+ */
+BOOL decodeCall(uint8_t *enc, char *call)
+{
+	uint32_t chunk = 0;
+	int len = MAX_CALL;
+
+	for(int i=0;i<N_CALL;i++)
+		chunk |= (uint32_t)enc[i] << (8*i);
+	if(chunk >= (uint32_t)RADIX_40*RADIX_40*RADIX_40*RADIX_40*RADIX_40*RADIX_40)
+		return FALSE;
+
+	for(int i=MAX_CALL-1;i>=0;i--)	{
+		call[i] = alphabet[chunk % RADIX_40];
+		chunk /= RADIX_40;
+	}
+	while((len > 0) && (call[len-1] == ' '))
+		len--;
+	call[len] = '\0';
+	return TRUE;
+}
+
+// the broadcast call: all ones
+BOOL isBroadcastCall(uint8_t *call)
+{
+	for(int i=0;i<N_CALL;i++)
+		if(call[i] != BROADCAST_CALL)
+			return FALSE;
+	return TRUE;
+}
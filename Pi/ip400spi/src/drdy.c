@@ -0,0 +1,220 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        drdy.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Node data ready line. Instead of polling the node
+                          at a fixed rate, wait for it to raise the line, then
+                          exchange back to back while it has data, falling back
+                          to a slow poll when it is idle. A frame queued from
+                          UDP brings the next exchange forward as well.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "types.h"
+#include "logger.h"
+#include "reactor.h"
+#include "drdy.h"
+
+// locals
+static int drdyFD = -1;				// line request or stand-in fd
+static BOOL standIn;				// fd stand-in for the line
+static BOOL lineHigh;				// last known level
+static void (*drdyExec)(void);		// exchange function
+static BOOL (*drdyPending)(void);	// more to exchange
+
+// stats
+static uint32_t nEdges;				// rising edges seen
+static uint32_t nWakes;				// brought forward by a queued frame
+static uint32_t nPolls;				// idle polls
+static uint32_t nBackToBack;		// exchanges straight after another
+
+// request a line from a gpiochip: input, both edges
+static int openGpioLine(char *chip, int line)
+{
+	struct gpio_v2_line_request req;
+	struct gpio_v2_line_values values;
+
+	int chipFD = open(chip, O_RDONLY);
+	if(chipFD == -1)	{
+		logger(LOG_ERROR, "Cannot open %s: %s\n", chip, strerror(errno));
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = line;
+	req.num_lines = 1;
+	strncpy(req.consumer, DRDY_CONSUMER, sizeof(req.consumer)-1);
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+	int rc = ioctl(chipFD, GPIO_V2_GET_LINE_IOCTL, &req);
+	close(chipFD);
+	if(rc == -1)	{
+		logger(LOG_ERROR, "Cannot request line %d on %s: %s\n", line, chip, strerror(errno));
+		return -1;
+	}
+
+	// starting level
+	memset(&values, 0, sizeof(values));
+	values.mask = 1;
+	if(ioctl(req.fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) != -1)
+		lineHigh = (values.bits & 1) ? TRUE : FALSE;
+
+	return req.fd;
+}
+
+/*
+ * Open the line given as chip:line, or a FIFO standing in for it
+ */
+BOOL drdyOpen(char *lineSpec)
+{
+	char chip[100];
+	int line;
+
+	lineHigh = FALSE;
+	nEdges = nWakes = nPolls = nBackToBack = 0;
+
+	char *sep = strrchr(lineSpec, ':');
+	if((strncmp(lineSpec, "/dev/gpiochip", 13) == 0) && (sep != NULL))	{
+		snprintf(chip, sizeof(chip), "%.*s", (int)(sep - lineSpec), lineSpec);
+		sscanf(sep+1, "%d", &line);
+		standIn = FALSE;
+		drdyFD = openGpioLine(chip, line);
+	} else {
+		// read-write keeps a FIFO open with no writer
+		standIn = TRUE;
+		if((drdyFD = open(lineSpec, O_RDWR | O_NONBLOCK)) == -1)
+			logger(LOG_ERROR, "Cannot open %s: %s\n", lineSpec, strerror(errno));
+	}
+
+	if(drdyFD == -1)
+		return FALSE;
+
+	// reads drain the line events without waiting
+	if(!standIn)
+		fcntl(drdyFD, F_SETFL, fcntl(drdyFD, F_GETFL) | O_NONBLOCK);
+
+	logger(LOG_NOTICE, "Data ready on %s%s\n", lineSpec, standIn ? " (stand-in)" : "");
+	return TRUE;
+}
+
+// read what the line has done since last time
+static void readLine(void)
+{
+	if(standIn)	{
+		char levels[32];
+		int n;
+		while((n = read(drdyFD, levels, sizeof(levels))) > 0)	{
+			for(int i=0;i<n;i++)	{
+				if(levels[i] == '1')	{
+					if(!lineHigh)
+						nEdges++;
+					lineHigh = TRUE;
+				} else if(levels[i] == '0')	{
+					lineHigh = FALSE;
+				}
+			}
+		}
+		return;
+	}
+
+	struct gpio_v2_line_event event;
+	while(read(drdyFD, &event, sizeof(event)) == sizeof(event))	{
+		if(event.id == GPIO_V2_LINE_EVENT_RISING_EDGE)	{
+			nEdges++;
+			lineHigh = TRUE;
+		} else {
+			lineHigh = FALSE;
+		}
+	}
+}
+
+// the line changed: exchange now if it went high
+static void drdyEvent(int fd, uint32_t events, void *arg)
+{
+	readLine();
+	if(lineHigh)
+		reactorNextTick(0);
+}
+
+/*
+ * Each tick runs the exchange function, then the next one
+ * follows straight on while the line is high or there is
+ * more to do. Otherwise it waits for the line, a queued
+ * frame or the idle poll
+ */
+static void drdyTick(void)
+{
+	(*drdyExec)();
+	readLine();
+
+	if(lineHigh || (*drdyPending)())	{
+		nBackToBack++;
+		reactorNextTick(DRDY_GAP);
+	} else {
+		nPolls++;
+	}
+}
+
+/*
+ * Start exchanging on the line
+ */
+BOOL drdyStart(void (*exec_function)(void), BOOL (*pending)(void))
+{
+	drdyExec = exec_function;
+	drdyPending = pending;
+
+	if(!reactorAdd(drdyFD, drdyEvent, NULL))
+		return FALSE;
+
+	return reactorStartTick(DRDY_IDLE_POLL, drdyTick);
+}
+
+/*
+ * Done: say how it went
+ */
+void drdyClose(void)
+{
+	if(drdyFD == -1)
+		return;
+
+	logger(LOG_NOTICE, "Data ready: %u edges, %u wakes, %u idle, %u back to back\n",
+			nEdges, nWakes, nPolls, nBackToBack);
+	reactorRemove(drdyFD);
+	close(drdyFD);
+	drdyFD = -1;
+}
+
+/*
+ * A frame has been queued: exchange now
+ * rather than at the next idle poll
+ */
+void drdyWake(void)
+{
+	if(drdyFD == -1)
+		return;
+
+	nWakes++;
+	reactorNextTick(0);
+}
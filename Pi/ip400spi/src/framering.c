@@ -0,0 +1,177 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        framering.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Bounded lock-free ring of frames, many producers
+                          to one consumer. Frames are copied into preallocated
+                          slots, so the UDP side never allocates and a burst
+                          can only ever use the ring's fixed memory.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "types.h"
+#include "framering.h"
+
+/*
+ * Allocate at least nSlots, rounded up to a power of 2.
+ * Slot i starts with sequence i: free for the producer at
+ * position i. Filled, it becomes i+1: ready for the consumer.
+ * Taken, it becomes i+nSlots: free for the next lap. With one
+ * slot, filled and free for the next lap would look the same,
+ * so there are always at least two
+ */
+BOOL ringInit(FRAME_RING *ring, unsigned nSlots)
+{
+	if((nSlots == 0) || (nSlots > FRAME_RING_MAX))
+		return FALSE;
+
+	ring->nSlots = 2;
+	while(ring->nSlots < nSlots)
+		ring->nSlots <<= 1;
+	ring->mask = ring->nSlots - 1;
+
+	// every page is touched here, not on the first busy burst
+	if((ring->slots = malloc(ring->nSlots * sizeof(FRAME_SLOT))) == NULL)
+		return FALSE;
+	memset(ring->slots, 0, ring->nSlots * sizeof(FRAME_SLOT));
+
+	for(unsigned i=0;i<ring->nSlots;i++)	{
+		atomic_init(&ring->slots[i].seq, i);
+		ring->slots[i].frame.buffer = ring->slots[i].data;
+		ring->slots[i].frame.length = 0;
+	}
+	atomic_init(&ring->putPos, 0);
+	atomic_init(&ring->takePos, 0);
+	atomic_init(&ring->nPut, 0);
+	atomic_init(&ring->nDrops, 0);
+	atomic_init(&ring->nTooLong, 0);
+	atomic_init(&ring->highWater, 0);
+	atomic_init(&ring->nExhausted, 0);
+	return TRUE;
+}
+
+void ringFree(FRAME_RING *ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+// keep the high water mark
+static void noteDepth(FRAME_RING *ring, unsigned depth)
+{
+	unsigned high = atomic_load_explicit(&ring->highWater, memory_order_relaxed);
+	while(depth > high)	{
+		if(atomic_compare_exchange_weak_explicit(&ring->highWater, &high, depth,
+				memory_order_relaxed, memory_order_relaxed))
+			break;
+	}
+}
+
+/*
+ * Copy a frame into the ring. Safe from any thread.
+ * Returns FALSE if it is full or the frame is too long
+ */
+BOOL ringPut(FRAME_RING *ring, void *data, uint16_t length)
+{
+	FRAME_SLOT *slot;
+
+	if(length > FRAME_SLOT_LEN)	{
+		atomic_fetch_add_explicit(&ring->nTooLong, 1, memory_order_relaxed);
+		return FALSE;
+	}
+
+	// claim a slot
+	unsigned pos = atomic_load_explicit(&ring->putPos, memory_order_relaxed);
+	for(;;)	{
+		slot = &ring->slots[pos & ring->mask];
+		unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		int diff = (int)(seq - pos);
+
+		if(diff == 0)	{
+			if(atomic_compare_exchange_weak_explicit(&ring->putPos, &pos, pos+1,
+					memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if(diff < 0)	{
+			// not yet taken on the last lap: full
+			atomic_fetch_add_explicit(&ring->nDrops, 1, memory_order_relaxed);
+			return FALSE;
+		} else {
+			// another producer got there first
+			pos = atomic_load_explicit(&ring->putPos, memory_order_relaxed);
+		}
+	}
+
+	// fill it, then publish
+	memcpy(slot->data, data, length);
+	slot->frame.length = length;
+	atomic_store_explicit(&slot->seq, pos+1, memory_order_release);
+
+	atomic_fetch_add_explicit(&ring->nPut, 1, memory_order_relaxed);
+	unsigned depth = pos + 1 - atomic_load_explicit(&ring->takePos, memory_order_relaxed);
+	if(depth >= ring->nSlots)
+		atomic_fetch_add_explicit(&ring->nExhausted, 1, memory_order_relaxed);
+	noteDepth(ring, depth);
+	return TRUE;
+}
+
+/*
+ * The oldest frame, left in the ring until released.
+ * Consumer only. Returns NULL if there is none
+ */
+SPI_DATA_FRAME *ringPeek(FRAME_RING *ring)
+{
+	unsigned pos = atomic_load_explicit(&ring->takePos, memory_order_relaxed);
+	FRAME_SLOT *slot = &ring->slots[pos & ring->mask];
+
+	if(atomic_load_explicit(&slot->seq, memory_order_acquire) != (pos+1))
+		return NULL;
+
+	return &slot->frame;
+}
+
+/*
+ * Done with the oldest frame: free its slot. Consumer only
+ */
+void ringRelease(FRAME_RING *ring)
+{
+	unsigned pos = atomic_load_explicit(&ring->takePos, memory_order_relaxed);
+	FRAME_SLOT *slot = &ring->slots[pos & ring->mask];
+
+	if(atomic_load_explicit(&slot->seq, memory_order_acquire) != (pos+1))
+		return;
+
+	atomic_store_explicit(&ring->takePos, pos+1, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, pos + ring->nSlots, memory_order_release);
+}
+
+// frames waiting
+uint32_t ringDepth(FRAME_RING *ring)
+{
+	unsigned put = atomic_load_explicit(&ring->putPos, memory_order_relaxed);
+	unsigned take = atomic_load_explicit(&ring->takePos, memory_order_relaxed);
+	return put - take;
+}
+
+// no room for another frame
+BOOL ringFull(FRAME_RING *ring)
+{
+	return (ringDepth(ring) >= ring->nSlots) ? TRUE : FALSE;
+}
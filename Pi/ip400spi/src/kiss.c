@@ -0,0 +1,575 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        kiss.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      KISS TCP server. Data frames from AX.25 applications
+                          go to the node as AX.25 frames, as its own KISS port
+                          would send them, and AX.25 frames from the node go
+                          back to every application, each through a buffer
+                          of its own so a slow one holds up no other.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "types.h"
+#include "logger.h"
+#include "spidefs.h"
+#include "reactor.h"
+#include "callsign.h"
+#include "tun.h"
+#include "kiss.h"
+
+// a connected application
+struct kiss_client_t	{
+	int				fd;						// socket, -1 if free
+	uint8_t			in[KISS_READ_LEN];		// read, not yet decoded
+	uint16_t		inPos, inLen;
+	uint8_t			frame[KISS_FRAME_MAX];	// frame being decoded
+	uint16_t		frameLen;
+	BOOL			escape;					// last byte was FESC
+	BOOL			overrun;				// too long: skip to the next FEND
+	BOOL			held;					// a whole frame, waiting for room
+	BOOL			paused;					// not reading till there is room
+	uint8_t			out[KISS_OUT_LEN];		// to write
+	uint32_t		outLen;
+	uint32_t		nTx;					// frames from it
+	uint32_t		nRx;					// frames to it
+};
+
+// locals
+static struct kiss_client_t clients[KISS_MAX_CLIENTS];
+static int listenFD = -1;
+static KISS_STATS stats;
+
+// frame going to the node: header then the AX.25 payload
+static union	{
+	struct {
+		struct spi_hdr_t	hdr;
+		uint8_t		buffer[PAYLOAD_MAX];
+	} frame;
+	uint8_t			rawData[sizeof(struct spi_hdr_t) + PAYLOAD_MAX];
+} kissTxFrame;
+
+// a frame from the node, unescaped then escaped
+static uint8_t ax25Frame[1 + AX25_MIN_ADDRS*AX25_ADDR_LEN + PAYLOAD_MAX];
+static uint8_t kissFrame[2 + 2*sizeof(ax25Frame)];
+
+static void kissAccept(int fd, uint32_t events, void *arg);
+static void kissEvent(int fd, uint32_t events, void *arg);
+
+/*
+ * Bytes before the next FEND or FESC: they are copied
+ * as they are, in one go, either way
+ */
+static uint32_t kissPlain(uint8_t *data, uint32_t len)
+{
+	uint32_t n = 0;
+
+	while((n < len) && (data[n] != KISS_FEND) && (data[n] != KISS_FESC))
+		n++;
+	return n;
+}
+
+/*
+ * Escape a frame and put FENDs round it.
+ * Returns the length
+ */
+static uint32_t kissEscape(uint8_t *data, uint32_t len, uint8_t *out)
+{
+	uint32_t pos = 0, outLen = 0;
+
+	out[outLen++] = KISS_FEND;
+	while(pos < len)	{
+		uint32_t n = kissPlain(data + pos, len - pos);
+		memcpy(out + outLen, data + pos, n);
+		outLen += n;
+		pos += n;
+		if(pos == len)
+			break;
+		out[outLen++] = KISS_FESC;
+		out[outLen++] = (data[pos++] == KISS_FEND) ? KISS_TFEND : KISS_TFESC;
+	}
+	out[outLen++] = KISS_FEND;
+	return outLen;
+}
+
+// onto the frame being decoded, unless it is too long
+static void kissPut(struct kiss_client_t *c, uint8_t *data, uint32_t len)
+{
+	if(c->overrun || (c->frameLen + len > KISS_FRAME_MAX))	{
+		c->overrun = TRUE;
+		return;
+	}
+	memcpy(c->frame + c->frameLen, data, len);
+	c->frameLen += len;
+}
+
+/*
+ * Decode what a client sent, up to the end of the next
+ * frame. TRUE if there is a whole frame
+ */
+static BOOL kissUnescape(struct kiss_client_t *c)
+{
+	while(c->inPos < c->inLen)	{
+		uint8_t *data = c->in + c->inPos;
+		uint32_t len = c->inLen - c->inPos;
+
+		if(c->escape)	{
+			uint8_t b = data[0];
+			if(b == KISS_TFEND)
+				b = KISS_FEND;
+			else if(b == KISS_TFESC)
+				b = KISS_FESC;
+			kissPut(c, &b, 1);
+			c->escape = FALSE;
+			c->inPos++;
+			continue;
+		}
+
+		uint32_t n = kissPlain(data, len);
+		kissPut(c, data, n);
+		c->inPos += n;
+		if(n == len)
+			break;
+
+		c->inPos++;
+		if(data[n] == KISS_FESC)	{
+			c->escape = TRUE;
+			continue;
+		}
+
+		// FEND: the end of a frame, or fill between them
+		if(c->overrun)	{
+			stats.nTxDrops++;
+			c->overrun = FALSE;
+			c->frameLen = 0;
+			continue;
+		}
+		if(c->frameLen != 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * An AX.25 address as an IP400 callsign and VPN field,
+ * as the node's KISS port does it
+ */
+static BOOL kissToCall(uint8_t *addr, uint8_t *call, uint8_t *vpn)
+{
+	char ascii[MAX_CALL+1];
+	int len = 0;
+
+	while((len < MAX_CALL) && ((addr[len] >> 1) != ' '))	{
+		ascii[len] = addr[len] >> 1;
+		len++;
+	}
+	ascii[len] = '\0';
+
+	if(!strcmp(ascii, AX25_BROADCAST))	{
+		memset(call, BROADCAST_CALL, N_CALL);
+		memset(vpn, BROADCAST_CALL, IP_400_PORT_SIZE);
+		return TRUE;
+	}
+	if(!encodeCall(ascii, call))
+		return FALSE;
+
+	vpn[0] = AX25_VPN_LO | ((addr[AX25_ADDR_LEN-1] >> 1) & 0x0F);
+	if(addr[AX25_ADDR_LEN-1] & AX25_SSID_CH)
+		vpn[0] |= 0x10;
+	vpn[1] = AX25_VPN_HI;
+	return TRUE;
+}
+
+// and back: shifted, space padded, with the SSID
+static void kissFromCall(uint8_t *call, uint8_t *vpn, BOOL last, uint8_t *addr)
+{
+	char ascii[MAX_CALL+1];
+	int len;
+
+	if(isBroadcastCall(call))
+		strcpy(ascii, AX25_BROADCAST);
+	else if(!decodeCall(call, ascii))
+		ascii[0] = '\0';
+
+	len = strlen(ascii);
+	for(int i=0;i<MAX_CALL;i++)
+		addr[i] = (uint8_t)(((i < len) ? ascii[i] : ' ') << 1);
+
+	addr[AX25_ADDR_LEN-1] = AX25_SSID_RES | (last ? AX25_SSID_FINAL : 0);
+	if((vpn[1] == AX25_VPN_HI) && ((vpn[0] & AX25_VPN_MASK) == AX25_VPN_LO))	{
+		addr[AX25_ADDR_LEN-1] |= (vpn[0] & 0x0F) << 1;
+		if(vpn[0] & 0x10)
+			addr[AX25_ADDR_LEN-1] |= AX25_SSID_CH;
+	}
+}
+
+/*
+ * A whole frame from a client. Data frames go into the tx ring
+ * with the destination and source as the header calls; the
+ * mesh does its own routing, so any repeaters are left out
+ */
+static void kissSend(struct kiss_client_t *c)
+{
+	struct spi_hdr_t *hdr = &kissTxFrame.frame.hdr;
+	SPI_DATA_FRAME spiFrame;
+	int nAddrs = 0;
+
+	uint8_t *ax25 = c->frame + 1;
+	uint32_t len = c->frameLen - 1;
+
+	// TXDELAY and the like mean nothing here
+	if((c->frame[0] & KISS_CMD_MASK) != KISS_TYPE_DATA)	{
+		stats.nCommands++;
+		return;
+	}
+
+	while(nAddrs < AX25_MAX_ADDRS)	{
+		if((uint32_t)(nAddrs + 1) * AX25_ADDR_LEN > len)
+			break;
+		if(ax25[(nAddrs++ * AX25_ADDR_LEN) + AX25_ADDR_LEN-1] & AX25_SSID_FINAL)
+			break;
+	}
+
+	uint32_t skip = nAddrs * AX25_ADDR_LEN;
+	if((nAddrs < AX25_MIN_ADDRS) || !(ax25[skip-1] & AX25_SSID_FINAL) || (len - skip > PAYLOAD_MAX) ||
+			!kissToCall(ax25, hdr->toCall, hdr->toPort) ||
+			!kissToCall(ax25 + AX25_ADDR_LEN, hdr->fromCall, hdr->fromPort))	{
+		stats.nTxDrops++;
+		return;
+	}
+
+	len -= skip;
+	memcpy(kissTxFrame.frame.buffer, ax25 + skip, len);
+	hdr->length_hi = (uint8_t)(len >> 8);
+	hdr->length_lo = (uint8_t)(len & 0xFF);
+	spiFrame.buffer = kissTxFrame.rawData;
+	spiFrame.length = len + sizeof(struct spi_hdr_t);
+	if(!EnqueSPIFrame(&spiFrame))	{
+		stats.nTxDrops++;
+		return;
+	}
+	c->nTx++;
+	stats.nTxFrames++;
+}
+
+/*
+ * Frames from a client, while the tx ring has room. FALSE if
+ * it filled: the frame is held and reading stops till there is
+ */
+static BOOL kissRxDrain(struct kiss_client_t *c)
+{
+	for(;;)	{
+		if(!c->held && !kissUnescape(c))
+			return TRUE;
+
+		if(spiTxRoom() == 0)	{
+			c->held = TRUE;
+			if(!c->paused)	{
+				c->paused = TRUE;
+				reactorEnable(c->fd, FALSE);
+			}
+			return FALSE;
+		}
+
+		kissSend(c);
+		c->held = FALSE;
+		c->frameLen = 0;
+	}
+}
+
+/*
+ * Listen for applications on [address:]port
+ */
+BOOL kissOpen(char *kissSpec)
+{
+	char spec[100], *port;
+	char *addr = KISS_DEFAULT_ADDR;
+	struct sockaddr_in sin;
+	int on = 1;
+
+	strncpy(spec, kissSpec, sizeof(spec)-1);
+	spec[sizeof(spec)-1] = '\0';
+	if((port = strrchr(spec, ':')) != NULL)	{
+		*port++ = '\0';
+		addr = spec;
+	} else {
+		port = spec;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons((uint16_t)atoi(port));
+	if((sin.sin_port == 0) || (inet_aton(addr, &sin.sin_addr) == 0))	{
+		logger(LOG_ERROR, "KISS needs [address:]port: %s\n", kissSpec);
+		return FALSE;
+	}
+
+	for(int i=0;i<KISS_MAX_CLIENTS;i++)
+		clients[i].fd = -1;
+	memset(&stats, 0, sizeof(stats));
+
+	if((listenFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)	{
+		logger(LOG_ERROR, "Cannot create KISS socket: %s\n", strerror(errno));
+		return FALSE;
+	}
+	setsockopt(listenFD, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	if((bind(listenFD, (struct sockaddr *)&sin, sizeof(sin)) == -1) || (listen(listenFD, KISS_MAX_CLIENTS) == -1))	{
+		logger(LOG_ERROR, "Cannot listen on %s:%s: %s\n", addr, port, strerror(errno));
+		close(listenFD);
+		listenFD = -1;
+		return FALSE;
+	}
+
+	// fixed header fields
+	struct spi_hdr_t *hdr = &kissTxFrame.frame.hdr;
+	memset(hdr, 0, sizeof(struct spi_hdr_t));
+	hdr->eye[0] = 'I';
+	hdr->eye[1] = 'P';
+	hdr->eye[2] = '4';
+	hdr->eye[3] = 'C';
+	hdr->status = SINGLE_FRAME;
+	hdr->coding = AX_25_PACKET;
+
+	if(!reactorAdd(listenFD, kissAccept, NULL))	{
+		close(listenFD);
+		listenFD = -1;
+		return FALSE;
+	}
+
+	logger(LOG_NOTICE, "KISS clients on %s:%s\n", addr, port);
+	return TRUE;
+}
+
+// done with an application
+static void kissDrop(struct kiss_client_t *c)
+{
+	logger(LOG_NOTICE, "KISS client gone: %u frames from it, %u to it\n", c->nTx, c->nRx);
+
+	reactorRemove(c->fd);
+	close(c->fd);
+	c->fd = -1;
+	stats.nClients--;
+}
+
+void kissClose(void)
+{
+	if(listenFD == -1)
+		return;
+
+	for(int i=0;i<KISS_MAX_CLIENTS;i++)
+		if(clients[i].fd != -1)
+			kissDrop(&clients[i]);
+
+	logger(LOG_NOTICE, "KISS tx %u rx %u frames, %u/%u dropped, %u commands\n",
+			stats.nTxFrames, stats.nRxFrames, stats.nTxDrops, stats.nRxDrops, stats.nCommands);
+
+	reactorRemove(listenFD);
+	close(listenFD);
+	listenFD = -1;
+}
+
+// a new application
+static void kissAccept(int fd, uint32_t events, void *arg)
+{
+	int on = 1;
+
+	int conn = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(conn == -1)
+		return;
+
+	// frames are small and want to go now
+	setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	for(int i=0;i<KISS_MAX_CLIENTS;i++)	{
+		struct kiss_client_t *c = &clients[i];
+		if(c->fd != -1)
+			continue;
+		memset(c, 0, sizeof(struct kiss_client_t));
+		c->fd = conn;
+		if(!reactorAdd(conn, kissEvent, c))	{
+			c->fd = -1;
+			break;
+		}
+		stats.nClients++;
+		stats.nConnects++;
+		logger(LOG_NOTICE, "KISS client connected\n");
+		return;
+	}
+
+	logger(LOG_ERROR, "No room for a KISS client\n");
+	close(conn);
+}
+
+/*
+ * Write what is waiting for a client. Whatever the socket
+ * will not take now waits for it to say there is room.
+ * FALSE if the client is gone
+ */
+static BOOL kissWrite(struct kiss_client_t *c)
+{
+	if(c->outLen == 0)
+		return TRUE;
+
+	ssize_t n = send(c->fd, c->out, c->outLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if(n == -1)	{
+		if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))	{
+			kissDrop(c);
+			return FALSE;
+		}
+		n = 0;
+	}
+
+	c->outLen -= n;
+	if(c->outLen != 0)
+		memmove(c->out, c->out + n, c->outLen);
+	reactorEnableOutput(c->fd, (c->outLen != 0) ? TRUE : FALSE);
+	return TRUE;
+}
+
+/*
+ * Input from an application, or room to write to it:
+ * called from the event loop
+ */
+static void kissEvent(int fd, uint32_t events, void *arg)
+{
+	struct kiss_client_t *c = (struct kiss_client_t *)arg;
+
+	if((events & (EPOLLOUT | EPOLLERR)) && !kissWrite(c))
+		return;
+
+	// waiting for room: only see if it went away
+	if(c->paused)	{
+		if(events & (EPOLLHUP | EPOLLERR))
+			kissDrop(c);
+		return;
+	}
+	if(!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+		return;
+
+	for(int i=0;i<KISS_RX_BURST;i++)	{
+		ssize_t len = recv(fd, c->in, KISS_READ_LEN, 0);
+		if(len == -1)	{
+			if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				kissDrop(c);
+			return;
+		}
+		if(len == 0)	{
+			kissDrop(c);
+			return;
+		}
+
+		c->inPos = 0;
+		c->inLen = (uint16_t)len;
+		if(!kissRxDrain(c))
+			return;
+	}
+}
+
+/*
+ * Room in the tx ring again: send the frames
+ * held and carry on reading
+ */
+void kiss_rx_resume(void)
+{
+	for(int i=0;i<KISS_MAX_CLIENTS;i++)	{
+		struct kiss_client_t *c = &clients[i];
+		if((c->fd == -1) || !c->paused)
+			continue;
+		if(!kissRxDrain(c))
+			continue;
+		c->paused = FALSE;
+		reactorEnable(c->fd, TRUE);
+	}
+}
+
+/*
+ * A frame from the node: AX.25 frames go to every client,
+ * escaped once and copied into each buffer. A client whose
+ * buffer is full misses the frame
+ */
+void kissDeliver(uint8_t *frame, uint16_t length)
+{
+	struct spi_hdr_t *hdr = (struct spi_hdr_t *)frame;
+
+	if((stats.nClients == 0) || (length < sizeof(struct spi_hdr_t)) || (hdr->coding != AX_25_PACKET))
+		return;
+
+	// skip what comes before the payload
+	uint16_t skip = sizeof(struct spi_hdr_t);
+	if(hdr->flags & TUN_FLAG_SRCEXT)
+		skip += N_CALL;
+	if(hdr->flags & TUN_FLAG_DESTEXT)
+		skip += N_CALL;
+	if(hdr->flags & TUN_FLAG_HOPTABLE)
+		skip += TUN_HOPTABLE_SIZE;
+	if((length < skip) || (length - skip > PAYLOAD_MAX))	{
+		stats.nRxDrops++;
+		return;
+	}
+
+	uint16_t len = length - skip;
+	ax25Frame[0] = KISS_TYPE_DATA;
+	kissFromCall(hdr->toCall, hdr->toPort, FALSE, &ax25Frame[1]);
+	kissFromCall(hdr->fromCall, hdr->fromPort, TRUE, &ax25Frame[1 + AX25_ADDR_LEN]);
+	memcpy(&ax25Frame[1 + AX25_MIN_ADDRS*AX25_ADDR_LEN], frame + skip, len);
+
+	uint32_t kissLen = kissEscape(ax25Frame, 1 + AX25_MIN_ADDRS*AX25_ADDR_LEN + len, kissFrame);
+
+	for(int i=0;i<KISS_MAX_CLIENTS;i++)	{
+		struct kiss_client_t *c = &clients[i];
+		if(c->fd == -1)
+			continue;
+		if(c->outLen + kissLen > KISS_OUT_LEN)	{
+			stats.nRxDrops++;
+			continue;
+		}
+		memcpy(c->out + c->outLen, kissFrame, kissLen);
+		c->outLen += kissLen;
+		c->nRx++;
+		stats.nRxFrames++;
+	}
+}
+
+/*
+ * Write out what the exchange brought in: one
+ * send per client, however many frames
+ */
+void kissFlush(void)
+{
+	for(int i=0;i<KISS_MAX_CLIENTS;i++)	{
+		struct kiss_client_t *c = &clients[i];
+		if((c->fd != -1) && (c->outLen != 0))
+			kissWrite(c);
+	}
+}
+
+void kissGetStats(KISS_STATS *s)
+{
+	memcpy(s, &stats, sizeof(KISS_STATS));
+}
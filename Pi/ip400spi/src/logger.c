@@ -7,9 +7,14 @@
 
 	Author:		      MartinA
 
-	Revision:	      1.00
+	Revision:	      1.01
 
-	Description:      Log error messages in the system
+	Description:      Log error messages in the system. The caller puts
+					  the format and a copy of its arguments on a lock-free
+					  ring; a writer thread does the formatting and the
+					  writes, so debug logging does not change the timing
+					  of the SPI exchange. udpgen builds this file too,
+					  against its own logger.h.
 
                           This program is free software: you can redistribute it and/or modify
                           it under the terms of the GNU General Public License as published by
@@ -17,53 +22,590 @@
                           (at your option) any later version, provided this copyright notice
                           is included.
 
-                          Copyright (c) 2024-25 Alberta Digital Radio Communications Society
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
 
 	Revision History:
+		1.01	Oct. 18, 2026	asynchronous writer, rate limiting per call site
 
 ---------------------------------------------------------------------------*/
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "types.h"
 #include "logger.h"
 
+#define	LOG_LINE_MAX		1024		// one formatted line
+#define	LOG_SPEC_MAX		40			// one rebuilt conversion
+#define	LOG_WRITER_STACK	(64*1024)	// small, as it may be locked in memory
+
+// kinds of argument
+enum	{
+	ARG_INT=0,							// signed integer
+	ARG_UINT,							// unsigned integer
+	ARG_CHAR,							// %c
+	ARG_DOUBLE,							// floating point
+	ARG_STR,							// string, copied to the text
+	ARG_PTR								// pointer
+};
+
+// length modifiers
+enum	{
+	LEN_NONE=0,
+	LEN_HH,
+	LEN_H,
+	LEN_L,
+	LEN_LL,
+	LEN_SIZE,							// z, t
+	LEN_LONG_DOUBLE						// L
+};
+
+// one conversion in the format
+typedef struct log_spec_t	{
+	const char		*flags;				// flags, width and precision
+	int				flagsLen;
+	int				nStars;				// widths or precisions from the args
+	int				length;				// LEN_xxx
+	char			conv;				// conversion character
+} LOG_SPEC;
+
+// one argument
+typedef union log_arg_t	{
+	int64_t			i;
+	uint64_t		u;
+	double			d;
+	void			*p;
+	uint16_t		offset;				// into the text
+} LOG_ARG;
+
+// a record on the ring
+typedef struct log_record_t	{
+	atomic_uint		seq;				// ring sequence
+	uint8_t			severity;
+	uint8_t			nArgs;
+	uint16_t		textLen;
+	struct timespec	when;				// realtime at the call
+	const char		*format;
+	uint8_t			kinds[LOG_MAX_ARGS];
+	LOG_ARG			args[LOG_MAX_ARGS];
+	char			text[LOG_TEXT_MAX];
+} LOG_RECORD;
+
+// a call site, known by its format
+typedef struct log_site_t	{
+	_Atomic(const char *)	format;
+	atomic_uint		second;				// the second being counted
+	atomic_uint		count;				// lines this second
+	atomic_uint		suppressed;			// not yet reported
+} LOG_SITE;
+
 BOOL logDebug = FALSE;
 
+static LOG_RECORD ring[LOG_RING_SLOTS];
+static atomic_uint ringTail;			// next record to claim
+static atomic_uint ringHead;			// next record to write
+static LOG_SITE sites[LOG_SITES];
+
+static pthread_t writerThread;
+static atomic_bool writerRunning;
+static atomic_bool writerStop;
+static BOOL atexitDone = FALSE;
+
+static atomic_uint nLogged, nWritten, nDropped, nSuppressed;
+
+static char *sevNames[] = { "DEBUG: ", "Notice: ", "ERROR: ", "FATAL: " };
+
+static void *logWriter(void *arg);
+
 void openLog(BOOL debug)
 {
 	logDebug = debug;
+
+	if(atomic_load(&writerRunning))
+		return;
+
+	for(unsigned i=0;i<LOG_RING_SLOTS;i++)
+		atomic_store_explicit(&ring[i].seq, i, memory_order_relaxed);
+	atomic_store(&ringTail, 0);
+	atomic_store(&ringHead, 0);
+	atomic_store(&writerStop, FALSE);
+
+	// without a writer we log as we always have
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, LOG_WRITER_STACK);
+	int err = pthread_create(&writerThread, &attr, logWriter, NULL);
+	pthread_attr_destroy(&attr);
+	if(err != 0)	{
+		fprintf(stderr, "ERROR: Cannot start the log writer, logging synchronously\n");
+		return;
+	}
+	atomic_store(&writerRunning, TRUE);
+
+	if(!atexitDone)	{
+		atexit(closeLog);
+		atexitDone = TRUE;
+	}
 }
 
-// log an error or info message
-void logger(int severity, char *format, ...)
+// write what is left and stop the writer
+void closeLog(void)
 {
-	switch(severity)	{
+	if(!atomic_load(&writerRunning))
+		return;
 
-	case LOG_DEBUG:
-		if(!logDebug)
+	atomic_store(&writerStop, TRUE);
+	pthread_join(writerThread, NULL);
+	atomic_store(&writerRunning, FALSE);
+}
+
+// wait for the writer to catch up
+void logFlush(void)
+{
+	struct timespec ts = { 0, 1000000 };
+
+	for(int i=0;(i<LOG_FLUSH_TIME) && atomic_load(&writerRunning);i++)	{
+		if(atomic_load(&ringHead) == atomic_load(&ringTail))
 			return;
-		fprintf(stderr, "DEBUG: ");
-		break;
+		nanosleep(&ts, NULL);
+	}
+}
 
-	case LOG_NOTICE:
-		fprintf(stderr, "Notice: ");
-		break;
+void logGetStats(LOG_STATS *stats)
+{
+	stats->nLogged = atomic_load_explicit(&nLogged, memory_order_relaxed);
+	stats->nWritten = atomic_load_explicit(&nWritten, memory_order_relaxed);
+	stats->nDropped = atomic_load_explicit(&nDropped, memory_order_relaxed);
+	stats->nSuppressed = atomic_load_explicit(&nSuppressed, memory_order_relaxed);
+}
 
-	case LOG_ERROR:
-		fprintf(stderr, "ERROR: ");
-		break;
+/*
+ * Parse a conversion, p is past the '%'. Returns
+ * the character after it, NULL if not understood
+ */
+static const char *parseSpec(const char *p, LOG_SPEC *spec)
+{
+	spec->flags = p;
+	spec->nStars = 0;
+	spec->length = LEN_NONE;
+
+	while((*p != '\0') && (strchr("-+ #0'", *p) != NULL))
+		p++;
+	if(*p == '*')	{
+		spec->nStars++;
+		p++;
+	}
+	while((*p >= '0') && (*p <= '9'))
+		p++;
+	if(*p == '.')	{
+		p++;
+		if(*p == '*')	{
+			spec->nStars++;
+			p++;
+		}
+		while((*p >= '0') && (*p <= '9'))
+			p++;
+	}
+	spec->flagsLen = p - spec->flags;
 
-	case LOG_FATAL:
-		fprintf(stderr, "FATAL: ");
+	switch(*p)	{
+	case 'h':
+		if(*++p == 'h')	{
+			spec->length = LEN_HH;
+			p++;
+		} else {
+			spec->length = LEN_H;
+		}
+		break;
+	case 'l':
+		if(*++p == 'l')	{
+			spec->length = LEN_LL;
+			p++;
+		} else {
+			spec->length = LEN_L;
+		}
+		break;
+	case 'j':
+		spec->length = LEN_LL;			// intmax_t
+		p++;
+		break;
+	case 'z':
+	case 't':
+		spec->length = LEN_SIZE;
+		p++;
+		break;
+	case 'L':
+		spec->length = LEN_LONG_DOUBLE;
+		p++;
 		break;
 	}
 
-	// process the arg list
-    va_list argptr;
-    va_start(argptr, format);
-    vfprintf(stderr, format, argptr);
-    va_end(argptr);
+	spec->conv = *p;
+	if((spec->conv == '\0') || (strchr("diuoxXcsfFeEgGaApn", spec->conv) == NULL))
+		return NULL;
+	if((spec->conv == 's') && (spec->length != LEN_NONE))
+		return NULL;				// no wide strings
+	return p + 1;
 }
 
+/*
+ * Copy the arguments the format uses into the record.
+ * Anything past what fits is left out, and the writer
+ * prints the rest of the format as it is
+ */
+static void captureArgs(LOG_RECORD *rec, const char *format, va_list ap)
+{
+	LOG_SPEC spec;
+	int n = 0, textLen = 0;
+
+	for(const char *p = format; *p != '\0'; )	{
+		if(*p++ != '%')
+			continue;
+		if(*p == '%')	{
+			p++;
+			continue;
+		}
+		if((p = parseSpec(p, &spec)) == NULL)
+			break;
+		if(n + spec.nStars + 1 > LOG_MAX_ARGS)
+			break;
+
+		for(int i=0;i<spec.nStars;i++)	{
+			rec->kinds[n] = ARG_INT;
+			rec->args[n++].i = va_arg(ap, int);
+		}
+
+		LOG_ARG *arg = &rec->args[n];
+		switch(spec.conv)	{
+		case 'd':
+		case 'i':
+			rec->kinds[n] = ARG_INT;
+			switch(spec.length)	{
+			case LEN_HH:	arg->i = (signed char)va_arg(ap, int);	break;
+			case LEN_H:		arg->i = (short)va_arg(ap, int);		break;
+			case LEN_L:		arg->i = va_arg(ap, long);				break;
+			case LEN_LL:	arg->i = va_arg(ap, long long);			break;
+			case LEN_SIZE:	arg->i = va_arg(ap, ptrdiff_t);			break;
+			default:		arg->i = va_arg(ap, int);				break;
+			}
+			break;
+
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			rec->kinds[n] = ARG_UINT;
+			switch(spec.length)	{
+			case LEN_HH:	arg->u = (unsigned char)va_arg(ap, unsigned);		break;
+			case LEN_H:		arg->u = (unsigned short)va_arg(ap, unsigned);		break;
+			case LEN_L:		arg->u = va_arg(ap, unsigned long);					break;
+			case LEN_LL:	arg->u = va_arg(ap, unsigned long long);			break;
+			case LEN_SIZE:	arg->u = va_arg(ap, size_t);						break;
+			default:		arg->u = va_arg(ap, unsigned);						break;
+			}
+			break;
+
+		case 'c':
+			rec->kinds[n] = ARG_CHAR;
+			arg->i = va_arg(ap, int);
+			break;
+
+		case 'p':
+			rec->kinds[n] = ARG_PTR;
+			arg->p = va_arg(ap, void *);
+			break;
+
+		case 'n':
+			(void)va_arg(ap, void *);
+			continue;
+
+		case 's':	{
+			const char *s = va_arg(ap, const char *);
+			if(s == NULL)
+				s = "(null)";
+			int room = LOG_TEXT_MAX - textLen - 1;
+			int len = strnlen(s, room > 0 ? room : 0);
+			rec->kinds[n] = ARG_STR;
+			arg->offset = textLen;
+			memcpy(&rec->text[textLen], s, len);
+			rec->text[textLen + len] = '\0';
+			textLen += len + ((room > 0) ? 1 : 0);
+			}
+			break;
+
+		default:
+			rec->kinds[n] = ARG_DOUBLE;
+			if(spec.length == LEN_LONG_DOUBLE)
+				arg->d = (double)va_arg(ap, long double);
+			else
+				arg->d = va_arg(ap, double);
+			break;
+		}
+		n++;
+	}
+
+	rec->nArgs = n;
+	rec->textLen = textLen;
+}
+
+/*
+ * Format a record the way vsnprintf would have. The
+ * conversions are rebuilt one at a time with the
+ * widths filled in and integers as long long
+ */
+static int formatArgs(LOG_RECORD *rec, char *buf, int size)
+{
+	char specBuf[LOG_SPEC_MAX];
+	LOG_SPEC spec;
+	int len = 0, n = 0;
+	const char *p = rec->format;
 
+	while((*p != '\0') && (len < size - 1))	{
+		if(*p != '%')	{
+			buf[len++] = *p++;
+			continue;
+		}
+		if(p[1] == '%')	{
+			buf[len++] = '%';
+			p += 2;
+			continue;
+		}
+
+		// not understood or not captured: the rest as it is
+		const char *next = parseSpec(p + 1, &spec);
+		if((next != NULL) && (spec.conv == 'n'))	{
+			p = next;
+			continue;
+		}
+		if((next == NULL) || (n + spec.nStars >= rec->nArgs))	{
+			len += snprintf(&buf[len], size - len, "%s", p);
+			break;
+		}
+		p = next;
+
+		// the flags, with the widths in place of the stars
+		int s = 0;
+		specBuf[s++] = '%';
+		for(int i=0;(i<spec.flagsLen) && (s < LOG_SPEC_MAX - 8);i++)	{
+			if(spec.flags[i] == '*')
+				s += snprintf(&specBuf[s], LOG_SPEC_MAX - 8 - s, "%d", (int)rec->args[n++].i);
+			else
+				specBuf[s++] = spec.flags[i];
+		}
+		if((rec->kinds[n] == ARG_INT) || (rec->kinds[n] == ARG_UINT))	{
+			specBuf[s++] = 'l';
+			specBuf[s++] = 'l';
+		}
+		specBuf[s++] = spec.conv;
+		specBuf[s] = '\0';
+
+		LOG_ARG *arg = &rec->args[n];
+		int room = size - len, nOut = 0;
+		switch(rec->kinds[n++])	{
+		case ARG_INT:		nOut = snprintf(&buf[len], room, specBuf, (long long)arg->i);				break;
+		case ARG_UINT:		nOut = snprintf(&buf[len], room, specBuf, (unsigned long long)arg->u);		break;
+		case ARG_CHAR:		nOut = snprintf(&buf[len], room, specBuf, (int)arg->i);						break;
+		case ARG_DOUBLE:	nOut = snprintf(&buf[len], room, specBuf, arg->d);							break;
+		case ARG_STR:		nOut = snprintf(&buf[len], room, specBuf, &rec->text[arg->offset]);			break;
+		case ARG_PTR:		nOut = snprintf(&buf[len], room, specBuf, arg->p);							break;
+		}
+		len += (nOut < room) ? nOut : room - 1;
+	}
+
+	if(len >= size)
+		len = size - 1;
+	buf[len] = '\0';
+	return len;
+}
+
+// time and severity
+static int formatPrefix(struct timespec *when, int severity, char *buf, int size)
+{
+	struct tm tm;
+
+	localtime_r(&when->tv_sec, &tm);
+	int len = strftime(buf, size, "%H:%M:%S", &tm);
+	len += snprintf(&buf[len], size - len, ".%06ld %s", when->tv_nsec / 1000,
+			((severity >= LOG_DEBUG) && (severity <= LOG_FATAL)) ? sevNames[severity] : "");
+	return len;
+}
+
+/*
+ * Count a line against its call site. Lines over the
+ * rate are counted and reported by the writer
+ */
+static BOOL siteAllow(const char *format, unsigned second)
+{
+	unsigned hash = (unsigned)(((uintptr_t)format >> 3) * 2654435761u);
+
+	for(int probe=0;probe<8;probe++)	{
+		LOG_SITE *site = &sites[(hash + probe) & (LOG_SITES-1)];
+		const char *known = atomic_load_explicit(&site->format, memory_order_acquire);
+
+		if(known == NULL)	{
+			const char *expected = NULL;
+			if(!atomic_compare_exchange_strong(&site->format, &expected, format) && (expected != format))
+				continue;
+		} else if(known != format)	{
+			continue;
+		}
+
+		// a new second starts the count again
+		if(atomic_exchange_explicit(&site->second, second, memory_order_relaxed) != second)
+			atomic_store_explicit(&site->count, 0, memory_order_relaxed);
+		if(atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) < LOG_SITE_RATE)
+			return TRUE;
+
+		atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&nSuppressed, 1, memory_order_relaxed);
+		return FALSE;
+	}
+
+	// table full: not limited
+	return TRUE;
+}
+
+// format and write now
+static void writeDirect(int severity, const char *format, va_list ap)
+{
+	char line[LOG_LINE_MAX];
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	int len = formatPrefix(&now, severity, line, sizeof(line));
+	vsnprintf(&line[len], sizeof(line) - len, format, ap);
+	fputs(line, stderr);
+}
+
+// log an error or info message
+void logger(int severity, char *format, ...)
+{
+	va_list argptr;
+
+	if((severity == LOG_DEBUG) && !logDebug)
+		return;
+
+	// before the writer starts, or on the way out
+	va_start(argptr, format);
+	if(!atomic_load_explicit(&writerRunning, memory_order_acquire) || (severity == LOG_FATAL))	{
+		logFlush();
+		writeDirect(severity, format, argptr);
+		va_end(argptr);
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if(!siteAllow(format, (unsigned)now.tv_sec))	{
+		va_end(argptr);
+		return;
+	}
+
+	// claim a record
+	unsigned pos = atomic_load_explicit(&ringTail, memory_order_relaxed);
+	LOG_RECORD *rec;
+	for(;;)	{
+		rec = &ring[pos & (LOG_RING_SLOTS-1)];
+		int diff = (int)(atomic_load_explicit(&rec->seq, memory_order_acquire) - pos);
+		if(diff == 0)	{
+			if(atomic_compare_exchange_weak_explicit(&ringTail, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if(diff < 0)	{
+			atomic_fetch_add_explicit(&nDropped, 1, memory_order_relaxed);
+			va_end(argptr);
+			return;
+		} else {
+			pos = atomic_load_explicit(&ringTail, memory_order_relaxed);
+		}
+	}
+
+	rec->severity = severity;
+	rec->when = now;
+	rec->format = format;
+	captureArgs(rec, format, argptr);
+	va_end(argptr);
+
+	atomic_fetch_add_explicit(&nLogged, 1, memory_order_relaxed);
+	atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+}
+
+// report call sites that went over their rate
+static void reportSuppressed(void)
+{
+	char line[LOG_LINE_MAX];
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	for(int i=0;i<LOG_SITES;i++)	{
+		const char *format = atomic_load_explicit(&sites[i].format, memory_order_acquire);
+		if(format == NULL)
+			continue;
+		unsigned n = atomic_exchange_explicit(&sites[i].suppressed, 0, memory_order_relaxed);
+		if(n == 0)
+			continue;
+
+		int len = formatPrefix(&now, LOG_NOTICE, line, sizeof(line));
+		len += snprintf(&line[len], sizeof(line) - len, "%u lines suppressed: ", n);
+		for(const char *p = format;(*p != '\0') && (*p != '\n') && (len < (int)sizeof(line) - 2);p++)
+			line[len++] = *p;
+		line[len++] = '\n';
+		fwrite(line, 1, len, stderr);
+	}
+}
+
+/*
+ * The writer: take records off the ring in order,
+ * format and write them. Drops and suppressed lines
+ * are reported once a second
+ */
+static void *logWriter(void *arg)
+{
+	char line[LOG_LINE_MAX];
+	struct timespec idle = { 0, LOG_WRITER_SLEEP * 1000000L };
+	unsigned lastDropped = 0;
+	time_t lastReport = time(NULL);
+
+	for(;;)	{
+		unsigned head = atomic_load_explicit(&ringHead, memory_order_relaxed);
+		LOG_RECORD *rec = &ring[head & (LOG_RING_SLOTS-1)];
+
+		if(atomic_load_explicit(&rec->seq, memory_order_acquire) == head + 1)	{
+			int len = formatPrefix(&rec->when, rec->severity, line, sizeof(line));
+			len += formatArgs(rec, &line[len], sizeof(line) - len);
+			atomic_store_explicit(&rec->seq, head + LOG_RING_SLOTS, memory_order_release);
+			atomic_store_explicit(&ringHead, head + 1, memory_order_release);
+			fwrite(line, 1, len, stderr);
+			atomic_fetch_add_explicit(&nWritten, 1, memory_order_relaxed);
+			continue;
+		}
+
+		// caught up
+		time_t now = time(NULL);
+		unsigned dropped = atomic_load_explicit(&nDropped, memory_order_relaxed);
+		if((now != lastReport) || (dropped != lastDropped) || atomic_load(&writerStop))	{
+			if(dropped != lastDropped)	{
+				struct timespec ts;
+				clock_gettime(CLOCK_REALTIME, &ts);
+				int len = formatPrefix(&ts, LOG_NOTICE, line, sizeof(line));
+				len += snprintf(&line[len], sizeof(line) - len, "%u log records dropped, ring full\n", dropped - lastDropped);
+				fwrite(line, 1, len, stderr);
+			}
+			lastDropped = dropped;
+			reportSuppressed();
+			lastReport = now;
+		}
+
+		if(atomic_load(&writerStop))
+			break;
+		nanosleep(&idle, NULL);
+	}
+
+	return NULL;
+}
@@ -29,6 +29,16 @@
 #include "logger.h"
 #include "spidefs.h"
 #include "timer.h"
+#include "reactor.h"
+#include "drdy.h"
+#include "tun.h"
+#include "subs.h"
+#include "shm.h"
+#include "kiss.h"
+#include "metrics.h"
+#include "framering.h"
+#include "rt.h"
+#include "spiclock.h"
 
 // SPI device
 char spiDev[20];
@@ -37,6 +47,19 @@ int debugFlag;
 char hostname[50];				// name of remote host
 uint16_t hostport;				// host port
 uint16_t localport;				// my port
+char drdyLine[100];				// data ready line, if any
+char tunSpec[100];				// tun interface, if any
+char subsFile[100];				// subscriber file, if any
+char shmPath[100];				// shared memory socket, if any
+char kissSpec[100];				// KISS TCP port, if any
+char metricsSock[100];			// metrics socket, if any
+char metricsFile[100];			// metrics file, if any
+char ctlNet[50];				// network subscriptions come from, if any
+char mcastIf[50];				// interface for multicast subscribers, if any
+unsigned txSlots;				// frames queued for the node
+int rtPriority;					// SCHED_FIFO priority, 0 if not real-time
+int rtCPU;						// CPU to pin to, -1 if any
+uint32_t clockMax;				// SPI clock to tune up to, 0 if not
 
 // timer or interrupt mode
 #define	NO_INTERRUPT	0		// do not use interrupts
@@ -48,7 +71,7 @@ void show_help(char *name);
 void sighandler(int s)
 {
 	logger(LOG_ERROR, "\n3000Caught signal %d\n",s);
-	stopTimer();
+	reactorStop();
 	exit(1);
 }
 
@@ -69,9 +92,22 @@ int main(int argc, char *argv[])
 	// set default SPI
 	strcpy(spiDev, SPI_0_DEV_0);
 	debugFlag = FALSE;
+	drdyLine[0] = '\0';
+	tunSpec[0] = '\0';
+	subsFile[0] = '\0';
+	shmPath[0] = '\0';
+	kissSpec[0] = '\0';
+	metricsSock[0] = metricsFile[0] = '\0';
+	ctlNet[0] = '\0';
+	mcastIf[0] = '\0';
+	txSlots = FRAME_RING_SLOTS;
+	rtPriority = RT_PRIORITY_NONE;
+	rtCPU = RT_CPU_ANY;
+	clockMax = 0;
+	hostname[0] = '\0';
 
 	// parse command line parameters
-	while ((c = getopt(argc, argv, "s:d:hn:p:m:")) != -1) {
+	while ((c = getopt(argc, argv, "s:d:hn:p:m:g:t:f:u:k:e:o:q:r:a:c:w:i:")) != -1) {
 
 		// process the command line
 		switch((char )c) {
@@ -96,6 +132,71 @@ int main(int argc, char *argv[])
 				sscanf(optarg, "%hd", &localport);
 				break;
 
+			// data ready line
+			case 'g':
+				strncpy(drdyLine, optarg, sizeof(drdyLine)-1);
+				break;
+
+			// tun interface
+			case 't':
+				strncpy(tunSpec, optarg, sizeof(tunSpec)-1);
+				break;
+
+			// subscriber file
+			case 'f':
+				strncpy(subsFile, optarg, sizeof(subsFile)-1);
+				break;
+
+			// network for subscription datagrams
+			case 'w':
+				strncpy(ctlNet, optarg, sizeof(ctlNet)-1);
+				break;
+
+			// interface for multicast subscribers
+			case 'i':
+				strncpy(mcastIf, optarg, sizeof(mcastIf)-1);
+				break;
+
+			// shared memory clients
+			case 'u':
+				strncpy(shmPath, optarg, sizeof(shmPath)-1);
+				break;
+
+			// KISS clients
+			case 'k':
+				strncpy(kissSpec, optarg, sizeof(kissSpec)-1);
+				break;
+
+			// metrics socket
+			case 'e':
+				strncpy(metricsSock, optarg, sizeof(metricsSock)-1);
+				break;
+
+			// metrics file
+			case 'o':
+				strncpy(metricsFile, optarg, sizeof(metricsFile)-1);
+				break;
+
+			// tx ring size
+			case 'q':
+				sscanf(optarg, "%u", &txSlots);
+				break;
+
+			// real-time priority
+			case 'r':
+				sscanf(optarg, "%d", &rtPriority);
+				break;
+
+			// CPU for the SPI thread
+			case 'a':
+				sscanf(optarg, "%d", &rtCPU);
+				break;
+
+			// SPI clock to tune up to
+			case 'c':
+				sscanf(optarg, "%u", &clockMax);
+				break;
+
 			// debug
 			case 'd':
 				sscanf(optarg, "%x", &debugFlag);
@@ -119,17 +220,63 @@ int main(int argc, char *argv[])
 	}
 
     spi_setup(spiDevNum, SPI_MODE_0, SPI_NBITS, SPI_SPEED, debugFlag&DEBUG_SPI);
+    spiClockInit(spiDevNum, clockMax);
 
-	if(!spiTaskInit(spiDevNum))	{
+	if(!spiTaskInit(spiDevNum, txSlots))	{
 		logger(LOG_FATAL, "Cannot open SPI device %s\n", spiDev);
 		exit(100);
 	}
 
+	// one event loop for everything
+	if(!reactorInit())	{
+		logger(LOG_FATAL, "Cannot create the event loop\n");
+		exit(101);
+	}
+
 	if(!setup_udp_socket(hostname, hostport, localport, debugFlag))	{
 		logger(LOG_FATAL, "Cannot create UDP socket to %s:%d\n", hostname, hostport, localport);
 		exit(100);
 	}
 
+	if((ctlNet[0] != '\0') && !subsControlNet(ctlNet))	{
+		logger(LOG_FATAL, "Bad subscription network %s: need address/bits\n", ctlNet);
+		exit(100);
+	}
+
+	if((mcastIf[0] != '\0') && !udp_multicast_if(mcastIf))	{
+		logger(LOG_FATAL, "Bad multicast interface %s: need its address\n", mcastIf);
+		exit(100);
+	}
+
+	if((subsFile[0] != '\0') && !subsLoad(subsFile))	{
+		logger(LOG_FATAL, "Cannot load subscribers from %s\n", subsFile);
+		exit(100);
+	}
+
+	// local applications
+	if((shmPath[0] != '\0') && !shmOpen(shmPath))	{
+		logger(LOG_FATAL, "Cannot open shared memory socket %s\n", shmPath);
+		exit(100);
+	}
+
+	// AX.25 applications
+	if((kissSpec[0] != '\0') && !kissOpen(kissSpec))	{
+		logger(LOG_FATAL, "Cannot open KISS port %s\n", kissSpec);
+		exit(100);
+	}
+
+	// IP packets straight to the mesh
+	if((tunSpec[0] != '\0') && !tunOpen(tunSpec))	{
+		logger(LOG_FATAL, "Cannot open tun interface %s\n", tunSpec);
+		exit(100);
+	}
+
+	// counters for whoever asks
+	if(((metricsSock[0] != '\0') || (metricsFile[0] != '\0')) && !metricsOpen(metricsSock, metricsFile))	{
+		logger(LOG_FATAL, "Cannot open metrics socket %s or file %s\n", metricsSock, metricsFile);
+		exit(100);
+	}
+
 #if NO_INTERRUPT
 	while(1)	{
 		spiTask();
@@ -137,10 +284,38 @@ int main(int argc, char *argv[])
 	}
 	forced syntax error;		// force error if this mode is invoked
 #else
-	if(!startTimer(TIMER_VALUE, &spiTask))	{
+	// follow the data ready line, else poll
+	if(drdyLine[0] != '\0')	{
+		if(!drdyOpen(drdyLine))	{
+			logger(LOG_FATAL, "Cannot open data ready line %s\n", drdyLine);
+			exit(101);
+		}
+		if(!drdyStart(&spiTask, &spiPending))	{
+			logger(LOG_FATAL, "Could not start the SPI task\n");
+			exit(101);
+		}
+	} else if(!reactorStartTick(TIMER_VALUE, &spiTask))	{
 		logger(LOG_FATAL, "Could not start the SPI task\n");
 		exit(101);
 	}
+
+	// everything is allocated: lock it down
+	if(!rtSetup(rtPriority, rtCPU))	{
+		logger(LOG_FATAL, "Cannot set up real-time mode\n");
+		exit(101);
+	}
+
+	if(!reactorRun())	{
+		logger(LOG_FATAL, "Event loop failed\n");
+		exit(101);
+	}
+	drdyClose();
+	tunClose();
+	shmClose();
+	kissClose();
+	rtClose();
+	metricsClose();
+	close_udp_socket();
 #endif
 
 	return EXIT_SUCCESS;
@@ -148,12 +323,25 @@ int main(int argc, char *argv[])
 
 void show_help(char *name) {
 	fprintf(stderr,
-			"Usage: %s -[sdhnpm]\n"
+			"Usage: %s -[sdhnpmgtfwiukeoqrac]\n"
 			"-s SPI device name\n"
 			"-d  debug mode \n"
 			"-h print this help message\n"
 			"-n remote host name\n"
 			"-p remote port number"
-			"-m my port number",
-			name);
+			"-m my port number\n"
+			"-g data ready line: gpiochip:line, or a FIFO stand-in\n"
+			"-t tun interface: name,callsign,address\n"
+			"-f subscriber file: host port codings [callsign] per line\n"
+			"-w network subscription datagrams may come from, address/bits: else the loopback only\n"
+			"-i address of the interface to send to multicast subscribers from\n"
+			"-u shared memory socket for local applications, e.g. " SHM_SOCKET "\n"
+			"-k KISS TCP port for AX.25 applications: [address:]port, default address " KISS_DEFAULT_ADDR "\n"
+			"-e metrics socket: connect to read the counters\n"
+			"-o metrics file, rewritten in the Prometheus text format\n"
+			"-q frames queued for the node, default %d, at most %d\n"
+			"-r real-time: SCHED_FIFO priority for the SPI thread, locked memory\n"
+			"-a CPU to pin the SPI thread to\n"
+			"-c highest SPI clock to tune up to, Hz: checked exchanges only\n",
+			name, FRAME_RING_SLOTS, FRAME_RING_MAX);
 }
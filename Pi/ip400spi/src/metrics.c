@@ -0,0 +1,433 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        metrics.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Metrics registry. Counters and latency histograms
+                          kept with atomic adds, and the stats of the other
+                          modules, reported in the Prometheus text format on
+                          a unix socket and in a file.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/timerfd.h>
+
+#include "types.h"
+#include "logger.h"
+#include "spidefs.h"
+#include "reactor.h"
+#include "reasm.h"
+#include "tun.h"
+#include "kiss.h"
+#include "metrics.h"
+#include "spiclock.h"
+
+// names and help, in enum order
+struct metric_desc_t	{
+	char			*name;
+	char			*help;
+};
+
+static const struct metric_desc_t counterDesc[N_MET_COUNTERS] = {
+	{ "spi_exchanges_total",		"Exchanges with the node" },
+	{ "spi_errors_total",			"Exchanges that failed" },
+	{ "spi_bytes_total",			"Bytes clocked over SPI" },
+	{ "spi_driver_calls_total",		"Calls to the SPI driver, each one or more transfers" },
+	{ "spi_eye_failures_total",		"Frames or headers that failed the eye check" },
+	{ "spi_rx_frames_total",		"Single frames from the node" },
+	{ "spi_rx_packed_total",		"Frames unpacked from packed frames" },
+	{ "spi_rx_too_long_total",		"Single frames from the node that were too long" },
+	{ "spi_tx_frames_total",		"Frames sent to the node" },
+	{ "spi_tx_fragments_total",		"Fragments sent to the node" },
+	{ "spi_tx_packed_total",		"Frames packed for the node" },
+};
+
+static const struct metric_desc_t histDesc[N_MET_HISTS] = {
+	{ "spi_exchange_us",			"Time for one exchange with the node, us" },
+	{ "tick_late_us",				"How late each tick ran, us" },
+	{ "spi_tx_depth",				"Frames waiting for the node at each exchange" },
+	{ "spi_batch_exchanges",		"Exchanges per SPI task run" },
+};
+
+// a histogram
+struct metric_hist_t	{
+	atomic_ullong	buckets[METRICS_HIST_BUCKETS];
+	atomic_ullong	sum;
+	atomic_ullong	count;
+};
+
+static atomic_ullong counters[N_MET_COUNTERS];
+static struct metric_hist_t hists[N_MET_HISTS];
+
+// the endpoints
+static int listenFD = -1;					// metrics socket
+static int fileTimerFD = -1;				// file refresh
+static char sockName[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static char fileName[200];
+static char text[METRICS_TEXT_MAX];			// the report
+
+static void metricsAccept(int fd, uint32_t events, void *arg);
+static void metricsFileTimer(int fd, uint32_t events, void *arg);
+static BOOL metricsWriteFile(void);
+
+/*
+ * Hot path: counts and observations
+ */
+void metricInc(METRIC_COUNTER id)
+{
+	atomic_fetch_add_explicit(&counters[id], 1, memory_order_relaxed);
+}
+
+void metricAdd(METRIC_COUNTER id, uint32_t n)
+{
+	atomic_fetch_add_explicit(&counters[id], n, memory_order_relaxed);
+}
+
+// bucket n holds values above 2^(n-1), up to 2^n
+void metricObserve(METRIC_HIST id, uint32_t value)
+{
+	struct metric_hist_t *h = &hists[id];
+	int bucket = (value <= 1) ? 0 : 32 - __builtin_clz(value - 1);
+
+	if(bucket >= METRICS_HIST_BUCKETS)
+		bucket = METRICS_HIST_BUCKETS-1;
+
+	atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+}
+
+/*
+ * The bucket a fraction of the observations are
+ * in, in thousandths: its upper bound
+ */
+uint32_t metricPercentile(METRIC_HIST id, int permille)
+{
+	struct metric_hist_t *h = &hists[id];
+	uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+	uint64_t want = ((count * permille) + 999) / 1000, seen = 0;
+
+	if(count == 0)
+		return 0;
+
+	for(int i=0;i<METRICS_HIST_BUCKETS;i++)	{
+		seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+		if(seen >= want)
+			return 1U << i;
+	}
+	return 1U << (METRICS_HIST_BUCKETS-1);
+}
+
+/*
+ * Open the socket, the file, or both
+ */
+BOOL metricsOpen(char *sockPath, char *filePath)
+{
+	struct sockaddr_un addr;
+
+	if((sockPath != NULL) && (sockPath[0] != '\0'))	{
+		if((listenFD = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)	{
+			logger(LOG_ERROR, "Cannot create metrics socket: %s\n", strerror(errno));
+			return FALSE;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, sockPath, sizeof(addr.sun_path)-1);
+		strcpy(sockName, addr.sun_path);
+		unlink(sockName);
+
+		if((bind(listenFD, (struct sockaddr *)&addr, sizeof(addr)) == -1) || (listen(listenFD, 4) == -1))	{
+			logger(LOG_ERROR, "Cannot listen on %s: %s\n", sockName, strerror(errno));
+			close(listenFD);
+			listenFD = -1;
+			return FALSE;
+		}
+
+		if(!reactorAdd(listenFD, metricsAccept, NULL))
+			return FALSE;
+		logger(LOG_NOTICE, "Metrics on %s\n", sockName);
+	}
+
+	if((filePath != NULL) && (filePath[0] != '\0'))	{
+		struct itimerspec its;
+
+		strncpy(fileName, filePath, sizeof(fileName)-5);
+		if(!metricsWriteFile())
+			return FALSE;
+
+		if((fileTimerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)	{
+			logger(LOG_ERROR, "Cannot create metrics timer: %s\n", strerror(errno));
+			return FALSE;
+		}
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = its.it_interval.tv_sec = METRICS_FILE_TIME;
+		timerfd_settime(fileTimerFD, 0, &its, NULL);
+
+		if(!reactorAdd(fileTimerFD, metricsFileTimer, NULL))
+			return FALSE;
+		logger(LOG_NOTICE, "Metrics written to %s every %d seconds\n", fileName, METRICS_FILE_TIME);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Close them, leaving the file with the final numbers
+ */
+void metricsClose(void)
+{
+	if(listenFD != -1)	{
+		reactorRemove(listenFD);
+		close(listenFD);
+		unlink(sockName);
+		listenFD = -1;
+	}
+
+	if(fileTimerFD != -1)	{
+		reactorRemove(fileTimerFD);
+		close(fileTimerFD);
+		fileTimerFD = -1;
+		metricsWriteFile();
+	}
+}
+
+// a client connected: give it the report and hang up
+static void metricsAccept(int fd, uint32_t events, void *arg)
+{
+	int conn = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(conn == -1)
+		return;
+
+	int len = metricsFormat(text, sizeof(text));
+	if(send(conn, text, len, MSG_NOSIGNAL) != len)
+		logger(LOG_DEBUG, "Metrics client did not take the report\n");
+	close(conn);
+}
+
+// time to rewrite the file
+static void metricsFileTimer(int fd, uint32_t events, void *arg)
+{
+	uint64_t expirations;
+
+	if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+	metricsWriteFile();
+}
+
+/*
+ * Write a new file and rename it over the old one, so
+ * a collector never sees half a report
+ */
+static BOOL metricsWriteFile(void)
+{
+	char tmpName[sizeof(fileName)+4];
+	FILE *fp;
+
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", fileName);
+	if((fp = fopen(tmpName, "w")) == NULL)	{
+		logger(LOG_ERROR, "Cannot write metrics to %s: %s\n", tmpName, strerror(errno));
+		return FALSE;
+	}
+
+	int len = metricsFormat(text, sizeof(text));
+	BOOL ok = (fwrite(text, 1, len, fp) == (size_t)len) ? TRUE : FALSE;
+	if((fclose(fp) != 0) || !ok || (rename(tmpName, fileName) == -1))	{
+		logger(LOG_ERROR, "Cannot write metrics to %s: %s\n", fileName, strerror(errno));
+		unlink(tmpName);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Report building
+ */
+struct report_t	{
+	char			*buffer;
+	int				size;
+	int				len;
+};
+
+static void put(struct report_t *r, char *format, ...)
+{
+	va_list args;
+
+	if(r->len >= r->size)
+		return;
+
+	va_start(args, format);
+	int n = vsnprintf(r->buffer + r->len, r->size - r->len, format, args);
+	va_end(args);
+
+	r->len = ((n < 0) || (r->len + n >= r->size)) ? r->size - 1 : r->len + n;
+}
+
+static void putMetric(struct report_t *r, char *type, char *name, char *help, uint64_t value)
+{
+	put(r, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+	put(r, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+	put(r, METRICS_PREFIX "%s %llu\n", name, (unsigned long long)value);
+}
+
+static void putCounter(struct report_t *r, char *name, char *help, uint64_t value)
+{
+	putMetric(r, "counter", name, help, value);
+}
+
+static void putGauge(struct report_t *r, char *name, char *help, uint64_t value)
+{
+	putMetric(r, "gauge", name, help, value);
+}
+
+// buckets are cumulative in the report
+static void putHist(struct report_t *r, METRIC_HIST id)
+{
+	struct metric_hist_t *h = &hists[id];
+	char *name = histDesc[id].name;
+	uint64_t total = 0;
+
+	put(r, "# HELP " METRICS_PREFIX "%s %s\n", name, histDesc[id].help);
+	put(r, "# TYPE " METRICS_PREFIX "%s histogram\n", name);
+	for(int i=0;i<METRICS_HIST_BUCKETS-1;i++)	{
+		total += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+		put(r, METRICS_PREFIX "%s_bucket{le=\"%u\"} %llu\n", name, 1U << i, (unsigned long long)total);
+	}
+	total += atomic_load_explicit(&h->buckets[METRICS_HIST_BUCKETS-1], memory_order_relaxed);
+	put(r, METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)total);
+	put(r, METRICS_PREFIX "%s_sum %llu\n", name,
+			(unsigned long long)atomic_load_explicit(&h->sum, memory_order_relaxed));
+	put(r, METRICS_PREFIX "%s_count %llu\n", name, (unsigned long long)total);
+}
+
+/*
+ * Everything, in the Prometheus text format.
+ * Returns the length
+ */
+int metricsFormat(char *buffer, int size)
+{
+	struct report_t r = { buffer, size, 0 };
+	REACTOR_STATS rst;
+	SPI_STATS sst;
+	UDP_STATS ust;
+	REASM_STATS ast;
+	TUN_STATS tst;
+	KISS_STATS kst;
+	LOG_STATS lst;
+	SPI_CLOCK_STATS cst;
+
+	buffer[0] = '\0';
+
+	// our own
+	for(int i=0;i<N_MET_COUNTERS;i++)
+		putCounter(&r, counterDesc[i].name, counterDesc[i].help,
+				atomic_load_explicit(&counters[i], memory_order_relaxed));
+	for(int i=0;i<N_MET_HISTS;i++)
+		putHist(&r, i);
+
+	// the tx ring and credit
+	spiGetStats(&sst);
+	putGauge(&r, "spi_tx_slots", "Frames the tx ring holds", sst.txSlots);
+	putGauge(&r, "spi_tx_depth_frames", "Frames waiting for the node", sst.txDepth);
+	putGauge(&r, "spi_tx_high_water_frames", "Most frames there have been waiting", sst.txHighWater);
+	putCounter(&r, "spi_tx_queued_total", "Frames queued for the node", sst.txPut);
+	putCounter(&r, "spi_tx_drops_total", "Frames dropped with the tx ring full", sst.txDrops);
+	putCounter(&r, "spi_tx_too_long_total", "Frames too long for the tx ring", sst.txTooLong);
+	putCounter(&r, "spi_tx_exhausted_total", "Times every tx ring slot was in use", sst.txExhausted);
+	putGauge(&r, "spi_peer_credit_bytes", "Bytes the node will take", sst.peerCredit);
+	putCounter(&r, "spi_credit_stalls_total", "Frames held back for credit", sst.creditStalls);
+	putCounter(&r, "spi_credit_requests_total", "Grants asked for by the node", sst.creditRequests);
+	putGauge(&r, "spi_header_first", "Exchanges are header first", sst.headerFirst ? 1 : 0);
+	putGauge(&r, "spi_checked", "Exchanges carry a CRC", sst.linkChecked ? 1 : 0);
+
+	// the clock, and the checks that set it
+	spiClockGetStats(&cst);
+	putGauge(&r, "spi_clock_hz", "SPI clock now, Hz", cst.clockHz);
+	putGauge(&r, "spi_clock_max_hz", "Highest SPI clock to tune to, Hz", cst.maxHz);
+	putGauge(&r, "spi_clock_tuning", "Stepping the clock up now", cst.tuning ? 1 : 0);
+	putCounter(&r, "spi_checked_exchanges_total", "Exchanges checked", cst.nChecked);
+	putCounter(&r, "spi_check_errors_total", "Exchanges that failed the CRC", cst.nCheckErrors);
+	putCounter(&r, "spi_seq_errors_total", "Exchanges missing from the count", cst.nSeqErrors);
+	putCounter(&r, "spi_clock_backoffs_total", "Clock steps down for errors", cst.nBackoffs);
+	putCounter(&r, "spi_clock_stepups_total", "Clock steps back up after clean exchanges", cst.nStepUps);
+	putCounter(&r, "spi_clock_tests_total", "Test frames sent", cst.nTests);
+	putCounter(&r, "spi_clock_test_failures_total", "Test frames lost or damaged", cst.nTestFails);
+
+	// timer jitter
+	reactorGetStats(&rst);
+	putCounter(&r, "ticks_total", "Ticks run", rst.nTicks);
+	putCounter(&r, "ticks_missed_total", "Deadlines passed before the tick ran", rst.nMissed);
+	putCounter(&r, "ticks_early_total", "Ticks pulled in", rst.nEarly);
+	putGauge(&r, "tick_late_max_us", "Latest a tick has run, us", rst.maxLate);
+
+	// fragments
+	reasmGetStats(&ast);
+	putCounter(&r, "reasm_fragments_total", "Fragments received", ast.nFrags);
+	putCounter(&r, "reasm_frames_total", "Frames reassembled", ast.nFrames);
+	putCounter(&r, "reasm_out_of_order_total", "Fragments after a gap, stream dropped", ast.nOutOfOrder);
+	putCounter(&r, "reasm_duplicates_total", "Fragments already held", ast.nDuplicates);
+	putCounter(&r, "reasm_bad_total", "Fragments past the end or too many", ast.nBadFrags);
+	putCounter(&r, "reasm_timeouts_total", "Streams not completed in time", ast.nTimeouts);
+	putCounter(&r, "reasm_evicted_total", "Streams pushed out by a new one", ast.nEvicted);
+	putCounter(&r, "reasm_restarts_total", "Streams dropped for a new first fragment", ast.nRestarts);
+	putGauge(&r, "reasm_max_streams", "Most streams at once", ast.maxStreams);
+
+	// UDP in and out
+	udp_get_stats(&ust);
+	putCounter(&r, "udp_rx_calls_total", "recvmmsg calls", ust.nRxCalls);
+	putCounter(&r, "udp_rx_frames_total", "Datagrams received", ust.nRxFrames);
+	putCounter(&r, "udp_tx_calls_total", "sendmmsg calls", ust.nTxCalls);
+	putCounter(&r, "udp_tx_frames_total", "Datagrams sent", ust.nTxFrames);
+	putCounter(&r, "udp_tx_drops_total", "Datagrams failed or too long", ust.nTxDrops);
+	putCounter(&r, "udp_unsubscribed_total", "Frames no subscriber wanted", ust.nUnsubscribed);
+	putGauge(&r, "udp_tx_room_bytes", "Room in the socket send buffer", udp_tx_room());
+
+	// tun interface
+	tunGetStats(&tst);
+	putCounter(&r, "tun_tx_packets_total", "Packets to the mesh", tst.nTxPackets);
+	putCounter(&r, "tun_rx_packets_total", "Packets from the mesh", tst.nRxPackets);
+	putCounter(&r, "tun_no_route_total", "No callsign for the address", tst.nNoRoute);
+	putCounter(&r, "tun_tx_drops_total", "Packets to the mesh dropped", tst.nTxDrops);
+	putCounter(&r, "tun_rx_drops_total", "Packets from the mesh dropped", tst.nRxDrops);
+
+	// KISS clients
+	kissGetStats(&kst);
+	putGauge(&r, "kiss_clients", "KISS clients connected", kst.nClients);
+	putCounter(&r, "kiss_connects_total", "KISS clients accepted", kst.nConnects);
+	putCounter(&r, "kiss_tx_frames_total", "Frames from KISS clients to the mesh", kst.nTxFrames);
+	putCounter(&r, "kiss_rx_frames_total", "Frames from the mesh to KISS clients", kst.nRxFrames);
+	putCounter(&r, "kiss_tx_drops_total", "Frames from KISS clients dropped", kst.nTxDrops);
+	putCounter(&r, "kiss_rx_drops_total", "Frames a KISS client was too slow for", kst.nRxDrops);
+	putCounter(&r, "kiss_commands_total", "KISS commands ignored", kst.nCommands);
+
+	// the logger
+	logGetStats(&lst);
+	putCounter(&r, "log_records_total", "Log records queued", lst.nLogged);
+	putCounter(&r, "log_written_total", "Log records written", lst.nWritten);
+	putCounter(&r, "log_dropped_total", "Log records dropped, ring full", lst.nDropped);
+	putCounter(&r, "log_suppressed_total", "Log lines over the rate for their call site", lst.nSuppressed);
+
+	return r.len;
+}
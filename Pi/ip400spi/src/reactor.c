@@ -0,0 +1,327 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        reactor.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Event loop. A single thread waits in epoll on the
+                          tick timer and every other descriptor, so the SPI
+                          task and the UDP socket share the transmit queue
+                          without locks, and there are no signals or thread
+                          switches between a timer expiring and the exchange.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "types.h"
+#include "logger.h"
+#include "timer.h"
+#include "reactor.h"
+#include "metrics.h"
+
+// local defines
+#define	TICK_SOURCE		REACTOR_MAX_SOURCES		// epoll id of the tick timer
+#define	NS_PER_SEC		1000000000LL
+
+// a descriptor being watched
+struct reactor_source_t	{
+	int					fd;					// descriptor, -1 if free
+	REACTOR_HANDLER		handler;			// called when it is ready
+	void				*arg;				// handler argument
+	uint32_t			events;				// what it is watched for
+};
+static struct reactor_source_t sources[REACTOR_MAX_SOURCES];
+
+// locals
+static int epollFD = -1;					// epoll instance
+static int tickFD = -1;						// tick timer
+static void (*tickFunction)(void);			// called each tick
+static int64_t tickInterval;				// ns between ticks
+static int64_t periodic;					// next periodic deadline
+static int64_t deadline;					// next deadline: periodic or pulled in
+static int64_t lastStatsLog;				// when jitter was last logged
+static BOOL reactorExit;					// stop the loop
+static REACTOR_STATS stats;					// tick timing
+
+// monotonic time in ns
+static int64_t monoNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * NS_PER_SEC) + ts.tv_nsec;
+}
+
+// set the timer for an absolute deadline
+static void armTick(int64_t when)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = when / NS_PER_SEC;
+	its.it_value.tv_nsec = when % NS_PER_SEC;
+	if(timerfd_settime(tickFD, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+		logger(LOG_ERROR, "Tick timer set failed: %s\n", strerror(errno));
+}
+
+/*
+ * Create the epoll instance
+ */
+BOOL reactorInit(void)
+{
+	for(int i=0;i<REACTOR_MAX_SOURCES;i++)
+		sources[i].fd = -1;
+
+	memset(&stats, 0, sizeof(stats));
+	reactorExit = FALSE;
+	tickFunction = NULL;
+
+	if((epollFD = epoll_create1(EPOLL_CLOEXEC)) == -1)	{
+		logger(LOG_ERROR, "Cannot create epoll instance: %s\n", strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Watch a descriptor for input
+ */
+BOOL reactorAdd(int fd, REACTOR_HANDLER handler, void *arg)
+{
+	struct epoll_event ev;
+
+	for(int i=0;i<REACTOR_MAX_SOURCES;i++)	{
+		if(sources[i].fd != -1)
+			continue;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if(epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &ev) == -1)	{
+			logger(LOG_ERROR, "Cannot watch fd %d: %s\n", fd, strerror(errno));
+			return FALSE;
+		}
+		sources[i].fd = fd;
+		sources[i].handler = handler;
+		sources[i].arg = arg;
+		sources[i].events = EPOLLIN;
+		return TRUE;
+	}
+
+	logger(LOG_ERROR, "No room to watch fd %d\n", fd);
+	return FALSE;
+}
+
+/*
+ * Stop watching a descriptor
+ */
+BOOL reactorRemove(int fd)
+{
+	for(int i=0;i<REACTOR_MAX_SOURCES;i++)	{
+		if(sources[i].fd != fd)
+			continue;
+		epoll_ctl(epollFD, EPOLL_CTL_DEL, fd, NULL);
+		sources[i].fd = -1;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+// set or clear one of the events a descriptor is watched for
+static BOOL reactorWatch(int fd, uint32_t event, BOOL enable)
+{
+	struct epoll_event ev;
+
+	for(int i=0;i<REACTOR_MAX_SOURCES;i++)	{
+		if(sources[i].fd != fd)
+			continue;
+		uint32_t events = enable ? (sources[i].events | event) : (sources[i].events & ~event);
+		if(events == sources[i].events)
+			return TRUE;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.u32 = i;
+		if(epoll_ctl(epollFD, EPOLL_CTL_MOD, fd, &ev) == -1)
+			return FALSE;
+		sources[i].events = events;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Stop or start watching a descriptor for input, leaving it registered
+ */
+BOOL reactorEnable(int fd, BOOL enable)
+{
+	return reactorWatch(fd, EPOLLIN, enable);
+}
+
+/*
+ * Watch a descriptor for room to write as well: the
+ * handler gets EPOLLOUT until this is turned off
+ */
+BOOL reactorEnableOutput(int fd, BOOL enable)
+{
+	return reactorWatch(fd, EPOLLOUT, enable);
+}
+
+/*
+ * Call a function every interval ms
+ */
+BOOL reactorStartTick(int interval, void (*tick_function)(void))
+{
+	struct epoll_event ev;
+
+	if((tickFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)	{
+		logger(LOG_ERROR, "Cannot create tick timer: %s\n", strerror(errno));
+		return FALSE;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = TICK_SOURCE;
+	if(epoll_ctl(epollFD, EPOLL_CTL_ADD, tickFD, &ev) == -1)	{
+		logger(LOG_ERROR, "Cannot watch tick timer: %s\n", strerror(errno));
+		return FALSE;
+	}
+
+	tickFunction = tick_function;
+	tickInterval = MSTONS(interval);
+	lastStatsLog = monoNow();
+	periodic = deadline = lastStatsLog + tickInterval;
+	armTick(deadline);
+	return TRUE;
+}
+
+/*
+ * Run the next tick in delay us rather than at the next
+ * period, if that is sooner
+ */
+void reactorNextTick(int delay)
+{
+	int64_t when = monoNow() + ((int64_t)delay * 1000);
+
+	if((tickFD == -1) || (when >= deadline))
+		return;
+
+	deadline = when;
+	stats.nEarly++;
+	armTick(deadline);
+}
+
+// log the tick timing
+static void logStats(int severity)
+{
+	if(stats.nTicks == 0)
+		return;
+
+	logger(severity, "Ticks %u, missed %u, pulled in %u, late us: %u avg %u min %u max, p99 under %u\n",
+			stats.nTicks, stats.nMissed, stats.nEarly,
+			(uint32_t)(stats.totLate/stats.nTicks), stats.minLate, stats.maxLate,
+			metricPercentile(MET_HIST_TICK_LATE, 990));
+}
+
+// the tick timer expired
+static void runTick(void)
+{
+	uint64_t expirations;
+
+	if(read(tickFD, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	// how late are we
+	int64_t now = monoNow();
+	uint32_t late = (now > deadline) ? (uint32_t)((now - deadline)/1000) : 0;
+	if((stats.nTicks++ == 0) || (late < stats.minLate))
+		stats.minLate = late;
+	if(late > stats.maxLate)
+		stats.maxLate = late;
+	stats.totLate += late;
+	metricObserve(MET_HIST_TICK_LATE, late);
+
+	// the next periodic deadline, skipping any we have passed
+	if(deadline >= periodic)	{
+		periodic += tickInterval;
+		if(periodic <= now)	{
+			int64_t nMissed = ((now - periodic)/tickInterval) + 1;
+			stats.nMissed += nMissed;
+			periodic += nMissed * tickInterval;
+		}
+	}
+	deadline = periodic;
+	armTick(deadline);
+
+	// the tick function may pull the next one in
+	(*tickFunction)();
+
+	if((now - lastStatsLog) >= ((int64_t)REACTOR_STATS_TIME * NS_PER_SEC))	{
+		logStats(LOG_DEBUG);
+		lastStatsLog = now;
+	}
+}
+
+/*
+ * Wait for events and dispatch them. Does not
+ * return until stopped
+ */
+BOOL reactorRun(void)
+{
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	while(!reactorExit)	{
+
+		int nEvents = epoll_wait(epollFD, events, REACTOR_MAX_EVENTS, -1);
+		if(nEvents == -1)	{
+			if(errno == EINTR)
+				continue;
+			logger(LOG_ERROR, "Event wait failed: %s\n", strerror(errno));
+			return FALSE;
+		}
+
+		for(int i=0;i<nEvents;i++)	{
+			uint32_t id = events[i].data.u32;
+			if(id == TICK_SOURCE)	{
+				runTick();
+				continue;
+			}
+			if((id < REACTOR_MAX_SOURCES) && (sources[id].fd != -1))
+				(*sources[id].handler)(sources[id].fd, events[i].events, sources[id].arg);
+		}
+	}
+
+	logStats(LOG_NOTICE);
+	if(tickFD != -1)
+		close(tickFD);
+	close(epollFD);
+	tickFD = epollFD = -1;
+	return TRUE;
+}
+
+void reactorStop(void)
+{
+	reactorExit = TRUE;
+}
+
+void reactorGetStats(REACTOR_STATS *s)
+{
+	memcpy(s, &stats, sizeof(REACTOR_STATS));
+}
@@ -0,0 +1,259 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        reasm.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Reassembles fragmented frames from the node, several
+                          streams at once, and sends each complete frame to
+                          UDP as a single datagram.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "logger.h"
+#include "spidefs.h"
+#include "reasm.h"
+
+// a stream being reassembled
+struct reasm_stream_t	{
+	BOOL				inUse;					// stream is active
+	struct reasm_key_t	key;					// who it is from and to
+	int64_t				started;				// ms, first fragment
+	uint16_t			total;					// frame length, once the last is in
+	uint16_t			held;					// bytes covered
+	uint16_t			nextOffset;				// end of the in-order data
+	uint8_t				nSegs;					// fragments received
+	struct	{
+		uint16_t		offset;
+		uint16_t		length;
+	} segs[REASM_SEGMENTS];						// where each one went
+	union	{
+		struct {
+			struct spi_hdr_t	hdr;
+			uint8_t		buffer[SPI_REASM_MAX];
+		} frame;
+		uint8_t			rawData[sizeof(struct spi_hdr_t) + SPI_REASM_MAX];
+	} buf;
+};
+
+static struct reasm_stream_t streams[REASM_STREAMS];
+static REASM_STATS stats;
+
+// monotonic time in ms
+static int64_t reasmNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void reasmKey(struct spi_hdr_t *hdr, struct reasm_key_t *key)
+{
+	memcpy(key->fromCall, hdr->fromCall, N_CALL);
+	memcpy(key->fromIP, hdr->fromPort, IP_400_PORT_SIZE);
+	memcpy(key->toCall, hdr->toCall, N_CALL);
+	memcpy(key->toIP, hdr->toPort, IP_400_PORT_SIZE);
+}
+
+/*
+ * Find the stream for a key, or start one. A full
+ * table gives up the oldest stream
+ */
+static struct reasm_stream_t *reasmStream(struct reasm_key_t *key)
+{
+	struct reasm_stream_t *slot = NULL, *oldest = NULL;
+	uint32_t nActive = 0;
+
+	for(int i=0;i<REASM_STREAMS;i++)	{
+		struct reasm_stream_t *s = &streams[i];
+		if(!s->inUse)	{
+			if(slot == NULL)
+				slot = s;
+			continue;
+		}
+		if(memcmp(&s->key, key, sizeof(struct reasm_key_t)) == 0)
+			return s;
+		if((oldest == NULL) || (s->started < oldest->started))
+			oldest = s;
+		nActive++;
+	}
+
+	if(slot == NULL)	{
+		logger(LOG_DEBUG, "Reassembly table full, dropped a stream with %d bytes\n", oldest->held);
+		stats.nEvicted++;
+		slot = oldest;
+		nActive--;
+	}
+
+	if(++nActive > stats.maxStreams)
+		stats.maxStreams = nActive;
+
+	memset(slot, 0, offsetof(struct reasm_stream_t, buf));
+	slot->inUse = TRUE;
+	slot->key = *key;
+	slot->started = reasmNow();
+	return slot;
+}
+
+void reasmInit(void)
+{
+	memset(streams, 0, sizeof(streams));
+	memset(&stats, 0, sizeof(stats));
+}
+
+/*
+ * Add a fragment to its stream. Fragments come in order and
+ * may not overlap, so the bytes held are the bytes covered: when
+ * they reach the frame length, the frame goes to UDP and the
+ * stream is freed
+ */
+void reasmFragment(struct spi_hdr_t *hdr, uint8_t *data)
+{
+	struct reasm_key_t key;
+	struct reasm_stream_t *s;
+
+	uint8_t fragStat = hdr->status & SPI_STATUS_MASK;
+	uint16_t offset = ((uint16_t)hdr->offset_hi << 8) + hdr->offset_lo;
+	uint16_t length = ((uint16_t)hdr->length_hi << 8) + hdr->length_lo;
+
+	stats.nFrags++;
+
+	// must fit in the buffer before it gets a stream
+	if((length > SPI_BUFFER_LEN) || ((offset + length) > SPI_REASM_MAX))	{
+		logger(LOG_DEBUG, "Fragment at %d, %d bytes, out of range\n", offset, length);
+		stats.nBadFrags++;
+		return;
+	}
+
+	reasmKey(hdr, &key);
+	s = reasmStream(&key);
+
+	/*
+	 * The start of a frame on a stream that already has data:
+	 * the end of the last one was lost. Its fragments would
+	 * be taken as duplicates or spliced into this one, so it
+	 * is dropped and the stream starts over
+	 */
+	if(((fragStat == FIRST_FRAGMENT) || (offset == 0)) && (s->nSegs != 0))	{
+		logger(LOG_DEBUG, "New frame on a stream with %d bytes in %d fragments\n", s->held, s->nSegs);
+		stats.nRestarts++;
+		memset(s, 0, offsetof(struct reasm_stream_t, buf));
+		s->inUse = TRUE;
+		s->key = key;
+		s->started = reasmNow();
+	}
+
+	// and in the frame, once its length is known
+	if((s->total != 0) && (((offset + length) > s->total) ||
+			((fragStat == LAST_FRAGMENT) && ((offset + length) != s->total))))	{
+		logger(LOG_DEBUG, "Fragment at %d, %d bytes, past the end\n", offset, length);
+		stats.nBadFrags++;
+		return;
+	}
+
+	// seen it already, or it overlaps one that was
+	for(int i=0;i<s->nSegs;i++)	{
+		uint16_t segOffset = s->segs[i].offset;
+		uint16_t segEnd = segOffset + s->segs[i].length;
+		if((segOffset == offset) && (segEnd == (offset + length)))	{
+			stats.nDuplicates++;
+			return;
+		}
+		if((offset < segEnd) && (segOffset < (offset + length)))	{
+			logger(LOG_DEBUG, "Fragment at %d, %d bytes, overlaps one at %d\n", offset, length, segOffset);
+			stats.nBadFrags++;
+			s->inUse = FALSE;
+			return;
+		}
+		// the last fragment ends the frame
+		if((fragStat == LAST_FRAGMENT) && (segEnd > (offset + length)))	{
+			logger(LOG_DEBUG, "Last fragment ends at %d, before one at %d\n", offset + length, segOffset);
+			stats.nBadFrags++;
+			s->inUse = FALSE;
+			return;
+		}
+	}
+
+	if(s->nSegs == REASM_SEGMENTS)	{
+		logger(LOG_DEBUG, "Too many fragments in a stream\n");
+		stats.nBadFrags++;
+		s->inUse = FALSE;
+		return;
+	}
+
+	/*
+	 * A fragment that does not start where the data ends: one
+	 * before it was lost. Keeping the stream would let the rest
+	 * of the next frame fill the gap, so it is dropped
+	 */
+	if(offset != s->nextOffset)	{
+		logger(LOG_DEBUG, "Fragment at %d after a gap at %d, stream dropped\n", offset, s->nextOffset);
+		stats.nOutOfOrder++;
+		s->inUse = FALSE;
+		return;
+	}
+	s->nextOffset = offset + length;
+
+	s->segs[s->nSegs].offset = offset;
+	s->segs[s->nSegs].length = length;
+	s->nSegs++;
+	s->held += length;
+	memcpy(s->buf.frame.buffer + offset, data, length);
+
+	if(fragStat == LAST_FRAGMENT)
+		s->total = offset + length;
+
+	if((s->total == 0) || (s->held < s->total))
+		return;
+
+	// complete: one datagram for the lot, the header
+	// fields being the same in every fragment
+	s->buf.frame.hdr = *hdr;
+	s->buf.frame.hdr.status = SINGLE_FRAME;
+	s->buf.frame.hdr.offset_hi = s->buf.frame.hdr.offset_lo = 0;
+	s->buf.frame.hdr.length_hi = (s->total >> 8);
+	s->buf.frame.hdr.length_lo = (s->total & 0xFF);
+
+	spiDeliver(s->buf.rawData, s->total + sizeof(struct spi_hdr_t));
+	stats.nFrames++;
+	s->inUse = FALSE;
+}
+
+/*
+ * Drop streams that have taken too long
+ */
+void reasmExpire(void)
+{
+	int64_t now = reasmNow();
+
+	for(int i=0;i<REASM_STREAMS;i++)	{
+		struct reasm_stream_t *s = &streams[i];
+		if(!s->inUse || ((now - s->started) < REASM_TIMEOUT))
+			continue;
+		logger(LOG_DEBUG, "Reassembly timed out with %d bytes in %d fragments\n", s->held, s->nSegs);
+		stats.nTimeouts++;
+		s->inUse = FALSE;
+	}
+}
+
+void reasmGetStats(REASM_STATS *st)
+{
+	memcpy(st, &stats, sizeof(REASM_STATS));
+}
@@ -0,0 +1,141 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        rt.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Real-time mode for the thread that runs the SPI
+                          exchange: SCHED_FIFO, CPU pinning, locked and
+                          prefaulted memory. Each part falls back on its own
+                          if the system does not allow it.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+
+#include "types.h"
+#include "logger.h"
+#include "metrics.h"
+#include "rt.h"
+
+// locals
+static BOOL rtActive = FALSE;			// something was set up
+static long startFaults;				// page faults when set up
+
+// touch the stack we will need, so it is mapped and locked
+static void __attribute__((noinline)) prefaultStack(void)
+{
+	volatile uint8_t stack[RT_STACK_PREFAULT];
+	long page = sysconf(_SC_PAGESIZE);
+
+	for(int i=0;i<RT_STACK_PREFAULT;i+=page)
+		stack[i] = 0;
+	(void)stack[0];
+}
+
+// page faults taken so far by this thread
+static long threadFaults(void)
+{
+	struct rusage ru;
+
+	if(getrusage(RUSAGE_THREAD, &ru) == -1)
+		return 0;
+	return ru.ru_minflt + ru.ru_majflt;
+}
+
+/*
+ * Lock memory, then schedule and pin the calling thread.
+ * Returns FALSE only for a bad priority or CPU
+ */
+BOOL rtSetup(int priority, int cpu)
+{
+	if(priority != RT_PRIORITY_NONE)	{
+		int minPrio = sched_get_priority_min(SCHED_FIFO), maxPrio = sched_get_priority_max(SCHED_FIFO);
+		if((priority < minPrio) || (priority > maxPrio))	{
+			logger(LOG_ERROR, "Real-time priority must be %d to %d\n", minPrio, maxPrio);
+			return FALSE;
+		}
+	}
+	if((cpu != RT_CPU_ANY) && ((cpu < 0) || (cpu >= sysconf(_SC_NPROCESSORS_CONF))))	{
+		logger(LOG_ERROR, "No CPU %d\n", cpu);
+		return FALSE;
+	}
+
+	if(priority != RT_PRIORITY_NONE)	{
+
+		// keep freed memory, rather than fault it back in later
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_MAX, 0);
+
+		// everything mapped now, and anything mapped later
+		if(mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+			logger(LOG_NOTICE, "Cannot lock memory, carrying on without: %s\n", strerror(errno));
+		prefaultStack();
+
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(err != 0)
+			logger(LOG_NOTICE, "Cannot run SCHED_FIFO, carrying on without: %s\n", strerror(err));
+		else
+			logger(LOG_NOTICE, "SPI thread is SCHED_FIFO priority %d\n", priority);
+
+		// wake on time, not when convenient
+		prctl(PR_SET_TIMERSLACK, RT_TIMER_SLACK, 0, 0, 0);
+		rtActive = TRUE;
+	}
+
+	if(cpu != RT_CPU_ANY)	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if(err != 0)
+			logger(LOG_NOTICE, "Cannot pin to CPU %d, carrying on without: %s\n", cpu, strerror(err));
+		else
+			logger(LOG_NOTICE, "SPI thread pinned to CPU %d\n", cpu);
+		rtActive = TRUE;
+	}
+
+	startFaults = threadFaults();
+	return TRUE;
+}
+
+/*
+ * Say how it went: faults taken since setup,
+ * and how late exchanges started
+ */
+void rtClose(void)
+{
+	if(!rtActive)
+		return;
+
+	logger(LOG_NOTICE, "Real-time: %ld page faults since setup, start error us: p50 %u p99 %u p99.9 %u\n",
+			threadFaults() - startFaults,
+			metricPercentile(MET_HIST_TICK_LATE, 500), metricPercentile(MET_HIST_TICK_LATE, 990),
+			metricPercentile(MET_HIST_TICK_LATE, 999));
+	rtActive = FALSE;
+}
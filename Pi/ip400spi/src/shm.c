@@ -0,0 +1,332 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        shm.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Shared memory clients. Each local application gets
+                          a pair of rings in a memfd: frames from the node are
+                          copied once, into its rx ring, and read in place;
+                          frames it puts in its tx ring go to the node. An
+                          eventfd each way says there is something new.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "types.h"
+#include "logger.h"
+#include "spidefs.h"
+#include "reactor.h"
+#include "shm.h"
+
+// a connected application
+struct shm_client_t	{
+	int				connFD;					// unix socket, -1 if free
+	int				memFD;					// the region
+	int				rxBell;					// we signal: frames for it
+	int				txBell;					// it signals: frames for us
+	SHM_REGION		*region;				// mapped
+	uint16_t		codings;				// what it wants
+	BOOL			rxPending;				// frames since the last signal
+	BOOL			txPaused;				// tx ring waiting for room
+	uint32_t		nRx;					// frames to it
+	uint32_t		nTx;					// frames from it
+};
+
+static struct shm_client_t clients[SHM_MAX_CLIENTS];
+static int listenFD = -1;
+static char sockPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static void shmAccept(int fd, uint32_t events, void *arg);
+static void shmConnEvent(int fd, uint32_t events, void *arg);
+static void shmTxEvent(int fd, uint32_t events, void *arg);
+
+/*
+ * Listen for applications
+ */
+BOOL shmOpen(char *path)
+{
+	struct sockaddr_un addr;
+
+	for(int i=0;i<SHM_MAX_CLIENTS;i++)
+		clients[i].connFD = -1;
+
+	if((listenFD = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)	{
+		logger(LOG_ERROR, "Cannot create shared memory socket: %s\n", strerror(errno));
+		return FALSE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	strcpy(sockPath, addr.sun_path);
+	unlink(sockPath);
+
+	if((bind(listenFD, (struct sockaddr *)&addr, sizeof(addr)) == -1) || (listen(listenFD, SHM_MAX_CLIENTS) == -1))	{
+		logger(LOG_ERROR, "Cannot listen on %s: %s\n", sockPath, strerror(errno));
+		close(listenFD);
+		listenFD = -1;
+		return FALSE;
+	}
+
+	if(!reactorAdd(listenFD, shmAccept, NULL))
+		return FALSE;
+
+	logger(LOG_NOTICE, "Shared memory clients on %s\n", sockPath);
+	return TRUE;
+}
+
+// done with an application
+static void shmDrop(struct shm_client_t *c)
+{
+	logger(LOG_NOTICE, "Shared memory client gone: %u frames to it, %u dropped, %u from it\n",
+			c->nRx, (c->region != NULL) ? c->region->rx.nDrops : 0, c->nTx);
+
+	reactorRemove(c->connFD);
+	close(c->connFD);
+	if(c->region != NULL)	{
+		reactorRemove(c->txBell);
+		munmap(c->region, sizeof(SHM_REGION));
+		close(c->memFD);
+		close(c->rxBell);
+		close(c->txBell);
+	}
+	c->connFD = -1;
+}
+
+void shmClose(void)
+{
+	for(int i=0;i<SHM_MAX_CLIENTS;i++)
+		if(clients[i].connFD != -1)
+			shmDrop(&clients[i]);
+
+	if(listenFD != -1)	{
+		reactorRemove(listenFD);
+		close(listenFD);
+		unlink(sockPath);
+		listenFD = -1;
+	}
+}
+
+// a new connection: wait for its hello
+static void shmAccept(int fd, uint32_t events, void *arg)
+{
+	int conn = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(conn == -1)
+		return;
+
+	for(int i=0;i<SHM_MAX_CLIENTS;i++)	{
+		struct shm_client_t *c = &clients[i];
+		if(c->connFD != -1)
+			continue;
+		memset(c, 0, sizeof(struct shm_client_t));
+		c->connFD = conn;
+		if(!reactorAdd(conn, shmConnEvent, c))	{
+			c->connFD = -1;
+			break;
+		}
+		return;
+	}
+
+	logger(LOG_ERROR, "No room for a shared memory client\n");
+	close(conn);
+}
+
+/*
+ * Build the region and doorbells, and pass them over
+ */
+static BOOL shmSetup(struct shm_client_t *c)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	uint8_t ok = 1;
+	union {
+		char			buf[CMSG_SPACE(SHM_N_FDS * sizeof(int))];
+		struct cmsghdr	align;
+	} ctl;
+
+	if((c->memFD = memfd_create("ip400shm", MFD_CLOEXEC)) == -1)
+		return FALSE;
+	if(ftruncate(c->memFD, sizeof(SHM_REGION)) == -1)	{
+		close(c->memFD);
+		return FALSE;
+	}
+	c->region = mmap(NULL, sizeof(SHM_REGION), PROT_READ | PROT_WRITE, MAP_SHARED, c->memFD, 0);
+	if(c->region == MAP_FAILED)	{
+		c->region = NULL;
+		close(c->memFD);
+		return FALSE;
+	}
+	c->region->magic = SHM_MAGIC;
+	c->region->version = SHM_VERSION;
+
+	c->rxBell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	c->txBell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &ok;
+	iov.iov_len = sizeof(ok);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(SHM_N_FDS * sizeof(int));
+	int fds[SHM_N_FDS] = { c->memFD, c->rxBell, c->txBell };
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if((c->rxBell == -1) || (c->txBell == -1) || (sendmsg(c->connFD, &msg, 0) == -1))
+		return FALSE;
+
+	return reactorAdd(c->txBell, shmTxEvent, c);
+}
+
+// the hello, or the application going away
+static void shmConnEvent(int fd, uint32_t events, void *arg)
+{
+	struct shm_client_t *c = (struct shm_client_t *)arg;
+	SHM_HELLO hello;
+
+	ssize_t len = recv(fd, &hello, sizeof(hello), 0);
+	if((len == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+		return;
+
+	if(len <= 0)	{
+		shmDrop(c);
+		return;
+	}
+
+	// already set up: nothing more to say
+	if(c->region != NULL)
+		return;
+
+	if((len != sizeof(hello)) || (hello.magic != SHM_MAGIC) || (hello.version != SHM_VERSION))	{
+		logger(LOG_ERROR, "Bad shared memory hello\n");
+		shmDrop(c);
+		return;
+	}
+
+	c->codings = hello.codings;
+	if(!shmSetup(c))	{
+		logger(LOG_ERROR, "Cannot set up shared memory client: %s\n", strerror(errno));
+		shmDrop(c);
+		return;
+	}
+	logger(LOG_NOTICE, "Shared memory client, codings %04X\n", c->codings);
+}
+
+/*
+ * A frame from the node: into the rx ring of each
+ * application that wants it
+ */
+void shmDeliver(uint8_t *frame, uint16_t length)
+{
+	struct spi_hdr_t *hdr = (struct spi_hdr_t *)frame;
+	uint16_t coding = 1 << (hdr->coding & 0x0F);
+
+	for(int i=0;i<SHM_MAX_CLIENTS;i++)	{
+		struct shm_client_t *c = &clients[i];
+		if((c->region == NULL) || !(c->codings & coding))
+			continue;
+
+		SHM_SLOT *slot = shmRingSlot(&c->region->rx);
+		if((slot == NULL) || (length > SHM_SLOT_LEN))	{
+			c->region->rx.nDrops++;
+			continue;
+		}
+		memcpy(slot->data, frame, length);
+		slot->length = length;
+		shmRingCommit(&c->region->rx);
+		c->rxPending = TRUE;
+		c->nRx++;
+	}
+}
+
+/*
+ * Tell each application with new frames: once per
+ * exchange, however many there were
+ */
+void shmFlush(void)
+{
+	uint64_t one = 1;
+
+	for(int i=0;i<SHM_MAX_CLIENTS;i++)	{
+		struct shm_client_t *c = &clients[i];
+		if((c->region == NULL) || !c->rxPending)
+			continue;
+		if(write(c->rxBell, &one, sizeof(one)) == -1)
+			logger(LOG_DEBUG, "Shared memory doorbell failed: %s\n", strerror(errno));
+		c->rxPending = FALSE;
+	}
+}
+
+// frames from an application, while the tx ring has room
+static void shmTxDrain(struct shm_client_t *c)
+{
+	SHM_SLOT *slot;
+	SPI_DATA_FRAME spiFrame;
+
+	while((slot = shmRingPeek(&c->region->tx)) != NULL)	{
+
+		if(spiTxRoom() == 0)	{
+			c->txPaused = TRUE;
+			return;
+		}
+
+		if((slot->length >= sizeof(struct spi_hdr_t)) && (slot->length <= SHM_SLOT_LEN) && isIP400Frame(slot->data))	{
+			spiFrame.buffer = slot->data;
+			spiFrame.length = slot->length;
+			EnqueSPIFrame(&spiFrame);
+			c->nTx++;
+		}
+		shmRingRelease(&c->region->tx);
+	}
+}
+
+static void shmTxEvent(int fd, uint32_t events, void *arg)
+{
+	uint64_t count;
+
+	if(read(fd, &count, sizeof(count)) != sizeof(count))
+		return;
+	shmTxDrain((struct shm_client_t *)arg);
+}
+
+/*
+ * Room in the tx ring again: carry on with
+ * any application that was waiting
+ */
+void shm_rx_resume(void)
+{
+	for(int i=0;i<SHM_MAX_CLIENTS;i++)	{
+		struct shm_client_t *c = &clients[i];
+		if((c->region == NULL) || !c->txPaused)
+			continue;
+		c->txPaused = FALSE;
+		shmTxDrain(c);
+	}
+}
@@ -23,17 +23,35 @@
 #include "spidefs.h"
 #include "logger.h"
 
+// the emulator's socket
+static char emuPath[108] = SPI_EMU_SOCKET;
+
 // translate SPI logical devices to real devices
 char *devnames[N_SPI] = {
 		SPI_0_DEV_0,
 		SPI_0_DEV_1,
 		SPI_1_DEV_0,
 		SPI_1_DEV_1,
-        SPI_1_DEV_2
+        SPI_1_DEV_2,
+		emuPath
 };
 
 SPI_CONFIG spi_config[N_SPI];	// SPI configurations
 
+// spidev
+static int spidevOpen(int device);
+static int spidevTransfer(int device, SPI_WORD *txdata, SPI_WORD *rxdata, int length);
+static int spidevTransferv(int device, SPI_XFER *xfers, int nXfers);
+static int spidevClose(int device);
+
+SPI_TRANSPORT spidevTransport = {
+		"spidev",
+		spidevOpen,
+		spidevTransfer,
+		spidevTransferv,
+		spidevClose
+};
+
 /*
  * setup the SPI devices
  */
@@ -43,12 +61,26 @@ void spi_setup(int device, uint8_t spiMode, uint8_t spibitsPerWord, int spiSpeed
     spi_config[device].bitsPerWord = spibitsPerWord;
     spi_config[device].speed = spiSpeed;
     spi_config[device].debug = debug;
+    spi_config[device].fd = -1;
+    spi_config[device].maxMessage = 0;
+    spi_config[device].transport = (device == SPI_EMU) ? &emuTransport : &spidevTransport;
 
 }
 
+/*
+ * A device name, or emu:path for the emulator
+ */
 int spi_lookup(char *devName)
 {
-	for(int i=0;i<N_SPI;i++)
+	int prefixLen = strlen(SPI_EMU_PREFIX);
+
+	if(!strncmp(devName, SPI_EMU_PREFIX, prefixLen))	{
+		if(devName[prefixLen] != '\0')
+			strncpy(emuPath, devName + prefixLen, sizeof(emuPath)-1);
+		return SPI_EMU;
+	}
+
+	for(int i=0;i<SPI_EMU;i++)
 		if(!strcmp(devName, devnames[i]))
 			return i;
 
@@ -56,9 +88,62 @@ int spi_lookup(char *devName)
 }
 
 /*
- * open an SPI device
+ * Through whichever transport the device uses
  */
 int spi_open(int device)
+{
+	if(spi_config[device].debug)
+		logger(LOG_NOTICE, "SPI transport %s\n", spi_config[device].transport->name);
+
+	return (*spi_config[device].transport->open)(device);
+}
+
+int spi_close(int device)
+{
+	return (*spi_config[device].transport->close)(device);
+}
+
+int spi_fdtransfer(int device, SPI_WORD *txdata, SPI_WORD *rxdata, int length)
+{
+	return (*spi_config[device].transport->transfer)(device, txdata, rxdata, length);
+}
+
+// several transfers in one go: returns the bytes clocked, or -1
+int spi_fdtransferv(int device, SPI_XFER *xfers, int nXfers)
+{
+	return (*spi_config[device].transport->transferv)(device, xfers, nXfers);
+}
+
+/*
+ * A new clock rate, from the next transfer: each one
+ * carries its own speed, so the device is left open
+ */
+void spi_setspeed(int device, uint32_t speed)
+{
+	spi_config[device].speed = speed;
+
+	if(spi_config[device].debug)
+		logger(LOG_NOTICE, "SPI clock on %s now %u Hz\n", devnames[device], speed);
+}
+
+// spidev refuses a message longer than its buffer
+static uint32_t spidevBufsiz(void)
+{
+	unsigned bufsiz = SPIDEV_BUFSIZ_DEF;
+
+	FILE *fp = fopen(SPIDEV_BUFSIZ, "r");
+	if(fp != NULL)	{
+		if(fscanf(fp, "%u", &bufsiz) != 1)
+			bufsiz = SPIDEV_BUFSIZ_DEF;
+		fclose(fp);
+	}
+	return bufsiz;
+}
+
+/*
+ * open an SPI device
+ */
+static int spidevOpen(int device)
 {
     int	spifd = -1;
     int statusVal = -1;
@@ -109,9 +194,11 @@ int spi_open(int device)
     }
 
     spi_config[device].fd = spifd;
+    spi_config[device].maxMessage = spidevBufsiz();
 
 	if(spi_config[device].debug)	{
-		logger(LOG_NOTICE, "Opened device %s with fd %d\n", devnames[device], spifd);
+		logger(LOG_NOTICE, "Opened device %s with fd %d, %u bytes per message\n", devnames[device], spifd,
+				spi_config[device].maxMessage);
     }
 
     return spifd;
@@ -120,10 +207,11 @@ int spi_open(int device)
 /*
  * close an SPI device
  */
-int spi_close(int spifd)
+static int spidevClose(int device)
 {
     int statusVal = -1;
-    statusVal = close(spifd);
+    statusVal = close(spi_config[device].fd);
+    spi_config[device].fd = -1;
     return statusVal;
 }
 
@@ -146,7 +234,7 @@ int spi_hdread(int fd, uint8_t *data, uint16_t length)
 /*
  * perform a full duplex read/write to the SPI using IOCTL
  */
-int spi_fdtransfer(int device, SPI_WORD *txdata, SPI_WORD *rxdata, int length)
+static int spidevTransfer(int device, SPI_WORD *txdata, SPI_WORD *rxdata, int length)
 {
 
 	static struct spi_ioc_transfer spi;
@@ -178,3 +266,38 @@ int spi_fdtransfer(int device, SPI_WORD *txdata, SPI_WORD *rxdata, int length)
 	return retVal;
 }
 
+
+/*
+ * Several full duplex transfers in one IOCTL. Chip select
+ * goes up between them, and the gap gives the node time to
+ * re-arm its DMA for the next
+ */
+static int spidevTransferv(int device, SPI_XFER *xfers, int nXfers)
+{
+	static struct spi_ioc_transfer spi[SPI_BATCH_MAX+1];
+	int retVal = -1;
+
+	if((nXfers < 1) || (nXfers > SPI_BATCH_MAX+1))
+		return -1;
+
+	memset(spi, 0, nXfers * sizeof(struct spi_ioc_transfer));
+
+	for(int i=0;i<nXfers;i++)	{
+		spi[i].tx_buf        = (unsigned long)(xfers[i].txdata);
+		spi[i].rx_buf        = (unsigned long)(xfers[i].rxdata);
+		spi[i].len           = sizeof(SPI_WORD)*xfers[i].length;
+		spi[i].delay_usecs   = (i < nXfers-1) ? xfers[i].gap : 0;
+		spi[i].speed_hz      = spi_config[device].speed;
+		spi[i].bits_per_word = spi_config[device].bitsPerWord;
+		spi[i].cs_change     = (i < nXfers-1) ? 1 : 0;
+		spi[i].tx_nbits      = 8;
+		spi[i].rx_nbits      = 8;
+	}
+
+	retVal = ioctl (spi_config[device].fd, SPI_IOC_MESSAGE(nXfers), spi);
+
+	if(spi_config[device].debug)
+		logger(LOG_NOTICE, "Did IOCTL of %d transfers on %s: %d\n", nXfers, devnames[device], retVal);
+
+	return retVal;
+}
@@ -0,0 +1,351 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        spiclock.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      SPI clock tuning: steps the clock up with test
+                          frames the node echoes, settles below the first
+                          rate with errors, and backs off when checked
+                          exchanges start failing.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "types.h"
+#include "spidefs.h"
+#include "logger.h"
+#include "spiclock.h"
+
+// the rates the clock steps through
+static const uint32_t clockSteps[] = {
+		SPI_SLOW_SPEED,
+		250000,
+		SPI_SPEED,
+		1000000,
+		2000000,
+		4000000,
+		8000000,
+		12000000,
+		16000000,
+		24000000,
+		32000000
+};
+#define	N_CLOCK_STEPS	((int)(sizeof(clockSteps)/sizeof(clockSteps[0])))
+
+// locals
+static int spiDevice;					// device to set
+static int clockStep;					// rate now
+static int startStep;					// SPI_SPEED
+static int goodStep;					// highest that passed, -1 for none
+static int topStep;						// highest to step back up to
+static SPI_CLOCK_STATS stats;
+
+// tuning
+static int nPassed;						// tests passed at this step
+static BOOL testOut;					// waiting for an echo
+static int testWait;					// exchanges waited for it
+static uint32_t testSeq;				// the test out, or next
+
+// backing off, and stepping back up
+static int windowExchanges;				// exchanges in the window
+static int windowErrors;				// bad ones
+static int cleanWindows;				// windows in a row without one
+static int stepUpWindows;				// clean windows to step up
+static BOOL steppedUp;					// on trial after a step up
+
+static void resetWindows(void)
+{
+	windowExchanges = windowErrors = 0;
+	cleanWindows = 0;
+	stepUpWindows = SPI_STEPUP_WINDOWS;
+	steppedUp = FALSE;
+}
+
+static void setStep(int step)
+{
+	clockStep = step;
+	stats.clockHz = clockSteps[step];
+	spi_setspeed(spiDevice, clockSteps[step]);
+}
+
+/*
+ * A test frame: its number, then a pattern that depends on
+ * it. Solid levels, alternate bits and a pseudo-random run
+ */
+static void testPattern(uint32_t seq, uint8_t *data)
+{
+	uint32_t lfsr = seq | 1;
+
+	data[0] = (seq >> 24);
+	data[1] = (seq >> 16) & 0xFF;
+	data[2] = (seq >> 8) & 0xFF;
+	data[3] = seq & 0xFF;
+
+	for(int i=4;i<SPI_BUFFER_LEN;i++)	{
+		switch(seq % 4)	{
+
+		case 0:
+			data[i] = 0x00;
+			break;
+
+		case 1:
+			data[i] = 0xFF;
+			break;
+
+		case 2:
+			data[i] = (i & 1) ? 0xAA : 0x55;
+			break;
+
+		default:
+			lfsr ^= lfsr << 13;
+			lfsr ^= lfsr >> 17;
+			lfsr ^= lfsr << 5;
+			data[i] = lfsr & 0xFF;
+			break;
+		}
+	}
+}
+
+/*
+ * Done stepping up, at a step that failed or the highest
+ * asked for: settle the margin below the highest that passed
+ */
+static void finishTuning(BOOL failed)
+{
+	uint32_t failedHz = stats.clockHz;
+	int step;
+
+	if(goodStep < 0)	{
+		step = (startStep > 0) ? startStep - 1 : 0;
+	} else {
+		step = goodStep - SPI_TUNE_MARGIN;
+		if(step < startStep)
+			step = startStep;
+	}
+
+	stats.tuning = FALSE;
+	stats.tuned = TRUE;
+	testOut = FALSE;
+	resetWindows();
+	topStep = step;
+	setStep(step);
+
+	if(failed)
+		logger(LOG_NOTICE, "SPI clock tuned to %u Hz, errors at %u Hz\n", stats.clockHz, failedHz);
+	else
+		logger(LOG_NOTICE, "SPI clock tuned to %u Hz\n", stats.clockHz);
+}
+
+static void stepFailed(char *reason)
+{
+	stats.nTestFails++;
+	logger(LOG_NOTICE, "Tuning the SPI clock: %s at %u Hz\n", reason, stats.clockHz);
+	finishTuning(TRUE);
+}
+
+// every test came back: on to the next rate, if there is one
+static void stepPassed(void)
+{
+	goodStep = clockStep;
+	nPassed = 0;
+
+	if((clockStep + 1 >= N_CLOCK_STEPS) || (clockSteps[clockStep + 1] > stats.maxHz))	{
+		finishTuning(FALSE);
+		return;
+	}
+	setStep(clockStep + 1);
+	logger(LOG_DEBUG, "Tuning the SPI clock: trying %u Hz\n", stats.clockHz);
+}
+
+/*
+ * Start at SPI_SPEED. A maximum above it
+ * tunes up to it once exchanges are checked
+ */
+void spiClockInit(int device, uint32_t maxHz)
+{
+	memset(&stats, 0, sizeof(stats));
+	spiDevice = device;
+	stats.maxHz = maxHz;
+
+	for(startStep=0;startStep<N_CLOCK_STEPS-1;startStep++)
+		if(clockSteps[startStep] >= SPI_SPEED)
+			break;
+	goodStep = -1;
+	topStep = startStep;
+	testOut = FALSE;
+	resetWindows();
+	setStep(startStep);
+}
+
+/*
+ * Exchanges are now checked: tune, if asked
+ * to and the node can echo test frames
+ */
+void spiClockLinkUp(BOOL canEcho)
+{
+	resetWindows();
+
+	if(stats.tuning || stats.tuned || (stats.maxHz <= stats.clockHz))
+		return;
+
+	if(!canEcho)	{
+		logger(LOG_NOTICE, "Node does not echo test frames, SPI clock stays at %u Hz\n", stats.clockHz);
+		stats.tuned = TRUE;
+		return;
+	}
+
+	logger(LOG_NOTICE, "Tuning the SPI clock from %u Hz, at most %u Hz\n", stats.clockHz, stats.maxHz);
+	stats.tuning = TRUE;
+	goodStep = -1;
+	nPassed = 0;
+	testOut = FALSE;
+}
+
+// back to unchecked exchanges: do not tune without checks
+void spiClockLinkDown(void)
+{
+	if(!stats.tuning)
+		return;
+
+	stats.tuning = FALSE;
+	testOut = FALSE;
+	setStep(startStep);
+	logger(LOG_NOTICE, "Checked exchanges stopped while tuning, SPI clock back to %u Hz\n", stats.clockHz);
+}
+
+BOOL spiClockTuning(void)
+{
+	return stats.tuning;
+}
+
+// a test frame should go next
+BOOL spiClockTestDue(void)
+{
+	return (stats.tuning && !testOut) ? TRUE : FALSE;
+}
+
+/*
+ * Fill in the next test frame, returning
+ * its length, or zero if none is due
+ */
+uint16_t spiClockTest(uint8_t *data)
+{
+	if(!spiClockTestDue())
+		return 0;
+
+	testPattern(testSeq, data);
+	testOut = TRUE;
+	testWait = 0;
+	stats.nTests++;
+	return SPI_BUFFER_LEN;
+}
+
+/*
+ * A test frame came back: it must be the one
+ * sent, and as it was
+ */
+void spiClockEcho(uint8_t *data, uint16_t length)
+{
+	static uint8_t expect[SPI_BUFFER_LEN];
+
+	// late, after tuning gave up
+	if(!stats.tuning || !testOut)
+		return;
+
+	testOut = FALSE;
+	testPattern(testSeq, expect);
+	if((length != SPI_BUFFER_LEN) || memcmp(data, expect, SPI_BUFFER_LEN))	{
+		stepFailed("test frame came back damaged");
+		return;
+	}
+
+	testSeq++;
+	if(++nPassed >= SPI_TUNE_TESTS)
+		stepPassed();
+}
+
+/*
+ * A checked exchange. While tuning, any error ends it;
+ * after, too many in the window take the clock down,
+ * and a long enough run of clean windows back up
+ */
+void spiClockExchange(SPI_LINK_RESULT result)
+{
+	stats.nChecked++;
+	switch(result)	{
+
+	case SPI_LINK_EYE:
+		stats.nEyeErrors++;
+		break;
+
+	case SPI_LINK_CRC:
+		stats.nCheckErrors++;
+		break;
+
+	case SPI_LINK_SEQ:
+		stats.nSeqErrors++;
+		break;
+
+	default:
+		break;
+	}
+
+	if(stats.tuning)	{
+		if(result != SPI_LINK_OK)
+			stepFailed((result == SPI_LINK_CRC) ? "CRC error" : (result == SPI_LINK_SEQ) ? "exchange lost" : "bad header");
+		else if(testOut && (++testWait > SPI_TUNE_WAIT))
+			stepFailed("test frame not echoed");
+		return;
+	}
+
+	if(result != SPI_LINK_OK)
+		windowErrors++;
+	if((++windowExchanges < SPI_BACKOFF_WINDOW) && (windowErrors < SPI_BACKOFF_ERRORS))
+		return;
+
+	if(windowErrors >= SPI_BACKOFF_ERRORS)	{
+		// the last step up did not hold: wait longer next time
+		if(steppedUp && (stepUpWindows < SPI_STEPUP_MAX))
+			stepUpWindows *= 2;
+		steppedUp = FALSE;
+		cleanWindows = 0;
+		if(clockStep > 0)	{
+			setStep(clockStep - 1);
+			stats.nBackoffs++;
+			logger(LOG_NOTICE, "%d bad exchanges in %d, SPI clock down to %u Hz\n",
+					windowErrors, windowExchanges, stats.clockHz);
+		}
+	} else if(windowErrors != 0)	{
+		cleanWindows = 0;
+	} else {
+		steppedUp = FALSE;
+		if((clockStep < topStep) && (++cleanWindows >= stepUpWindows))	{
+			setStep(clockStep + 1);
+			stats.nStepUps++;
+			steppedUp = TRUE;
+			cleanWindows = 0;
+			logger(LOG_NOTICE, "%d clean exchanges, SPI clock back up to %u Hz\n",
+					stepUpWindows * SPI_BACKOFF_WINDOW, stats.clockHz);
+		}
+	}
+	windowExchanges = windowErrors = 0;
+}
+
+void spiClockGetStats(SPI_CLOCK_STATS *s)
+{
+	memcpy(s, &stats, sizeof(SPI_CLOCK_STATS));
+}
@@ -0,0 +1,151 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        spiemu.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      SPI transport to the node emulator. Each transfer
+                          is one seqpacket message each way: the clock rate
+                          and what we clock out, and what the emulated node
+                          clocked back.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "types.h"
+#include "logger.h"
+#include "spidefs.h"
+
+static int emuOpen(int device);
+static int emuTransfer(int device, SPI_WORD *txdata, SPI_WORD *rxdata, int length);
+static int emuTransferv(int device, SPI_XFER *xfers, int nXfers);
+static int emuClose(int device);
+
+SPI_TRANSPORT emuTransport = {
+		"emulator",
+		emuOpen,
+		emuTransfer,
+		emuTransferv,
+		emuClose
+};
+
+/*
+ * Connect to the emulator, which must already be listening
+ */
+static int emuOpen(int device)
+{
+	struct sockaddr_un addr;
+	struct timeval tv;
+	int fd;
+
+	if((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1)	{
+		logger(LOG_ERROR, "Cannot create emulator socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, devnames[device], sizeof(addr.sun_path)-1);
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)	{
+		logger(LOG_ERROR, "Cannot reach the emulator on %s: %s\n", addr.sun_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	// a hung emulator looks like a dead node, not a hung daemon
+	tv.tv_sec = SPI_EMU_TIMEOUT / 1000;
+	tv.tv_usec = (SPI_EMU_TIMEOUT % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	logger(LOG_NOTICE, "Using the node emulator on %s\n", addr.sun_path);
+	spi_config[device].fd = fd;
+	spi_config[device].maxMessage = 0;
+	return fd;
+}
+
+static int emuClose(int device)
+{
+	int statusVal = close(spi_config[device].fd);
+	spi_config[device].fd = -1;
+	return statusVal;
+}
+
+/*
+ * Send the clock and what we clock out,
+ * read back the same length
+ */
+static int emuTransfer(int device, SPI_WORD *txdata, SPI_WORD *rxdata, int length)
+{
+	int fd = spi_config[device].fd;
+	uint32_t speed = spi_config[device].speed;
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	iov[0].iov_base = &speed;
+	iov[0].iov_len = sizeof(speed);
+	iov[1].iov_base = txdata;
+	iov[1].iov_len = length;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	if(sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)(sizeof(speed) + length))
+		return -1;
+
+	int nRead = recv(fd, rxdata, length, 0);
+	if(nRead != length)	{
+		if(nRead >= 0)
+			errno = EIO;
+		return -1;
+	}
+	return length;
+}
+
+// spidev waits out a gap busy, so do the same
+static void emuGap(uint16_t gap)
+{
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while((((now.tv_sec - start.tv_sec) * 1000000) + ((now.tv_nsec - start.tv_nsec) / 1000)) < gap);
+}
+
+/*
+ * A batch is the same messages one after the other,
+ * with the gaps the node would see
+ */
+static int emuTransferv(int device, SPI_XFER *xfers, int nXfers)
+{
+	int total = 0;
+
+	for(int i=0;i<nXfers;i++)	{
+		if(emuTransfer(device, xfers[i].txdata, xfers[i].rxdata, xfers[i].length) == -1)
+			return -1;
+		total += xfers[i].length;
+		if((i < nXfers-1) && (xfers[i].gap != 0))
+			emuGap(xfers[i].gap);
+	}
+	return total;
+}
@@ -21,11 +21,19 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #include "types.h"
 #include "spidefs.h"
 #include "logger.h"
-#include "dataq.h"
+#include "drdy.h"
+#include "framering.h"
+#include "reasm.h"
+#include "tun.h"
+#include "shm.h"
+#include "kiss.h"
+#include "metrics.h"
+#include "spiclock.h"
 
 // locals
 int spiDevFD;				// spi device file descriptor
@@ -37,62 +45,118 @@ enum {
 	SPITXFRAG					// next fragment
 };
 
-// receiver states
-enum {
-	SPIRXIDLE=0,				// idle
-	SPIRXFRAG					// next fragment
-};
-
 uint8_t	SPITxState;				// transmitter state
-uint8_t	SPIRxState;				// receiver state
-
-// SPI transmit frame queue
-FRAME_QUEUE	SPITxQueue;
-
-// frame buffers
-static SPI_BUFFER spiTxBuffer;
-static SPI_BUFFER spiRxBuffer;
-
-static union	{
-	struct {
-		struct spi_hdr_t	hdr;		// header
-		uint8_t	buffer[PAYLOAD_MAX];
-	} spiData;
-	uint8_t	rawData[PAYLOAD_MAX + sizeof(struct spi_hdr_t)];
-} rxFrameBuffer;
+BOOL	peerCanPack;			// node accepts packed frames
+uint16_t peerPackMax;			// node max packed payload
+BOOL	headerFirst;			// header first exchanges
+int		badHeaders;				// consecutive bad headers
+BOOL	peerHasCredit;			// node grants credit
+uint16_t peerCredit;			// bytes the node will take
+BOOL	grantRequested;			// node is out of credit
+uint32_t grantAnswered;			// grant the last request was answered with
+BOOL	creditAsked;			// asked the node for credit
+uint16_t creditAskedAt;			// with this much credit
+uint32_t creditStalls;			// frames held back for credit
+uint32_t creditRequests;		// grants asked for by the node
+BOOL	nodeBusy;				// node has more to send
+BOOL	txStalled;				// out of credit
+BOOL	linkChecked;			// exchanges carry a trailer
+BOOL	peerCanEcho;			// node echoes test frames
+
+// SPI transmit frame ring
+FRAME_RING	SPITxRing;
+
+// frame buffers: one per exchange in a batch. The tx and rx
+// pointers are the exchange being composed or taken apart
+static SPI_BUFFER spiTxBuffers[SPI_BATCH_MAX];
+static SPI_BUFFER spiRxBuffers[SPI_BATCH_MAX];
+static SPI_BUFFER *spiTxBuffer = &spiTxBuffers[0];
+static SPI_BUFFER *spiRxBuffer = &spiRxBuffers[0];
+
+// batching
+static int nodeBacklog;					// exchanges the node may want
+static uint16_t creditUsed;				// charged composing one exchange
+static uint16_t creditAhead;			// charged for exchanges after this one
+
+// checked exchanges
+static uint16_t crcTable[256];
+static uint8_t txSeq;					// our exchange count
+static uint8_t rxSeq;					// the node's, last seen
+static BOOL rxSeqValid;					// one has been seen
+
+// what a header tells us of the node, to take back if it fails its check
+typedef struct peer_state_t	{
+	BOOL		nodeBusy;
+	BOOL		canPack;
+	uint16_t	packMax;
+	BOOL		hasCredit;
+	uint16_t	credit;
+	BOOL		grantRequested;
+	BOOL		canEcho;
+} PEER_STATE;
+
+// the frame being sent
+static SPI_DATA_FRAME *txFrame;
+static uint16_t txSegLength;
+static uint16_t txOffset;
+static uint16_t txDataLen;
 
 // frame validator
 BOOL isIP400Frame(uint8_t *eye);
 
+// internals
+uint16_t setIdleHeader(BOOL creditReq);
+static uint16_t creditGrant(void);
+static void idleHeader(BOOL creditReq);
+void useCredit(uint16_t length);
+static int runFullLength(int nMax);
+static int runHeaderFirst(int nMax);
+static void exchangeDone(struct timespec *start, struct timespec *end, int nExchanges, int nxferred);
+static int spiTransfer(SPI_XFER *xfers, int nXfers);
+static int batchLimit(void);
+static BOOL moreToSend(void);
+static BOOL moreToExchange(void);
+static void spiRxHeader(void);
+static void spiRxFrame(int nxferred);
+static void spiCompose(void);
+static uint16_t hdrPayloadLength(struct spi_hdr_t *hdr);
+static uint16_t checkCRC(uint16_t crc, uint8_t *data, int length);
+static void sealTrailer(SPI_BUFFER *tx, uint16_t at);
+static SPI_LINK_RESULT checkTrailer(SPI_BUFFER *rx, uint16_t at);
+static void savePeer(PEER_STATE *peer);
+static void restorePeer(PEER_STATE *peer);
+static void loadTestFrame(void);
+static void releaseTxFrame(void);
+static void loadTxSegment(SPI_DATA_FRAME *frame, uint8_t status, uint16_t offset, uint16_t length);
+int packSPIFrames(void);
+void unpackSPIFrames(void);
+
+/*
+ * Queue a frame for the node: copied into the tx ring
+ */
 BOOL EnqueSPIFrame(void *spiFrame)
 {
-	SPI_DATA_FRAME *qFrame, *SrcFrame = (SPI_DATA_FRAME *)spiFrame;
-	uint8_t *frameBuffer;
-
-	// allocate an IP400 frame
-	if((qFrame=malloc(sizeof(SPI_DATA_FRAME)))== NULL)
-		return FALSE;
-	memcpy(qFrame, SrcFrame, sizeof(SPI_DATA_FRAME));
+	SPI_DATA_FRAME *SrcFrame = (SPI_DATA_FRAME *)spiFrame;
+	unsigned highWater = atomic_load(&SPITxRing.highWater);
 
-	// alloc the data portion of the frame
-	if((frameBuffer=malloc(SrcFrame->length)) == NULL)	{
+	if(!ringPut(&SPITxRing, SrcFrame->buffer, SrcFrame->length))	{
+		logger(LOG_DEBUG, "Tx ring: frame of %d bytes dropped, %u drops\n",
+				SrcFrame->length, atomic_load(&SPITxRing.nDrops));
 		return FALSE;
 	}
 
-	memcpy(frameBuffer, (uint8_t *)SrcFrame->buffer, SrcFrame->length);
-	qFrame->buffer = frameBuffer;
-	qFrame->length = SrcFrame->length;
-
-	if(!enqueFrame(&SPITxQueue, qFrame))
-		return FALSE;
+	if(atomic_load(&SPITxRing.highWater) > highWater)
+		logger(LOG_DEBUG, "Tx ring high water %u\n", atomic_load(&SPITxRing.highWater));
 
+	// exchange now rather than at the next poll
+	drdyWake();
 	return TRUE;
 }
 
 /*
  * Initialize the SPI task
  */
-BOOL spiTaskInit(int spiDev)
+BOOL spiTaskInit(int spiDev, unsigned txSlots)
 {
 	// open the SPI device
 	if((spiDevFD = spi_open(spiDev)) == -1)	{
@@ -100,179 +164,843 @@ BOOL spiTaskInit(int spiDev)
 		return FALSE;
 	}
 
-	spiTxBuffer.spiData.hdr.status = NO_FRAME;
-	spiRxBuffer.spiData.hdr.status = NO_FRAME;
+	setIdleHeader(FALSE);
+	spiRxBuffer->spiData.hdr.status = NO_FRAME;
 
-	// init the tx queue
-	SPITxQueue.q_forw = &SPITxQueue;
-	SPITxQueue.q_back = &SPITxQueue;
+	// the tx ring: the only frame memory, allocated now
+	if(!ringInit(&SPITxRing, txSlots))	{
+		logger(LOG_ERROR, "Cannot allocate a tx ring of %u frames\n", txSlots);
+		return FALSE;
+	}
+	logger(LOG_DEBUG, "Tx ring of %u frames\n", SPITxRing.nSlots);
 
 	// init vars
 	spiDevNum = spiDev;
 	SPITxState = SPITXIDLE;
-	SPIRxState = SPIRXIDLE;
-
-	rxFrameBuffer.spiData.hdr.eye[0] = 'I';
-	rxFrameBuffer.spiData.hdr.eye[1] = 'P';
-	rxFrameBuffer.spiData.hdr.eye[2] = (400 >> 8) & 0xff;
-	rxFrameBuffer.spiData.hdr.eye[3] = (400 & 0xff);
+	reasmInit();
+	peerCanPack = FALSE;
+	peerPackMax = 0;
+	headerFirst = FALSE;
+	badHeaders = 0;
+	peerHasCredit = FALSE;
+	peerCredit = 0;
+	grantRequested = FALSE;
+	grantAnswered = SPI_GRANT_NONE;
+	creditAsked = FALSE;
+	creditStalls = creditRequests = 0;
+	nodeBusy = FALSE;
+	txStalled = FALSE;
+	nodeBacklog = SPI_BATCH_START;
+	creditUsed = creditAhead = 0;
+	linkChecked = FALSE;
+	peerCanEcho = FALSE;
+
+	// CRC table for the trailers
+	for(int i=0;i<256;i++)	{
+		uint16_t crc = i << 8;
+		for(int bit=0;bit<8;bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ SPI_CHECK_POLY : (crc << 1);
+		crcTable[i] = crc;
+	}
 
 	return TRUE;
 }
 
 /*
  * Run the SPI functions.
- * Poll receiver for an inbound frame and read it. Add it to the frame queue.
- * Poll transmit queue for an outbound frame and send it.
+ * While either end has a backlog, several exchanges are done
+ * in one run: inbound frames go to UDP, outbound frames are
+ * taken from the tx ring, fragmented if needed
  */
 void spiTask(void)
 {
-	static SPI_DATA_FRAME *txFrame;
-	static uint16_t txSegLength;
-	static uint8_t *prxData;
-	static uint16_t rxSegLen;
+	metricObserve(MET_HIST_TX_DEPTH, ringDepth(&SPITxRing));
+
+	int nDone = headerFirst ? runHeaderFirst(batchLimit()) : runFullLength(batchLimit());
+	metricObserve(MET_HIST_BATCH, nDone);
+	reasmExpire();
+
+	// whatever this run brought in goes to UDP in one
+	// call, and local applications get one signal
+	udp_flush();
+	shmFlush();
+	kissFlush();
+
+	// the first exchange of the next run
+	spiTxBuffer = &spiTxBuffers[0];
+	spiRxBuffer = &spiRxBuffers[0];
+	creditUsed = 0;
+	spiCompose();
+}
 
-	memset(spiRxBuffer.rawData, 0, SPI_RAW_LEN);
+/*
+ * Full length exchanges: the ones after the first are composed
+ * ahead, while there are frames to send or the node may have
+ * some, and all of them go to the driver at once
+ */
+static int runFullLength(int nMax)
+{
+	SPI_XFER xfers[SPI_BATCH_MAX];
+	uint16_t charged[SPI_BATCH_MAX];
+	struct timespec start, end;
+	int nExchanges = 1, nBusy = 0;
 
-	// do an exchange with the STM32
-	int nxferred = spi_fdtransfer(spiDevNum, spiTxBuffer.rawData, spiRxBuffer.rawData, SPI_RAW_LEN);
-	if(nxferred == -1)	{
-		logger(LOG_ERROR, "SPI transmit error %d: %s\n", nxferred, geterrno(nxferred));
+	while(nExchanges < nMax)	{
+		if(!moreToSend() && !(nodeBusy && (nExchanges < nodeBacklog)))
+			break;
+		spiTxBuffer = &spiTxBuffers[nExchanges];
+		creditUsed = 0;
+		spiCompose();
+		charged[nExchanges++] = creditUsed;
 	}
 
-	/*
-	 * Inbound frame. Reassemble fragments if needed...
-	 */
-	// we have to declare these here, as teh !#)$*& compiler will not allow declarations in statements
-	uint8_t rstat = NO_FRAME;
-	uint8_t fragStat;
-	uint16_t offset;
-	uint16_t frameLen=0, prevLen=0;
+	// the node may only switch to header first on the last one
+	for(int i=0;i<nExchanges;i++)	{
+		SPI_BUFFER *tx = &spiTxBuffers[i];
+		if((i < nExchanges-1) && ((tx->spiData.hdr.status & SPI_STATUS_MASK) == NO_FRAME))
+			tx->spiData.hdr.status &= ~SPI_CAP_VARLEN;
+
+		memset(spiRxBuffers[i].rawData, 0, SPI_RAW_LEN);
+		xfers[i].txdata = tx->rawData;
+		xfers[i].rxdata = spiRxBuffers[i].rawData;
+		xfers[i].length = SPI_RAW_LEN;
+		xfers[i].gap = SPI_BATCH_GAP;
+	}
 
-	switch(SPIRxState)	{
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int nxferred = spiTransfer(xfers, nExchanges);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	exchangeDone(&start, &end, nExchanges, nxferred);
+
+	// each reply, in order. Its credit was given before
+	// the node had seen the frames composed after it
+	for(int i=0;i<nExchanges;i++)	{
+		spiTxBuffer = &spiTxBuffers[i];
+		spiRxBuffer = &spiRxBuffers[i];
+		creditAhead = 0;
+		for(int j=i+1;j<nExchanges;j++)
+			creditAhead += charged[j];
+
+		spiRxHeader();
+		spiRxFrame(nxferred);
+		if(nodeBusy)
+			nBusy++;
+	}
+	creditAhead = 0;
 
-	case SPIRXIDLE:
-		rstat = spiRxBuffer.spiData.hdr.status;
-
-		// next validate the frame type
-		if((rstat == NO_FRAME) || (rstat >= N_FRAGS))
-			break;
+	// the busy bit says if the node has more, not how much
+	if(nodeBusy)
+		nodeBacklog = (2*nodeBacklog > SPI_BATCH_MAX) ? SPI_BATCH_MAX : 2*nodeBacklog;
+	else
+		nodeBacklog = (nBusy+1 > SPI_BATCH_START) ? nBusy+1 : SPI_BATCH_START;
 
+	return nExchanges;
+}
 
-		// copy the header fields
-		// validate the eye of the frame
-		if(!isIP400Frame(spiRxBuffer.spiData.hdr.eye))	{
-			logger(LOG_DEBUG, "Bad frame: Stat %d len %d, failed eye test %02X:%02X:%02X:%02X\n",rstat,nxferred,
-			spiRxBuffer.spiData.hdr.eye[0],
-			spiRxBuffer.spiData.hdr.eye[1],
-			spiRxBuffer.spiData.hdr.eye[2],
-			spiRxBuffer.spiData.hdr.eye[3]);
+/*
+ * Header first exchanges: the payload length comes from both
+ * headers, so an exchange cannot be clocked until its headers
+ * are in. Instead each payload goes to the driver with the next
+ * header, from the other buffer, composed once this header
+ * is known
+ */
+static int runHeaderFirst(int nMax)
+{
+	SPI_XFER xfers[2];
+	struct timespec start, end;
+	int cur = 0, nExchanges = 0, total = 0;
+
+	memset(spiRxBuffers[cur].rawData, 0, SPI_RAW_LEN);
+	xfers[0].txdata = spiTxBuffers[cur].rawData;
+	xfers[0].rxdata = spiRxBuffers[cur].rawData;
+	xfers[0].length = SPI_HDR_LEN;
+	xfers[0].gap = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int nxferred = spiTransfer(xfers, 1);
+
+	while(nxferred != -1)	{
+		SPI_BUFFER *tx = &spiTxBuffers[cur];
+		SPI_BUFFER *rx = &spiRxBuffers[cur];
+		int next = cur ^ 1, nXfers = 0;
+
+		total += nxferred;
+		nExchanges++;
+		spiTxBuffer = tx;
+		spiRxBuffer = rx;
+
+		// node may have restarted and gone back to full length
+		if(!isIP400Frame(rx->spiData.hdr.eye))	{
+			metricInc(MET_SPI_EYE_FAILS);
+			if(linkChecked)
+				spiClockExchange(SPI_LINK_EYE);
+			if(++badHeaders >= SPI_VARLEN_ERRORS)	{
+				logger(LOG_NOTICE, "No valid headers, back to full length exchanges\n");
+				headerFirst = FALSE;
+				linkChecked = FALSE;
+				spiClockLinkDown();
+			}
 			break;
 		}
+		badHeaders = 0;
+
+		// checked: always a payload phase, for the trailers
+		uint16_t txLen = hdrPayloadLength(&tx->spiData.hdr);
+		uint16_t rxLen = hdrPayloadLength(&rx->spiData.hdr);
+		uint16_t xferLen = (txLen > rxLen) ? txLen : rxLen;
+		uint16_t payLen = linkChecked ? xferLen + SPI_CHECK_LEN : xferLen;
+		PEER_STATE peer;
+		savePeer(&peer);
+		spiRxHeader();
+
+		if(payLen != 0)	{
+			if(linkChecked)
+				sealTrailer(tx, xferLen);
+			xfers[nXfers].txdata = tx->spiData.buffer;
+			xfers[nXfers].rxdata = rx->spiData.buffer;
+			xfers[nXfers].length = payLen;
+			xfers[nXfers++].gap = SPI_BATCH_GAP;
+		}
 
-		// copy the header fields
-		memcpy(&rxFrameBuffer.spiData.hdr, &spiRxBuffer.spiData.hdr, sizeof(struct spi_hdr_t));
+		BOOL more = ((nExchanges < nMax) && moreToExchange()) ? TRUE : FALSE;
+		if(more)	{
+			spiTxBuffer = &spiTxBuffers[next];
+			creditUsed = 0;
+			spiCompose();
+			memset(spiRxBuffers[next].rawData, 0, SPI_RAW_LEN);
+			xfers[nXfers].txdata = spiTxBuffers[next].rawData;
+			xfers[nXfers].rxdata = spiRxBuffers[next].rawData;
+			xfers[nXfers].length = SPI_HDR_LEN;
+			xfers[nXfers++].gap = 0;
+		}
+		if(nXfers == 0)
+			break;
 
-		// copy data fields
-		prxData =  rxFrameBuffer.spiData.buffer;
-		rxSegLen = (spiRxBuffer.spiData.hdr.length_hi << 8) + spiRxBuffer.spiData.hdr.length_lo;
-		memcpy(prxData, spiRxBuffer.spiData.buffer, rxSegLen);
+		usleep(SPI_PHASE_DELAY);
+		nxferred = spiTransfer(xfers, nXfers);
+		if(nxferred == -1)
+			break;
 
-		if(rstat != SINGLE_FRAME)	{
-			SPIRxState = SPIRXFRAG;
-			logger(LOG_DEBUG, "Fragmented frame received\n");
-		} else {
-			rxFrameBuffer.spiData.hdr.status = SINGLE_FRAME;
-			rxFrameBuffer.spiData.hdr.length_hi = (rxSegLen >> 8);
-			rxFrameBuffer.spiData.hdr.length_lo = (rxSegLen & 0xFF);
-			rxFrameBuffer.spiData.hdr.offset_hi = rxFrameBuffer.spiData.hdr.offset_lo = 0;
-			send_udp_packet(rxFrameBuffer.rawData, rxSegLen+sizeof(struct spi_hdr_t));
-			SPIRxState = SPIRXIDLE;
-			spiRxBuffer.spiData.hdr.status = N_FRAGS;	// set an invalid frame type
+		// a header that fails its check is taken back
+		BOOL good = TRUE;
+		if(linkChecked)	{
+			SPI_LINK_RESULT result = checkTrailer(rx, xferLen);
+			spiClockExchange(result);
+			if(result == SPI_LINK_CRC)	{
+				restorePeer(&peer);
+				good = FALSE;
+			}
 		}
-		break;
 
-	case SPIRXFRAG:
-		fragStat = spiRxBuffer.spiData.hdr.status;
-		offset = ((uint16_t)spiTxBuffer.spiData.hdr.offset_hi << 8) + (uint16_t)spiTxBuffer.spiData.hdr.offset_lo;
-		prxData = rxFrameBuffer.rawData + offset;
-		rxSegLen = (spiRxBuffer.spiData.hdr.length_hi << 8) + spiRxBuffer.spiData.hdr.length_lo;
-		memcpy(prxData, spiRxBuffer.spiData.buffer, rxSegLen);
-
-		if(fragStat == LAST_FRAGMENT)	{
-			frameLen = offset + rxSegLen;
-			spiRxBuffer.spiData.hdr.length_hi = (frameLen >> 8);
-			spiRxBuffer.spiData.hdr.length_lo = (frameLen & 0xFF);
-			// process frame for tx here...
-			SPIRxState = SPIRXIDLE;					// placeholder
+		spiRxBuffer = rx;
+		if(good && (xferLen != 0))	{
+			// out now, not at the end of the run: the far end may be waiting on it
+			spiRxFrame(nxferred);
+			udp_flush();
+			shmFlush();
+			kissFlush();
 		}
-		break;
+		if(!more)	{
+			total += nxferred;
+			break;
+		}
+
+		// the next header is in: its payload was not
+		if(payLen != 0)	{
+			total += payLen;
+			nxferred -= payLen;
+		}
+		cur = next;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	exchangeDone(&start, &end, (nExchanges == 0) ? 1 : nExchanges, (nxferred == -1) ? -1 : total);
+	return nExchanges;
+}
+
+/*
+ * The exchanges in a run: their time, count and bytes
+ */
+static void exchangeDone(struct timespec *start, struct timespec *end, int nExchanges, int nxferred)
+{
+	uint32_t elapsed = ((end->tv_sec - start->tv_sec) * 1000000) + ((end->tv_nsec - start->tv_nsec) / 1000);
+
+	for(int i=0;i<nExchanges;i++)
+		metricObserve(MET_HIST_EXCHANGE, elapsed/nExchanges);
+	metricAdd(MET_SPI_EXCHANGES, nExchanges);
+
+	if(nxferred == -1)	{
+		metricInc(MET_SPI_ERRORS);
+		logger(LOG_ERROR, "SPI transmit error %d: %s\n", nxferred, geterrno(nxferred));
+	} else {
+		metricAdd(MET_SPI_BYTES, nxferred);
+	}
+}
+
+// one call to the driver, with one or more transfers
+static int spiTransfer(SPI_XFER *xfers, int nXfers)
+{
+	metricInc(MET_SPI_CALLS);
+	return spi_fdtransferv(spiDevNum, xfers, nXfers);
+}
+
+// most exchanges in one run: spidev takes bufsiz bytes at a time
+static int batchLimit(void)
+{
+	int nMax = SPI_BATCH_MAX;
+	uint32_t maxMessage = spi_config[spiDevNum].maxMessage;
+
+	if(!headerFirst && (maxMessage != 0) && (maxMessage/SPI_RAW_LEN < nMax))
+		nMax = maxMessage/SPI_RAW_LEN;
+
+	return (nMax < 1) ? 1 : nMax;
+}
+
+// frames to send that the node has room for
+static BOOL moreToSend(void)
+{
+	if(SPITxState == SPITXFRAG)
+		return TRUE;
+
+	// keep exchanging while a test frame is out
+	if(linkChecked && peerCanEcho && spiClockTuning())
+		return TRUE;
+
+	if(txStalled)
+		return FALSE;
+
+	return (ringPeek(&SPITxRing) != NULL) ? TRUE : FALSE;
+}
+
+// either end wants another exchange: a request for the
+// grant the node already has is not worth one
+static BOOL moreToExchange(void)
+{
+	if(nodeBusy || (grantRequested && (creditGrant() != grantAnswered)))
+		return TRUE;
+
+	return moreToSend();
+}
+
+/*
+ * The header of an inbound exchange: if the node has more, and
+ * an idle one says what it accepts and how much it will take
+ */
+static void spiRxHeader(void)
+{
+	uint8_t rstat = spiRxBuffer->spiData.hdr.status & SPI_STATUS_MASK;
+
+	nodeBusy = (isIP400Frame(spiRxBuffer->spiData.hdr.eye) && (spiRxBuffer->spiData.hdr.status & SPI_BUSY)) ? TRUE : FALSE;
+	if((rstat != NO_FRAME) || !isIP400Frame(spiRxBuffer->spiData.hdr.eye))
+		return;
+
+	BOOL canPack = (spiRxBuffer->spiData.hdr.status & SPI_CAP_PACKED) ? TRUE : FALSE;
+	if(canPack != peerCanPack)
+		logger(LOG_NOTICE, "Node %s packed frames\n", canPack ? "accepts" : "does not accept");
+	peerCanPack = canPack;
+	peerPackMax = ((uint16_t)spiRxBuffer->spiData.hdr.offset_hi << 8) + spiRxBuffer->spiData.hdr.offset_lo;
+
+	// and how much it will take from us, less what it has not seen yet
+	peerHasCredit = (spiRxBuffer->spiData.hdr.status & SPI_CAP_CREDIT) ? TRUE : FALSE;
+	if(peerHasCredit)	{
+		uint16_t credit = ((uint16_t)spiRxBuffer->spiData.hdr.length_hi << 8) + spiRxBuffer->spiData.hdr.length_lo;
+		peerCredit = (creditAhead > credit) ? 0 : credit - creditAhead;
+	}
+	if(spiRxBuffer->spiData.hdr.status & SPI_CREDIT_REQ)
+		grantRequested = TRUE;
+
+	// extra caps, if the coding field has them
+	uint8_t xcaps = 0;
+	if((spiRxBuffer->spiData.hdr.coding & SPI_XCAPS_MASK) == SPI_XCAPS_MARK)
+		xcaps = spiRxBuffer->spiData.hdr.coding & ~SPI_XCAPS_MASK;
+	peerCanEcho = (xcaps & SPI_XCAP_ECHO) ? TRUE : FALSE;
+
+	// both idle headers offered header first: switch after this one
+	if(!headerFirst && (spiRxBuffer->spiData.hdr.status & SPI_CAP_VARLEN) &&
+			((spiTxBuffer->spiData.hdr.status & SPI_STATUS_MASK) == NO_FRAME) &&
+			(spiTxBuffer->spiData.hdr.status & SPI_CAP_VARLEN))	{
+		headerFirst = TRUE;
+		badHeaders = 0;
+
+		// checked as well, if both offered it
+		linkChecked = ((xcaps & SPI_XCAP_CHECK) && (spiTxBuffer->spiData.hdr.coding == (SPI_XCAPS_MARK | SPI_XCAP_CHECK))) ? TRUE : FALSE;
+		txSeq = 0;
+		rxSeqValid = FALSE;
+		logger(LOG_NOTICE, "Switching to header first exchanges%s\n", linkChecked ? ", checked" : "");
+		if(linkChecked)
+			spiClockLinkUp(peerCanEcho);
+	}
+}
+
+/*
+ * Inbound frame. Reassemble fragments if needed...
+ */
+static void spiRxFrame(int nxferred)
+{
+	uint16_t rxSegLen;
+	uint8_t rstat = spiRxBuffer->spiData.hdr.status & SPI_STATUS_MASK;
+
+	// a test frame we sent, echoed
+	if(rstat == TEST_FRAME)	{
+		if(isIP400Frame(spiRxBuffer->spiData.hdr.eye))
+			spiClockEcho(spiRxBuffer->spiData.buffer, hdrPayloadLength(&spiRxBuffer->spiData.hdr));
+		return;
+	}
+
+	// packed frames are complete, so can arrive between fragments
+	if(rstat == PACKED_FRAME)	{
+		if(isIP400Frame(spiRxBuffer->spiData.hdr.eye))
+			unpackSPIFrames();
+		return;
 	}
 
 	/*
-	 * process an outbound frame
-	 * Fragment it if longer that 500 byte, s->length);s
+	 * Single frames go straight to UDP, fragments
+	 * to reassembly, whatever stream they are from
 	 */
+	if((rstat == NO_FRAME) || (rstat >= N_FRAGS))
+		return;
+
+	// validate the eye of the frame
+	if(!isIP400Frame(spiRxBuffer->spiData.hdr.eye))	{
+		metricInc(MET_SPI_EYE_FAILS);
+		logger(LOG_DEBUG, "Bad frame: Stat %d len %d, failed eye test %02X:%02X:%02X:%02X\n",rstat,nxferred,
+		spiRxBuffer->spiData.hdr.eye[0],
+		spiRxBuffer->spiData.hdr.eye[1],
+		spiRxBuffer->spiData.hdr.eye[2],
+		spiRxBuffer->spiData.hdr.eye[3]);
+	} else if(rstat != SINGLE_FRAME)	{
+		reasmFragment(&spiRxBuffer->spiData.hdr, spiRxBuffer->spiData.buffer);
+	} else {
+		rxSegLen = (spiRxBuffer->spiData.hdr.length_hi << 8) + spiRxBuffer->spiData.hdr.length_lo;
+		if(rxSegLen > SPI_BUFFER_LEN)	{
+			metricInc(MET_SPI_RX_TOO_LONG);
+			logger(LOG_DEBUG, "Frame length %d too long\n", rxSegLen);
+		} else {
+			metricInc(MET_SPI_RX_FRAMES);
+			spiRxBuffer->spiData.hdr.status = SINGLE_FRAME;
+			spiRxBuffer->spiData.hdr.offset_hi = spiRxBuffer->spiData.hdr.offset_lo = 0;
+			spiDeliver(spiRxBuffer->rawData, rxSegLen+sizeof(struct spi_hdr_t));
+		}
+	}
+}
+
+/*
+ * process an outbound frame into the tx buffer
+ * Fragment it if longer than one SPI buffer
+ */
+static void spiCompose(void)
+{
+	txStalled = FALSE;
 	switch(SPITxState)	{
 
 	case SPITXIDLE:
-		if((txFrame=dequeFrame(&SPITxQueue)) == NULL)	{
-			spiTxBuffer.spiData.hdr.status = NO_FRAME;
+		// the node asked for credit: a grant it has not had goes first
+		if(grantRequested && (creditGrant() != grantAnswered))	{
+			idleHeader(FALSE);
 			break;
 		}
-		txSegLength = txFrame->length;
-		spiTxBuffer.spiData.hdr.status = SINGLE_FRAME;
 
-		// fragment the frame if needed
-		if(txFrame->length > SPI_BUFFER_LEN)	{
-			txSegLength = SPI_BUFFER_LEN;
-			spiTxBuffer.spiData.hdr.status = FRAME_FRAGMENT;
-			SPITxState = SPITXFRAG;
+		// tuning the clock: a test frame for the node to echo
+		if(linkChecked && peerCanEcho && spiClockTestDue())	{
+			loadTestFrame();
+			break;
+		}
+
+		// pack small frames together if the node can take them
+		if(peerCanPack && (packSPIFrames() != 0))	{
+			creditAsked = FALSE;
+			break;
+		}
+
+		if((txFrame=ringPeek(&SPITxRing)) == NULL)	{
+			idleHeader(FALSE);
+			break;
 		}
 
-		// send the frame and/or fragment
-		memcpy(spiTxBuffer.rawData, txFrame->buffer, txSegLength);
-		spiTxBuffer.spiData.hdr.offset_hi = spiTxBuffer.spiData.hdr.offset_lo = 0;
+		// too short to have a header: drop it
+		if(txFrame->length < sizeof(struct spi_hdr_t))	{
+			releaseTxFrame();
+			idleHeader(FALSE);
+			break;
+		}
 
-		// release memory if only a single frame
-		if(spiTxBuffer.spiData.hdr.status == SINGLE_FRAME)
-		{
-			free(txFrame->buffer);
-			free(txFrame);
+		// a frame is only started when all of it fits
+		uint16_t txPayload = txFrame->length - sizeof(struct spi_hdr_t);
+		if(peerHasCredit && (txPayload > peerCredit))	{
+			// log the odd one, there can be many
+			if((creditStalls++ % 1000) == 0)
+				logger(LOG_DEBUG, "Out of credit: %d bytes, need %d\n", peerCredit, txPayload);
+
+			// ask once, and again only if the node's grant changes
+			idleHeader(!creditAsked || (peerCredit != creditAskedAt));
+			creditAsked = TRUE;
+			creditAskedAt = peerCredit;
+			txStalled = TRUE;
+			break;
+		}
+		creditAsked = FALSE;
+		useCredit(txPayload);
+
+		// fragment the data if needed
+		txDataLen = txPayload;
+		txOffset = 0;
+		if(txDataLen > SPI_BUFFER_LEN)	{
+			txSegLength = SPI_BUFFER_LEN;
+			loadTxSegment(txFrame, FIRST_FRAGMENT, txOffset, txSegLength);
+			SPITxState = SPITXFRAG;
+			break;
 		}
+
+		// single frame: release the slot
+		txSegLength = txDataLen;
+		loadTxSegment(txFrame, SINGLE_FRAME, txOffset, txSegLength);
+		metricInc(MET_SPI_TX_FRAMES);
+		releaseTxFrame();
 		break;
 
 	case SPITXFRAG:
-		offset = ((uint16_t)(spiTxBuffer.spiData.hdr.offset_hi) << 8) + (uint16_t)spiTxBuffer.spiData.hdr.offset_lo;
-		prevLen = ((uint16_t)(spiTxBuffer.spiData.hdr.length_hi) << 8) + (uint16_t)spiTxBuffer.spiData.hdr.length_lo;
-		offset += prevLen;
-		txFrame->length -= prevLen;
-		txSegLength = txFrame->length;
-		if(txFrame->length > SPI_BUFFER_LEN)	{
-			spiTxBuffer.spiData.hdr.status = FRAME_FRAGMENT;
+		txOffset += txSegLength;
+		txSegLength = txDataLen - txOffset;
+		if(txSegLength > SPI_BUFFER_LEN)	{
 			txSegLength = SPI_BUFFER_LEN;
-		} else {
-			spiTxBuffer.spiData.hdr.status = LAST_FRAGMENT;
-			SPITxState = SPITXIDLE;
+			loadTxSegment(txFrame, MIDDLE_FRAGMENT, txOffset, txSegLength);
+			break;
 		}
 
-		// send the next fragment
-		void *fragAddr = txFrame->buffer + offset;
-		memcpy(spiTxBuffer.spiData.buffer, fragAddr, txSegLength);
-		spiTxBuffer.spiData.hdr.offset_hi = (offset >> 8);
-		spiTxBuffer.spiData.hdr.offset_lo = (offset & 0xff);
-		spiTxBuffer.spiData.hdr.length_hi = (txSegLength >> 8);
-		spiTxBuffer.spiData.hdr.length_lo = (txSegLength & 0xFF);
-
 		// done with frame
-		if(spiTxBuffer.spiData.hdr.status == LAST_FRAGMENT)
-		{
-			free(txFrame->buffer);
-			free(txFrame);
-		}
+		loadTxSegment(txFrame, LAST_FRAGMENT, txOffset, txSegLength);
+		metricInc(MET_SPI_TX_FRAMES);
+		SPITxState = SPITXIDLE;
+		releaseTxFrame();
 		break;
 	}
+}
+
+/*
+ * More to exchange right away: the node said it has more, the
+ * next exchange carries a frame, or frames are waiting that the
+ * node has room for. Out of credit waits for the node to say so
+ */
+BOOL spiPending(void)
+{
+	if(moreToExchange())
+		return TRUE;
+
+	return ((spiTxBuffers[0].spiData.hdr.status & SPI_STATUS_MASK) != NO_FRAME) ? TRUE : FALSE;
+}
+
+/*
+ * Done with the oldest frame in the ring. If UDP, tun, shared
+ * memory or KISS stopped for want of room, they can carry on
+ */
+static void releaseTxFrame(void)
+{
+	ringRelease(&SPITxRing);
+	udp_rx_resume();
+	tun_rx_resume();
+	shm_rx_resume();
+	kiss_rx_resume();
+}
+
+/*
+ * A complete frame from the node: the tun interface takes
+ * IP frames, and the rest go to KISS clients if AX.25,
+ * local applications and UDP
+ */
+void spiDeliver(void *data, uint16_t length)
+{
+	if(tunDeliver(data, length))
+		return;
+
+	kissDeliver(data, length);
+	shmDeliver(data, length);
+	send_udp_packet(data, length);
+}
+
+// free slots in the tx ring
+uint32_t spiTxRoom(void)
+{
+	return SPITxRing.nSlots - ringDepth(&SPITxRing);
+}
+
+void spiGetStats(SPI_STATS *stats)
+{
+	stats->txSlots = SPITxRing.nSlots;
+	stats->txDepth = ringDepth(&SPITxRing);
+	stats->txHighWater = atomic_load(&SPITxRing.highWater);
+	stats->txPut = atomic_load(&SPITxRing.nPut);
+	stats->txDrops = atomic_load(&SPITxRing.nDrops);
+	stats->txTooLong = atomic_load(&SPITxRing.nTooLong);
+	stats->txExhausted = atomic_load(&SPITxRing.nExhausted);
+	stats->peerCredit = peerHasCredit ? peerCredit : 0;
+	stats->creditStalls = creditStalls;
+	stats->creditRequests = creditRequests;
+	stats->headerFirst = headerFirst;
+	stats->linkChecked = linkChecked;
+}
+
+/*
+ * Load one segment of a frame from UDP into the tx buffer:
+ * the frame header, then the data at the offset
+ */
+static void loadTxSegment(SPI_DATA_FRAME *frame, uint8_t status, uint16_t offset, uint16_t length)
+{
+	uint8_t *frameData = (uint8_t *)frame->buffer + sizeof(struct spi_hdr_t);
+
+	memcpy(&spiTxBuffer->spiData.hdr, frame->buffer, sizeof(struct spi_hdr_t));
+	memcpy(spiTxBuffer->spiData.buffer, frameData + offset, length);
+
+	spiTxBuffer->spiData.hdr.status = status;
+	spiTxBuffer->spiData.hdr.offset_hi = (offset >> 8);
+	spiTxBuffer->spiData.hdr.offset_lo = (offset & 0xFF);
+	spiTxBuffer->spiData.hdr.length_hi = (length >> 8);
+	spiTxBuffer->spiData.hdr.length_lo = (length & 0xFF);
+
+	if(status != SINGLE_FRAME)
+		metricInc(MET_SPI_TX_FRAGS);
+}
+
+/*
+ * Idle header: no frame, advertise that we accept packed
+ * frames up to our buffer size, and grant the node credit
+ * for what the UDP socket can still take. Returns the grant
+ */
+uint16_t setIdleHeader(BOOL creditReq)
+{
+	spiTxBuffer->spiData.hdr.eye[0] = 'I';
+	spiTxBuffer->spiData.hdr.eye[1] = 'P';
+	spiTxBuffer->spiData.hdr.eye[2] = '4';
+	spiTxBuffer->spiData.hdr.eye[3] = 'C';
+	spiTxBuffer->spiData.hdr.status = NO_FRAME | SPI_CAP_PACKED | SPI_CAP_VARLEN | SPI_CAP_CREDIT;
+	if(creditReq)
+		spiTxBuffer->spiData.hdr.status |= SPI_CREDIT_REQ;
+	spiTxBuffer->spiData.hdr.coding = SPI_XCAPS_MARK | SPI_XCAP_CHECK;
+	spiTxBuffer->spiData.hdr.offset_hi = (SPI_BUFFER_LEN >> 8);
+	spiTxBuffer->spiData.hdr.offset_lo = (SPI_BUFFER_LEN & 0xFF);
+
+	uint16_t grant = creditGrant();
+	spiTxBuffer->spiData.hdr.length_hi = (grant >> 8);
+	spiTxBuffer->spiData.hdr.length_lo = (grant & 0xFF);
+	return grant;
+}
+
+// what the UDP socket can still take
+static uint16_t creditGrant(void)
+{
+	uint32_t grant = udp_tx_room();
+	return (grant > SPI_CREDIT_MAX) ? SPI_CREDIT_MAX : grant;
+}
+
+/*
+ * An idle header in the exchanges: it answers a request
+ * from the node, counted once for each grant, as the same
+ * one again tells it nothing new
+ */
+static void idleHeader(BOOL creditReq)
+{
+	uint16_t grant = setIdleHeader(creditReq);
+	if(!grantRequested)
+		return;
+
+	grantRequested = FALSE;
+	if(grant != grantAnswered)	{
+		grantAnswered = grant;
+		creditRequests++;
+	}
+}
+
+// charge a frame against the node's credit
+void useCredit(uint16_t length)
+{
+	if(!peerHasCredit)
+		return;
+
+	uint16_t charge = (length > peerCredit) ? peerCredit : length;
+	peerCredit -= charge;
+	creditUsed += charge;
+}
+
+// the payload length a header announces
+static uint16_t hdrPayloadLength(struct spi_hdr_t *hdr)
+{
+	if(((hdr->status & SPI_STATUS_MASK) == NO_FRAME) || !isIP400Frame(hdr->eye))
+		return 0;
+
+	uint16_t length = (hdr->length_hi << 8) + hdr->length_lo;
+	return (length > SPI_BUFFER_LEN) ? SPI_BUFFER_LEN : length;
+}
+
+// CRC-16 CCITT, msb first
+static uint16_t checkCRC(uint16_t crc, uint8_t *data, int length)
+{
+	for(int i=0;i<length;i++)
+		crc = (crc << 8) ^ crcTable[((crc >> 8) ^ data[i]) & 0xFF];
+
+	return crc;
+}
+
+/*
+ * Our trailer, straight after the payload: the exchange count,
+ * a spare byte, then the CRC of our header, payload and both
+ */
+static void sealTrailer(SPI_BUFFER *tx, uint16_t at)
+{
+	uint8_t *trailer = tx->spiData.buffer + at;
+
+	trailer[0] = ++txSeq;
+	trailer[1] = 0;
+
+	uint16_t crc = checkCRC(SPI_CHECK_INIT, tx->rawData, SPI_HDR_LEN);
+	crc = checkCRC(crc, tx->spiData.buffer, hdrPayloadLength(&tx->spiData.hdr));
+	crc = checkCRC(crc, trailer, 2);
+	trailer[2] = (crc >> 8);
+	trailer[3] = (crc & 0xFF);
+}
+
+/*
+ * The node's trailer: its CRC must match, and its count follow
+ * on from the last one. A failed one is taken as the next count
+ */
+static SPI_LINK_RESULT checkTrailer(SPI_BUFFER *rx, uint16_t at)
+{
+	uint8_t *trailer = rx->spiData.buffer + at;
+
+	uint16_t crc = checkCRC(SPI_CHECK_INIT, rx->rawData, SPI_HDR_LEN);
+	crc = checkCRC(crc, rx->spiData.buffer, hdrPayloadLength(&rx->spiData.hdr));
+	crc = checkCRC(crc, trailer, 2);
+	if(crc != (((uint16_t)trailer[2] << 8) + trailer[3]))	{
+		rxSeq++;
+		return SPI_LINK_CRC;
+	}
+
+	BOOL inSequence = (!rxSeqValid || (trailer[0] == (uint8_t)(rxSeq + 1))) ? TRUE : FALSE;
+	rxSeq = trailer[0];
+	rxSeqValid = TRUE;
+	return inSequence ? SPI_LINK_OK : SPI_LINK_SEQ;
+}
+
+static void savePeer(PEER_STATE *peer)
+{
+	peer->nodeBusy = nodeBusy;
+	peer->canPack = peerCanPack;
+	peer->packMax = peerPackMax;
+	peer->hasCredit = peerHasCredit;
+	peer->credit = peerCredit;
+	peer->grantRequested = grantRequested;
+	peer->canEcho = peerCanEcho;
+}
 
+static void restorePeer(PEER_STATE *peer)
+{
+	nodeBusy = peer->nodeBusy;
+	peerCanPack = peer->canPack;
+	peerPackMax = peer->packMax;
+	peerHasCredit = peer->hasCredit;
+	peerCredit = peer->credit;
+	grantRequested = peer->grantRequested;
+	peerCanEcho = peer->canEcho;
+}
+
+/*
+ * A test frame: full length, so the whole buffer is clocked.
+ * The node sends it back and does not charge it to credit
+ */
+static void loadTestFrame(void)
+{
+	memset(&spiTxBuffer->spiData.hdr, 0, sizeof(struct spi_hdr_t));
+	uint16_t length = spiClockTest(spiTxBuffer->spiData.buffer);
+
+	spiTxBuffer->spiData.hdr.eye[0] = 'I';
+	spiTxBuffer->spiData.hdr.eye[1] = 'P';
+	spiTxBuffer->spiData.hdr.eye[2] = '4';
+	spiTxBuffer->spiData.hdr.eye[3] = 'C';
+	spiTxBuffer->spiData.hdr.status = TEST_FRAME;
+	spiTxBuffer->spiData.hdr.length_hi = (length >> 8);
+	spiTxBuffer->spiData.hdr.length_lo = (length & 0xFF);
+}
+
+/*
+ * Pack as many complete frames as will fit into the
+ * tx buffer. Frames from UDP are already a header and data.
+ * Returns the number packed, zero leaves the buffer untouched
+ */
+int packSPIFrames(void)
+{
+	SPI_DATA_FRAME *txFrame;
+	uint16_t packLen = 0;
+	int nPacked = 0;
+
+	uint16_t packMax = (peerPackMax < SPI_BUFFER_LEN) ? peerPackMax : SPI_BUFFER_LEN;
+	if(peerHasCredit && (peerCredit < packMax))
+		packMax = peerCredit;
+
+	while((txFrame = ringPeek(&SPITxRing)) != NULL)	{
+
+		if(txFrame->length < sizeof(struct spi_hdr_t))
+			break;
+		if(packLen + SPI_PACK_LEN_SIZE + txFrame->length > packMax)
+			break;
+
+		// sub-record: length, then the frame as a single
+		uint8_t *rec = spiTxBuffer->spiData.buffer + packLen;
+		rec[0] = (txFrame->length >> 8);
+		rec[1] = (txFrame->length & 0xFF);
+		memcpy(rec + SPI_PACK_LEN_SIZE, txFrame->buffer, txFrame->length);
+		((struct spi_hdr_t *)(rec + SPI_PACK_LEN_SIZE))->status = SINGLE_FRAME;
+
+		packLen += SPI_PACK_LEN_SIZE + txFrame->length;
+		nPacked++;
+
+		releaseTxFrame();
+	}
+
+	if(nPacked == 0)
+		return 0;
+	useCredit(packLen);
+	metricAdd(MET_SPI_TX_PACKED, nPacked);
+
+	spiTxBuffer->spiData.hdr.eye[0] = 'I';
+	spiTxBuffer->spiData.hdr.eye[1] = 'P';
+	spiTxBuffer->spiData.hdr.eye[2] = '4';
+	spiTxBuffer->spiData.hdr.eye[3] = 'C';
+	spiTxBuffer->spiData.hdr.status = PACKED_FRAME;
+	spiTxBuffer->spiData.hdr.offset_hi = spiTxBuffer->spiData.hdr.offset_lo = 0;
+	spiTxBuffer->spiData.hdr.length_hi = (packLen >> 8);
+	spiTxBuffer->spiData.hdr.length_lo = (packLen & 0xFF);
+
+	logger(LOG_DEBUG, "Packed %d frames, %d bytes\n", nPacked, packLen);
+	return nPacked;
+}
+
+/*
+ * Send each sub-record of a packed frame as a UDP packet
+ */
+void unpackSPIFrames(void)
+{
+	uint16_t packLen = (spiRxBuffer->spiData.hdr.length_hi << 8) + spiRxBuffer->spiData.hdr.length_lo;
+	if(packLen > SPI_BUFFER_LEN)	{
+		logger(LOG_ERROR, "Packed frame length %d too long\n", packLen);
+		return;
+	}
+
+	uint8_t *rec = spiRxBuffer->spiData.buffer;
+	uint8_t *end = rec + packLen;
+
+	while(rec + SPI_PACK_REC_HDR <= end)	{
+		uint16_t recLen = (rec[0] << 8) + rec[1];
+		uint8_t *recData = rec + SPI_PACK_LEN_SIZE;
+
+		// validate the record before using it
+		if((recLen < sizeof(struct spi_hdr_t)) || (recData + recLen > end) || !isIP400Frame(recData))	{
+			logger(LOG_ERROR, "Bad packed record, length %d\n", recLen);
+			return;
+		}
+
+		metricInc(MET_SPI_RX_PACKED);
+		spiDeliver(recData, recLen);
+		rec = recData + recLen;
+	}
 }
 
 // validate the frame eye
@@ -0,0 +1,303 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        subs.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      UDP subscribers. Each frame from the node is checked
+                          against every subscriber's filter using just its SPI
+                          header, and goes to all that match, so several
+                          applications can share the node without a relay.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include "types.h"
+#include "logger.h"
+#include "spidefs.h"
+#include "callsign.h"
+#include "subs.h"
+
+// local defines
+#define	SUBS_LINE_LEN		200					// longest line in the file
+#define	SUBS_DELIM			" \t\r\n"
+
+static SUBSCRIBER subs[SUBS_MAX];
+
+// where control datagrams may come from, besides the loopback
+static uint32_t ctlNet;
+static uint32_t ctlMask;
+
+void subsInit(void)
+{
+	memset(subs, 0, sizeof(subs));
+	ctlNet = SUBS_LOOPBACK_NET;
+	ctlMask = SUBS_LOOPBACK_MASK;
+}
+
+// codings: * or a comma separated list
+static BOOL subsCodings(char *list, uint16_t *codings)
+{
+	*codings = 0;
+	if(!strcmp(list, "*"))	{
+		*codings = SUBS_ALL_CODINGS;
+		return TRUE;
+	}
+
+	for(char *tok=strtok(list, ",");tok!=NULL;tok=strtok(NULL, ","))	{
+		char *end;
+		long coding = strtol(tok, &end, 0);
+		if((*end != '\0') || (coding < 0) || (coding > SUBS_CODING_MASK))
+			return FALSE;
+		*codings |= (1 << coding);
+	}
+	return (*codings != 0) ? TRUE : FALSE;
+}
+
+static SUBSCRIBER *subsFind(struct sockaddr_in *addr)
+{
+	for(int i=0;i<SUBS_MAX;i++)	{
+		if(subs[i].inUse && (subs[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr) &&
+				(subs[i].addr.sin_port == addr->sin_port))
+			return &subs[i];
+	}
+	return NULL;
+}
+
+/*
+ * Add a subscriber, or update one at the same address.
+ * A bad callsign leaves an existing one as it was
+ */
+BOOL subsAdd(struct sockaddr_in *addr, uint16_t codings, char *call, BOOL permanent)
+{
+	SUBSCRIBER *s = subsFind(addr);
+	uint8_t encCall[N_CALL];
+
+	// a datagram cannot change one from the command line or file
+	if((s != NULL) && s->permanent && !permanent)	{
+		logger(LOG_DEBUG, "Subscriber %s:%d is permanent, not changed\n", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+		return FALSE;
+	}
+
+	if((call != NULL) && !encodeCall(call, encCall))	{
+		logger(LOG_ERROR, "Bad subscriber callsign %s\n", call);
+		return FALSE;
+	}
+
+	if(s == NULL)	{
+		for(int i=0;i<SUBS_MAX;i++)	{
+			if(!subs[i].inUse)	{
+				s = &subs[i];
+				break;
+			}
+		}
+		if(s == NULL)	{
+			logger(LOG_ERROR, "No room for subscriber %s:%d\n", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+			return FALSE;
+		}
+		memset(s, 0, sizeof(SUBSCRIBER));
+		logger(LOG_NOTICE, "Subscriber %s:%d codings %04X%s%s\n", inet_ntoa(addr->sin_addr),
+				ntohs(addr->sin_port), codings, (call != NULL) ? " call " : "", (call != NULL) ? call : "");
+	}
+
+	s->hasCall = (call != NULL) ? TRUE : FALSE;
+	if(s->hasCall)
+		memcpy(s->call, encCall, N_CALL);
+
+	s->addr = *addr;
+	s->codings = codings;
+	s->permanent |= permanent;
+	s->expires = time(NULL) + SUBS_EXPIRE;
+	s->inUse = TRUE;
+	return TRUE;
+}
+
+/*
+ * Read subscribers from a file
+ */
+BOOL subsLoad(char *fileName)
+{
+	char line[SUBS_LINE_LEN];
+	int lineNum = 0;
+	BOOL ok = TRUE;
+
+	FILE *fp = fopen(fileName, "r");
+	if(fp == NULL)	{
+		logger(LOG_ERROR, "Cannot open subscriber file %s\n", fileName);
+		return FALSE;
+	}
+
+	while(fgets(line, sizeof(line), fp) != NULL)	{
+		lineNum++;
+		char *host = strtok(line, SUBS_DELIM);
+		if((host == NULL) || (host[0] == '#'))
+			continue;
+		char *port = strtok(NULL, SUBS_DELIM);
+		char *list = strtok(NULL, SUBS_DELIM);
+		char *call = strtok(NULL, SUBS_DELIM);
+
+		struct hostent *he = gethostbyname(host);
+		struct sockaddr_in addr;
+		uint16_t codings;
+		if((port == NULL) || (list == NULL) || (he == NULL) || !subsCodings(list, &codings))	{
+			logger(LOG_ERROR, "%s line %d: need host port codings [callsign]\n", fileName, lineNum);
+			ok = FALSE;
+			continue;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr = *(struct in_addr *)he->h_addr;
+		addr.sin_port = htons(atoi(port));
+		ok &= subsAdd(&addr, codings, call, TRUE);
+	}
+
+	fclose(fp);
+	return ok;
+}
+
+/*
+ * The network control datagrams may also come
+ * from, as address/bits
+ */
+BOOL subsControlNet(char *netSpec)
+{
+	char spec[SUBS_LINE_LEN];
+	struct in_addr addr;
+	int bits = 32;
+
+	strncpy(spec, netSpec, sizeof(spec)-1);
+	spec[sizeof(spec)-1] = '\0';
+
+	char *slash = strchr(spec, '/');
+	if(slash != NULL)	{
+		*slash++ = '\0';
+		char *end;
+		bits = strtol(slash, &end, 10);
+		if((*end != '\0') || (bits < 0) || (bits > 32))
+			return FALSE;
+	}
+	if(!inet_aton(spec, &addr))
+		return FALSE;
+
+	ctlMask = (bits == 0) ? 0 : (0xFFFFFFFF << (32 - bits));
+	ctlNet = ntohl(addr.s_addr) & ctlMask;
+	logger(LOG_NOTICE, "Subscriptions taken from %s/%d\n", spec, bits);
+	return TRUE;
+}
+
+// control datagrams only from the loopback or the given network
+static BOOL subsAllowed(struct sockaddr_in *from)
+{
+	uint32_t addr = ntohl(from->sin_addr.s_addr);
+
+	if((addr & SUBS_LOOPBACK_MASK) == SUBS_LOOPBACK_NET)
+		return TRUE;
+	return ((addr & ctlMask) == ctlNet) ? TRUE : FALSE;
+}
+
+/*
+ * A control datagram: subscribe or unsubscribe the sender.
+ * Returns FALSE if it is not one
+ */
+BOOL subsControl(char *msg, int length, struct sockaddr_in *from)
+{
+	char cmd[SUBS_LINE_LEN];
+	uint16_t codings;
+
+	if((length <= 0) || (length >= sizeof(cmd)))
+		return FALSE;
+
+	if(!subsAllowed(from))	{
+		logger(LOG_DEBUG, "Control datagram from %s:%d refused\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+		return TRUE;
+	}
+	memcpy(cmd, msg, length);
+	cmd[length] = '\0';
+
+	char *verb = strtok(cmd, SUBS_DELIM);
+	if(verb == NULL)
+		return FALSE;
+
+	if(!strcmp(verb, SUBS_CMD_UNSUB))	{
+		SUBSCRIBER *s = subsFind(from);
+		if((s != NULL) && !s->permanent)	{
+			logger(LOG_NOTICE, "Subscriber %s:%d left\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+			s->inUse = FALSE;
+		}
+		return TRUE;
+	}
+
+	if(strcmp(verb, SUBS_CMD_SUB))
+		return FALSE;
+
+	char *list = strtok(NULL, SUBS_DELIM);
+	char *call = strtok(NULL, SUBS_DELIM);
+	if((list == NULL) || !subsCodings(list, &codings))	{
+		logger(LOG_ERROR, "Bad subscription from %s:%d\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+		return TRUE;
+	}
+
+	subsAdd(from, codings, call, FALSE);
+	return TRUE;
+}
+
+/*
+ * Subscribers that want a frame, from its header alone:
+ * fills in their addresses and returns how many
+ */
+int subsMatch(struct spi_hdr_t *hdr, struct sockaddr_in *dests, int maxDests)
+{
+	uint16_t coding = 1 << (hdr->coding & SUBS_CODING_MASK);
+	time_t now = 0;
+	int nDests = 0;
+
+	for(int i=0;(i<SUBS_MAX) && (nDests<maxDests);i++)	{
+		SUBSCRIBER *s = &subs[i];
+		if(!s->inUse || !(s->codings & coding))
+			continue;
+
+		if(s->hasCall && memcmp(s->call, hdr->fromCall, N_CALL) && memcmp(s->call, hdr->toCall, N_CALL))
+			continue;
+
+		// lapsed
+		if(!s->permanent)	{
+			if(now == 0)
+				now = time(NULL);
+			if(now > s->expires)	{
+				logger(LOG_NOTICE, "Subscriber %s:%d lapsed\n", inet_ntoa(s->addr.sin_addr), ntohs(s->addr.sin_port));
+				s->inUse = FALSE;
+				continue;
+			}
+		}
+
+		s->nFrames++;
+		dests[nDests++] = s->addr;
+	}
+	return nDests;
+}
+
+void subsLog(void)
+{
+	for(int i=0;i<SUBS_MAX;i++)	{
+		if(subs[i].inUse)
+			logger(LOG_NOTICE, "Subscriber %s:%d: %u frames\n", inet_ntoa(subs[i].addr.sin_addr),
+					ntohs(subs[i].addr.sin_port), subs[i].nFrames);
+	}
+}
@@ -0,0 +1,401 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        tun.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      TUN interface. IPv4 packets from the interface go
+                          to the node as IP encapsulated frames addressed by
+                          callsign, and IP frames from the node are written
+                          back to it, so applications can use ordinary sockets
+                          on the mesh addresses.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+#include "types.h"
+#include "logger.h"
+#include "spidefs.h"
+#include "reactor.h"
+#include "callsign.h"
+#include "tun.h"
+
+// local defines
+#define	TUN_DEVICE		"/dev/net/tun"
+
+// an address we have heard from
+struct tun_peer_t	{
+	uint32_t		addr;					// IPv4 address, host order; 0 if free
+	uint8_t			call[N_CALL];			// compressed callsign
+	uint8_t			vpn[IP_400_PORT_SIZE];	// VPN field
+	time_t			seen;					// last heard
+};
+
+// locals
+static int tunFD = -1;						// tun device
+static BOOL tunPaused;						// no room in the tx ring
+static uint8_t myCall[N_CALL];				// our callsign
+static uint8_t myVPN[IP_400_PORT_SIZE];		// and VPN field
+static uint32_t myAddr;						// our address
+static struct tun_peer_t peers[TUN_PEERS];
+static TUN_STATS stats;
+
+// frame going to the node: header then the packet
+static union	{
+	struct {
+		struct spi_hdr_t	hdr;
+		uint8_t		buffer[TUN_MTU];
+	} frame;
+	uint8_t			rawData[sizeof(struct spi_hdr_t) + TUN_MTU];
+} tunTxFrame;
+
+void tun_receive(int fd, uint32_t events, void *arg);
+
+/*
+ * The VPN address of a callsign and VPN field:
+ * 172.(16 + hash of the call).vpn[1].vpn[0]
+ */
+static uint32_t tunAddrFromCall(uint8_t *call, uint8_t *vpn)
+{
+	uint8_t b3 = call[0] ^ call[2];
+	uint8_t b4 = call[1] ^ call[3];
+	uint32_t b2 = ((b3 + b4) & 0xF) + 16;
+
+	return (172U << 24) | (b2 << 16) | ((uint32_t)vpn[1] << 8) | vpn[0];
+}
+
+// remember who has an address
+static void tunLearn(uint8_t *call, uint8_t *vpn)
+{
+	struct tun_peer_t *slot = NULL;
+
+	if(isBroadcastCall(call))
+		return;
+
+	uint32_t addr = tunAddrFromCall(call, vpn);
+	time_t now = time(NULL);
+
+	for(int i=0;i<TUN_PEERS;i++)	{
+		struct tun_peer_t *p = &peers[i];
+		if(p->addr == addr)	{
+			slot = p;
+			break;
+		}
+		// a free one, else the one heard from longest ago
+		if((slot == NULL) || ((slot->addr != 0) && ((p->addr == 0) || (p->seen < slot->seen))))
+			slot = p;
+	}
+
+	if(slot->addr != addr)	{
+		struct in_addr ia = { htonl(addr) };
+		logger(LOG_DEBUG, "TUN learned %s\n", inet_ntoa(ia));
+		stats.nLearned++;
+	}
+	slot->addr = addr;
+	memcpy(slot->call, call, N_CALL);
+	memcpy(slot->vpn, vpn, IP_400_PORT_SIZE);
+	slot->seen = now;
+}
+
+/*
+ * Callsign and VPN for a destination: broadcast for
+ * broadcasts and multicast, else from the table
+ */
+static BOOL tunRoute(uint32_t addr, uint8_t *call, uint8_t *vpn)
+{
+	if((addr == 0xFFFFFFFF) || ((addr >> 28) == 0xE) ||
+			(addr == (TUN_NETWORK | ~TUN_NETMASK)))	{
+		memset(call, BROADCAST_CALL, N_CALL);
+		memset(vpn, BROADCAST_CALL, IP_400_PORT_SIZE);
+		return TRUE;
+	}
+
+	time_t now = time(NULL);
+	for(int i=0;i<TUN_PEERS;i++)	{
+		struct tun_peer_t *p = &peers[i];
+		if(p->addr != addr)
+			continue;
+		if((now - p->seen) > TUN_PEER_AGE)	{
+			p->addr = 0;
+			return FALSE;
+		}
+		memcpy(call, p->call, N_CALL);
+		memcpy(vpn, p->vpn, IP_400_PORT_SIZE);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+// set an interface address by ioctl
+static BOOL tunSetAddr(int sock, char *name, unsigned long req, uint32_t addr)
+{
+	struct ifreq ifr;
+	struct sockaddr_in *sin = (struct sockaddr_in *)&ifr.ifr_addr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, IFNAMSIZ, "%s", name);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(addr);
+	return (ioctl(sock, req, &ifr) == -1) ? FALSE : TRUE;
+}
+
+// give the interface its address and bring it up
+static BOOL tunConfigure(char *name)
+{
+	struct ifreq ifr;
+	BOOL ok = TRUE;
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(sock == -1)
+		return FALSE;
+
+	ok &= tunSetAddr(sock, name, SIOCSIFADDR, myAddr);
+	ok &= tunSetAddr(sock, name, SIOCSIFNETMASK, TUN_NETMASK);
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, IFNAMSIZ, "%s", name);
+	ifr.ifr_mtu = TUN_MTU;
+	if(ioctl(sock, SIOCSIFMTU, &ifr) == -1)
+		ok = FALSE;
+
+	if(ioctl(sock, SIOCGIFFLAGS, &ifr) == -1)	{
+		ok = FALSE;
+	} else {
+		ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+		if(ioctl(sock, SIOCSIFFLAGS, &ifr) == -1)
+			ok = FALSE;
+	}
+
+	if(!ok)
+		logger(LOG_ERROR, "Cannot configure %s: %s\n", name, strerror(errno));
+	close(sock);
+	return ok;
+}
+
+/*
+ * Open the tun interface: name,callsign,address
+ */
+BOOL tunOpen(char *tunSpec)
+{
+	char spec[100], *name, *call, *addr;
+	struct in_addr ia;
+	struct ifreq ifr;
+
+	strncpy(spec, tunSpec, sizeof(spec)-1);
+	spec[sizeof(spec)-1] = '\0';
+	name = strtok(spec, ",");
+	call = strtok(NULL, ",");
+	addr = strtok(NULL, ",");
+	if((name == NULL) || (call == NULL) || (addr == NULL) || (inet_aton(addr, &ia) == 0))	{
+		logger(LOG_ERROR, "TUN needs name,callsign,address: %s\n", tunSpec);
+		return FALSE;
+	}
+
+	if(!encodeCall(call, myCall))	{
+		logger(LOG_ERROR, "Callsign %s must be 1 to %d characters\n", call, MAX_CALL);
+		return FALSE;
+	}
+
+	// the address must be the one the mesh will know us by
+	myAddr = ntohl(ia.s_addr);
+	myVPN[0] = (uint8_t)(myAddr & 0xFF);
+	myVPN[1] = (uint8_t)((myAddr >> 8) & 0xFF);
+	if(tunAddrFromCall(myCall, myVPN) != myAddr)	{
+		ia.s_addr = htonl(tunAddrFromCall(myCall, myVPN));
+		logger(LOG_ERROR, "Address for %s must be %s\n", call, inet_ntoa(ia));
+		return FALSE;
+	}
+
+	if((tunFD = open(TUN_DEVICE, O_RDWR | O_NONBLOCK | O_CLOEXEC)) == -1)	{
+		logger(LOG_ERROR, "Cannot open %s: %s\n", TUN_DEVICE, strerror(errno));
+		return FALSE;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+	snprintf(ifr.ifr_name, IFNAMSIZ, "%s", name);
+	if(ioctl(tunFD, TUNSETIFF, &ifr) == -1)	{
+		logger(LOG_ERROR, "Cannot create %s: %s\n", name, strerror(errno));
+		close(tunFD);
+		tunFD = -1;
+		return FALSE;
+	}
+
+	if(!tunConfigure(ifr.ifr_name))	{
+		close(tunFD);
+		tunFD = -1;
+		return FALSE;
+	}
+
+	memset(peers, 0, sizeof(peers));
+	memset(&stats, 0, sizeof(stats));
+	tunPaused = FALSE;
+
+	// fixed header fields
+	struct spi_hdr_t *hdr = &tunTxFrame.frame.hdr;
+	memset(hdr, 0, sizeof(struct spi_hdr_t));
+	hdr->eye[0] = 'I';
+	hdr->eye[1] = 'P';
+	hdr->eye[2] = '4';
+	hdr->eye[3] = 'C';
+	hdr->status = SINGLE_FRAME;
+	memcpy(hdr->fromCall, myCall, N_CALL);
+	memcpy(hdr->fromPort, myVPN, IP_400_PORT_SIZE);
+	hdr->coding = TUN_CODING_IP;
+
+	if(!reactorAdd(tunFD, tun_receive, NULL))	{
+		close(tunFD);
+		tunFD = -1;
+		return FALSE;
+	}
+
+	logger(LOG_NOTICE, "TUN %s up as %s %s\n", ifr.ifr_name, call, addr);
+	return TRUE;
+}
+
+void tunClose(void)
+{
+	if(tunFD == -1)
+		return;
+
+	logger(LOG_NOTICE, "TUN tx %u rx %u packets, %u no route, %u/%u dropped, %u learned\n",
+			stats.nTxPackets, stats.nRxPackets, stats.nNoRoute,
+			stats.nTxDrops, stats.nRxDrops, stats.nLearned);
+
+	reactorRemove(tunFD);
+	close(tunFD);
+	tunFD = -1;
+}
+
+/*
+ * A frame from the node: learn the sender from beacons and
+ * IP frames, and write IP frames to the interface. Returns
+ * TRUE if the frame was taken, else it goes to UDP
+ */
+BOOL tunDeliver(uint8_t *frame, uint16_t length)
+{
+	struct spi_hdr_t *hdr = (struct spi_hdr_t *)frame;
+
+	if((tunFD == -1) || (length < sizeof(struct spi_hdr_t)))
+		return FALSE;
+
+	if((hdr->coding != TUN_CODING_BEACON) && (hdr->coding != TUN_CODING_IP))
+		return FALSE;
+
+	tunLearn(hdr->fromCall, hdr->fromPort);
+	if(hdr->coding == TUN_CODING_BEACON)
+		return FALSE;
+
+	// skip what comes before the packet
+	uint16_t skip = sizeof(struct spi_hdr_t);
+	if(hdr->flags & TUN_FLAG_SRCEXT)
+		skip += N_CALL;
+	if(hdr->flags & TUN_FLAG_DESTEXT)
+		skip += N_CALL;
+	if(hdr->flags & TUN_FLAG_HOPTABLE)
+		skip += TUN_HOPTABLE_SIZE;
+
+	uint8_t *packet = frame + skip;
+	if((length < skip + 20) || ((packet[0] >> 4) != 4))	{
+		stats.nRxDrops++;
+		return TRUE;
+	}
+
+	if(write(tunFD, packet, length - skip) == -1)	{
+		stats.nRxDrops++;
+		return TRUE;
+	}
+	stats.nRxPackets++;
+	return TRUE;
+}
+
+/*
+ * Room in the tx ring again: carry on reading
+ */
+void tun_rx_resume(void)
+{
+	if(!tunPaused || (tunFD == -1))
+		return;
+
+	tunPaused = FALSE;
+	reactorEnable(tunFD, TRUE);
+}
+
+/*
+ * Packets from the interface: called from the event loop.
+ * Each one goes into the tx ring, so several can go to the
+ * node in one exchange
+ */
+void tun_receive(int fd, uint32_t events, void *arg)
+{
+	struct spi_hdr_t *hdr = &tunTxFrame.frame.hdr;
+	SPI_DATA_FRAME spiFrame;
+
+	for(int i=0;i<TUN_RX_BURST;i++)	{
+
+		// no room: leave the rest queued on the interface
+		if(spiTxRoom() == 0)	{
+			tunPaused = TRUE;
+			reactorEnable(fd, FALSE);
+			return;
+		}
+
+		ssize_t len = read(fd, tunTxFrame.frame.buffer, TUN_MTU);
+		if(len == -1)	{
+			if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				logger(LOG_ERROR, "TUN read error %d\n", errno);
+			return;
+		}
+
+		// IPv4 only
+		if((len < 20) || ((tunTxFrame.frame.buffer[0] >> 4) != 4))	{
+			stats.nTxDrops++;
+			continue;
+		}
+
+		uint32_t dest;
+		memcpy(&dest, &tunTxFrame.frame.buffer[16], sizeof(dest));
+		if(!tunRoute(ntohl(dest), hdr->toCall, hdr->toPort))	{
+			stats.nNoRoute++;
+			continue;
+		}
+
+		hdr->length_hi = (uint8_t)(len >> 8);
+		hdr->length_lo = (uint8_t)(len & 0xFF);
+		spiFrame.buffer = tunTxFrame.rawData;
+		spiFrame.length = len + sizeof(struct spi_hdr_t);
+		if(!EnqueSPIFrame(&spiFrame))	{
+			stats.nTxDrops++;
+			continue;
+		}
+		stats.nTxPackets++;
+	}
+}
+
+void tunGetStats(TUN_STATS *s)
+{
+	memcpy(s, &stats, sizeof(TUN_STATS));
+}
@@ -18,6 +18,7 @@
                           Copyright (c) 2024-25 Alberta Digital Radio Communications Society
 
 ---------------------------------------------------------------------------*/
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -28,30 +29,56 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
-#include <pthread.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 
 #include "types.h"
 #include "logger.h"
 #include "spidefs.h"
+#include "reactor.h"
+#include "subs.h"
 
 // local defines
-#define	MAX_BUFFER		1024				// max buffer size
+#define	MAX_BUFFER		(sizeof(struct spi_hdr_t) + PAYLOAD_MAX)	// max buffer size
+#define	MAX_TX_BUFFER	(sizeof(struct spi_hdr_t) + SPI_REASM_MAX)	// reassembled frames
 #define SOCKET_ERROR	-1					// socket error
 
+/*
+ * Both directions are batched: datagrams are read with one
+ * recvmmsg into a set of preallocated buffers, and the frames
+ * one SPI exchange produces are collected and sent with one
+ * sendmmsg when the exchange is done.
+ */
+#define	UDP_RX_BURST	16					// datagrams read per wakeup
+#define	UDP_TX_BATCH	16					// frames sent per call
+#define	UDP_TX_MSGS		(4*UDP_TX_BATCH)	// datagrams: a frame can go to several subscribers
+
 struct udp_threads_t	{
 	int					udpsock;			// socket
 	struct sockaddr_in 	si_remote;			// where to send it
-	// background task
-	BOOL				exit;				// exit
-	pthread_t			rxfunc;				// rx function
-	uint8_t				buffer[MAX_BUFFER];	// rx bufferrxSegLen
-	int					length;				// length received
+	BOOL				rxPaused;			// no room for more
+	// receive batch
+	uint8_t				rxBuf[UDP_RX_BURST][MAX_BUFFER];
+	struct sockaddr_in	rxFrom[UDP_RX_BURST];
+	struct iovec		rxIov[UDP_RX_BURST];
+	struct mmsghdr		rxMsg[UDP_RX_BURST];
+	// transmit batch: each frame copied once, then
+	// one datagram per subscriber pointing at it
+	uint8_t				txBuf[UDP_TX_BATCH][MAX_TX_BUFFER];
+	struct sockaddr_in	txTo[UDP_TX_MSGS];
+	struct iovec		txIov[UDP_TX_MSGS];
+	struct mmsghdr		txMsg[UDP_TX_MSGS];
+	int					nTxBufs;			// frames waiting to go
+	int					nTxPending;			// datagrams waiting to go
+	UDP_STATS			stats;				// syscalls per frame
 } udp_threads;
 
-void *udp_receive_task(void *args);
+void udp_receive(int fd, uint32_t events, void *arg);
 
 uint8_t udpDebug;
 int sendCnt=0;
+int sendBufSize=0;				// socket send buffer size
 
 /*
  * set up the UDP Socket
@@ -62,18 +89,24 @@ BOOL setup_udp_socket(char *hostname, int hostport, int localport, int debug)
 	struct hostent ah, *host;
 
 	udpDebug = debug;
+	subsInit();
 
-	memset(&ah,0,sizeof(ah));
-	host = gethostbyname(hostname);
-	if (!host)
-	{
-		logger(LOG_NOTICE, "Unable to find host %s\n", hostname);
-		return FALSE;
-	}
+	// the remote host, if any, gets everything
 	memset((char *) &udp_threads.si_remote, 0, sizeof(struct sockaddr_in));
-	udp_threads.si_remote.sin_addr = *(struct in_addr *)host->h_addr;
-	udp_threads.si_remote.sin_family = AF_INET;
-	udp_threads.si_remote.sin_port = htons(hostport);
+	if(hostname[0] != '\0')	{
+		memset(&ah,0,sizeof(ah));
+		host = gethostbyname(hostname);
+		if (!host)
+		{
+			logger(LOG_NOTICE, "Unable to find host %s\n", hostname);
+			return FALSE;
+		}
+		udp_threads.si_remote.sin_addr = *(struct in_addr *)host->h_addr;
+		udp_threads.si_remote.sin_family = AF_INET;
+		udp_threads.si_remote.sin_port = htons(hostport);
+		if(!subsAdd(&udp_threads.si_remote, SUBS_ALL_CODINGS, NULL, TRUE))
+			return FALSE;
+	}
 
 	if ((udp_threads.udpsock=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))==-1)
 	{
@@ -85,7 +118,7 @@ BOOL setup_udp_socket(char *hostname, int hostport, int localport, int debug)
 	si_me.sin_family = AF_INET;
 	si_me.sin_port = htons(localport);
 	si_me.sin_addr.s_addr = htonl(INADDR_ANY);
-	if (!strncmp(inet_ntoa(udp_threads.si_remote.sin_addr),"127.",4))
+	if ((hostname[0] != '\0') && !strncmp(inet_ntoa(udp_threads.si_remote.sin_addr),"127.",4))
 		si_me.sin_addr.s_addr = inet_addr("127.0.0.1");
 	if (bind(udp_threads.udpsock, (const struct sockaddr *)&si_me, sizeof(si_me))==-1)
 	{
@@ -98,86 +131,241 @@ BOOL setup_udp_socket(char *hostname, int hostport, int localport, int debug)
 		return FALSE;
 	}
 
-    // set the receive timeout on the read to one second
-	struct timeval timeout;
-	timeout.tv_sec = (__time_t)1;
-	timeout.tv_usec =(__suseconds_t)0;
-	if (setsockopt (udp_threads.udpsock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval)) < 0)	{
-			logger(LOG_NOTICE, "setsockopt timeout failed\n");
+	// reads never block: the event loop says when there is data
+	int flags = fcntl(udp_threads.udpsock, F_GETFL);
+	if(fcntl(udp_threads.udpsock, F_SETFL, flags | O_NONBLOCK) < 0)	{
+			logger(LOG_NOTICE, "fcntl non-blocking failed\n");
 	}
 
-	// start the rx background
-	udp_threads.exit = FALSE;
-	pthread_create(&udp_threads.rxfunc, NULL, &udp_receive_task, (void *)(&udp_threads));
+	// multicast subscribers: the local network only
+	unsigned char ttl = SUBS_MCAST_TTL;
+	if(setsockopt(udp_threads.udpsock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)	{
+			logger(LOG_NOTICE, "setsockopt multicast TTL failed\n");
+	}
+
+	// size of the send buffer, for flow control
+	socklen_t optlen = sizeof(sendBufSize);
+	if(getsockopt(udp_threads.udpsock, SOL_SOCKET, SO_SNDBUF, &sendBufSize, &optlen) < 0)	{
+			logger(LOG_NOTICE, "getsockopt send buffer failed\n");
+	}
+
+	// point the batches at their buffers
+	memset(udp_threads.rxMsg, 0, sizeof(udp_threads.rxMsg));
+	memset(udp_threads.txMsg, 0, sizeof(udp_threads.txMsg));
+	for(int i=0;i<UDP_RX_BURST;i++)	{
+		udp_threads.rxIov[i].iov_base = udp_threads.rxBuf[i];
+		udp_threads.rxIov[i].iov_len = MAX_BUFFER;
+		udp_threads.rxMsg[i].msg_hdr.msg_iov = &udp_threads.rxIov[i];
+		udp_threads.rxMsg[i].msg_hdr.msg_iovlen = 1;
+		udp_threads.rxMsg[i].msg_hdr.msg_name = &udp_threads.rxFrom[i];
+	}
+	for(int i=0;i<UDP_TX_MSGS;i++)	{
+		udp_threads.txMsg[i].msg_hdr.msg_iov = &udp_threads.txIov[i];
+		udp_threads.txMsg[i].msg_hdr.msg_iovlen = 1;
+		udp_threads.txMsg[i].msg_hdr.msg_name = &udp_threads.txTo[i];
+		udp_threads.txMsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+	udp_threads.nTxBufs = udp_threads.nTxPending = 0;
+	memset(&udp_threads.stats, 0, sizeof(UDP_STATS));
+
+	// receive from the event loop
+	udp_threads.rxPaused = FALSE;
+	if(!reactorAdd(udp_threads.udpsock, udp_receive, (void *)(&udp_threads)))
+		return FALSE;
 
 	if(udpDebug&DEBUG_UDP)
 		logger(LOG_NOTICE, "UDP Setup completed\n");
 	return TRUE;
 }
 
+/*
+ * Send to multicast subscribers from the interface
+ * with this address, rather than the routed one
+ */
+BOOL udp_multicast_if(char *ifAddr)
+{
+	struct in_addr addr;
+
+	if(!inet_aton(ifAddr, &addr))
+		return FALSE;
+
+	if(setsockopt(udp_threads.udpsock, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr)) < 0)	{
+		logger(LOG_ERROR, "Cannot send multicast from %s: %s\n", ifAddr, strerror(errno));
+		return FALSE;
+	}
+	logger(LOG_NOTICE, "Multicast subscribers sent from %s\n", ifAddr);
+	return TRUE;
+}
+
 /*
  * Close the socket
  */
 void close_udp_socket(void)
 {
-	udp_threads.exit = TRUE;
-	pthread_join(udp_threads.rxfunc, NULL);
+	UDP_STATS *st = &udp_threads.stats;
+
+	udp_flush();
+	reactorRemove(udp_threads.udpsock);
+
+	logger(LOG_NOTICE, "UDP rx %u frames in %u calls, tx %u frames in %u calls, %u dropped, %u unsubscribed\n",
+			st->nRxFrames, st->nRxCalls, st->nTxFrames, st->nTxCalls, st->nTxDrops, st->nUnsubscribed);
+	subsLog();
 
 	if(udp_threads.udpsock)
 		close(udp_threads.udpsock);
 }
 
 /*
- * Send a UDP packet
+ * Send a UDP packet to each subscriber that wants it. The
+ * header says who does, before anything is copied; then it
+ * is copied into the batch once, which goes out on the next
+ * flush, or now if it is full
  */
 BOOL send_udp_packet(void *data, uint16_t length)
 {
-	int stat;
-	stat = sendto(udp_threads.udpsock, data, length, 0, (struct sockaddr *)&udp_threads.si_remote,sizeof(struct sockaddr_in));
-	if(stat == -1)	{
-		logger(LOG_NOTICE, "Error on UDP packet: %d:%s\n", errno, geterrno(errno));
+	struct udp_threads_t *s = &udp_threads;
+	struct sockaddr_in dests[SUBS_MAX];
+
+	if(length > MAX_TX_BUFFER)	{
+		logger(LOG_NOTICE, "UDP packet of %d bytes too long\n", length);
+		s->stats.nTxDrops++;
 		return FALSE;
 	}
-	logger(LOG_DEBUG, "UDP Packet %d Sent\n", ++sendCnt);
+
+	int nDests = subsMatch((struct spi_hdr_t *)data, dests, SUBS_MAX);
+	if(nDests == 0)	{
+		s->stats.nUnsubscribed++;
+		return TRUE;
+	}
+
+	if((s->nTxBufs == UDP_TX_BATCH) || ((s->nTxPending + nDests) > UDP_TX_MSGS))
+		udp_flush();
+
+	uint8_t *buf = s->txBuf[s->nTxBufs++];
+	memcpy(buf, data, length);
+	for(int i=0;i<nDests;i++)	{
+		s->txTo[s->nTxPending] = dests[i];
+		s->txIov[s->nTxPending].iov_base = buf;
+		s->txIov[s->nTxPending].iov_len = length;
+		s->nTxPending++;
+	}
 	return TRUE;
 }
 
 /*
- * Receive a UDP packet
+ * Send the batch with as few calls as the kernel allows
  */
-void *udp_receive_task(void *args)
+void udp_flush(void)
 {
-	struct sockaddr_in si_them;
-	unsigned int themlen = sizeof(struct sockaddr_in);
+	struct udp_threads_t *s = &udp_threads;
+	int sent = 0;
 
-	struct udp_threads_t *s = (struct udp_threads_t *)args;
-	SPI_DATA_FRAME *spiFrame;
+	while(sent < s->nTxPending)	{
+		int stat = sendmmsg(s->udpsock, &s->txMsg[sent], s->nTxPending - sent, 0);
+		s->stats.nTxCalls++;
+		if(stat == -1)	{
+			if(errno == EINTR)
+				continue;
+			logger(LOG_NOTICE, "Error on UDP packet: %d:%s\n", errno, geterrno(errno));
+			// skip the one that failed
+			s->stats.nTxDrops++;
+			sent++;
+			continue;
+		}
+		sent += stat;
+		s->stats.nTxFrames += stat;
+		sendCnt += stat;
+	}
 
-	while(!s->exit)		{
+	if(s->nTxPending != 0)
+		logger(LOG_DEBUG, "UDP Packets to %d Sent\n", sendCnt);
+	s->nTxBufs = s->nTxPending = 0;
+}
 
-		if ((s->length = recvfrom(s->udpsock,s->buffer,MAX_BUFFER, 0,
-				(struct sockaddr *)&si_them,&themlen)) == SOCKET_ERROR)
-		{
-			/*
-			 * process a non-timeout.
-			 */
-			if(errno != EAGAIN)	{
-				logger(LOG_ERROR, "UDP Receive error %d\n", errno);
-			}
-		} else {
-			// check the packet header first
-			if(!isIP400Frame(s->buffer))
-				continue;
+void udp_get_stats(UDP_STATS *stats)
+{
+	memcpy(stats, &udp_threads.stats, sizeof(UDP_STATS));
+}
 
-			// rx a good packet
-			if((spiFrame = malloc(s->length)) == NULL)	{
-				continue;
-			}
-			spiFrame->buffer = s->buffer;
-			spiFrame->length = s->length;
-			EnqueSPIFrame(spiFrame);
+/*
+ * Room left in the socket send buffer. The kernel counts
+ * buffer overhead as well, so only half is really payload
+ */
+uint32_t udp_tx_room(void)
+{
+	int outq;
+
+	if(ioctl(udp_threads.udpsock, SIOCOUTQ, &outq) == -1)
+		return 0;
+
+	if(outq >= sendBufSize)
+		return 0;
+
+	return (sendBufSize - outq)/2;
+}
+
+/*
+ * Room in the tx ring again: carry on receiving
+ */
+void udp_rx_resume(void)
+{
+	if(!udp_threads.rxPaused)
+		return;
+
+	udp_threads.rxPaused = FALSE;
+	reactorEnable(udp_threads.udpsock, TRUE);
+}
+
+/*
+ * Receive UDP packets: called from the event loop when the
+ * socket is readable. Reads a bounded burst in one call, no
+ * more than the tx ring has room for, so the SPI tick is not
+ * held up; anything left wakes the loop again
+ */
+void udp_receive(int fd, uint32_t events, void *arg)
+{
+	struct udp_threads_t *s = (struct udp_threads_t *)arg;
+	SPI_DATA_FRAME spiFrame;
+	int nRead;
+
+	// no room: leave the rest in the socket buffer
+	uint32_t room = spiTxRoom();
+	if(room == 0)	{
+		s->rxPaused = TRUE;
+		reactorEnable(s->udpsock, FALSE);
+		return;
+	}
+	if(room > UDP_RX_BURST)
+		room = UDP_RX_BURST;
+
+	for(int i=0;i<room;i++)
+		s->rxMsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+
+	if((nRead = recvmmsg(s->udpsock, s->rxMsg, room, 0, NULL)) == SOCKET_ERROR)	{
+		/*
+		 * process a non-timeout.
+		 */
+		if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))	{
+			logger(LOG_ERROR, "UDP Receive error %d\n", errno);
+		}
+		return;
+	}
+	s->stats.nRxCalls++;
+	s->stats.nRxFrames += nRead;
+
+	for(int i=0;i<nRead;i++)	{
+
+		// check the packet header first: else
+		// it may be a subscription
+		if(!isIP400Frame(s->rxBuf[i]))	{
+			subsControl((char *)s->rxBuf[i], s->rxMsg[i].msg_len, &s->rxFrom[i]);
+			continue;
 		}
+
+		// rx a good packet: the queue takes a copy
+		spiFrame.buffer = s->rxBuf[i];
+		spiFrame.length = s->rxMsg[i].msg_len;
+		EnqueSPIFrame(&spiFrame);
 	}
-	return NULL;
 }
 
@@ -0,0 +1,225 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        reasmtest.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Test for fragment reassembly: frames are fed in
+                          fragments, some lost, repeated or interleaved with
+                          another stream, and each frame that comes out must
+                          be the one that went in, whole. Above all, a frame
+                          whose last fragment was lost must not take the
+                          next frame on the same stream with it.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "types.h"
+#include "logger.h"
+#include "spidefs.h"
+#include "reasm.h"
+
+#define	TEST_FRAME_LEN		1053				// three fragments: 500, 500, 53
+#define	TEST_MAX_OUT		8					// frames delivered in one case
+
+// a frame's data: a pattern from its number
+static uint8_t frameData[TEST_FRAME_LEN];
+
+// what came out
+static struct	{
+	uint16_t		length;
+	uint8_t			data[sizeof(struct spi_hdr_t) + SPI_REASM_MAX];
+} delivered[TEST_MAX_OUT];
+static int nDelivered;
+
+static int nErrors;
+
+// reassembly's outputs, stood in for
+void spiDeliver(void *data, uint16_t length)
+{
+	if(nDelivered < TEST_MAX_OUT)	{
+		delivered[nDelivered].length = length;
+		memcpy(delivered[nDelivered].data, data, length);
+	}
+	nDelivered++;
+}
+
+void logger(int severity, char *format, ...)
+{
+}
+
+static void fillFrame(uint8_t frameNum)
+{
+	for(int i=0;i<TEST_FRAME_LEN;i++)
+		frameData[i] = (uint8_t)(frameNum * 37 + i);
+}
+
+// one fragment of the current frame, from a station
+static void sendFrag(char station, uint8_t status, uint16_t offset, uint16_t length)
+{
+	struct spi_hdr_t hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.eye, "IP4C", 4);
+	memset(hdr.fromCall, station, N_CALL);
+	hdr.status = status;
+	hdr.offset_hi = (offset >> 8);
+	hdr.offset_lo = (offset & 0xFF);
+	hdr.length_hi = (length >> 8);
+	hdr.length_lo = (length & 0xFF);
+	reasmFragment(&hdr, frameData + offset);
+}
+
+// fragments of a frame, as the node sends them: skip one to lose it
+#define	FRAG_FIRST			0x01
+#define	FRAG_MIDDLE			0x02
+#define	FRAG_LAST			0x04
+#define	FRAG_ALL			(FRAG_FIRST | FRAG_MIDDLE | FRAG_LAST)
+
+static void sendFrame(char station, uint8_t frameNum, uint8_t which)
+{
+	fillFrame(frameNum);
+	if(which & FRAG_FIRST)
+		sendFrag(station, FIRST_FRAGMENT, 0, SPI_BUFFER_LEN);
+	if(which & FRAG_MIDDLE)
+		sendFrag(station, MIDDLE_FRAGMENT, SPI_BUFFER_LEN, SPI_BUFFER_LEN);
+	if(which & FRAG_LAST)
+		sendFrag(station, LAST_FRAGMENT, 2*SPI_BUFFER_LEN, TEST_FRAME_LEN - 2*SPI_BUFFER_LEN);
+}
+
+// the n'th frame out is this one, whole
+static void checkOut(char *name, int n, char station, uint8_t frameNum)
+{
+	if(n >= nDelivered)	{
+		fprintf(stderr, "%s: frame %d not delivered\n", name, n);
+		nErrors++;
+		return;
+	}
+
+	struct spi_hdr_t *hdr = (struct spi_hdr_t *)delivered[n].data;
+	uint8_t *data = delivered[n].data + sizeof(struct spi_hdr_t);
+	uint16_t length = ((uint16_t)hdr->length_hi << 8) + hdr->length_lo;
+
+	fillFrame(frameNum);
+	if((delivered[n].length != sizeof(struct spi_hdr_t) + TEST_FRAME_LEN) || (length != TEST_FRAME_LEN))	{
+		fprintf(stderr, "%s: frame %d is %d bytes\n", name, n, length);
+		nErrors++;
+	} else if((hdr->status != SINGLE_FRAME) || (hdr->fromCall[0] != station))	{
+		fprintf(stderr, "%s: frame %d status %d from %c\n", name, n, hdr->status, hdr->fromCall[0]);
+		nErrors++;
+	} else if(memcmp(data, frameData, TEST_FRAME_LEN))	{
+		fprintf(stderr, "%s: frame %d is not frame %d\n", name, n, frameNum);
+		nErrors++;
+	}
+}
+
+static void checkCount(char *name, int nFrames)
+{
+	if(nDelivered != nFrames)	{
+		fprintf(stderr, "%s: %d frames delivered, expected %d\n", name, nDelivered, nFrames);
+		nErrors++;
+	}
+}
+
+static void startCase(void)
+{
+	reasmInit();
+	nDelivered = 0;
+}
+
+int main(int argc, char *argv[])
+{
+	REASM_STATS st;
+
+	// in order, nothing lost
+	startCase();
+	sendFrame('A', 1, FRAG_ALL);
+	checkCount("whole", 1);
+	checkOut("whole", 0, 'A', 1);
+
+	// the last fragment lost: the next frame comes out as itself
+	startCase();
+	sendFrame('A', 1, FRAG_FIRST | FRAG_MIDDLE);
+	sendFrame('A', 2, FRAG_ALL);
+	checkCount("last lost", 1);
+	checkOut("last lost", 0, 'A', 2);
+	reasmGetStats(&st);
+	if((st.nRestarts != 1) || (st.nDuplicates != 0))	{
+		fprintf(stderr, "last lost: %u restarts, %u duplicates\n", st.nRestarts, st.nDuplicates);
+		nErrors++;
+	}
+
+	// the first fragment lost: the rest is not spliced into the next
+	startCase();
+	sendFrame('A', 1, FRAG_MIDDLE | FRAG_LAST);
+	sendFrame('A', 2, FRAG_ALL);
+	checkCount("first lost", 1);
+	checkOut("first lost", 0, 'A', 2);
+
+	// a middle fragment lost, then two whole frames
+	startCase();
+	sendFrame('A', 1, FRAG_FIRST | FRAG_LAST);
+	sendFrame('A', 2, FRAG_ALL);
+	sendFrame('A', 3, FRAG_ALL);
+	checkCount("middle lost", 2);
+	checkOut("middle lost", 0, 'A', 2);
+	checkOut("middle lost", 1, 'A', 3);
+
+	// a middle fragment lost, then the first of the next frame:
+	// the next frame's middle must not fill the gap
+	startCase();
+	sendFrame('A', 1, FRAG_FIRST | FRAG_LAST);
+	sendFrame('A', 2, FRAG_MIDDLE | FRAG_LAST);
+	sendFrame('A', 3, FRAG_ALL);
+	checkCount("gap filled", 1);
+	checkOut("gap filled", 0, 'A', 3);
+
+	// a repeated middle fragment is a duplicate, and harmless
+	startCase();
+	fillFrame(1);
+	sendFrag('A', FIRST_FRAGMENT, 0, SPI_BUFFER_LEN);
+	sendFrag('A', MIDDLE_FRAGMENT, SPI_BUFFER_LEN, SPI_BUFFER_LEN);
+	sendFrag('A', MIDDLE_FRAGMENT, SPI_BUFFER_LEN, SPI_BUFFER_LEN);
+	sendFrag('A', LAST_FRAGMENT, 2*SPI_BUFFER_LEN, TEST_FRAME_LEN - 2*SPI_BUFFER_LEN);
+	checkCount("duplicate", 1);
+	checkOut("duplicate", 0, 'A', 1);
+	reasmGetStats(&st);
+	if(st.nDuplicates != 1)	{
+		fprintf(stderr, "duplicate: %u duplicates\n", st.nDuplicates);
+		nErrors++;
+	}
+
+	// two stations interleaved, one losing a last fragment
+	startCase();
+	fillFrame(1);
+	sendFrag('A', FIRST_FRAGMENT, 0, SPI_BUFFER_LEN);
+	fillFrame(5);
+	sendFrag('B', FIRST_FRAGMENT, 0, SPI_BUFFER_LEN);
+	fillFrame(1);
+	sendFrag('A', MIDDLE_FRAGMENT, SPI_BUFFER_LEN, SPI_BUFFER_LEN);
+	fillFrame(5);
+	sendFrag('B', MIDDLE_FRAGMENT, SPI_BUFFER_LEN, SPI_BUFFER_LEN);
+	sendFrag('B', LAST_FRAGMENT, 2*SPI_BUFFER_LEN, TEST_FRAME_LEN - 2*SPI_BUFFER_LEN);
+	sendFrame('A', 2, FRAG_ALL);
+	checkCount("interleaved", 2);
+	checkOut("interleaved", 0, 'B', 5);
+	checkOut("interleaved", 1, 'A', 2);
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
@@ -0,0 +1,335 @@
+/*---------------------------------------------------------------------------
+        Project:          Ip400Spi
+
+        File Name:        ringtest.c
+
+        Author:           MartinA
+
+        Creation Date:    Oct. 18, 2026
+
+        Description:      Stress test for the frame ring: four producers put
+                          numbered frames as fast as they can while one consumer
+                          takes them, checking each producer's frames arrive
+                          intact and in order; then the producers overrun a
+                          ring nobody is taking from, checking it keeps exactly
+                          what fits and counts the rest as drops.
+
+                          This program is free software: you can redistribute it and/or modify
+                          it under the terms of the GNU General Public License as published by
+                          the Free Software Foundation, either version 2 of the License, or
+                          (at your option) any later version, provided this copyright notice
+                          is included.
+
+                          Copyright (c) 2024-26 Alberta Digital Radio Communications Society
+
+---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "types.h"
+#include "framering.h"
+
+// defaults
+#define	TEST_PRODUCERS		4					// threads putting frames
+#define	TEST_FRAMES			1000000				// frames from each
+#define	TEST_SLOTS			16					// small, so it wraps and fills
+
+// frame stamp: who sent it, its number, then a pattern from both
+typedef struct stamp_t	{
+	uint32_t		producer;
+	uint32_t		seq;
+} STAMP;
+
+#define	TEST_MIN_LEN		sizeof(STAMP)
+#define	TEST_MAX_LEN		256
+
+static FRAME_RING ring;
+static int nFrames = TEST_FRAMES;
+static int nSlots = TEST_SLOTS;
+
+static atomic_int producersDone;
+static atomic_int startFlag;
+static atomic_uint nRefused;				// puts that returned FALSE
+
+// each producer's accepted frames, for the overflow check
+static uint32_t nAccepted[TEST_PRODUCERS];
+
+static int nErrors;
+
+// length and pattern vary with the frame, so a torn copy shows
+static uint16_t frameLen(uint32_t producer, uint32_t seq)
+{
+	return TEST_MIN_LEN + ((producer * 31 + seq) % (TEST_MAX_LEN - TEST_MIN_LEN + 1));
+}
+
+static void buildFrame(uint8_t *buf, uint32_t producer, uint32_t seq, uint16_t len)
+{
+	STAMP *hdr = (STAMP *)buf;
+	hdr->producer = producer;
+	hdr->seq = seq;
+	for(int i=TEST_MIN_LEN;i<len;i++)
+		buf[i] = (uint8_t)(producer + seq + i);
+}
+
+// check a frame taken from the ring against what the producer sent
+static BOOL checkFrame(SPI_DATA_FRAME *fr, uint32_t *nextSeq, BOOL gaps)
+{
+	uint8_t *data = (uint8_t *)fr->buffer;
+	STAMP *hdr = (STAMP *)data;
+
+	if((fr->length < TEST_MIN_LEN) || (hdr->producer >= TEST_PRODUCERS))	{
+		fprintf(stderr, "bad frame: length %d, producer %u\n", fr->length, hdr->producer);
+		return FALSE;
+	}
+
+	uint32_t p = hdr->producer;
+	if(gaps ? (hdr->seq < nextSeq[p]) : (hdr->seq != nextSeq[p]))	{
+		fprintf(stderr, "producer %u: frame %u, expected %u\n", p, hdr->seq, nextSeq[p]);
+		return FALSE;
+	}
+	if(fr->length != frameLen(p, hdr->seq))	{
+		fprintf(stderr, "producer %u frame %u: length %d\n", p, hdr->seq, fr->length);
+		return FALSE;
+	}
+	for(int i=TEST_MIN_LEN;i<fr->length;i++)	{
+		if(data[i] != (uint8_t)(p + hdr->seq + i))	{
+			fprintf(stderr, "producer %u frame %u: byte %d corrupt\n", p, hdr->seq, i);
+			return FALSE;
+		}
+	}
+	nextSeq[p] = hdr->seq + 1;
+	return TRUE;
+}
+
+/*
+ * Ordering: retry on a full ring, so every frame gets through
+ */
+static void *orderProducer(void *arg)
+{
+	uint32_t producer = (uint32_t)(uintptr_t)arg;
+	uint8_t buf[TEST_MAX_LEN];
+
+	while(!atomic_load(&startFlag))
+		sched_yield();
+
+	for(uint32_t seq=0;seq<(uint32_t)nFrames;seq++)	{
+		uint16_t len = frameLen(producer, seq);
+		buildFrame(buf, producer, seq, len);
+		while(!ringPut(&ring, buf, len))	{
+			atomic_fetch_add(&nRefused, 1);
+			sched_yield();
+		}
+	}
+	atomic_fetch_add(&producersDone, 1);
+	return NULL;
+}
+
+static void testOrdering(void)
+{
+	pthread_t threads[TEST_PRODUCERS];
+	uint32_t nextSeq[TEST_PRODUCERS];
+	uint64_t nTaken = 0;
+	uint64_t total = (uint64_t)nFrames * TEST_PRODUCERS;
+
+	if(!ringInit(&ring, nSlots))	{
+		fprintf(stderr, "ordering: ring of %d slots not allocated\n", nSlots);
+		nErrors++;
+		return;
+	}
+	memset(nextSeq, 0, sizeof(nextSeq));
+	atomic_store(&producersDone, 0);
+	atomic_store(&startFlag, 0);
+	atomic_store(&nRefused, 0);
+
+	for(int i=0;i<TEST_PRODUCERS;i++)
+		pthread_create(&threads[i], NULL, orderProducer, (void *)(uintptr_t)i);
+	atomic_store(&startFlag, 1);
+
+	// take until the producers are done and the ring is empty
+	for(;;)	{
+		SPI_DATA_FRAME *fr = ringPeek(&ring);
+		if(fr == NULL)	{
+			if((atomic_load(&producersDone) == TEST_PRODUCERS) && (ringPeek(&ring) == NULL))
+				break;
+			sched_yield();
+			continue;
+		}
+		if(!checkFrame(fr, nextSeq, FALSE))	{
+			nErrors++;
+			break;
+		}
+		ringRelease(&ring);
+		nTaken++;
+	}
+
+	for(int i=0;i<TEST_PRODUCERS;i++)
+		pthread_join(threads[i], NULL);
+
+	printf("ordering: %llu of %llu frames taken, %u refused while full, deepest %u of %u\n",
+			(unsigned long long)nTaken, (unsigned long long)total,
+			atomic_load(&nRefused), atomic_load(&ring.highWater), ring.nSlots);
+
+	if(nTaken != total)	{
+		fprintf(stderr, "ordering: frames lost\n");
+		nErrors++;
+	}
+	if(atomic_load(&ring.nPut) != total)	{
+		fprintf(stderr, "ordering: %u puts counted\n", atomic_load(&ring.nPut));
+		nErrors++;
+	}
+	if(atomic_load(&ring.nDrops) != atomic_load(&nRefused))	{
+		fprintf(stderr, "ordering: %u drops counted, %u refused\n",
+				atomic_load(&ring.nDrops), atomic_load(&nRefused));
+		nErrors++;
+	}
+	if(ringDepth(&ring) != 0)	{
+		fprintf(stderr, "ordering: %u left in the ring\n", ringDepth(&ring));
+		nErrors++;
+	}
+	ringFree(&ring);
+}
+
+/*
+ * Overflow: nobody takes, so all but a ring's worth are dropped
+ */
+static void *overflowProducer(void *arg)
+{
+	uint32_t producer = (uint32_t)(uintptr_t)arg;
+	uint8_t buf[TEST_MAX_LEN];
+
+	while(!atomic_load(&startFlag))
+		sched_yield();
+
+	for(uint32_t seq=0;seq<ring.nSlots;seq++)	{
+		uint16_t len = frameLen(producer, seq);
+		buildFrame(buf, producer, seq, len);
+		if(ringPut(&ring, buf, len))
+			nAccepted[producer]++;
+		else
+			atomic_fetch_add(&nRefused, 1);
+	}
+	return NULL;
+}
+
+static void testOverflow(void)
+{
+	pthread_t threads[TEST_PRODUCERS];
+	uint32_t nextSeq[TEST_PRODUCERS];
+	uint32_t nTaken[TEST_PRODUCERS];
+	uint8_t big[FRAME_SLOT_LEN + 1];
+
+	if(!ringInit(&ring, nSlots))	{
+		fprintf(stderr, "overflow: ring of %d slots not allocated\n", nSlots);
+		nErrors++;
+		return;
+	}
+	memset(nextSeq, 0, sizeof(nextSeq));
+	memset(nTaken, 0, sizeof(nTaken));
+	memset(nAccepted, 0, sizeof(nAccepted));
+	atomic_store(&startFlag, 0);
+	atomic_store(&nRefused, 0);
+
+	// each producer tries to fill the ring on its own
+	for(int i=0;i<TEST_PRODUCERS;i++)
+		pthread_create(&threads[i], NULL, overflowProducer, (void *)(uintptr_t)i);
+	atomic_store(&startFlag, 1);
+	for(int i=0;i<TEST_PRODUCERS;i++)
+		pthread_join(threads[i], NULL);
+
+	// and one that is too long for a slot
+	memset(big, 0, sizeof(big));
+	if(ringPut(&ring, big, sizeof(big)))	{
+		fprintf(stderr, "overflow: frame of %d bytes accepted\n", (int)sizeof(big));
+		nErrors++;
+	}
+
+	unsigned attempts = TEST_PRODUCERS * ring.nSlots;
+	printf("overflow: %u of %u frames kept, %u dropped, ring exhausted %u times\n",
+			atomic_load(&ring.nPut), attempts, atomic_load(&ring.nDrops),
+			atomic_load(&ring.nExhausted));
+
+	if(!ringFull(&ring) || (ringDepth(&ring) != ring.nSlots))	{
+		fprintf(stderr, "overflow: %u frames in %u slots\n", ringDepth(&ring), ring.nSlots);
+		nErrors++;
+	}
+	if((atomic_load(&ring.nPut) != ring.nSlots) || (atomic_load(&ring.nDrops) != attempts - ring.nSlots)
+			|| (atomic_load(&nRefused) != attempts - ring.nSlots))	{
+		fprintf(stderr, "overflow: %u put, %u drops counted, %u refused\n",
+				atomic_load(&ring.nPut), atomic_load(&ring.nDrops), atomic_load(&nRefused));
+		nErrors++;
+	}
+	if(atomic_load(&ring.nTooLong) != 1)	{
+		fprintf(stderr, "overflow: %u too long\n", atomic_load(&ring.nTooLong));
+		nErrors++;
+	}
+	if(atomic_load(&ring.nExhausted) != 1)	{
+		fprintf(stderr, "overflow: exhausted %u times\n", atomic_load(&ring.nExhausted));
+		nErrors++;
+	}
+
+	// what was kept is intact and in order for each producer
+	SPI_DATA_FRAME *fr;
+	while((fr = ringPeek(&ring)) != NULL)	{
+		if(!checkFrame(fr, nextSeq, TRUE))	{
+			nErrors++;
+			break;
+		}
+		nTaken[((STAMP *)fr->buffer)->producer]++;
+		ringRelease(&ring);
+	}
+	for(int i=0;i<TEST_PRODUCERS;i++)	{
+		if(nTaken[i] != nAccepted[i])	{
+			fprintf(stderr, "overflow: producer %d had %u accepted, %u taken\n", i, nAccepted[i], nTaken[i]);
+			nErrors++;
+		}
+	}
+
+	// and it takes frames again once drained
+	big[0] = 0;
+	if(!ringPut(&ring, big, TEST_MIN_LEN) || (ringDepth(&ring) != 1))	{
+		fprintf(stderr, "overflow: ring not reusable after draining\n");
+		nErrors++;
+	}
+	ringFree(&ring);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while((c = getopt(argc, argv, "n:s:h")) != -1)	{
+		switch((char)c)	{
+
+		case 'n':
+			nFrames = atoi(optarg);
+			break;
+
+		case 's':
+			nSlots = atoi(optarg);
+			break;
+
+		default:
+			fprintf(stderr, "Usage: %s [-n frames per producer] [-s ring slots]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(nFrames <= 0)
+		nFrames = 1;
+	if((nSlots <= 0) || (nSlots > FRAME_RING_MAX))
+		nSlots = TEST_SLOTS;
+
+	printf("%d producers, %d frames each, %d slots\n", TEST_PRODUCERS, nFrames, nSlots);
+	fflush(stdout);
+	testOrdering();
+	testOverflow();
+
+	printf("%s\n", nErrors ? "FAIL" : "PASS");
+	return nErrors ? 1 : 0;
+}
@@ -6,7 +6,7 @@
 C_SRCS += \
 ../src/errno.c \
 ../src/ip400frame.c \
-../src/logger.c \
+../../ip400spi/src/logger.c \
 ../src/main.c \
 ../src/udp.c 
 
@@ -29,7 +29,15 @@ OBJS += \
 src/%.o: ../src/%.c src/subdir.mk
 	@echo 'Building file: $<'
 	@echo 'Invoking: GCC C Compiler'
-	gcc -I"/home/martin/eclipse-workspace/udpgen/include" -O0 -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$@" -o "$@" "$<"
+	gcc -I"/home/martin/eclipse-workspace/udpgen/include" -O0 -g3 -Wall -c -fmessage-length=0 -pthread -MMD -MP -MF"$(@:%.o=%.d)" -MT"$@" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+# the logger is ip400spi's
+src/%.o: ../../ip400spi/src/%.c src/subdir.mk
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C Compiler'
+	gcc -I"/home/martin/eclipse-workspace/udpgen/include" -O0 -g3 -Wall -c -fmessage-length=0 -pthread -MMD -MP -MF"$(@:%.o=%.d)" -MT"$@" -o "$@" "$<"
 	@echo 'Finished building: $<'
 	@echo ' '
 
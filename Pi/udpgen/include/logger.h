@@ -28,8 +28,32 @@
 #define	LOG_ERROR		2			// error message
 #define	LOG_FATAL		3			// fatal error (causes exit)
 
+/*
+ * Records go on a lock-free ring and a writer thread
+ * formats them, so the caller only copies its arguments.
+ * Each call site is held to LOG_SITE_RATE lines a second.
+ */
+#define	LOG_RING_SLOTS		1024		// records waiting for the writer, power of 2
+#define	LOG_MAX_ARGS		12			// arguments kept per record
+#define	LOG_TEXT_MAX		192			// string arguments, copied
+#define	LOG_SITES			128			// call sites rate limited, power of 2
+#define	LOG_SITE_RATE		20			// lines a second from one call site
+#define	LOG_WRITER_SLEEP	5			// ms the writer waits when idle
+#define	LOG_FLUSH_TIME		1000		// ms to wait for the writer to catch up
+
+// logger stats
+typedef struct log_stats_t	{
+	uint32_t		nLogged;			// records queued
+	uint32_t		nWritten;			// records written
+	uint32_t		nDropped;			// ring full
+	uint32_t		nSuppressed;		// over the rate for the call site
+} LOG_STATS;
+
 void openLog(uint8_t debug);
+void closeLog(void);
+void logFlush(void);
 void logger(int severity, char *format, ...);
+void logGetStats(LOG_STATS *stats);
 char *geterrno(int errnum);
 
 #endif /* INCLUDE_LOGGER_H_ */
@@ -106,6 +106,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	// open the log
+	openLog(debugFlag&DEBUG_LOG);
+
 	if(!setup_udp_socket(hostname, hostport, localport))	{
 		logger(LOG_FATAL, "Cannot create UDP socket to %s:%d\n", hostname, hostport, localport);
 		exit(100);
@@ -96,7 +96,7 @@ BOOL setup_udp_socket(char *hostname, int hostport, int localport)
 			logger(LOG_NOTICE, "setsockopt timeout failed\n");
 	}
 
-	logger(LOG_DEBUG, "Sending to %X:%d", si_me.sin_addr.s_addr, si_me.sin_zero);
+	logger(LOG_DEBUG, "Sending to %X:%d\n", si_me.sin_addr.s_addr, ntohs(si_me.sin_port));
 
 	return TRUE;
 }
@@ -54,6 +54,8 @@ BOOL enqueFrame(FRAME_QUEUE *que, IP400_FRAME *fr, uint16_t length);
 IP400_FRAME *dequeFrame(FRAME_QUEUE *que);
 BOOL quehasData(FRAME_QUEUE *que);
 int getQlength(FRAME_QUEUE *que);
+int getQdepth(FRAME_QUEUE *que);
+IP400_FRAME *peekFrame(FRAME_QUEUE *que);
 
 // queue management
 void insque (struct qelem *elem, struct qelem *pred);
@@ -39,6 +39,7 @@
 #define	N_EYE				4			// bytes in the eye 'IP4C'
 #define	MAX_CHUNKS			2			// maximum callsign 'chunks'
 #define	BFR_SIZE			2048		// tx/rx buffer size
+#define	RX_BATCH_SIZE		16			// max rx frames processed in one batch
 
 // callsign field
 #define	ALL_CALL_VALUE		(uint32_t)0xFFFFFFFF
@@ -196,6 +197,16 @@ typedef struct radio_stats_t {
 	void			*bfrStatus;					// pointr to a buffer status struct
 } RADIO_STATS;
 
+// receive context: taken once for a batch of rx frames
+typedef struct rx_context_t {
+	uint32_t		lastRSSI;					// rssi from the radio stats
+	uint16_t		myVPNAddr;					// my VPN address
+	uint32_t		myCallEnc;					// my callsign, encoded
+	IP400_MAC		*myMac;						// my MAC address
+	uint8_t			mySSID;						// my AX.25 SSID
+	BOOL			ax25Enabled;				// AX.25 mode is enabled
+} RX_CONTEXT;
+
 // interpretations
 extern char *ofdm_ab_modTypes[];
 extern char *ofdm_ab_bandwidth[];
@@ -230,7 +241,11 @@ uint8_t getFrameStatus(void);					// get the frame status
 BOOL FrameisMine(IP400_FRAME *frame);
 void RepeatFrame(IP400_FRAME *frame);
 void ProcessRxFrame(IP400_FRAME *rframe, int rawLength);
+void ProcessRxBatch(IP400_FRAME **frames, int nFrames);
+void GetRxContext(RX_CONTEXT *ctx);
 void DeleteFrame(IP400_FRAME *fr);
+void FreeFramePayload(void *buf);
+uint32_t ReserveSeqNums(int n);
 //
 // lookup a frame in the mesh table
 int getNMeshEntries(char *dest_call, int len);
@@ -0,0 +1,90 @@
+/*---------------------------------------------------------------------------
+	Project:	      IP400 Unified Firmware Platform
+
+	Module:		      Over the air fragmentation
+
+	File Name:	      rffrag.h
+
+	Date Created:	  Oct 18, 2026
+
+	Author:			  MartinA
+
+	Description:      Definitions for sending and reassembling payloads
+					  longer than PAYLOAD_MAX
+
+					  Copyright © 2024-26, Alberta Digital Radio Communications Society,
+					  All rights reserved
+
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+
+#ifndef RFFRAG_H_
+#define RFFRAG_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "frame.h"
+
+/*
+ * The fragments of a payload share a sequence group: the first
+ * carries the base sequence number and the rest follow on from it
+ * with no gaps. Since the mesh drops anything out of sequence,
+ * a gap means a lost fragment and the group is abandoned.
+ *
+ * The node does not rebuild the payload: a complete group is
+ * handed on as its fragments, in order, and the host puts them
+ * together from the SPI offsets. A frame's length field stops at
+ * 511 bytes, an SPI exchange carries at most SPI_BUFFER_LEN, so a
+ * rebuilt payload would only be cut up again on its way to the
+ * host, and the copy would need another RF_FRAG_MAX*PAYLOAD_MAX
+ * bytes of RAM per group. Holding the group still means the host
+ * never sees part of a payload.
+ */
+#define	RF_FRAG_MAX				4							// most fragments in a group
+#define	RF_REASM_CONTEXTS		4							// groups reassembled at once
+#define	RF_REASM_MEM_CAP		(2*RF_FRAG_MAX*PAYLOAD_MAX)	// most payload held at once
+#define	RF_REASM_TIMEOUT		pdMS_TO_TICKS(2000)			// ticks to complete a group
+
+// reassembly context: one per group
+typedef struct rf_reasm_ctx_t {
+	BOOL			active;						// collecting fragments
+	IP400_MAC		source;						// group source
+	IP400_MAC		dest;						// group destination
+	uint32_t		nextSeq;					// next sequence expected
+	uint32_t		startTick;					// tick of first fragment
+	uint16_t		nBytes;						// payload held
+	uint8_t			nFrags;						// fragments held
+	IP400_FRAME		*frags[RF_FRAG_MAX];		// the fragments, in order
+} RF_REASM_CTX;
+
+// stats
+typedef struct rf_frag_stats_t {
+	uint32_t		nTxGroups;					// groups sent
+	uint32_t		nTxFrags;					// fragments sent
+	uint32_t		nTxFails;					// groups cut short
+	uint32_t		nRxFrags;					// fragments received
+	uint32_t		nRxGroups;					// groups completed
+	uint32_t		nLost;						// groups with a missing fragment
+	uint32_t		nExpired;					// groups timed out
+	uint32_t		nOrphans;					// fragment with no group
+	uint32_t		nNoContext;					// no free context
+	uint32_t		nMemCap;					// memory cap reached
+	uint32_t		nTooLong;					// more than RF_FRAG_MAX fragments
+	uint32_t		minLatency;					// first to last fragment, ms
+	uint32_t		maxLatency;
+	uint32_t		totLatency;					// for the average
+} RF_FRAG_STATS;
+
+void RFFragInit(void);
+void SendRFFragments(IP400_FRAME *tmpl, uint8_t *payload, int len, uint8_t modemAddr);
+RF_REASM_CTX *RFReassemble(IP400_FRAME *frag);
+void RFReasmDone(RF_REASM_CTX *ctx);
+void RFReasmTimer(void);
+
+void PrintRFFragStats(void);
+void ResetRFFragStats(void);
+
+#endif /* RFFRAG_H_ */
@@ -71,8 +71,11 @@ typedef struct spi_hdr_t	{
 typedef union spi_stat_u	{
 	struct spi_status_t	{
 		unsigned	status:3;			// frame status
-		unsigned	reserved:4;			// reserved
-		unsigned	busy:1;				// busy bit
+		unsigned	packCap:1;			// accepts packed frames (NO_FRAME only)
+		unsigned	varLenCap:1;		// can do header first exchanges (NO_FRAME only)
+		unsigned	creditCap:1;		// length field is a credit grant (NO_FRAME only)
+		unsigned	creditReq:1;		// sender is out of credit (NO_FRAME only)
+		unsigned	busy:1;				// sender has more to send
 	} frameStat;
 	uint8_t	status_byte;
 } SPI_HDR_STATUS;
@@ -98,13 +101,94 @@ typedef enum	spi_frame_stat_e {
 		N_STATUS			// last status
 } spiFrameStatus;
 
+/*
+ * Packed frames: several complete frames in one exchange.
+ * The payload is a series of sub-records, each a 2 byte
+ * length (msb first) followed by an SPI header and its data.
+ * Only sent once the peer has set packCap in a NO_FRAME
+ * header, which also carries its max packed payload in
+ * the offset field.
+ */
+#define	PACKED_FRAME		7			// status: packed sub-records
+#define	SPI_PACK_LEN_SIZE	sizeof(uint16_t)
+#define	SPI_PACK_REC_HDR	(SPI_PACK_LEN_SIZE + sizeof(struct spi_hdr_t))
+
+/*
+ * Header first exchanges: each exchange starts with just the
+ * headers, whose length fields give the payload each end will
+ * send (zero for NO_FRAME). Then exactly the larger of the two
+ * is clocked, or nothing at all when both are idle.
+ * Both ends start with full length exchanges, and switch
+ * after the first one where both idle headers had varLenCap.
+ */
+#define	SPI_HDR_LEN			sizeof(struct spi_hdr_t)
+
+/*
+ * Checked exchanges: once both idle headers that switch to
+ * header first also carry SPI_XCAP_CHECK in their coding field,
+ * every exchange has a payload phase SPI_CHECK_LEN longer than
+ * the larger payload. Each end puts a trailer straight after
+ * the payload: its own exchange count, a spare byte, and a
+ * CRC-16 (CCITT, msb first) of its header, its own payload and
+ * those two bytes. An exchange that fails the check is dropped
+ * whole. Idle headers are checked in the ISR, frames by the
+ * task, from a copy of the trailer after the buffer. The host
+ * tunes its clock with TEST_FRAMEs, which go back as they came.
+ */
+#define	SPI_CHECK_LEN		4			// trailer: count, spare, CRC
+#define	SPI_CHECK_INIT		0xFFFF		// CRC preset
+#define	SPI_CHECK_POLY		0x1021		// CCITT polynomial
+#define	SPI_XCAPS_MARK		0xA0		// NO_FRAME coding: the rest are extra caps
+#define	SPI_XCAPS_MASK		0xF0
+#define	SPI_XCAP_CHECK		0x01		// sender can do checked exchanges
+#define	SPI_XCAP_ECHO		0x02		// sender echoes test frames
+#define	TEST_FRAME			6			// status: test pattern, to be echoed
+
+/*
+ * Credit flow control: once a peer sets creditCap, the length
+ * field of its idle headers is the number of payload bytes it
+ * will take, and frames are only sent while they fit. A sender
+ * out of credit sets creditReq in its idle header, and the peer
+ * answers with an idle header carrying a fresh grant, once for
+ * each change in the grant: the answer goes ahead of frames,
+ * the same grant again does not. A sender asks once, then again
+ * only when the grant it sees changes, so two peers out of
+ * credit do not trade idle headers for ever.
+ */
+#define	SPI_CREDIT_WINDOW		(4*SPI_BUFFER_LEN)	// largest grant
+#define	SPI_GRANT_NONE			0x10000				// no request answered yet
+#define	SPI_CREDIT_MAX_QUEUED	8					// radio tx queue depth for no credit
+#define	SPI_CREDIT_HEAP_RESERVE	4096				// heap kept back from the host
+
+/*
+ * Data ready: the node sets busy in a header when it, or one
+ * soon after it, carries something for the host: a frame, a
+ * credit request or a grant the host is waiting for. The same
+ * state drives a data ready line to the host, on boards whose
+ * pin configuration has an output labelled SPI_DRDY, so the host
+ * can exchange back to back while it is high and poll slowly
+ * when it is low.
+ */
+#ifdef SPI_DRDY_Pin
+#define	__SPI_DATA_READY		1
+#else
+#define	__SPI_DATA_READY		0
+#endif
+
+// exchange phases
+typedef enum	spi_phase_e {
+		SPI_PHASE_FULL=0,	// full length exchange
+		SPI_PHASE_HDR,		// header only
+		SPI_PHASE_PAYLOAD	// payload following a header
+} spiPhase;
+
 // data buffer struct
 typedef union	{
 	struct {
 		struct spi_hdr_t	hdr;		// header
-		uint8_t	buffer[SPI_BUFFER_LEN];
+		uint8_t	buffer[SPI_BUFFER_LEN + SPI_CHECK_LEN];	// and room for a trailer
 	} spiData;
-	uint8_t	rawData[SPI_RAW_LEN];
+	uint8_t	rawData[SPI_RAW_LEN + SPI_CHECK_LEN];
 } SPI_BUFFER;
 
 
@@ -120,8 +204,45 @@ typedef struct spi_stats_t {
 	int nIBIP400Frames;					// number of inbound IP400 frames
 	int nOBIP400Frames;					// number of outbound IP400 frames
 	int nDiscarded;						// discarded frames
+	int nPackedTx;						// packed exchanges to host
+	int nPackedTxFrames;				// frames in packed exchanges to host
+	int nPackedRx;						// packed exchanges from host
+	int nPackedRxFrames;				// frames in packed exchanges from host
+	int nPackErrors;					// bad sub-records
+	int nHdrOnly;						// header only exchanges
+	int nPayloads;						// payload exchanges
+	uint32_t payloadBytes;				// bytes clocked in payloads
+	int nCreditStalls;					// frames held back for credit
+	int nCreditRequests;				// grants asked for by the host
+	uint16_t lastGrant;					// last credit granted to the host
+	int nPoolEmpty;						// no receive buffer free
+	int poolLowWater;					// fewest receive buffers free
+	int nZeroCopy;						// frames using the receive buffer
+	int nPoolCopies;					// payloads copied, pool low
+	int nTxLate;						// idle exchange, next frame not composed
+	int nDataReady;						// data ready raised
+	int nCheckErrors;					// exchanges that failed the CRC
+	int nSeqErrors;						// exchanges missing
+	int nTestEchoes;					// test frames sent back
 } SPI_STATS;
 
+/*
+ * Receive buffers come from a fixed pool. A frame from the host
+ * keeps its payload in the buffer it arrived in, so each buffer
+ * is reference counted: the SPI task holds one, each frame another.
+ * A frame pins its buffer until the radio sends it. The exchanges
+ * need a reserve: one armed, one with the task and two in the
+ * receive queue. Only a few buffers on top of that are for frames
+ * to hold; below the reserve, payloads are copied to the heap at
+ * their own length and the grant closes. Each buffer is about
+ * 530 bytes of RAM, so the pool is kept small: holding one for
+ * each of the SPI_CREDIT_MAX_QUEUED frames the radio can have
+ * waiting would take over 6k of a 32k part.
+ */
+#define	SPI_RX_POOL_RESERVE		4				// kept for the exchanges
+#define	SPI_RX_POOL_HELD		2				// for frames to hold
+#define	SPI_RX_POOL_SIZE		(SPI_RX_POOL_RESERVE + SPI_RX_POOL_HELD)
+
 #define	SPI_TIMEOUT				100				// SPI timeout
 
 void PrintSPIStats(void);
@@ -129,6 +250,13 @@ void ResetSPIStats(void);
 BOOL isIP400Frame(uint8_t *eye);
 
 BOOL EnqueSPIFrame(void *ip400frame);
+
+// receive buffer pool
+SPI_BUFFER *SPIRxBufAlloc(void);
+int SPIRxBufFree(void);
+BOOL SPIRxBufOwns(void *p);
+BOOL SPIRxBufHold(void *p);
+void SPIRxBufRelease(void *p);
 void SendSPIFrame(void *spi, uint8_t *payload, int len);
 
 
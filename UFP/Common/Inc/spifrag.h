@@ -0,0 +1,67 @@
+/*---------------------------------------------------------------------------
+	Project:	      IP400 Unified Firmware Platform
+
+	Module:		      SPI fragment reassembly
+
+	File Name:	      spifrag.h
+
+	Date Created:	  Oct 18, 2026
+
+	Author:			  MartinA
+
+	Description:      Definitions for reassembling fragmented frames from the host
+
+					  Copyright © 2024-26, Alberta Digital Radio Communications Society,
+					  All rights reserved
+
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+
+#ifndef SPIFRAG_H_
+#define SPIFRAG_H_
+
+#include <stdint.h>
+
+#include "types.h"
+#include "spi.h"
+
+#define	SPI_REASM_CONTEXTS		4							// streams reassembled at once
+#define	SPI_REASM_MAX_LEN		1536						// largest datagram
+#define	SPI_REASM_MEM_CAP		(2*SPI_REASM_MAX_LEN)		// most heap held at once
+#define	SPI_REASM_TIMEOUT		(500/SPI_TASK_SCHED)		// 500 ms to complete, in task ticks
+
+// reassembly context: one per stream
+typedef struct spi_reasm_ctx_t {
+	BOOL			active;						// reassembly in progress
+	SPI_HEADER		hdr;						// header from the first fragment
+	uint8_t			*buffer;					// datagram buffer
+	uint16_t		length;						// bytes so far
+	uint16_t		age;						// task ticks since first fragment
+	// stats
+	uint32_t		nDatagrams;					// datagrams completed
+	uint32_t		nFragments;					// fragments accepted
+	uint32_t		nTimeouts;					// given up waiting
+	uint32_t		nOffsetErrors;				// fragment out of sequence
+	uint32_t		nOverflows;					// datagram too long
+	uint16_t		maxLength;					// longest datagram
+} SPI_REASM_CTX;
+
+// context independent stats
+typedef struct spi_reasm_stats_t {
+	uint32_t		nOrphans;					// fragment with no context
+	uint32_t		nNoContext;					// no free context
+	uint32_t		nMemCap;					// memory cap reached
+	uint32_t		nAllocFails;				// heap allocation failed
+} SPI_REASM_STATS;
+
+void SPIReasmInit(void);
+void SPIReassemble(SPI_HEADER *hdr, uint8_t *data, uint16_t len);
+void SPIReasmTimer(void);
+void SPIReasmFlush(void);
+
+void PrintSPIReasmStats(void);
+void ResetSPIReasmStats(void);
+
+#endif /* SPIFRAG_H_ */
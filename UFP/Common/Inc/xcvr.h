@@ -34,6 +34,7 @@ typedef struct	xcvr_abs_t	{
 		char	*type;							// type of radio
 // static functions
 		void	(*Init)(void);					// initialize
+		void	(*DeInit)(void);				// release, when swapped out
 		void	(*Process)(void);				// processing
 		void *	(*GetSetup)(void);				// get the radio setup
 		void 	(*ApplySetup)(void *);			// apply setup
@@ -54,7 +55,9 @@ typedef enum xcvr_test_e {
 	XCVR_TEST_OFF=0,			// test mode off
 	XCVR_TEST_CW,				// CW mode: digital loopback
 	XCVR_TEST_PATTERN,			// send Test pattern
-	XCVR_TEST_ANALB				// analog loopback (OFDM Only)
+	XCVR_TEST_ANALB,			// analog loopback (OFDM Only)
+	XCVR_TEST_NULL_LOOPBACK,	// null xcvr: frames looped back to rx
+	XCVR_TEST_NULL_SINK			// null xcvr: frames discarded
 } XcvrTestMode;
 
 // test modes for codec
@@ -104,6 +107,7 @@ void *GetRadioSetup(int index);
 void ApplySetup(int index);
 void QueueTxFrame(void *txframe, int xcvrAddr);
 void runXcvrTest(uint8_t index, uint8_t testNum);
+void SwapNullXcvr(uint8_t index, BOOL swapIn);
 RADIO_STATS *GetRadioStats(uint8_t index);
 
 void resetBufferStats(int index);
@@ -115,5 +119,6 @@ void QueueRxFrameCallback(void *rxframe);
 __REPLACEABLE XCVR_ABS *wl33_GetVectors(void);				// get wl33 Vectors
 __REPLACEABLE XCVR_ABS *AT86RF215_GetVectors(void);			// get AT Vectors
 __REPLACEABLE XCVR_ABS *ofdb_ab_GetVectors(void);			// get OFDM_AB Vectors
+__REPLACEABLE XCVR_ABS *null_GetVectors(void);				// get null xcvr Vectors
 
 #endif /* XCVR_H_ */
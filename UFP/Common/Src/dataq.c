@@ -98,3 +98,37 @@ int getQlength(FRAME_QUEUE *que)
 
 	return f->length;
 }
+
+/*
+ * Number of frames queued: walked with the queue
+ * locked, so safe from any task
+ */
+int getQdepth(FRAME_QUEUE *que)
+{
+	int depth = 0;
+
+	vPortEnterCritical();
+
+	for(FRAME_QUEUE *f = que->q_forw; f != que; f = f->q_forw)
+		depth++;
+
+	vPortExitCritical();
+	return depth;
+}
+
+/*
+ * Return the next frame without dequeuing it
+ * Returns null if no frame is on the queue
+ */
+IP400_FRAME *peekFrame(FRAME_QUEUE *que)
+{
+	IP400_FRAME *ipFrame = NULL;
+
+	vPortEnterCritical();
+
+	if(que->q_back != que)
+		ipFrame = que->q_forw->frame;
+
+	vPortExitCritical();
+	return ipFrame;
+}
@@ -45,6 +45,7 @@
 #include "setup.h"
 #include "memory.h"
 #include "xcvr.h"
+#include "rffrag.h"
 
 // local debug
 #define	__DUMP_BEACON		0		// dump a beacon frame
@@ -57,6 +58,17 @@ typedef enum call_stat_e	{
 	FRAME_NEEDS_REPEATING			// frame needs repeating
 }CallsignStatus;					// call sign status
 
+// rx frame groups: one per consumer
+typedef enum rx_group_e	{
+	RX_GROUP_CHAT=0,				// chat and echo responses
+	RX_GROUP_BEACON,				// beacons: mesh
+	RX_GROUP_AX25,					// AX.25: KISS or SPI
+	RX_GROUP_ECHOREQ,				// echo requests
+	RX_GROUP_SPI,					// user defined: SPI
+	N_RX_GROUPS,					// number of groups
+	RX_GROUP_NONE					// consumed or dropped
+} RxGroup;
+
 uint32_t  nextSeq;		// next frame sequence number
 FRAME_STATS frStats;	// frame stats
 
@@ -68,6 +80,21 @@ FRAME_STATS *GetFrameStats(void)
 void Frame_task_init(void)
 {
 	nextSeq = 0xFFFFFFFF;
+	RFFragInit();
+}
+
+/*
+ * Take a run of consecutive sequence numbers,
+ * returns the first
+ */
+uint32_t ReserveSeqNums(int n)
+{
+	vPortEnterCritical();
+	uint32_t seq = nextSeq;
+	nextSeq += n;
+	vPortExitCritical();
+
+	return seq;
 }
 
 
@@ -202,7 +229,7 @@ BOOL SendDataFrame(char *srcCall, uint16_t srcIPAddr, char *destCall, uint16_t d
 	callEncode(srcCall, srcIPAddr, txFrame, SRC_CALLSIGN);
 	callEncode(destCall, dstIPAddr, txFrame, DEST_CALLSIGN);
 
-	txFrame->length = length;
+	txFrame->length = length & 0xFF;
 
 	// flag fields
 	RADIO_SETUP *setup = getRadioSetup(DEFAULT_MODEM);
@@ -211,7 +238,6 @@ BOOL SendDataFrame(char *srcCall, uint16_t srcIPAddr, char *destCall, uint16_t d
 	txFrame->flagfld.flags.hoptable = FALSE;
 	txFrame->flagfld.flags.payloadMSB = (length & 0x100) >> 8;
 	txFrame->hopTable = NULL;
-	txFrame->seqNum = nextSeq++;
 
 	txFrame->flagfld.flags.bitsperCarr = setup->xModulationSelect;
 
@@ -223,6 +249,13 @@ BOOL SendDataFrame(char *srcCall, uint16_t srcIPAddr, char *destCall, uint16_t d
 	txFrame->flagfld.flags.FEC = FALSE;
 #endif
 
+	// too long for the air: send it in pieces, which reserve their own numbers
+	if(length > PAYLOAD_MAX)	{
+		SendRFFragments(txFrame, data, length, DEFAULT_MODEM);
+		return TRUE;
+	}
+
+	txFrame->seqNum = nextSeq++;
 	QueueTxFrame(txFrame, DEFAULT_MODEM);
 
 	return TRUE;
@@ -288,16 +321,7 @@ void SendSPIFrame(void *spi, uint8_t *payload, int len)
 		ip400Frame->flagfld.flags.hoptable = FALSE;
 	}
 
-	// Step 2: the rest is the payload
-	if((ip400Frame->buf=nodeMemAlloc(FRAME,len)) == NULL)	{
-		if(ip400Frame->flagfld.flags.hoptable)
-			nodeMemFree(FRAME,hTable);
-		nodeMemFree(FRAME,ip400Frame);
-		return;
-	}
-	memcpy(ip400Frame->buf, payload, len);
-
-	// step 4: header flags
+	// step 3: header flags
 	ip400Frame->flagfld.flagBytes[0] = spiFlags.bytedefs[0];
 	ip400Frame->flagfld.flagBytes[1] = spiFlags.bytedefs[1];
 
@@ -307,12 +331,33 @@ void SendSPIFrame(void *spi, uint8_t *payload, int len)
 	ip400Frame->flagfld.flags.bandwidth = spiFlags.bitdefs.bandwidth;
 	ip400Frame->flagfld.flags.FEC = (spiFlags.bitdefs.FECMethod > 0) ? TRUE : FALSE;
 	ip400Frame->flagfld.flags.bitsperCarr = spiFlags.bitdefs.bitsperCarr;
+	uint8_t modemAddr = spiFlags.bitdefs.modem;
+
+	// step 4: a whole datagram too long for the air goes in pieces
+	if((len > PAYLOAD_MAX) && (spiHdr->spiStat == SINGLE_FRAME))	{
+		ip400Frame->buf = NULL;
+		SendRFFragments(ip400Frame, payload, len, modemAddr);
+		return;
+	}
+
+	// step 5: the rest is the payload, left where it
+	// arrived if that was an SPI receive buffer
+	if(SPIRxBufHold(payload))	{
+		ip400Frame->buf = payload;
+	} else {
+		if((ip400Frame->buf=nodeMemAlloc(FRAME,len)) == NULL)	{
+			if(ip400Frame->hopTable != NULL)
+				nodeMemFree(FRAME,hTable);
+			nodeMemFree(FRAME,ip400Frame);
+			return;
+		}
+		memcpy(ip400Frame->buf, payload, len);
+	}
 	ip400Frame->flagfld.flags.payloadMSB = (len & 0x100) >> 8;
 
 	ip400Frame->seqNum = nextSeq++;
 	ip400Frame->length = len & 0xFF;
 
-	uint8_t modemAddr = spiFlags.bitdefs.modem;
 	QueueTxFrame(ip400Frame, modemAddr);
 
 }
@@ -321,23 +366,18 @@ void SendSPIFrame(void *spi, uint8_t *payload, int len)
 // returns a value if I originated the frame
 // or am in the hop table
 // check both VPN and AX25 addressing modes
-CallsignStatus FindCallinFrame(IP400_FRAME *frame)
+// the first 6 characters of the callsign are compared in encoded form
+CallsignStatus FindCallinFrame(IP400_FRAME *frame, RX_CONTEXT *ctx)
 {
-	char decCall[30];
-
 	// check if I am the originator call sign
-	uint16_t myVPNAddr = GetVPNLowerWord();
-	STN_PARAMS *stn_params = GetStationParams();			// get the station params
-
-	callDecode(frame, decCall, NULL, SRC_CALLSIGN);
-	if(CompareToMyCall(decCall)) 	{
+	if(frame->source.callbytes.callsign.encoded == ctx->myCallEnc) 	{
 		// check the VPN address
-		if(frame->source.vpnBytes.encvpn == myVPNAddr)
+		if(frame->source.vpnBytes.encvpn == ctx->myVPNAddr)
 				return CALLSIGN_IN_ADDRESS;
 		// check the AX.25 compatibility mode as well
-		if(isAX25Enabled())	{
+		if(ctx->ax25Enabled)	{
 			if((frame->source.vpnBytes.encvpn&AX25_VPN_MASK) == AX25_VPN_BASE)	{
-				if((frame->source.vpnBytes.encvpn&AX25_SSID_MASK) == stn_params->setup_data.flags.SSID)
+				if((frame->source.vpnBytes.encvpn&AX25_SSID_MASK) == ctx->mySSID)
 					return CALLSIGN_IN_ADDRESS;
 			}
 		}
@@ -350,19 +390,17 @@ CallsignStatus FindCallinFrame(IP400_FRAME *frame)
 	// check my call is in the table
 	// two different meanings:
 	HOPTABLE *htable = (HOPTABLE *)frame->hopTable;
-	IP400_MAC *myMac;
-	GetMyMAC(&myMac);
 	for(int i=0;i<MAX_HOPS; i++)	{
-		if(htable->rptCalls[i].callbytes.callsign.encoded == myMac->callbytes.callsign.encoded)	{
+		if(htable->rptCalls[i].callbytes.callsign.encoded == ctx->myMac->callbytes.callsign.encoded)	{
 			// if my call is the hop table in ax25 mode, and the 'h' bit is clear, repeat it
-			if(isAX25Enabled())	{
-				if((htable->rptCalls[i].vpnBytes.ax25vpn.ssid == stn_params->setup_data.flags.SSID) &&
+			if(ctx->ax25Enabled)	{
+				if((htable->rptCalls[i].vpnBytes.ax25vpn.ssid == ctx->mySSID) &&
 						!htable->rptCalls[i].vpnBytes.ax25vpn.c_h_bit) {
 					htable->rptCalls[i].vpnBytes.ax25vpn.c_h_bit = TRUE;
 					return FRAME_NEEDS_REPEATING;
 				}
 			} else {
-				if(htable->rptCalls[i].vpnBytes.encvpn == myVPNAddr)
+				if(htable->rptCalls[i].vpnBytes.encvpn == ctx->myVPNAddr)
 					return CALLSIGN_IN_ADDRESS;
 			}
 		}
@@ -408,6 +446,18 @@ void RepeatIP400Frame(IP400_FRAME *frame, BOOL addHopEntry)
 	QueueTxFrame(rptFrame, DEFAULT_MODEM);
 }
 
+/*
+ * Free a frame payload: from the heap, or
+ * a reference to the SPI buffer it arrived in
+ */
+void FreeFramePayload(void *buf)
+{
+	if(SPIRxBufOwns(buf))
+		SPIRxBufRelease(buf);
+	else
+		nodeMemFree(FRAME, buf);
+}
+
 /*
  * Delete a frame in allocated memory
  */
@@ -416,7 +466,7 @@ void DeleteFrame(IP400_FRAME *fr)
 	if(fr->hopTable != NULL)
 		nodeMemFree(FRAME, fr->hopTable);
 	if(fr->buf)
-		nodeMemFree(FRAME, fr->buf);
+		FreeFramePayload(fr->buf);
 	nodeMemFree(FRAME, fr);
 }
 
@@ -427,12 +477,45 @@ void DeleteFrame(IP400_FRAME *fr)
  */
 
 /*
- * Process a received frame
+ * Take the receive context: radio and station
+ * values that do not change within a batch
  */
-void ProcessRxFrame(IP400_FRAME *rFrame, int rawLength)
+void GetRxContext(RX_CONTEXT *ctx)
+{
+	IP400_FRAME encFrame;
+
+#if	__XCVR_AT86					// has a AT86RF215
+	RADIO_STATS *stats = GetRadioStats(XCVR_AT86_SUBG);
+#endif
+#if	__XCVR_OFDM_AB				// has an OFDM transceiver
+	RADIO_STATS *stats = GetRadioStats(XCVR_OFDM);
+#endif
+#if	__XCVR_WL33					// has a WL33
+	RADIO_STATS *stats = GetRadioStats(XCVR_WL33);
+#endif
+	ctx->lastRSSI = stats->lastRSSI;
+
+	STN_PARAMS *stn_params = GetStationParams();			// get the station params
+	callEncode(stn_params->setup_data.stnCall, 0, &encFrame, SRC_CALLSIGN);
+	ctx->myCallEnc = encFrame.source.callbytes.callsign.encoded;
+	ctx->mySSID = stn_params->setup_data.flags.SSID;
+
+	ctx->myVPNAddr = GetVPNLowerWord();
+	GetMyMAC(&ctx->myMac);
+	ctx->ax25Enabled = isAX25Enabled();
+}
+
+static void DispatchRxGroup(RxGroup group, IP400_FRAME **frames, int nFrames, RX_CONTEXT *ctx);
+
+/*
+ * Classify a received frame by its consumer.
+ * Frames that are mine, repeated, rejected or bad are
+ * consumed here and return RX_GROUP_NONE
+ */
+static RxGroup ClassifyRxFrame(IP400_FRAME *rFrame, int rawLength, RX_CONTEXT *ctx)
 {
 	// find a reason to reject a frame...
-	CallsignStatus callStat = FindCallinFrame(rFrame);
+	CallsignStatus callStat = FindCallinFrame(rFrame, ctx);
 
 	/*
 	 * Handle frame repeating first...
@@ -447,108 +530,180 @@ void ProcessRxFrame(IP400_FRAME *rFrame, int rawLength)
 	case CALLSIGN_IN_ADDRESS:
 		DeleteFrame(rFrame);
 		frStats.nWereMine++;
-		return;
+		return RX_GROUP_NONE;
 
 	// AX.25 frame needs to be repeated
 	case FRAME_NEEDS_REPEATING:
 		RepeatIP400Frame(rFrame, FALSE);
 		frStats.nRepeated++;
 		DeleteFrame(rFrame);
-		return;
+		return RX_GROUP_NONE;
 	}
 
 	frStats.nProcessed++;
 
-#if	__XCVR_AT86					// has a AT86RF215
-	RADIO_STATS *stats = GetRadioStats(XCVR_AT86_SUBG);
-#endif
-#if	__XCVR_OFDM_AB				// has an OFDM transceiver
-	RADIO_STATS *stats = GetRadioStats(XCVR_OFDM);
-#endif
-#if	__XCVR_WL33					// has a WL33
-	RADIO_STATS *stats = GetRadioStats(XCVR_WL33);
-#endif
-
+	// do a sanity check on the length
+	if(rFrame->length > rawLength)		{
+		frStats.Unknown++;
+		DeleteFrame(rFrame);
+		return RX_GROUP_NONE;
+	}
 
 	// the only one to drop through is CALLSIGN_NOT_FOUND
-	IP400DataType frameType = rFrame->flagfld.flags.coding;
+	RxGroup group;
+	switch(rFrame->flagfld.flags.coding)	{
 
-	// process the frame if it is not mine and unique
-	// do a sanity check on the length
-	if(rFrame->length <= rawLength)		{
+	case UTF8_TEXT_PACKET:
+	case ECHO_RESPONSE:
+		group = RX_GROUP_CHAT;
+		break;
+
+	case BEACON_PACKET:
+		group = RX_GROUP_BEACON;
+		break;
+
+	case AX_25_PACKET:			// AX.25 encapsulated packet
+		group = RX_GROUP_AX25;
+		break;
+
+	// echo requests are answered regardless of the destination
+	case ECHO_REQUEST:
+		return RX_GROUP_ECHOREQ;
+
+    //reserved for future use
+	case LOCAL_COMMAND:			// local command frame
+		return RX_GROUP_NONE;
+
+	default:			// user defined frame
+		group = RX_GROUP_SPI;
+		break;
+	}
+
+	// process the frame if it is for me
+	if(!Mesh_Accept_RxFrame((void *)rFrame, (void *)ctx))	{
+		frStats.nRejected++;
+		return RX_GROUP_NONE;
+	}
+
+	// fragments are held until their group is complete,
+	// then handed on together, still as fragments: the
+	// host reassembles them from the SPI offsets
+	if(rFrame->flagfld.flags.fragmentation != FRAG_SELFCONTAINED)	{
+		RF_REASM_CTX *reasm;
+		if((reasm = RFReassemble(rFrame)) != NULL)	{
+			DispatchRxGroup(group, reasm->frags, reasm->nFrags, ctx);
+			RFReasmDone(reasm);
+		}
+		return RX_GROUP_NONE;
+	}
+	return group;
+}
+
+/*
+ * Dispatch a group of classified frames to their consumer
+ */
+static void DispatchRxGroup(RxGroup group, IP400_FRAME **frames, int nFrames, RX_CONTEXT *ctx)
+{
+	IP400_FRAME *rFrame;
 
-		switch(frameType)	{
+	for(int i=0;i<nFrames;i++)	{
+		rFrame = frames[i];
 
-		// process a local chat frame
-		case UTF8_TEXT_PACKET:
-			if(Mesh_Accept_Frame((void *)rFrame, stats->lastRSSI))	{
-				EnqueChatFrame((void *)rFrame);
+		switch(group)	{
+
+		// process a local chat frame, treat echo responses the same
+		case RX_GROUP_CHAT:
+			EnqueChatFrame((void *)rFrame);
+			if(rFrame->flagfld.flags.coding == ECHO_RESPONSE)
+				frStats.nEchoResp++;
+			else
 				frStats.nChat++;
-			} else frStats.nRejected++;
 			break;
 
 		// process a beacon frame
-		case BEACON_PACKET:
-			if(Mesh_Accept_Frame((void *)rFrame, stats->lastRSSI))	{
-				Mesh_ProcessBeacon((void *)rFrame, stats->lastRSSI);
+		case RX_GROUP_BEACON:
+			Mesh_ProcessBeacon((void *)rFrame, ctx->lastRSSI);
 #if __DUMP_BEACON
-				EnqueChatFrame((void *)&rFrame);
+			EnqueChatFrame((void *)&rFrame);
 #endif
 #if __BEACON2SPI
-				EnqueSPIFrame(rFrame);
+			EnqueSPIFrame(rFrame);
 #else
-				DeleteFrame(rFrame);
+			DeleteFrame(rFrame);
 #endif
-				frStats.nBeacons++;
-			} else {
-				frStats.nRejected++;
-			}
+			frStats.nBeacons++;
 			break;
 
-
 		// use kiss mode output if enabled, else send it out the SPI
-		case AX_25_PACKET:			// AX.25 encapsulated packet
-			if(Mesh_Accept_Frame((void *)rFrame, stats->lastRSSI))	{
+		case RX_GROUP_AX25:
 #if __INCLUDE_KISS
-				if(isAX25Enabled())
-					ProcessRxKissFrame(rFrame);					// send out as a kiss frame
-				else
-					EnqueSPIFrame((void *)rFrame);				// duplicate on SPI as well
+			if(ctx->ax25Enabled)
+				ProcessRxKissFrame(rFrame);					// send out as a kiss frame
+			else
+				EnqueSPIFrame((void *)rFrame);				// duplicate on SPI as well
 #else
-				EnqueSPIFrame((void *)rFrame);
+			EnqueSPIFrame((void *)rFrame);
 #endif
-				frStats.nKiss++;
-			} else frStats.nRejected++;
+			frStats.nKiss++;
 			break;
 
 		// echo request frame
-		case ECHO_REQUEST:
+		case RX_GROUP_ECHOREQ:
 			SendEchoRespFrame(rFrame);
 			frStats.nEchoReq++;
 			break;
 
-		// echo response: treat it like a chat frame
-		case ECHO_RESPONSE:
-			if(Mesh_Accept_Frame((void *)rFrame, stats->lastRSSI))	{
-				EnqueChatFrame((void *)rFrame);
-				frStats.nEchoResp++;
-			} else frStats.nRejected++;
+		// user defined frame
+		case RX_GROUP_SPI:
+			EnqueSPIFrame((void *)rFrame);
+			frStats.nUndecoded++;
 			break;
 
-	    //reserved for future use
-		case LOCAL_COMMAND:			// local command frame
+		default:
 			break;
+		}
+	}
+}
 
-		default:			// user defined frame
-			if(Mesh_Accept_Frame((void *)rFrame, stats->lastRSSI))	{
-				EnqueSPIFrame((void *)rFrame);
-				frStats.nUndecoded++;
-			} else frStats.nRejected++;
-			break;
+/*
+ * Process a received frame
+ */
+void ProcessRxFrame(IP400_FRAME *rFrame, int rawLength)
+{
+	RX_CONTEXT ctx;
 
-		}
-	} else {
-		frStats.Unknown++;
-		DeleteFrame(rFrame);
+	GetRxContext(&ctx);
+
+	RxGroup group = ClassifyRxFrame(rFrame, rawLength, &ctx);
+	if(group != RX_GROUP_NONE)
+		DispatchRxGroup(group, &rFrame, 1, &ctx);
+}
+
+/*
+ * Process a batch of received frames: the context is taken once,
+ * the frames are classified, then each group is handed to its
+ * consumer in one pass. Order is kept within a group.
+ */
+void ProcessRxBatch(IP400_FRAME **frames, int nFrames)
+{
+	RX_CONTEXT ctx;
+	static IP400_FRAME *groups[N_RX_GROUPS][RX_BATCH_SIZE];
+	int nGroup[N_RX_GROUPS];
+
+	if(nFrames > RX_BATCH_SIZE)
+		nFrames = RX_BATCH_SIZE;
+
+	GetRxContext(&ctx);
+	memset(nGroup, 0, sizeof(nGroup));
+
+	for(int i=0;i<nFrames;i++)	{
+		RxGroup group = ClassifyRxFrame(frames[i], frames[i]->length, &ctx);
+		if(group != RX_GROUP_NONE)
+			groups[group][nGroup[group]++] = frames[i];
+	}
+
+	for(int g=0;g<N_RX_GROUPS;g++)	{
+		if(nGroup[g] != 0)
+			DispatchRxGroup((RxGroup)g, groups[g], nGroup[g], &ctx);
 	}
 }
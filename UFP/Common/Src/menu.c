@@ -39,6 +39,10 @@
 #include "xcvr.h"
 #include "bfrmgr.h"
 #include "tasks.h"
+#include "rffrag.h"
+#if defined(__NUCLEOCC2) || defined (__PI_BOARD)
+#include "nullxcvr.h"
+#endif
 
 #if _HAS_FPGA
 #include "platform.h"
@@ -387,6 +391,10 @@ uint8_t showstats(void)
 	}
 
 	Print_Frame_stats(GetFrameStats());
+	PrintRFFragStats();
+#if defined(__NUCLEOCC2) || defined (__PI_BOARD)
+	PrintNullXcvrStats();
+#endif
 	return RET_PAUSE;
 }
 // E: Reset frame stats
@@ -401,6 +409,10 @@ uint8_t resetstats(void)
 	FRAME_STATS *fr = GetFrameStats();
 	memset(fr, 0, sizeof(FRAME_STATS));
 	ResetSPIStats();
+	ResetRFFragStats();
+#if defined(__NUCLEOCC2) || defined (__PI_BOARD)
+	ResetNullXcvrStats();
+#endif
 
 	USART_Print_string("Statistics reset\r\n\n");
 	return RET_PAUSE;
@@ -439,6 +451,20 @@ uint8_t memStats(void)
 	Print_Memory_Stats();
 	return RET_PAUSE;
 }
+// N: Null transceiver, loop frames back
+uint8_t nullLoopMode(void)
+{
+	runXcvrTest(xcvrNum, XCVR_TEST_NULL_LOOPBACK);
+	sendTextString("Null transceiver loopback enabled\r\n");
+	return RET_PAUSE;
+}
+// O: Null transceiver, discard frames
+uint8_t nullSinkMode(void)
+{
+	runXcvrTest(xcvrNum, XCVR_TEST_NULL_SINK);
+	sendTextString("Null transceiver sink enabled\r\n");
+	return RET_PAUSE;
+}
 // P: Set PRBS diag mode or PRBS mode
 #if _HAS_CODEC
 uint8_t setCodec(void)
@@ -797,7 +823,7 @@ FIELD_VALIDATOR stationValidators[] = {
 };
 
 // diagnostics menu
-#define N_DIAGMENU	11
+#define N_DIAGMENU	13
 struct menuItems_t diagMenu[N_DIAGMENU] = {
 		{ "Show Frame stats\r\n", 'D', showstats, ENTRY_NONE, 0 },
 		{ "Reset all stats\r\n", 'E', resetstats, ENTRY_NONE, 0 },
@@ -806,6 +832,8 @@ struct menuItems_t diagMenu[N_DIAGMENU] = {
 		{ "SPI Stats\r\n", 'I', spistats, ENTRY_NONE, 0 },
 		{ "LED test\r\n", 'L', ledTest, ENTRY_NONE, 0 },
 		{ "Memory Status\r\n", 'M', memStats, ENTRY_NONE, 0 },
+		{ "Null Xcvr Loopback\r\n", 'N', nullLoopMode, ENTRY_NONE, 0 },
+		{ "Null Xcvr Sink\r\n", 'O', nullSinkMode, ENTRY_NONE, 0 },
 #if _HAS_CODEC
 		{ "Codec Tests\r\n", 'P', setCodec, ENTRY_NONE, 0 },
 #else
@@ -230,25 +230,36 @@ void UpdateMeshStatus(void)
  */
 BOOL Mesh_Accept_Frame(void *rxFrame, uint32_t rssi)
 {
-	IP400_FRAME *frameData = (IP400_FRAME *)rxFrame;
-	char decCall[30];
-	uint16_t vpnAddr;
+	RX_CONTEXT ctx;
+
+	GetRxContext(&ctx);
+	ctx.lastRSSI = rssi;
+
+	return Mesh_Accept_RxFrame(rxFrame, &ctx);
+}
 
-	uint16_t myIPAddr = GetVPNLowerWord();
+/*
+ * Same as above, using a receive context taken once for
+ * a batch of frames. The first 6 characters of the dest
+ * callsign are compared in their encoded form.
+ */
+BOOL Mesh_Accept_RxFrame(void *rxFrame, void *rxContext)
+{
+	IP400_FRAME *frameData = (IP400_FRAME *)rxFrame;
+	RX_CONTEXT *ctx = (RX_CONTEXT *)rxContext;
 
 	// 1) first variant: broadcast to all stations: accept all
 	if((frameData->dest.callbytes.callsign.bytes[0] == BROADCAST_ADDR)
 		&&	(frameData->dest.callbytes.callsign.bytes[1] == BROADCAST_ADDR))
 		return TRUE;
 
-	// To continue, unpack the callsign and compare first BOOL callDecode(IP400_FRAME *frame, char *callsign, uint16_t *ipAddr, CallSignSource source)
-	callDecode(frameData, decCall, &vpnAddr, DEST_CALLSIGN);
-	if(CompareToMyCall(decCall)) {
+	// To continue, compare the callsign
+	if(frameData->dest.callbytes.callsign.encoded == ctx->myCallEnc) {
 
 		// 3) AX25 Compatible
-		if(isAX25Enabled())		{
+		if(ctx->ax25Enabled)		{
 			if(frameData->dest.vpnBytes.ax25vpn.marker == BROADCAST_ADDR)	{
-				if(frameData->dest.vpnBytes.ax25vpn.ssid == getAX25SSID())
+				if(frameData->dest.vpnBytes.ax25vpn.ssid == ctx->mySSID)
 					return TRUE;
 			}
 		}
@@ -257,8 +268,8 @@ BOOL Mesh_Accept_Frame(void *rxFrame, uint32_t rssi)
 			return TRUE;
 
 		// 4) VPN Address maches..
-		else if(frameData->dest.vpnBytes.encvpn == myIPAddr)
-			return Check_Sender_Address(rxFrame, rssi);
+		else if(frameData->dest.vpnBytes.encvpn == ctx->myVPNAddr)
+			return Check_Sender_Address(rxFrame, ctx->lastRSSI);
 	}
 
 	// not for me
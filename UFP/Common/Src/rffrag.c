@@ -0,0 +1,300 @@
+/*---------------------------------------------------------------------------
+	Project:	      IP400 Unified Firmware Platform
+
+	Module:		      Over the air fragmentation
+
+	File Name:	      rffrag.c
+
+	Date Created:	  Oct 18, 2026
+
+	Author:			  MartinA
+
+	Description:      Payloads longer than PAYLOAD_MAX are sent as a group
+					  of fragments with consecutive sequence numbers. The
+					  receiver holds the fragments of a group until all have
+					  arrived, then hands them on together and in order, so a
+					  consumer never sees part of a payload. The payload is
+					  put back together by the host, not here: see rffrag.h.
+
+					  Copyright © 2024-26, Alberta Digital Radio Communications Society,
+					  All rights reserved
+
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <cmsis_os2.h>
+#include <FreeRTOS.h>
+#include <string.h>
+#include <config.h>
+
+#include "types.h"
+#include "frame.h"
+#include "memory.h"
+#include "usart.h"
+#include "xcvr.h"
+#include "rffrag.h"
+
+// locals
+RF_REASM_CTX		rfReasm[RF_REASM_CONTEXTS];		// reassembly contexts
+RF_FRAG_STATS		rfFragStats;					// stats
+uint32_t			rfReasmHeld;					// payload bytes held
+
+// payload length of a frame
+static uint16_t frameLength(IP400_FRAME *fr)
+{
+	return fr->length + (((uint16_t)fr->flagfld.flags.payloadMSB) << 8);
+}
+
+/*
+ * Initialize
+ */
+void RFFragInit(void)
+{
+	memset(rfReasm, 0, sizeof(rfReasm));
+	rfReasmHeld = 0;
+	ResetRFFragStats();
+}
+
+/*
+ * ------------------------------------------------------------------------
+ * 	Transmit
+ * ------------------------------------------------------------------------
+ */
+
+/*
+ * Send a payload too long for the air as a group of fragments.
+ * Each is a complete copy of the template frame, hop table and all,
+ * so it can be repeated on its own. The template is freed
+ */
+void SendRFFragments(IP400_FRAME *tmpl, uint8_t *payload, int len, uint8_t modemAddr)
+{
+	int nFrags = (len + PAYLOAD_MAX - 1)/PAYLOAD_MAX;
+
+	if(nFrags > RF_FRAG_MAX)	{
+		rfFragStats.nTooLong++;
+		DeleteFrame(tmpl);
+		return;
+	}
+
+	uint32_t seq = ReserveSeqNums(nFrags);
+	rfFragStats.nTxGroups++;
+
+	for(int i=0;i<nFrags;i++)	{
+		uint16_t fragLen = (len > PAYLOAD_MAX) ? PAYLOAD_MAX : len;
+
+		IP400_FRAME *frag;
+		if((frag=nodeMemAlloc(FRAME,sizeof(IP400_FRAME))) == NULL)	{
+			rfFragStats.nTxFails++;
+			break;
+		}
+		memcpy(frag, tmpl, sizeof(IP400_FRAME));
+		frag->hopTable = NULL;
+		frag->buf = NULL;
+
+		if(tmpl->hopTable != NULL)	{
+			if((frag->hopTable=nodeMemAlloc(FRAME,sizeof(HOPTABLE))) == NULL)	{
+				DeleteFrame(frag);
+				rfFragStats.nTxFails++;
+				break;
+			}
+			memcpy(frag->hopTable, tmpl->hopTable, sizeof(HOPTABLE));
+		}
+		if((frag->buf=nodeMemAlloc(FRAME,fragLen)) == NULL)	{
+			DeleteFrame(frag);
+			rfFragStats.nTxFails++;
+			break;
+		}
+		memcpy(frag->buf, payload, fragLen);
+
+		if(i == 0)
+			frag->flagfld.flags.fragmentation = FRAG_FIRST_FRAG;
+		else if(i == (nFrags-1))
+			frag->flagfld.flags.fragmentation = FRAG_END_FRAG;
+		else
+			frag->flagfld.flags.fragmentation = FRAG_MIDDLE_FRAG;
+
+		frag->flagfld.flags.payloadMSB = (fragLen & 0x100) >> 8;
+		frag->length = fragLen & 0xFF;
+		frag->seqNum = seq++;
+
+		QueueTxFrame(frag, modemAddr);
+		rfFragStats.nTxFrags++;
+
+		payload += fragLen;
+		len -= fragLen;
+	}
+
+	DeleteFrame(tmpl);
+}
+
+/*
+ * ------------------------------------------------------------------------
+ * 	Receive
+ * ------------------------------------------------------------------------
+ */
+
+// drop a group and the fragments it holds
+static void dropGroup(RF_REASM_CTX *ctx)
+{
+	for(int i=0;i<ctx->nFrags;i++)
+		DeleteFrame(ctx->frags[i]);
+
+	RFReasmDone(ctx);
+}
+
+// find the group a fragment belongs to
+static RF_REASM_CTX *findGroup(IP400_FRAME *frag)
+{
+	for(int i=0;i<RF_REASM_CONTEXTS;i++)	{
+		RF_REASM_CTX *ctx = &rfReasm[i];
+		if(!ctx->active)
+			continue;
+		if((ctx->source.callbytes.callsign.encoded == frag->source.callbytes.callsign.encoded) &&
+				(ctx->source.vpnBytes.encvpn == frag->source.vpnBytes.encvpn) &&
+				(ctx->dest.callbytes.callsign.encoded == frag->dest.callbytes.callsign.encoded) &&
+				(ctx->dest.vpnBytes.encvpn == frag->dest.vpnBytes.encvpn))
+			return ctx;
+	}
+	return NULL;
+}
+
+// start a new group with its first fragment
+static RF_REASM_CTX *newGroup(IP400_FRAME *frag)
+{
+	if(rfReasmHeld + frameLength(frag) > RF_REASM_MEM_CAP)	{
+		rfFragStats.nMemCap++;
+		return NULL;
+	}
+
+	for(int i=0;i<RF_REASM_CONTEXTS;i++)	{
+		RF_REASM_CTX *ctx = &rfReasm[i];
+		if(ctx->active)
+			continue;
+		ctx->active = TRUE;
+		ctx->source = frag->source;
+		ctx->dest = frag->dest;
+		ctx->nextSeq = frag->seqNum;
+		ctx->startTick = osKernelGetTickCount();
+		ctx->nBytes = 0;
+		ctx->nFrags = 0;
+		return ctx;
+	}
+
+	rfFragStats.nNoContext++;
+	return NULL;
+}
+
+/*
+ * Add a received fragment to its group. Returns the group
+ * when it is complete, else NULL. The fragment is owned
+ * by the group from here on, or freed if it has none
+ */
+RF_REASM_CTX *RFReassemble(IP400_FRAME *frag)
+{
+	RF_REASM_CTX *ctx = findGroup(frag);
+	uint8_t fragType = frag->flagfld.flags.fragmentation;
+
+	rfFragStats.nRxFrags++;
+
+	// a first fragment starts over: anything held is lost
+	if(fragType == FRAG_FIRST_FRAG)	{
+		if(ctx != NULL)	{
+			rfFragStats.nLost++;
+			dropGroup(ctx);
+		}
+		ctx = newGroup(frag);
+	}
+
+	if(ctx == NULL)	{
+		if(fragType != FRAG_FIRST_FRAG)
+			rfFragStats.nOrphans++;
+		DeleteFrame(frag);
+		return NULL;
+	}
+
+	// sequence gap or too many
+	if(frag->seqNum != ctx->nextSeq)	{
+		rfFragStats.nLost++;
+		dropGroup(ctx);
+		DeleteFrame(frag);
+		return NULL;
+	}
+	if((ctx->nFrags >= RF_FRAG_MAX) || (rfReasmHeld + frameLength(frag) > RF_REASM_MEM_CAP))	{
+		rfFragStats.nTooLong++;
+		dropGroup(ctx);
+		DeleteFrame(frag);
+		return NULL;
+	}
+
+	ctx->frags[ctx->nFrags++] = frag;
+	ctx->nBytes += frameLength(frag);
+	rfReasmHeld += frameLength(frag);
+	ctx->nextSeq++;
+
+	if(fragType != FRAG_END_FRAG)
+		return NULL;
+
+	// complete
+	uint32_t latency = ((osKernelGetTickCount() - ctx->startTick) * 1000) / configTICK_RATE_HZ;
+	if(rfFragStats.nRxGroups++ == 0)
+		rfFragStats.minLatency = latency;
+	else if(latency < rfFragStats.minLatency)
+		rfFragStats.minLatency = latency;
+	if(latency > rfFragStats.maxLatency)
+		rfFragStats.maxLatency = latency;
+	rfFragStats.totLatency += latency;
+
+	return ctx;
+}
+
+/*
+ * The fragments have been handed on: free the context
+ */
+void RFReasmDone(RF_REASM_CTX *ctx)
+{
+	rfReasmHeld -= ctx->nBytes;
+	ctx->nBytes = 0;
+	ctx->nFrags = 0;
+	ctx->active = FALSE;
+}
+
+/*
+ * Give up on groups that have taken too long
+ */
+void RFReasmTimer(void)
+{
+	uint32_t now = osKernelGetTickCount();
+
+	for(int i=0;i<RF_REASM_CONTEXTS;i++)	{
+		RF_REASM_CTX *ctx = &rfReasm[i];
+		if(ctx->active && ((now - ctx->startTick) > RF_REASM_TIMEOUT))	{
+			rfFragStats.nExpired++;
+			dropGroup(ctx);
+		}
+	}
+}
+
+/*
+ * Diagnostics
+ */
+void PrintRFFragStats(void)
+{
+	USART_Print_string("\r\nRF Fragmentation\r\n");
+	USART_Print_string("Tx groups->%d, fragments->%d, failed->%d\r\n",
+			rfFragStats.nTxGroups, rfFragStats.nTxFrags, rfFragStats.nTxFails);
+	USART_Print_string("Rx fragments->%d, groups->%d, %d bytes held\r\n",
+			rfFragStats.nRxFrags, rfFragStats.nRxGroups, rfReasmHeld);
+	USART_Print_string("Lost->%d, expired->%d, orphans->%d\r\n",
+			rfFragStats.nLost, rfFragStats.nExpired, rfFragStats.nOrphans);
+	USART_Print_string("No context->%d, memory cap->%d, too long->%d\r\n",
+			rfFragStats.nNoContext, rfFragStats.nMemCap, rfFragStats.nTooLong);
+	if(rfFragStats.nRxGroups != 0)
+		USART_Print_string("Latency ms->%d avg, %d min, %d max\r\n",
+				rfFragStats.totLatency/rfFragStats.nRxGroups, rfFragStats.minLatency, rfFragStats.maxLatency);
+}
+
+void ResetRFFragStats(void)
+{
+	memset(&rfFragStats, 0, sizeof(RF_FRAG_STATS));
+}
@@ -0,0 +1,238 @@
+/*---------------------------------------------------------------------------
+	Project:	      IP400 Unified Firmware Platform
+
+	Module:		      SPI fragment reassembly
+
+	File Name:	      spifrag.c
+
+	Date Created:	  Oct 18, 2026
+
+	Author:			  MartinA
+
+	Description:      Frames from the host longer than one SPI exchange
+					  arrive as fragments. Put them back together per stream,
+					  keyed by the source and destination, then hand the
+					  whole datagram on, to be fragmented to the air MTU
+					  if it needs to be.
+
+					  Copyright © 2024-26, Alberta Digital Radio Communications Society,
+					  All rights reserved
+
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <string.h>
+
+#include "types.h"
+#include "frame.h"
+#include "spi.h"
+#include "memory.h"
+#include "usart.h"
+#include "tasks.h"
+#include "spifrag.h"
+
+// locals
+SPI_REASM_CTX		reasmCtx[SPI_REASM_CONTEXTS];	// reassembly contexts
+SPI_REASM_STATS		reasmStats;						// context independent stats
+uint32_t			reasmMemHeld;					// heap held by contexts
+
+/*
+ * Initialize
+ */
+void SPIReasmInit(void)
+{
+	memset(reasmCtx, 0, sizeof(reasmCtx));
+	memset(&reasmStats, 0, sizeof(SPI_REASM_STATS));
+	reasmMemHeld = 0;
+}
+
+// free a context, keeping its stats
+static void freeContext(SPI_REASM_CTX *ctx)
+{
+	if(ctx->buffer != NULL)	{
+		nodeMemFree(SPI, ctx->buffer);
+		reasmMemHeld -= SPI_REASM_MAX_LEN;
+	}
+	ctx->buffer = NULL;
+	ctx->active = FALSE;
+}
+
+// same stream: source and destination match
+static BOOL sameStream(SPI_HEADER *a, SPI_HEADER *b)
+{
+	if(memcmp(a->fromCall, b->fromCall, N_CALL) || memcmp(a->fromIP, b->fromIP, N_IPBYTES))
+		return FALSE;
+
+	if(memcmp(a->toCall, b->toCall, N_CALL) || memcmp(a->toIP, b->toIP, N_IPBYTES))
+		return FALSE;
+
+	return TRUE;
+}
+
+// find the context for a stream
+static SPI_REASM_CTX *findContext(SPI_HEADER *hdr)
+{
+	for(int i=0;i<SPI_REASM_CONTEXTS;i++)
+		if(reasmCtx[i].active && sameStream(&reasmCtx[i].hdr, hdr))
+			return &reasmCtx[i];
+
+	return NULL;
+}
+
+// start a new stream
+static SPI_REASM_CTX *newContext(SPI_HEADER *hdr)
+{
+	SPI_REASM_CTX *ctx = NULL;
+
+	for(int i=0;i<SPI_REASM_CONTEXTS;i++)	{
+		if(!reasmCtx[i].active)	{
+			ctx = &reasmCtx[i];
+			break;
+		}
+	}
+	if(ctx == NULL)	{
+		reasmStats.nNoContext++;
+		return NULL;
+	}
+
+	if(reasmMemHeld + SPI_REASM_MAX_LEN > SPI_REASM_MEM_CAP)	{
+		reasmStats.nMemCap++;
+		return NULL;
+	}
+
+	if((ctx->buffer = nodeMemAlloc(SPI, SPI_REASM_MAX_LEN)) == NULL)	{
+		reasmStats.nAllocFails++;
+		return NULL;
+	}
+	reasmMemHeld += SPI_REASM_MAX_LEN;
+
+	memcpy(&ctx->hdr, hdr, sizeof(SPI_HEADER));
+	ctx->length = 0;
+	ctx->age = 0;
+	ctx->active = TRUE;
+	return ctx;
+}
+
+/*
+ * Process one SPI segment. Single frames go straight
+ * through, fragments are added to their stream
+ */
+void SPIReassemble(SPI_HEADER *hdr, uint8_t *data, uint16_t len)
+{
+	SPI_REASM_CTX *ctx;
+	uint8_t status = hdr->spiStat;
+
+	if(status == SINGLE_FRAME)	{
+		SendSPIFrame(hdr, data, len);
+		return;
+	}
+
+	uint16_t offset = ((uint16_t)hdr->offset_hi << 8) + hdr->offset_lo;
+
+	// a first fragment restarts the stream
+	if(status == FIRST_FRAGMENT)	{
+		if((ctx = findContext(hdr)) != NULL)	{
+			ctx->nOffsetErrors++;
+			freeContext(ctx);
+		}
+		if((ctx = newContext(hdr)) == NULL)
+			return;
+	} else if((ctx = findContext(hdr)) == NULL)	{
+		reasmStats.nOrphans++;
+		return;
+	}
+
+	// fragments come in order over the SPI
+	if(offset != ctx->length)	{
+		ctx->nOffsetErrors++;
+		freeContext(ctx);
+		return;
+	}
+	if(ctx->length + len > SPI_REASM_MAX_LEN)	{
+		ctx->nOverflows++;
+		freeContext(ctx);
+		return;
+	}
+
+	memcpy(ctx->buffer + ctx->length, data, len);
+	ctx->length += len;
+	ctx->nFragments++;
+
+	if(status != LAST_FRAGMENT)
+		return;
+
+	// complete: send it on as one frame
+	ctx->hdr.spiStat = SINGLE_FRAME;
+	ctx->hdr.offset_hi = ctx->hdr.offset_lo = 0;
+	ctx->hdr.length_hi = (uint8_t)(ctx->length >> 8);
+	ctx->hdr.length_lo = (uint8_t)(ctx->length & 0xFF);
+	SendSPIFrame(&ctx->hdr, ctx->buffer, ctx->length);
+
+	ctx->nDatagrams++;
+	if(ctx->length > ctx->maxLength)
+		ctx->maxLength = ctx->length;
+	freeContext(ctx);
+}
+
+/*
+ * Called each task tick: give up on stale streams
+ */
+void SPIReasmTimer(void)
+{
+	for(int i=0;i<SPI_REASM_CONTEXTS;i++)	{
+		if(!reasmCtx[i].active)
+			continue;
+		if(++reasmCtx[i].age >= SPI_REASM_TIMEOUT)	{
+			reasmCtx[i].nTimeouts++;
+			freeContext(&reasmCtx[i]);
+		}
+	}
+}
+
+/*
+ * Drop everything: the host has gone away
+ */
+void SPIReasmFlush(void)
+{
+	for(int i=0;i<SPI_REASM_CONTEXTS;i++)
+		if(reasmCtx[i].active)
+			freeContext(&reasmCtx[i]);
+}
+
+/*
+ * Diagnostics
+ */
+void PrintSPIReasmStats(void)
+{
+	USART_Print_string("\r\nSPI Reassembly, %d bytes held\r\n", reasmMemHeld);
+
+	for(int i=0;i<SPI_REASM_CONTEXTS;i++)	{
+		SPI_REASM_CTX *ctx = &reasmCtx[i];
+		if(!ctx->active && (ctx->nFragments == 0))
+			continue;
+
+		USART_Print_string("Context %d (%s)", i, ctx->active ? "active" : "idle");
+		if(ctx->active)
+			USART_Print_string(", %d bytes, %d ticks", ctx->length, ctx->age);
+		USART_Print_string("\r\n");
+		USART_Print_string("Datagrams->%d, fragments->%d, longest->%d\r\n",
+				ctx->nDatagrams, ctx->nFragments, ctx->maxLength);
+		USART_Print_string("Timeouts->%d, offset errors->%d, overflows->%d\r\n",
+				ctx->nTimeouts, ctx->nOffsetErrors, ctx->nOverflows);
+	}
+
+	USART_Print_string("Orphans->%d, no context->%d, memory cap->%d, alloc fails->%d\r\n",
+			reasmStats.nOrphans, reasmStats.nNoContext, reasmStats.nMemCap, reasmStats.nAllocFails);
+}
+
+void ResetSPIReasmStats(void)
+{
+	for(int i=0;i<SPI_REASM_CONTEXTS;i++)	{
+		SPI_REASM_CTX *ctx = &reasmCtx[i];
+		ctx->nDatagrams = ctx->nFragments = 0;
+		ctx->nTimeouts = ctx->nOffsetErrors = ctx->nOverflows = 0;
+		ctx->maxLength = 0;
+	}
+	memset(&reasmStats, 0, sizeof(SPI_REASM_STATS));
+}
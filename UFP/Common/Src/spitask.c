@@ -40,6 +40,7 @@
 
 #include "led.h"
 #include "tasks.h"
+#include "spifrag.h"
 
 #if defined(__NUCLEOCC2) || defined(__PI_BOARD)
 #include "xcvr.h"
@@ -51,7 +52,29 @@
 
 // outbound frame queue
 FRAME_QUEUE spiTxQueue;			// queue for outbound
-static SPI_BUFFER spiTxBuffer;
+
+/*
+ * Two tx buffers: the DMA clocks out the active one while
+ * the task composes the next frame into the other. The ISR
+ * swaps them when it re-arms, if the next one is ready
+ */
+static SPI_BUFFER spiTxBuffers[2];
+static SPI_BUFFER *spiTxActive;			// being clocked out
+static SPI_BUFFER *spiTxCompose;		// being composed
+static volatile BOOL spiTxReady;		// composed buffer waiting to go
+static uint16_t spiTxCrc[2];			// CRC of each one's header and payload
+
+// checked exchanges
+static uint16_t crcTable[256];
+static uint16_t spiPayloadLen;			// larger payload, where the trailers are
+static uint8_t txSeq;					// our exchange count
+static uint8_t rxSeq;					// the host's, last seen
+static BOOL rxSeqValid;					// one has been seen
+
+// a test frame to send back
+static SPI_BUFFER spiEcho;
+static uint16_t spiEchoLen;
+static BOOL spiEchoPending;
 
 // inbound frame queue
 typedef struct rx_queue_elem_t {
@@ -61,6 +84,14 @@ typedef struct rx_queue_elem_t {
 FRAME_QUEUE spiRxQueue;
 SPI_BUFFER *spiRawFrame;
 
+// receive buffer pool
+typedef struct spi_rx_pool_t {
+	SPI_BUFFER	buffer;					// the buffer
+	uint8_t		refs;					// references held
+} SPI_RX_POOL_ELEM;
+
+static SPI_RX_POOL_ELEM spiRxPool[SPI_RX_POOL_SIZE];
+
 uint8_t					SPI_State;						// current state
 HAL_StatusTypeDef 		spiXfer;		// last transfer status
 BOOL 		spiExchangeComplete;		// spi exchange has been completed
@@ -68,13 +99,44 @@ BOOL 		spiErrorOccurred;
 BOOL 		spiActive;
 uint16_t	spiActivityTimer;			// no activity timer
 uint16_t	fragOffset;					// fragment offset
+BOOL		peerCanPack;				// host accepts packed frames
+uint16_t	peerPackMax;				// host max packed payload
+volatile spiPhase	spiXferPhase;		// exchange phase
+volatile BOOL	linkChecked;			// exchanges carry a trailer
+BOOL		peerHasCredit;				// host grants credit
+volatile uint16_t	peerCredit;			// bytes the host will take
+volatile BOOL	peerWantsCredit;		// host is out of credit
+uint32_t	grantAnswered;				// grant the last request was answered with
+BOOL		creditAsked;				// asked the host for credit
+uint16_t	creditAskedAt;				// with this much credit
+uint32_t	spiRxBytesIn;				// payload bytes queued from the host
+uint32_t	spiRxBytesOut;				// payload bytes passed on
+uint32_t	grantRxMark;				// bytes in when the last grant was made
 
 SPI_STATS spi_stats;					// spi stats
 
-
+
 // validate an inbound frame
 BOOL isIP400Frame(uint8_t *eye);
 
+// internals
+uint16_t FormatSPIFrame(IP400_FRAME *txFrame, SPI_HEADER *hdr, uint8_t *data);
+int PackSPIFrames(void);
+void UnpackSPIFrames(SPI_BUFFER *spiRxFrame);
+BOOL ComposeSPITx(void);
+uint16_t SetIdleHeader(BOOL creditReq);
+BOOL IdleHeader(BOOL creditReq);
+void FillIdleHeader(SPI_HEADER *hdr, BOOL creditReq, uint16_t grant);
+uint16_t SPICreditGrant(void);
+void SetDataReady(BOOL ready);
+static uint16_t CheckCRC(uint16_t crc, uint8_t *data, int length);
+static uint16_t TxCRC(SPI_BUFFER *buf);
+static uint16_t TrailerCRC(SPI_BUFFER *buf, uint8_t *trailer);
+static uint16_t HdrPayloadLength(SPI_HEADER *hdr);
+#if __INCLUDE_SPI
+HAL_StatusTypeDef StartSPIExchange(void);
+#endif
+
 /*
  * place a frame on the queue frame
  * frame is already in heap memory
@@ -130,6 +192,33 @@ void PrintSPIStats(void)
 	USART_Print_string("SPI Last fragment frames->%d\r\n", spi_stats.nLastFrames);
 	USART_Print_string("SPI discarded frames->%d\r\n", spi_stats.nDiscarded);
 
+	USART_Print_string("\r\nHost accepts packed frames->%s", peerCanPack ? "Yes" : "No");
+	if(peerCanPack)
+		USART_Print_string(", max %d bytes", peerPackMax);
+	USART_Print_string("\r\nSPI Packed exchanges out->%d, frames->%d\r\n", spi_stats.nPackedTx, spi_stats.nPackedTxFrames);
+	USART_Print_string("SPI Packed exchanges in->%d, frames->%d\r\n", spi_stats.nPackedRx, spi_stats.nPackedRxFrames);
+	USART_Print_string("SPI Packed record errors->%d\r\n", spi_stats.nPackErrors);
+
+	USART_Print_string("\r\nSPI Exchanges are %s\r\n", (spiXferPhase == SPI_PHASE_FULL) ? "full length" : "header first");
+	USART_Print_string("SPI Header only exchanges->%d\r\n", spi_stats.nHdrOnly);
+	USART_Print_string("SPI Payload exchanges->%d, bytes->%d\r\n", spi_stats.nPayloads, spi_stats.payloadBytes);
+	USART_Print_string("SPI Exchanges checked->%s, CRC errors->%d, missing->%d\r\n", linkChecked ? "Yes" : "No",
+			spi_stats.nCheckErrors, spi_stats.nSeqErrors);
+	USART_Print_string("SPI Test frames echoed->%d\r\n", spi_stats.nTestEchoes);
+
+	USART_Print_string("\r\nHost grants credit->%s", peerHasCredit ? "Yes" : "No");
+	if(peerHasCredit)
+		USART_Print_string(", %d bytes", peerCredit);
+	USART_Print_string("\r\nSPI Credit stalls->%d, requests->%d\r\n", spi_stats.nCreditStalls, spi_stats.nCreditRequests);
+	USART_Print_string("SPI Last grant->%d bytes, pending->%d bytes\r\n", spi_stats.lastGrant, spiRxBytesIn - spiRxBytesOut);
+
+	USART_Print_string("\r\nSPI Rx buffers->%d, fewest free->%d, none free->%d\r\n", SPI_RX_POOL_SIZE, spi_stats.poolLowWater, spi_stats.nPoolEmpty);
+	USART_Print_string("SPI Payloads left in place->%d, copied->%d\r\n", spi_stats.nZeroCopy, spi_stats.nPoolCopies);
+	USART_Print_string("SPI Idle exchanges with frames waiting->%d\r\n", spi_stats.nTxLate);
+	USART_Print_string("SPI Data ready raised->%d\r\n", spi_stats.nDataReady);
+
+	PrintSPIReasmStats();
+
 }
 
 /*
@@ -138,6 +227,8 @@ void PrintSPIStats(void)
 void ResetSPIStats(void)
 {
 	memset(&spi_stats, 0, sizeof(SPI_STATS));
+	spi_stats.poolLowWater = SPI_RX_POOL_SIZE;
+	ResetSPIReasmStats();
 }
 
 /*
@@ -149,17 +240,44 @@ void SPI_Task_init(void)
 	spiExchangeComplete = FALSE;
 	spiErrorOccurred = FALSE;
 
-	spiTxBuffer.spiData.hdr.eye[0] = 'I';
-	spiTxBuffer.spiData.hdr.eye[1] = 'P';
-	spiTxBuffer.spiData.hdr.eye[2] = '4';
-	spiTxBuffer.spiData.hdr.eye[3] = 'C';
-
 	SPI_HDR_STATUS defStat;
+	defStat.status_byte = 0;
 	defStat.frameStat.status = NO_FRAME;
-	spiTxBuffer.spiData.hdr.spiStat = defStat.status_byte;
+
+	// CRC table for the trailers
+	for(int i=0;i<256;i++)	{
+		uint16_t crc = i << 8;
+		for(int bit=0;bit<8;bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ SPI_CHECK_POLY : (crc << 1);
+		crcTable[i] = crc;
+	}
+
+	for(int i=0;i<2;i++)	{
+		spiTxBuffers[i].spiData.hdr.eye[0] = 'I';
+		spiTxBuffers[i].spiData.hdr.eye[1] = 'P';
+		spiTxBuffers[i].spiData.hdr.eye[2] = '4';
+		spiTxBuffers[i].spiData.hdr.eye[3] = 'C';
+		spiTxBuffers[i].spiData.hdr.spiStat = defStat.status_byte;
+		spiTxCrc[i] = TxCRC(&spiTxBuffers[i]);
+	}
+	spiTxActive = &spiTxBuffers[0];
+	spiTxCompose = &spiTxBuffers[1];
+	spiTxReady = FALSE;
+	spiXferPhase = SPI_PHASE_FULL;
+	linkChecked = FALSE;
+	spiEchoPending = FALSE;
 
 	spiActive = FALSE;					// no activity yet
 	spiActivityTimer = 0;
+	peerCanPack = FALSE;
+	peerPackMax = 0;
+	peerHasCredit = FALSE;
+	peerCredit = 0;
+	peerWantsCredit = FALSE;
+	grantAnswered = SPI_GRANT_NONE;
+	creditAsked = FALSE;
+	spiRxBytesIn = spiRxBytesOut = 0;
+	grantRxMark = 0;
 
 	// tx (outbound) frame queue
 	spiTxQueue.q_forw = &spiTxQueue;
@@ -169,15 +287,18 @@ void SPI_Task_init(void)
 	spiRxQueue.q_forw = &spiRxQueue;
 	spiRxQueue.q_back = &spiRxQueue;
 
-	if((spiRawFrame = nodeMemAlloc(SPI, SPI_RAW_LEN)) == NULL)
+	// clear stats first: the pool keeps a low water mark
+	memset(spiRxPool, 0, sizeof(spiRxPool));
+	ResetSPIStats();
+
+	if((spiRawFrame = SPIRxBufAlloc()) == NULL)
 		return;
 
-	// clear stats
-	ResetSPIStats();
+	SPIReasmInit();
 
 #if __INCLUDE_SPI
 	// start the ball rolling..
-	if((spiXfer = HAL_SPI_TransmitReceive_DMA(&GPIO_SPI_HANDLE, spiTxBuffer.rawData, (uint8_t *)spiRawFrame, SPI_RAW_LEN)) != HAL_OK)
+	if((spiXfer = StartSPIExchange()) != HAL_OK)
 		spiErrorOccurred = TRUE;
 #endif
 
@@ -193,11 +314,11 @@ void SPI_Task_Exec(void)
 	if(spiErrorOccurred)	{
 		if(GPIO_SPI_HANDLE.State == HAL_SPI_STATE_READY)	{
 			if(spiRawFrame == NULL)	{
-				if((spiRawFrame = nodeMemAlloc(SPI, SPI_RAW_LEN)) == NULL)	{
+				if((spiRawFrame = SPIRxBufAlloc()) == NULL)	{
 					return;
 				}
 			}
-			if((spiXfer = HAL_SPI_TransmitReceive_DMA(&GPIO_SPI_HANDLE, spiTxBuffer.rawData, (uint8_t *)spiRawFrame, SPI_RAW_LEN)) == HAL_OK)	{
+			if((spiXfer = StartSPIExchange()) == HAL_OK)	{
 				spiErrorOccurred = FALSE;
 			}
 			spiExchangeComplete = FALSE;
@@ -207,6 +328,9 @@ void SPI_Task_Exec(void)
 
 #endif
 
+	// stale fragments from the host
+	SPIReasmTimer();
+
 	/*
 	 * Here we wait for an exchange to be completed
 	 * If there is no activity for NO_SPI_TIMEOUT, then
@@ -215,18 +339,34 @@ void SPI_Task_Exec(void)
 	 * the queue will also be cleaned up
 	 */
 	if(spiActive && !spiExchangeComplete)		{
+		// carry on: the host polls slowly when data ready is low
 		spiActivityTimer += 1;
 		if(spiActivityTimer >= NO_SPI_TIMEOUT)	{
 			EmptySPIFrameQ();
+			SPIReasmFlush();
 			spiActive = FALSE;
+			peerCanPack = FALSE;
+			peerHasCredit = FALSE;
+			peerWantsCredit = FALSE;
+			grantAnswered = SPI_GRANT_NONE;
+			creditAsked = FALSE;
+			linkChecked = FALSE;
+			spiEchoPending = FALSE;
+#if __INCLUDE_SPI
+			// host may have restarted: go back to full length
+			if(spiXferPhase != SPI_PHASE_FULL)	{
+				HAL_SPI_Abort(&GPIO_SPI_HANDLE);
+				spiXferPhase = SPI_PHASE_FULL;
+				spiErrorOccurred = TRUE;
+			}
+#endif
 			spiActivityTimer = 0;
+			SetDataReady(FALSE);
+			return;
 		}
-		return;
-	}
-
-	// revive the active status if an exchange occurred;
-	// else keep emptying the queue
-	if(spiExchangeComplete)	{
+	} else if(spiExchangeComplete)	{
+		// revive the active status if an exchange occurred;
+		// else keep emptying the queue
 		spiExchangeComplete = FALSE;		// reset exchange done
 		spiActive = TRUE;					// indicate that the SPI is active..
 		spiActivityTimer = 0;				// reset no activity timer
@@ -242,116 +382,542 @@ void SPI_Task_Exec(void)
 	if((spiRxFrame = (SPI_BUFFER *)dequeFrame(&spiRxQueue)) != NULL)	{
 		int rxSegLen =  ((uint16_t)spiRxFrame->spiData.hdr.length_hi)<<8;
 		rxSegLen += ((uint16_t)spiRxFrame->spiData.hdr.length_lo);
-		SendSPIFrame(&spiRxFrame->spiData.hdr, (uint8_t *)&spiRxFrame->spiData.buffer, rxSegLen);
-		spi_stats.nOBIP400Frames++;
-		nodeMemFree(SPI,spiRxFrame);
+		if(linkChecked && (TrailerCRC(spiRxFrame, spiRxFrame->spiData.buffer + SPI_BUFFER_LEN) !=
+				(((uint16_t)spiRxFrame->spiData.buffer[SPI_BUFFER_LEN+2] << 8) + spiRxFrame->spiData.buffer[SPI_BUFFER_LEN+3])))	{
+			// failed its check: dropped whole
+			spi_stats.nCheckErrors++;
+		} else if(spiRxFrame->spiData.hdr.spiStat == TEST_FRAME)	{
+			// goes back next, as it came
+			memcpy(&spiEcho.spiData.hdr, &spiRxFrame->spiData.hdr, sizeof(SPI_HEADER));
+			spiEchoLen = (rxSegLen > SPI_BUFFER_LEN) ? SPI_BUFFER_LEN : rxSegLen;
+			memcpy(spiEcho.spiData.buffer, spiRxFrame->spiData.buffer, spiEchoLen);
+			spiEchoPending = TRUE;
+		} else if(spiRxFrame->spiData.hdr.spiStat == PACKED_FRAME)	{
+			UnpackSPIFrames(spiRxFrame);
+		} else {
+			SPIReassemble(&spiRxFrame->spiData.hdr, (uint8_t *)&spiRxFrame->spiData.buffer, rxSegLen);
+			spi_stats.nOBIP400Frames++;
+		}
+		spiRxBytesOut += rxSegLen;
+		SPIRxBufRelease(spiRxFrame);
+	}
+
+	// a plain idle header still waiting can give way to a frame
+	if(spiTxReady && (peerWantsCredit || spiEchoPending || (peekFrame(&spiTxQueue) != NULL)))	{
+		SPI_HDR_STATUS waiting;
+		vPortEnterCritical();
+		waiting.status_byte = spiTxCompose->spiData.hdr.spiStat;
+		if(spiTxReady && !waiting.frameStat.busy)
+			spiTxReady = FALSE;
+		vPortExitCritical();
+	}
+
+	// the next buffer has not gone out yet
+	if(spiTxReady)
+		return;
+
+	BOOL busy = ComposeSPITx();
+	if(busy)	{
+		SPI_HDR_STATUS txStat;
+		txStat.status_byte = spiTxCompose->spiData.hdr.spiStat;
+		txStat.frameStat.busy = TRUE;
+		spiTxCompose->spiData.hdr.spiStat = txStat.status_byte;
+	}
+	spiTxCrc[spiTxCompose - spiTxBuffers] = TxCRC(spiTxCompose);
+	spiTxReady = TRUE;
+
+	// tell the host: it may be polling slowly
+	if(busy)
+		SetDataReady(TRUE);
+}
+
+/*
+ * Outbound frame for SPI, composed into the idle tx buffer.
+ * Returns TRUE if it has anything the host needs
+ */
+BOOL ComposeSPITx(void)
+{
+	// a test frame from the host goes back first
+	if(spiEchoPending)	{
+		spiEchoPending = FALSE;
+		memcpy(&spiTxCompose->spiData.hdr, &spiEcho.spiData.hdr, sizeof(SPI_HEADER));
+		memcpy(spiTxCompose->spiData.buffer, spiEcho.spiData.buffer, spiEchoLen);
+		spi_stats.nTestEchoes++;
+		return TRUE;
 	}
 
 	/*
-	 * Outbound frame for SPI
+	 * The host asked for credit: a grant it has not had goes
+	 * first. The same grant again does not, so frames it has
+	 * room for are not held up behind it
 	 */
+	if(peerWantsCredit && (SPICreditGrant() != grantAnswered))
+		return IdleHeader(FALSE);
+
+	// pack small frames together if the host can take them
+	if(peerCanPack && (PackSPIFrames() != 0))	{
+		creditAsked = FALSE;
+		return TRUE;
+	}
+
 	IP400_FRAME *txFrame;
-	if((txFrame=dequeFrame(&spiTxQueue)) == NULL)	{
-		spiTxBuffer.spiData.hdr.spiStat = NO_FRAME;
+	if((txFrame=peekFrame(&spiTxQueue)) == NULL)	{
+		// credit opening up again is news
+		uint16_t lastGrant = spi_stats.lastGrant;
+		BOOL answered = IdleHeader(FALSE);
+		return (answered || ((spi_stats.lastGrant != 0) && (lastGrant == 0))) ? TRUE : FALSE;
+	}
+
+	// hold it until the host has room
+	uint16_t length = txFrame->length;
+	length += ((uint16_t)txFrame->flagfld.flags.payloadMSB) << 8;
+	uint16_t credit = peerCredit;
+	if(peerHasCredit && (length > credit))	{
+		spi_stats.nCreditStalls++;
+
+		// ask once, and again only if the host's grant changes
+		BOOL ask = (!creditAsked || (credit != creditAskedAt)) ? TRUE : FALSE;
+		creditAsked = TRUE;
+		creditAskedAt = credit;
+		return (IdleHeader(ask) || ask) ? TRUE : FALSE;
+	}
+	creditAsked = FALSE;
+
+	dequeFrame(&spiTxQueue);
+	length = FormatSPIFrame(txFrame, &spiTxCompose->spiData.hdr, spiTxCompose->spiData.buffer);
+	if(peerHasCredit)
+		peerCredit -= length;
+	DeleteFrame(txFrame);
+	return TRUE;
+}
+
+/*
+ * Idle header: no frame, what we can do, and how
+ * many bytes the host may send us
+ */
+uint16_t SetIdleHeader(BOOL creditReq)
+{
+	uint16_t grant = SPICreditGrant();
+	spi_stats.lastGrant = grant;
+	grantRxMark = spiRxBytesIn;
+
+	FillIdleHeader(&spiTxCompose->spiData.hdr, creditReq, grant);
+	return grant;
+}
+
+/*
+ * An idle header in the exchanges: it answers a request from
+ * the host, once for each grant as the same one again is no
+ * news. Returns TRUE if it did
+ */
+BOOL IdleHeader(BOOL creditReq)
+{
+	uint16_t grant = SetIdleHeader(creditReq);
+	if(!peerWantsCredit)
+		return FALSE;
+
+	peerWantsCredit = FALSE;
+	if(grant == grantAnswered)
+		return FALSE;
+
+	grantAnswered = grant;
+	spi_stats.nCreditRequests++;
+	return TRUE;
+}
+
+void FillIdleHeader(SPI_HEADER *hdr, BOOL creditReq, uint16_t grant)
+{
+	SPI_HDR_STATUS idleStat;
+	idleStat.status_byte = 0;
+	idleStat.frameStat.status = NO_FRAME;
+	idleStat.frameStat.packCap = TRUE;
+	idleStat.frameStat.varLenCap = TRUE;
+	idleStat.frameStat.creditCap = TRUE;
+	idleStat.frameStat.creditReq = creditReq;
+	hdr->spiStat = idleStat.status_byte;
+
+	// advertise the largest packed payload we accept
+	hdr->offset_hi = (uint8_t)(SPI_BUFFER_LEN>>8);
+	hdr->offset_lo = (uint8_t)(SPI_BUFFER_LEN&0xFF);
+
+	hdr->length_hi = (uint8_t)(grant>>8);
+	hdr->length_lo = (uint8_t)(grant&0xFF);
+
+	// and what else: checked exchanges, and echoing test frames
+	hdr->coding = SPI_XCAPS_MARK | SPI_XCAP_CHECK | SPI_XCAP_ECHO;
+}
+
+// the payload length a header announces
+static uint16_t HdrPayloadLength(SPI_HEADER *hdr)
+{
+	SPI_HDR_STATUS hdrStatus;
+	hdrStatus.status_byte = hdr->spiStat;
+
+	if((hdrStatus.frameStat.status == NO_FRAME) || !isIP400Frame(hdr->eye))
+		return 0;
+
+	uint16_t length = ((uint16_t)hdr->length_hi << 8) + hdr->length_lo;
+	return (length > SPI_BUFFER_LEN) ? SPI_BUFFER_LEN : length;
+}
+
+// CRC-16 CCITT, msb first
+static uint16_t CheckCRC(uint16_t crc, uint8_t *data, int length)
+{
+	for(int i=0;i<length;i++)
+		crc = (crc << 8) ^ crcTable[((crc >> 8) ^ data[i]) & 0xFF];
+
+	return crc;
+}
+
+// a tx buffer's header and payload: the ISR adds the count
+static uint16_t TxCRC(SPI_BUFFER *buf)
+{
+	uint16_t crc = CheckCRC(SPI_CHECK_INIT, buf->rawData, SPI_HDR_LEN);
+	return CheckCRC(crc, buf->spiData.buffer, HdrPayloadLength(&buf->spiData.hdr));
+}
+
+// what the trailer of a received buffer should carry
+static uint16_t TrailerCRC(SPI_BUFFER *buf, uint8_t *trailer)
+{
+	return CheckCRC(TxCRC(buf), trailer, 2);
+}
+
+/*
+ * Credit for the host: a window that closes as the
+ * radio tx queue fills, limited by the free heap and the
+ * free receive buffers, less what the host has sent that
+ * is not yet queued for the radio
+ */
+uint16_t SPICreditGrant(void)
+{
+	uint32_t grant = SPI_CREDIT_WINDOW;
 
-	// if we have a buffer manager, put the available bytes in the length field
 #if defined(__NUCLEOCC2) || defined(__PI_BOARD)
-		RADIO_STATS *stats = GetRadioStats(XCVR_WL33);
-		BUFFER_STATUS *bfrStatus = (BUFFER_STATUS *)stats->bfrStatus;
-		if(bfrStatus != NULL)	{
-			uint16_t txAvail = bfrStatus->txSize - bfrStatus->length;
-			spiTxBuffer.spiData.hdr.length_hi = (uint8_t)(txAvail>>8);
-			spiTxBuffer.spiData.hdr.length_lo = (uint8_t)(txAvail&0xFF);
-		}
+	uint32_t txQueued = wl33_TxQueueDepth();
+	if(txQueued >= SPI_CREDIT_MAX_QUEUED)
+		return 0;
+	grant = (grant * (SPI_CREDIT_MAX_QUEUED - txQueued)) / SPI_CREDIT_MAX_QUEUED;
 #endif
-	} else {
 
-		/*
-		 * reformat an IP400 frame into an SPI frame
-		 */
-		// step 0: common fields
-		memcpy(&spiTxBuffer.spiData.hdr.fromCall, txFrame->source.callbytes.callsign.bytes, N_CALL);
-		memcpy(&spiTxBuffer.spiData.hdr.fromIP, txFrame->source.vpnBytes.vpn, N_IPBYTES);
+	// each exchange from the host lands in a free buffer
+	uint32_t poolRoom = (uint32_t)SPIRxBufFree() * SPI_BUFFER_LEN;
+	if(grant > poolRoom)
+		grant = poolRoom;
+
+	size_t freeHeap = xPortGetFreeHeapSize();
+	if(freeHeap <= SPI_CREDIT_HEAP_RESERVE)
+		return 0;
+	if(grant > (freeHeap - SPI_CREDIT_HEAP_RESERVE))
+		grant = freeHeap - SPI_CREDIT_HEAP_RESERVE;
+
+	uint32_t pending = spiRxBytesIn - spiRxBytesOut;
+	if(pending >= grant)
+		return 0;
+
+	return (uint16_t)(grant - pending);
+}
+
+/*
+ * reformat an IP400 frame into an SPI header and data
+ * returns the data length
+ */
+uint16_t FormatSPIFrame(IP400_FRAME *txFrame, SPI_HEADER *hdr, uint8_t *data)
+{
+	// step 0: common fields
+	memcpy(&hdr->fromCall, txFrame->source.callbytes.callsign.bytes, N_CALL);
+	memcpy(&hdr->fromIP, txFrame->source.vpnBytes.vpn, N_IPBYTES);
+
+	memcpy(&hdr->toCall, txFrame->dest.callbytes.callsign.bytes, N_CALL);
+	memcpy(&hdr->toIP, txFrame->dest.vpnBytes.vpn, N_IPBYTES);
+
+	// flag fields: untouched by man or machine
+	hdr->coding = txFrame->flagfld.flags.coding;
+
+	uint8_t frag = txFrame->flagfld.flags.fragmentation;
+
+	// so payload related stuff
+	uint8_t *payload = (uint8_t *)txFrame->buf;
+	uint16_t length = txFrame->length;
+	length += ((uint16_t)txFrame->flagfld.flags.payloadMSB) << 8;
+
+	// extended calls
+	if(txFrame->flagfld.flags.srcExt)	{
+		memcpy(payload, (void *)&txFrame->srcExt, N_CALL);
+		payload += N_CALL;
+	}
+	if(txFrame->flagfld.flags.destExt)	{
+		memcpy(payload, (void *)&txFrame->destExt, N_CALL);
+		payload += N_CALL;
+	}
+	// hop table
+	if(txFrame->flagfld.flags.hoptable)	{
+		SPI_HOPTABLE *hSPItable = (SPI_HOPTABLE *)payload;
+		HOPTABLE *hIP400 = (HOPTABLE *)txFrame->hopTable;
+		for(int i=0;i<MAX_HOPS;i++)	{
+			hSPItable->hopEntry[i].callentry.callsign.encoded = hIP400->rptCalls[i].callbytes.callsign.encoded;
+			hSPItable->hopEntry[i].flags = hIP400->hopflags[i].flags;
+		}
+		payload += sizeof(SPI_HOPTABLE);
+	}
+	// remainder of payload
+	memcpy(data, payload, length);
+
+	switch(frag)	{
+
+		case FRAG_SELFCONTAINED:
+			hdr->offset_hi = 0;
+			hdr->offset_lo = 0;
+			hdr->length_lo = (uint8_t)length & 0xff;
+			hdr->length_hi = (uint8_t)(length >>8);
+			hdr->spiStat = SINGLE_FRAME;
+			fragOffset = 0;
+			spi_stats.nSingle++;
+			break;
+
+		case FRAG_FIRST_FRAG:
+			hdr->offset_hi = 0;
+			hdr->offset_lo = 0;
+			hdr->length_lo = (uint8_t)length & 0xff;
+			hdr->length_hi = (uint8_t)(length >>8);
+			hdr->spiStat = FIRST_FRAGMENT;
+			fragOffset = length;
+			spi_stats.nFirstFrames++;
+			break;
+
+		case FRAG_MIDDLE_FRAG:
+			hdr->offset_hi = (uint8_t)(fragOffset>>8);
+			hdr->offset_lo = (uint8_t)(fragOffset&0xFF);
+			hdr->length_lo = (uint8_t)length & 0xff;
+			hdr->length_hi = (uint8_t)(length >>8);
+			hdr->spiStat = MIDDLE_FRAGMENT;
+			fragOffset += length;
+			spi_stats.nMidFrames++;
+			break;
+
+		case FRAG_END_FRAG:
+			hdr->offset_hi = (uint8_t)(fragOffset>>8);
+			hdr->offset_lo = (uint8_t)(fragOffset&0xFF);
+			hdr->length_lo = (uint8_t)length & 0xff;
+			hdr->length_hi = (uint8_t)(length >>8);
+			hdr->spiStat = LAST_FRAGMENT;
+			fragOffset = 0;
+			spi_stats.nLastFrames++;
+			break;
+	}
+	return length;
+}
+
+/*
+ * Pack as many self-contained frames as will fit
+ * into the tx buffer. Returns the number packed,
+ * zero leaves the buffer untouched
+ */
+int PackSPIFrames(void)
+{
+	IP400_FRAME *txFrame;
+	uint16_t packLen = 0;
+	int nPacked = 0;
 
-		memcpy(&spiTxBuffer.spiData.hdr.toCall, txFrame->dest.callbytes.callsign.bytes, N_CALL);
-		memcpy(&spiTxBuffer.spiData.hdr.toIP, txFrame->dest.vpnBytes.vpn, N_IPBYTES);
+	uint16_t packMax = (peerPackMax < SPI_BUFFER_LEN) ? peerPackMax : SPI_BUFFER_LEN;
+	if(peerHasCredit && (peerCredit < packMax))
+		packMax = peerCredit;
 
-		// flag fields: untouched by man or machine
-		spiTxBuffer.spiData.hdr.coding = txFrame->flagfld.flags.coding;
+	while((txFrame = peekFrame(&spiTxQueue)) != NULL)	{
 
-		uint8_t frag = txFrame->flagfld.flags.fragmentation;
+		// fragments keep their own exchange
+		if(txFrame->flagfld.flags.fragmentation != FRAG_SELFCONTAINED)
+			break;
 
-		// so payload related stuff
-		uint8_t *payload = (uint8_t *)txFrame->buf;
 		uint16_t length = txFrame->length;
 		length += ((uint16_t)txFrame->flagfld.flags.payloadMSB) << 8;
+		if(packLen + SPI_PACK_REC_HDR + length > packMax)
+			break;
+
+		dequeFrame(&spiTxQueue);
+
+		// sub-record: length, header, data
+		uint8_t *rec = spiTxCompose->spiData.buffer + packLen;
+		SPI_HEADER *recHdr = (SPI_HEADER *)(rec + SPI_PACK_LEN_SIZE);
+		memset(recHdr, 0, sizeof(SPI_HEADER));
+		recHdr->eye[0] = 'I';
+		recHdr->eye[1] = 'P';
+		recHdr->eye[2] = '4';
+		recHdr->eye[3] = 'C';
+
+		uint16_t recLen = sizeof(SPI_HEADER) + FormatSPIFrame(txFrame, recHdr, rec + SPI_PACK_REC_HDR);
+		rec[0] = (uint8_t)(recLen >> 8);
+		rec[1] = (uint8_t)(recLen & 0xFF);
+		packLen += SPI_PACK_LEN_SIZE + recLen;
+		nPacked++;
 
-		// extended calls
-		if(txFrame->flagfld.flags.srcExt)	{
-			memcpy(payload, (void *)&txFrame->srcExt, N_CALL);
-			payload += N_CALL;
-		}
-		if(txFrame->flagfld.flags.destExt)	{
-			memcpy(payload, (void *)&txFrame->destExt, N_CALL);
-			payload += N_CALL;
-		}
-		// hop table
-		if(txFrame->flagfld.flags.hoptable)	{
-			SPI_HOPTABLE *hSPItable = (SPI_HOPTABLE *)payload;
-			HOPTABLE *hIP400 = (HOPTABLE *)txFrame->hopTable;
-			for(int i=0;i<MAX_HOPS;i++)	{
-				hSPItable->hopEntry[i].callentry.callsign.encoded = hIP400->rptCalls[i].callbytes.callsign.encoded;
-				hSPItable->hopEntry[i].flags = hIP400->hopflags[i].flags;
-			}
-			payload += sizeof(SPI_HOPTABLE);
+		DeleteFrame(txFrame);
+	}
+
+	if(nPacked == 0)
+		return 0;
+
+	spiTxCompose->spiData.hdr.spiStat = PACKED_FRAME;
+	spiTxCompose->spiData.hdr.offset_hi = 0;
+	spiTxCompose->spiData.hdr.offset_lo = 0;
+	spiTxCompose->spiData.hdr.length_hi = (uint8_t)(packLen >> 8);
+	spiTxCompose->spiData.hdr.length_lo = (uint8_t)(packLen & 0xFF);
+
+	if(peerHasCredit)
+		peerCredit -= packLen;
+
+	spi_stats.nPackedTx++;
+	spi_stats.nPackedTxFrames += nPacked;
+	return nPacked;
+}
+
+/*
+ * Unpack the sub-records of a packed inbound frame
+ */
+void UnpackSPIFrames(SPI_BUFFER *spiRxFrame)
+{
+	uint16_t packLen = ((uint16_t)spiRxFrame->spiData.hdr.length_hi)<<8;
+	packLen += ((uint16_t)spiRxFrame->spiData.hdr.length_lo);
+	if(packLen > SPI_BUFFER_LEN)	{
+		spi_stats.nPackErrors++;
+		return;
+	}
+
+	uint8_t *rec = spiRxFrame->spiData.buffer;
+	uint8_t *end = rec + packLen;
+
+	while(rec + SPI_PACK_REC_HDR <= end)	{
+		uint16_t recLen = ((uint16_t)rec[0] << 8) + rec[1];
+		SPI_HEADER *recHdr = (SPI_HEADER *)(rec + SPI_PACK_LEN_SIZE);
+
+		// validate the record before using it
+		if((recLen < sizeof(SPI_HEADER)) || (rec + SPI_PACK_LEN_SIZE + recLen > end) ||
+				!isIP400Frame(recHdr->eye) || (recHdr->spiStat != SINGLE_FRAME))	{
+			spi_stats.nPackErrors++;
+			return;
 		}
-		// remainder of payload
-		memcpy(spiTxBuffer.spiData.buffer, payload, length);
-
-		switch(frag)	{
-
-			case FRAG_SELFCONTAINED:
-				spiTxBuffer.spiData.hdr.offset_hi = 0;
-				spiTxBuffer.spiData.hdr.offset_lo = 0;
-				spiTxBuffer.spiData.hdr.length_lo = (uint8_t)length & 0xff;
-				spiTxBuffer.spiData.hdr.length_hi = (uint8_t)(length >>8);
-				spiTxBuffer.spiData.hdr.spiStat = SINGLE_FRAME;
-				fragOffset = 0;
-				spi_stats.nSingle++;
-				break;
-
-			case FRAG_FIRST_FRAG:
-				spiTxBuffer.spiData.hdr.offset_hi = 0;
-				spiTxBuffer.spiData.hdr.offset_lo = 0;
-				spiTxBuffer.spiData.hdr.length_lo = (uint8_t)length & 0xff;
-				spiTxBuffer.spiData.hdr.length_hi = (uint8_t)(length >>8);
-				spiTxBuffer.spiData.hdr.spiStat = FIRST_FRAGMENT;
-				fragOffset = length;
-				spi_stats.nFirstFrames++;
-				break;
-
-			case FRAG_MIDDLE_FRAG:
-				spiTxBuffer.spiData.hdr.offset_hi = (uint8_t)(fragOffset>>8);
-				spiTxBuffer.spiData.hdr.offset_lo = (uint8_t)(fragOffset&0xFF);
-				spiTxBuffer.spiData.hdr.length_lo = (uint8_t)length & 0xff;
-				spiTxBuffer.spiData.hdr.length_hi = (uint8_t)(length >>8);
-				spiTxBuffer.spiData.hdr.spiStat = MIDDLE_FRAGMENT;
-				fragOffset += length;
-				spi_stats.nMidFrames++;
-				break;
-
-			case FRAG_END_FRAG:
-				spiTxBuffer.spiData.hdr.offset_hi = (uint8_t)((2*fragOffset)>>8);
-				spiTxBuffer.spiData.hdr.offset_lo = (uint8_t)((2*fragOffset)&0xFF);
-				spiTxBuffer.spiData.hdr.length_lo = (uint8_t)length & 0xff;
-				spiTxBuffer.spiData.hdr.length_hi = (uint8_t)(length >>8);
-				spiTxBuffer.spiData.hdr.spiStat = LAST_FRAGMENT;
-				fragOffset = 0;
-				spi_stats.nLastFrames++;
-				break;
+
+		SendSPIFrame(recHdr, rec + SPI_PACK_REC_HDR, recLen - sizeof(SPI_HEADER));
+		spi_stats.nOBIP400Frames++;
+		spi_stats.nPackedRxFrames++;
+		rec += SPI_PACK_LEN_SIZE + recLen;
+	}
+	spi_stats.nPackedRx++;
+}
+
+/*
+ * Receive buffer pool. Called from the ISR and
+ * from tasks, so the counts are changed in a critical section
+ */
+SPI_BUFFER *SPIRxBufAlloc(void)
+{
+	SPI_BUFFER *buf = NULL;
+	int nFree = 0;
+
+	vPortEnterCritical();
+	for(int i=0;i<SPI_RX_POOL_SIZE;i++)	{
+		if(spiRxPool[i].refs != 0)
+			continue;
+		if(buf == NULL)	{
+			spiRxPool[i].refs = 1;
+			buf = &spiRxPool[i].buffer;
+		} else {
+			nFree++;
 		}
-		DeleteFrame(txFrame);
 	}
+	vPortExitCritical();
+
+	if(buf == NULL)	{
+		spi_stats.nPoolEmpty++;
+		return NULL;
+	}
+	if(nFree < spi_stats.poolLowWater)
+		spi_stats.poolLowWater = nFree;
+	return buf;
+}
+
+// buffers free now
+int SPIRxBufFree(void)
+{
+	int nFree = 0;
+
+	vPortEnterCritical();
+	for(int i=0;i<SPI_RX_POOL_SIZE;i++)
+		if(spiRxPool[i].refs == 0)
+			nFree++;
+	vPortExitCritical();
+
+	return nFree;
+}
+
+// the pool element holding an address, or NULL
+static SPI_RX_POOL_ELEM *poolElem(void *p)
+{
+	uint8_t *addr = (uint8_t *)p;
+	uint8_t *base = (uint8_t *)spiRxPool;
+
+	if((addr < base) || (addr >= base + sizeof(spiRxPool)))
+		return NULL;
+
+	return &spiRxPool[(addr - base)/sizeof(SPI_RX_POOL_ELEM)];
+}
+
+// an address is inside a pool buffer
+BOOL SPIRxBufOwns(void *p)
+{
+	return (poolElem(p) != NULL) ? TRUE : FALSE;
+}
+
+/*
+ * take another reference to the buffer holding an address,
+ * unless that would leave the exchanges short of buffers:
+ * the caller then copies the payload
+ */
+BOOL SPIRxBufHold(void *p)
+{
+	SPI_RX_POOL_ELEM *elem = poolElem(p);
+	if(elem == NULL)
+		return FALSE;
+
+	if(SPIRxBufFree() < SPI_RX_POOL_RESERVE)	{
+		spi_stats.nPoolCopies++;
+		return FALSE;
+	}
+
+	vPortEnterCritical();
+	elem->refs++;
+	vPortExitCritical();
+
+	spi_stats.nZeroCopy++;
+	return TRUE;
+}
+
+// drop a reference: the last one frees the buffer
+void SPIRxBufRelease(void *p)
+{
+	SPI_RX_POOL_ELEM *elem = poolElem(p);
+	if(elem == NULL)
+		return;
+
+	vPortEnterCritical();
+	if(elem->refs != 0)
+		elem->refs--;
+	vPortExitCritical();
+}
+
+/*
+ * Drive the data ready line, if the board has one.
+ * Called from the task and the ISR
+ */
+void SetDataReady(BOOL ready)
+{
+#if __SPI_DATA_READY
+	static BOOL drdyState = FALSE;
+
+	if(ready && !drdyState)
+		spi_stats.nDataReady++;
+	drdyState = ready;
+	HAL_GPIO_WritePin(SPI_DRDY_GPIO_Port, SPI_DRDY_Pin, ready ? GPIO_PIN_SET : GPIO_PIN_RESET);
+#endif
 }
 
 // test if an inbound frame is valid
@@ -364,11 +930,94 @@ BOOL isIP400Frame(uint8_t *eye)
 }
 
 #if __INCLUDE_SPI
+/*
+ * Arm the DMA for the next exchange: full length,
+ * or just the header when running header first
+ */
+HAL_StatusTypeDef StartSPIExchange(void)
+{
+	// a lost payload phase starts over with a header
+	if(spiXferPhase == SPI_PHASE_PAYLOAD)
+		spiXferPhase = SPI_PHASE_HDR;
+
+	uint16_t xferLen = (spiXferPhase == SPI_PHASE_FULL) ? SPI_RAW_LEN : SPI_HDR_LEN;
+	return HAL_SPI_TransmitReceive_DMA(&GPIO_SPI_HANDLE, spiTxActive->rawData, (uint8_t *)spiRawFrame, xferLen);
+}
+
+/*
+ * An exchange is done: the composed buffer goes next. If the
+ * task has not got to it, the one just sent goes again as an
+ * idle header, so a frame is never sent twice. The grant is
+ * cut by what the host has sent since it was made
+ */
+static void SwapTxBuffers(void)
+{
+	if(spiTxReady)	{
+		SPI_BUFFER *sent = spiTxActive;
+		spiTxActive = spiTxCompose;
+		spiTxCompose = sent;
+		spiTxReady = FALSE;
+
+		SPI_HDR_STATUS txStat;
+		txStat.status_byte = spiTxActive->spiData.hdr.spiStat;
+		SetDataReady(txStat.frameStat.busy);
+		return;
+	}
+
+	if(spiTxQueue.q_forw != &spiTxQueue)
+		spi_stats.nTxLate++;
+
+	uint32_t used = spiRxBytesIn - grantRxMark;
+	uint16_t grant = (spi_stats.lastGrant > used) ? spi_stats.lastGrant - used : 0;
+	FillIdleHeader(&spiTxActive->spiData.hdr, FALSE, grant);
+	spiTxCrc[spiTxActive - spiTxBuffers] = TxCRC(spiTxActive);
+	SetDataReady(FALSE);
+}
+
+// our trailer, straight after the payload
+static void SealTrailer(uint16_t at)
+{
+	uint8_t *trailer = spiTxActive->spiData.buffer + at;
+
+	trailer[0] = ++txSeq;
+	trailer[1] = 0;
+	uint16_t crc = CheckCRC(spiTxCrc[spiTxActive - spiTxBuffers], trailer, 2);
+	trailer[2] = (uint8_t)(crc >> 8);
+	trailer[3] = (uint8_t)(crc & 0xFF);
+}
+
+/*
+ * The host's trailer. An idle header is checked now, as it is
+ * used now; a frame's trailer is copied after the buffer for the
+ * task to check. Returns FALSE if the header is not to be used
+ */
+static BOOL CheckRxTrailer(void)
+{
+	uint8_t *trailer = spiRawFrame->spiData.buffer + spiPayloadLen;
+
+	if(rxSeqValid && (trailer[0] != (uint8_t)(rxSeq + 1)))
+		spi_stats.nSeqErrors++;
+	rxSeq = trailer[0];
+	rxSeqValid = TRUE;
+
+	if(HdrPayloadLength(&spiRawFrame->spiData.hdr) != 0)	{
+		memmove(spiRawFrame->spiData.buffer + SPI_BUFFER_LEN, trailer, SPI_CHECK_LEN);
+		return TRUE;
+	}
+
+	if(TrailerCRC(spiRawFrame, trailer) == (((uint16_t)trailer[2] << 8) + trailer[3]))
+		return TRUE;
+
+	spi_stats.nCheckErrors++;
+	return FALSE;
+}
+
 // rx done callback
 void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef * hspi)
 {
 
-	SPI_HDR_STATUS ibStatus;
+	SPI_HDR_STATUS ibStatus, obStatus;
+	BOOL rxGood = TRUE;
 
 	// interrupt is not for me...
 	if(hspi->Instance != GPIO_SPI_INST)
@@ -385,27 +1034,86 @@ void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef * hspi)
 
 	// set data valid and start a new transfer
 	if(hspi->State == HAL_SPI_STATE_READY)		{
+
+		// header first: clock exactly the larger payload, if any
+		if(spiXferPhase == SPI_PHASE_HDR)	{
+			uint16_t txLen = HdrPayloadLength(&spiTxActive->spiData.hdr);
+			uint16_t rxLen = HdrPayloadLength(&spiRawFrame->spiData.hdr);
+			uint16_t xferLen = (txLen > rxLen) ? txLen : rxLen;
+
+			// checked: always a payload phase, for the trailers
+			spiPayloadLen = xferLen;
+			if(linkChecked)	{
+				SealTrailer(xferLen);
+				xferLen += SPI_CHECK_LEN;
+			}
+			if(xferLen != 0)	{
+				spiXferPhase = SPI_PHASE_PAYLOAD;
+				spi_stats.nPayloads++;
+				spi_stats.payloadBytes += xferLen;
+				spiXfer = HAL_SPI_TransmitReceive_DMA(&GPIO_SPI_HANDLE, spiTxActive->spiData.buffer, spiRawFrame->spiData.buffer, xferLen);
+				if(spiXfer != HAL_OK)
+					spiErrorOccurred = TRUE;
+				return;
+			}
+			spi_stats.nHdrOnly++;
+		} else if(spiXferPhase == SPI_PHASE_PAYLOAD)	{
+			spiXferPhase = SPI_PHASE_HDR;
+			if(linkChecked)
+				rxGood = CheckRxTrailer();
+		}
+
 		spiExchangeComplete = TRUE;
 
 		// if the receiver has a valid frame, queue it and allocate another
 		ibStatus.status_byte = spiRawFrame->spiData.hdr.spiStat;
 		spiFrameStatus rstat = ibStatus.frameStat.status;
 
+		// an idle frame says what the host can do
+		if(rxGood && (rstat == NO_FRAME) && isIP400Frame(spiRawFrame->spiData.hdr.eye))	{
+			peerCanPack = ibStatus.frameStat.packCap;
+			peerPackMax = ((uint16_t)spiRawFrame->spiData.hdr.offset_hi << 8) + spiRawFrame->spiData.hdr.offset_lo;
+
+			// and how much it will take from us
+			peerHasCredit = ibStatus.frameStat.creditCap;
+			if(peerHasCredit)
+				peerCredit = ((uint16_t)spiRawFrame->spiData.hdr.length_hi << 8) + spiRawFrame->spiData.hdr.length_lo;
+			if(ibStatus.frameStat.creditReq)
+				peerWantsCredit = TRUE;
+
+			// both idle headers offered header first: switch after this one
+			obStatus.status_byte = spiTxActive->spiData.hdr.spiStat;
+			if((spiXferPhase == SPI_PHASE_FULL) && ibStatus.frameStat.varLenCap &&
+					(obStatus.frameStat.status == NO_FRAME) && obStatus.frameStat.varLenCap)	{
+				spiXferPhase = SPI_PHASE_HDR;
+
+				// and checked, if both offered it
+				uint8_t xcaps = spiRawFrame->spiData.hdr.coding;
+				uint8_t ourCaps = spiTxActive->spiData.hdr.coding;
+				linkChecked = (((xcaps & SPI_XCAPS_MASK) == SPI_XCAPS_MARK) && (xcaps & SPI_XCAP_CHECK) &&
+						((ourCaps & SPI_XCAPS_MASK) == SPI_XCAPS_MARK) && (ourCaps & SPI_XCAP_CHECK)) ? TRUE : FALSE;
+				txSeq = 0;
+				rxSeqValid = FALSE;
+			}
+		}
+
+		SwapTxBuffers();
+
 		// frame with status in the correct range
-		SPI_BUFFER *oldBuffer = spiRawFrame;
-		if((rstat > NO_FRAME) && (rstat < N_STATUS) && isIP400Frame(spiRawFrame->spiData.hdr.eye))	{
+		if((((rstat > NO_FRAME) && (rstat < N_STATUS)) || (rstat == PACKED_FRAME) || (rstat == TEST_FRAME)) && isIP400Frame(spiRawFrame->spiData.hdr.eye))	{
 			// queue the frame. If it fails, just re-use it
 			if(enqueFrame(&spiRxQueue, (IP400_FRAME *)spiRawFrame, 0))	{
-				if((spiRawFrame = nodeMemAlloc(SPI, SPI_RAW_LEN)) == NULL)	{
+				spiRxBytesIn += ((uint16_t)spiRawFrame->spiData.hdr.length_hi << 8) + spiRawFrame->spiData.hdr.length_lo;
+				// the old one is queued: the task re-arms when one is free
+				if((spiRawFrame = SPIRxBufAlloc()) == NULL)	{
 					spiErrorOccurred = TRUE;
-					spiRawFrame = oldBuffer;
 					return;
 				}
 			}
 		}
 
 		// next transfer
-		spiXfer = HAL_SPI_TransmitReceive_DMA(&GPIO_SPI_HANDLE, spiTxBuffer.rawData, (uint8_t *)spiRawFrame, SPI_RAW_LEN);
+		spiXfer = StartSPIExchange();
 		if(spiXfer != HAL_OK)
 			spiErrorOccurred = TRUE;
 		return;
@@ -39,6 +39,7 @@
 #include "setup.h"
 #include "memory.h"
 #include "xcvr.h"
+#include "rffrag.h"
 
 #include "led.h"
 
@@ -160,11 +161,19 @@ void Xcvr_Task_Exec(void)
 		(xcvrs[i].Process());
 
 	// process any outstanding rx frames
-	// see if we can buffer anything...
+	// in batches, so the fixed costs are paid once per batch
+	IP400_FRAME *batch[RX_BATCH_SIZE];
+	int nFrames;
+
 	while(quehasData(&rxQueue))	{
-		IP400_FRAME *f = dequeFrame(&rxQueue);
-		ProcessRxFrame(f, f->length);
+		nFrames = 0;
+		while((nFrames < RX_BATCH_SIZE) && quehasData(&rxQueue))
+			batch[nFrames++] = dequeFrame(&rxQueue);
+		ProcessRxBatch(batch, nFrames);
 	}
+
+	// fragment groups that never completed
+	RFReasmTimer();
 }
 
 /*
@@ -208,15 +217,76 @@ void QueueTxFrame(void *txframe, int xcvrAddr)
 
 /*
  * run a test on a xcvr
+ * the null xcvr modes swap the null transceiver into the slot,
+ * test off puts the real one back
  */
 void runXcvrTest(uint8_t index, uint8_t testNum)
 {
 	if(index > N_XCVRS)
 		return;
 
+	switch(testNum)	{
+
+	case XCVR_TEST_NULL_LOOPBACK:
+	case XCVR_TEST_NULL_SINK:
+		SwapNullXcvr(index, TRUE);
+		break;
+
+	case XCVR_TEST_OFF:
+		SwapNullXcvr(index, FALSE);
+		break;
+	}
+
 	(xcvrs[index].SetTestMode(testNum));
 }
 
+/*
+ * Swap the null transceiver in or out of a slot.
+ * Only the processing, tx, test and stats vectors are replaced,
+ * the setup still belongs to the real radio
+ */
+static XCVR_ABS savedVectors[N_XCVRS];			// real vectors while swapped out
+static BOOL nullSwapped[N_XCVRS];				// null xcvr is in the slot
+
+void SwapNullXcvr(uint8_t index, BOOL swapIn)
+{
+	if((index >= N_XCVRS) || (swapIn == nullSwapped[index]))
+		return;
+
+	// null xcvr is not linked in
+	if(null_GetVectors == NULL)
+		return;
+
+	XCVR_ABS *nullVectors = null_GetVectors();
+
+	vPortEnterCritical();
+
+	if(swapIn)	{
+		savedVectors[index] = xcvrs[index];
+		xcvrs[index].Process = nullVectors->Process;
+		xcvrs[index].QueTxFrame = nullVectors->QueTxFrame;
+		xcvrs[index].SetTestMode = nullVectors->SetTestMode;
+		xcvrs[index].GetStats = nullVectors->GetStats;
+	} else {
+		xcvrs[index] = savedVectors[index];
+	}
+	nullSwapped[index] = swapIn;
+
+	vPortExitCritical();
+
+	if(swapIn)	{
+		(nullVectors->Init)();
+		return;
+	}
+
+	// the last slot to swap it out lets its memory go
+	for(int i=0;i<N_XCVRS;i++)
+		if(nullSwapped[i])
+			return;
+	if(nullVectors->DeInit != NULL)
+		(nullVectors->DeInit)();
+}
+
 /*
  * retreive the stats for a specific radio
  */
@@ -69,6 +69,7 @@ BOOL RxHasData(void);
 uint8_t *GetRxBufferAddr(void);
 uint8_t *getRxBufferFrame(void);
 void SetRxDone(void);
+void Raw2RxQueue(RAWBUFFER *buffer);
 
 BOOL TxHasRoom(int length);
 BOOL IsTxReady(void);
@@ -77,6 +78,7 @@ uint16_t GetTxBufferLength(void);
 void *GetTxBufferAddr(void);
 void *GetTxBufferAltAddr(void);
 void SetTxBufferDone(void);
+uint16_t IP4002RawBuf(IP400_FRAME *tFrame, RAWBUFFER *buf);
 
 //
 BUFFER_STATUS *getBufferStatus(void);
@@ -0,0 +1,56 @@
+/*---------------------------------------------------------------------------
+	Project:	      IP400 Unified Firmware Platform
+
+	Module:		      Null transceiver
+
+	File Name:	      nullxcvr.h
+
+	Date Created:	  Oct 18, 2026
+
+	Author:			  MartinA
+
+	Description:      Definitions for the null/loopback transceiver
+
+					  Copyright © 2024-26, Alberta Digital Radio Communications Society,
+					  All rights reserved
+
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+
+#ifndef NULLXCVR_H_
+#define NULLXCVR_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+// null xcvr stats
+typedef struct null_xcvr_stats_t {
+	uint32_t		nTxFrames;					// frames queued for transmit
+	uint32_t		nLooped;					// frames looped back to rx
+	uint32_t		nSunk;						// frames discarded
+	uint32_t		nRxFrames;					// frames delivered to the stack
+	uint32_t		nNoBuffer;					// frames dropped, no buffer
+	uint32_t		firstTick;					// tick of first frame
+	uint32_t		lastTick;					// tick of last frame
+	uint64_t		txCycles;					// cycles spent serializing
+	uint64_t		rxCycles;					// cycles spent de-serializing
+	uint32_t		minCycles;					// min tx cycles/frame
+	uint32_t		maxCycles;					// max tx cycles/frame
+} NULL_XCVR_STATS;
+
+// links in from the xcvr abstraction
+void null_Init(void);
+void null_DeInit(void);
+void null_Process(void);
+void null_QTxFrame(void *txframe);
+void null_TestMode(uint8_t mode);
+void *GetNullStats(void);
+
+// diagnostics
+void PrintNullXcvrStats(void);
+void ResetNullXcvrStats(void);
+
+#endif /* NULLXCVR_H_ */
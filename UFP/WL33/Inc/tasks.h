@@ -47,6 +47,7 @@ void Xcvr_Task_Exec(void);
 void Mesh_Task_Init(void);
 void Mesh_ProcessBeacon(void *frameData, uint32_t rssi);
 BOOL Mesh_Accept_Frame(void *rxFrame, uint32_t rssi);
+BOOL Mesh_Accept_RxFrame(void *rxFrame, void *rxContext);
 void Mesh_ListStatus(void);
 void UpdateMeshStatus(void);
 
@@ -86,6 +86,7 @@ void wl33_PrintRadioSetup(void);
 void wl33_QTxFrame(void *);			// queue tx frame
 void wl33_TestMode(uint8_t  mode);
 void *Getwl33Stats(void);
+uint32_t wl33_TxQueueDepth(void);	// frames waiting for the tx buffer
 
 
 
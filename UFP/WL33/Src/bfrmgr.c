@@ -49,6 +49,7 @@ uint8_t txTimer;				// tx interval timer
 
 // forward refs
 void IP4002Buf(IP400_FRAME *tFrame);
+uint16_t IP4002Raw(IP400_FRAME *tFrame, RAWBUFFER *dest);
 
 /*
  * Initialize the buffer task
@@ -184,12 +185,38 @@ void SetTxBufferDone(void)
 
 // put a frame in the buffer
 void IP4002Buf(IP400_FRAME *tFrame)
+{
+	txBufferStatus.length += IP4002Raw(tFrame, txBufferStatus.addr + txBufferStatus.length);
+}
+
+/*
+ * Wrap a single frame in a complete raw buffer, header included.
+ * Used by transceivers that do not go through the tx buffer
+ * Returns the overall buffer length
+ */
+uint16_t IP4002RawBuf(IP400_FRAME *tFrame, RAWBUFFER *buf)
+{
+	size_t hdrSize = strlen(bfrHeader);
+
+	strcpy((char *)buf, bfrHeader);
+	uint16_t bfrLen = hdrSize + sizeof(uint16_t);
+	bfrLen += IP4002Raw(tFrame, buf + bfrLen);
+	memcpy(buf + hdrSize, &bfrLen, sizeof(uint16_t));
+
+	return bfrLen;
+}
+
+/*
+ * Serialize a frame at dest, and free it
+ * Returns the number of bytes occupied, including the length
+ */
+uint16_t IP4002Raw(IP400_FRAME *tFrame, RAWBUFFER *dest)
 {
 	/*
 	 * buffer has consecutive frames up to the max frame length.
 	 * Each frame starts with a length, and a null on the end
 	 */
-	RAWBUFFER *cpyDest = txBufferStatus.addr + txBufferStatus.length;					// Save start pointer for length calculation
+	RAWBUFFER *cpyDest = dest;					// Save start pointer for length calculation
 
 	// first put in the overall frame length
 	uint16_t frameLen = 2*(IP_400_MAC_SIZE) +IP_400_FLAG_SIZE + sizeof(uint16_t) + sizeof(uint32_t) + 2*IP_400_CALL_SIZE;
@@ -201,8 +228,6 @@ void IP4002Buf(IP400_FRAME *tFrame)
 	memcpy(cpyDest, (uint8_t *)&frameLen, sizeof(uint16_t));
 	cpyDest += sizeof(uint16_t);
 
-	txBufferStatus.length += frameLen + sizeof(uint16_t);		// add in the length bytes..
-
 	/*
 	 * Build the raw frame bytes: see IP400_FRAME struct (28 bytes)
 	 */
@@ -256,11 +281,11 @@ void IP4002Buf(IP400_FRAME *tFrame)
 
 	// free the allocations in the reverse order...
 	if(tFrame->buf != NULL)
-		nodeMemFree(FRAME,tFrame->buf);
+		FreeFramePayload(tFrame->buf);
 
 	nodeMemFree(FRAME,tFrame);
 
-
+	return frameLen + sizeof(uint16_t);			// add in the length bytes..
 }
 
 
@@ -272,14 +297,20 @@ void IP4002Buf(IP400_FRAME *tFrame)
 // break up the buffer into individual raw frames
 // Queue for later processing
 void SetRxDone(void)
+{
+	Raw2RxQueue(rxBuffer);
+}
+
+// break up any raw buffer onto the raw frame queue
+void Raw2RxQueue(RAWBUFFER *buffer)
 {
 	uint16_t pktlen;
 	int rxLength;
-	RAWBUFFER *bfrAddr = rxBuffer;
+	RAWBUFFER *bfrAddr = buffer;
 	RAWBUFFER *frame;
 
 	// if it is not this version; drop it
-	if(strncmp((char *)rxBuffer, bfrHeader, strlen(bfrHeader)))
+	if(strncmp((char *)buffer, bfrHeader, strlen(bfrHeader)))
 		return;
 
 	size_t hdrSize = strlen(bfrHeader);
@@ -0,0 +1,238 @@
+/*---------------------------------------------------------------------------
+	Project:	      IP400 Unified Firmware Platform
+
+	Module:		      Null transceiver
+
+	File Name:	      nullxcvr.c
+
+	Date Created:	  Oct 18, 2026
+
+	Author:			  MartinA
+
+	Description:      A transceiver with no radio behind it. Frames queued
+					  for transmit are serialized into a raw buffer exactly
+					  as the WL33 would send them, then either looped back
+					  through the receive path or discarded. Used to measure
+					  the throughput of the stack above the radio.
+
+					  Copyright © 2024-26, Alberta Digital Radio Communications Society,
+					  All rights reserved
+
+
+	Revision History:
+
+---------------------------------------------------------------------------*/
+#include <cmsis_os2.h>
+#include <string.h>
+#include <config.h>
+
+#include "main.h"
+#include "frame.h"
+#include "xcvr.h"
+#include "memory.h"
+#include "bfrmgr.h"
+#include "usart.h"
+#include "nullxcvr.h"
+
+// locals
+XcvrTestMode		nullMode;		// loopback or sink
+NULL_XCVR_STATS		nullStats;		// throughput stats
+RADIO_STATS			nullRadioStats;	// stats in the common format
+RAWBUFFER			*nullBuffer;	// serialization buffer, while swapped in
+
+// mode names
+char *nullModes[] = {
+		"Loopback",
+		"Sink"
+};
+
+// initialize the callbacks in the xcvr struct
+XCVR_ABS null_vectors = {
+		.Init = &null_Init,
+		.DeInit = &null_DeInit,
+		.Process = &null_Process,
+		.QueTxFrame = &null_QTxFrame,
+		.SetTestMode = &null_TestMode,
+		.GetStats = &GetNullStats,
+		.QueRxFrame = &QueueRxFrameCallback
+};
+// required to initialize structs
+XCVR_ABS *null_GetVectors(void)
+{
+	return &null_vectors;
+}
+
+/*
+ * The M0+ has no cycle counter, so build one from
+ * the tick count and the SysTick down counter
+ */
+static uint64_t getCycles(void)
+{
+	uint32_t tick, val;
+	uint32_t reload = SysTick->LOAD + 1;
+
+	do	{
+		tick = osKernelGetTickCount();
+		val = SysTick->VAL;
+	} while (tick != osKernelGetTickCount());
+
+	return ((uint64_t)tick * reload) + (reload - 1 - val);
+}
+
+/*
+ * Initialize: called when the null xcvr is swapped in.
+ * The buffer comes from the heap, so it only costs
+ * RAM while the null xcvr is in use
+ */
+void null_Init(void)
+{
+	if(nullMode != XCVR_TEST_NULL_SINK)
+		nullMode = XCVR_TEST_NULL_LOOPBACK;
+	ResetNullXcvrStats();
+
+	if(nullBuffer == NULL)
+		nullBuffer = (RAWBUFFER *)nodeMemAlloc(BUFFERS, BFR_SIZE);
+}
+
+/*
+ * De-initialize: called when the null xcvr
+ * is swapped out of the last slot
+ */
+void null_DeInit(void)
+{
+	if(nullBuffer != NULL)
+		nodeMemFree(BUFFERS, nullBuffer);
+	nullBuffer = NULL;
+}
+
+/*
+ * Process: deliver any looped back frames,
+ * same as the WL33 receive path
+ */
+void null_Process(void)
+{
+	uint8_t *rawFrame;
+
+	while(RxHasData())	{
+		rawFrame = getRxBufferFrame();
+
+		uint64_t start = getCycles();
+		IP400_FRAME *rFrame = Buf2IP400(rawFrame);
+		if(rFrame != NULL)		{
+			nullRadioStats.dequeued++;
+			nullStats.nRxFrames++;
+			(*null_vectors.QueRxFrame)(rFrame);
+		} else {
+			nullRadioStats.unprocessed++;
+		}
+		nullStats.rxCycles += getCycles() - start;
+
+		nodeMemFree(BUFFERS, rawFrame);
+	}
+}
+
+/*
+ * Transmit a frame: serialize, then loop or discard
+ */
+void null_QTxFrame(void *txframe)
+{
+	IP400_FRAME *tFrame = (IP400_FRAME *)txframe;
+
+	// no buffer: drop it, as serialization would have
+	if(nullBuffer == NULL)	{
+		if(tFrame->flagfld.flags.hoptable)
+			nodeMemFree(FRAME, tFrame->hopTable);
+		if(tFrame->buf != NULL)
+			FreeFramePayload(tFrame->buf);
+		nodeMemFree(FRAME, tFrame);
+		nullStats.nNoBuffer++;
+		return;
+	}
+
+	uint64_t start = getCycles();
+
+	// serialization frees the frame
+	IP4002RawBuf(tFrame, nullBuffer);
+
+	if(nullMode == XCVR_TEST_NULL_LOOPBACK)	{
+		Raw2RxQueue(nullBuffer);
+		nullStats.nLooped++;
+	} else {
+		nullStats.nSunk++;
+	}
+
+	uint32_t cycles = (uint32_t)(getCycles() - start);
+	nullStats.txCycles += cycles;
+	if(cycles < nullStats.minCycles)
+		nullStats.minCycles = cycles;
+	if(cycles > nullStats.maxCycles)
+		nullStats.maxCycles = cycles;
+
+	uint32_t now = osKernelGetTickCount();
+	if(nullStats.nTxFrames++ == 0)
+		nullStats.firstTick = now;
+	nullStats.lastTick = now;
+	nullRadioStats.TxFrameCnt++;
+}
+
+/*
+ * Test modes: only the null modes are meaningful
+ */
+void null_TestMode(uint8_t mode)
+{
+	switch(mode)	{
+
+	case XCVR_TEST_NULL_LOOPBACK:
+	case XCVR_TEST_NULL_SINK:
+		nullMode = mode;
+		break;
+
+	default:
+		break;
+	}
+}
+
+/*
+ * return the stats
+ */
+void *GetNullStats(void)
+{
+	nullRadioStats.fsmState = "Null";
+	nullRadioStats.codeState = nullModes[nullMode - XCVR_TEST_NULL_LOOPBACK];
+	nullRadioStats.RxFrameCnt = nullStats.nRxFrames;
+	nullRadioStats.bfrStatus = NULL;
+	return (void *)&nullRadioStats;
+}
+
+/*
+ * Diagnostics
+ */
+void PrintNullXcvrStats(void)
+{
+	if(nullStats.nTxFrames == 0)
+		return;
+
+	uint32_t elapsed = nullStats.lastTick - nullStats.firstTick;
+	uint32_t rate = 0;
+	if(elapsed != 0)
+		rate = (uint32_t)(((uint64_t)nullStats.nTxFrames * osKernelGetTickFreq())/elapsed);
+
+	USART_Print_string("Null Transceiver (%s)\r\n", nullModes[nullMode - XCVR_TEST_NULL_LOOPBACK]);
+	USART_Print_string("Frames tx->%d, looped->%d, sunk->%d, rx->%d\r\n",
+			nullStats.nTxFrames, nullStats.nLooped, nullStats.nSunk, nullStats.nRxFrames);
+	if(nullStats.nNoBuffer != 0)
+		USART_Print_string("Frames dropped, no buffer->%d\r\n", nullStats.nNoBuffer);
+	USART_Print_string("Elapsed->%d ticks, rate->%d frames/sec\r\n", elapsed, rate);
+	USART_Print_string("Tx cycles/frame->%d avg, %d min, %d max\r\n",
+			(uint32_t)(nullStats.txCycles/nullStats.nTxFrames), nullStats.minCycles, nullStats.maxCycles);
+	if(nullStats.nRxFrames != 0)
+		USART_Print_string("Rx cycles/frame->%d avg\r\n", (uint32_t)(nullStats.rxCycles/nullStats.nRxFrames));
+	USART_Print_string("\r\n");
+}
+
+void ResetNullXcvrStats(void)
+{
+	memset(&nullStats, 0, sizeof(NULL_XCVR_STATS));
+	memset(&nullRadioStats, 0, sizeof(RADIO_STATS));
+	nullStats.minCycles = UINT32_MAX;
+}
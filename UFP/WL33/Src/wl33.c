@@ -257,6 +257,16 @@ void wl33_QTxFrame(void *txframe)
 	enqueFrame(&wl33_TxQueue, fr, frLen);
 }
 
+/*
+ * tx queue depth, for the SPI credit: taken from the queue
+ * itself, which is locked, as frames are queued from other
+ * tasks while this one takes them off
+ */
+uint32_t wl33_TxQueueDepth(void)
+{
+	return (uint32_t)getQdepth(&wl33_TxQueue);
+}
+
 /*
  *  diagnostic modes
  */